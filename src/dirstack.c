@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see dirstack.h
  * @date 2026-06-19
- * @version 2026-06-19
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -58,6 +58,7 @@ int ds_push(tDirStack * stack, const TCHAR * src, const TCHAR * dst, const unsig
 	tDirStackFrame * frame = stack->frames + stack->size;
 	frame->level = level;
 	frame->modified = 0;
+	frame->pending = 0;
 	frame->src = ds_dup(src);
 	frame->dst = ds_dup(dst);
 	if (frame->src == NULL || frame->dst == NULL) {
@@ -85,6 +86,24 @@ int ds_markTop(tDirStack * stack) {
 }
 
 
+/**
+ * Returns the number of outstanding asynchronous operations of all frames at or below the
+ * given level, i.e. of those frames which ds_consume() would visit next.
+ *
+ * @param[in] stack - stack handle
+ * @param[in] level - count frames with this level or deeper
+ * @return number of outstanding operations
+ */
+size_t ds_pending(const tDirStack * stack, const unsigned int level) {
+	size_t res = 0;
+	size_t i = stack->size;
+	while (i > 0 && stack->frames[i - 1].level >= level) {
+		res += stack->frames[--i].pending;
+	}
+	return res;
+}
+
+
 /**
  * Visits and then pops every frame at or below the given level, top to
  * bottom.
@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see dirstack.c
  * @date 2026-06-19
- * @version 2026-06-19
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -37,6 +37,7 @@ extern "C" {
 typedef struct {
 	unsigned int level; /**< nesting depth of the directory */
 	int modified;       /**< marked as modified? */
+	size_t pending;     /**< number of outstanding asynchronous operations on direct children */
 	TCHAR * src;        /**< first path (owned copy) */
 	TCHAR * dst;        /**< second path (owned copy) */
 } tDirStackFrame;
@@ -63,6 +64,7 @@ typedef void (* tDirStackVisitor)(const tDirStackFrame * frame, void * param);
 
 int ds_push(tDirStack * stack, const TCHAR * src, const TCHAR * dst, const unsigned int level);
 int ds_markTop(tDirStack * stack);
+size_t ds_pending(const tDirStack * stack, const unsigned int level);
 void ds_consume(tDirStack * stack, const unsigned int level, tDirStackVisitor visitor, void * param);
 void ds_clear(tDirStack * stack);
 
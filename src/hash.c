@@ -0,0 +1,224 @@
+/**
+ * @file hash.c
+ * @author Daniel Starke
+ * @see hash.h
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Implements the XXH64 algorithm. Input is read byte-wise in little endian order which
+ * keeps the result independent of the platform and the input alignment.
+ */
+#include <string.h>
+#include "hash.h"
+
+
+#define HS_PRIME1 UINT64_C(0x9E3779B185EBCA87)
+#define HS_PRIME2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define HS_PRIME3 UINT64_C(0x165667B19E3779F9)
+#define HS_PRIME4 UINT64_C(0x85EBCA77C2B2AE63)
+#define HS_PRIME5 UINT64_C(0x27D4EB2F165667C5)
+
+
+/**
+ * Rotates the given value to the left.
+ *
+ * @param[in] value - value to rotate
+ * @param[in] bits - number of bits to rotate (1 to 63)
+ * @return rotated value
+ */
+static uint64_t hs_rotl(const uint64_t value, const unsigned int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+
+/**
+ * Loads a little endian 64-bit value.
+ *
+ * @param[in] buf - input buffer (8 bytes)
+ * @return loaded value
+ */
+static uint64_t hs_getU64(const uint8_t * buf) {
+	uint64_t res = 0;
+	int i;
+	for (i = 7; i >= 0; i--) res = (res << 8) | buf[i];
+	return res;
+}
+
+
+/**
+ * Loads a little endian 32-bit value.
+ *
+ * @param[in] buf - input buffer (4 bytes)
+ * @return loaded value
+ */
+static uint32_t hs_getU32(const uint8_t * buf) {
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+/**
+ * Mixes a single 64-bit input value into a lane accumulator.
+ *
+ * @param[in] acc - lane accumulator
+ * @param[in] input - input value
+ * @return new accumulator value
+ */
+static uint64_t hs_round(uint64_t acc, const uint64_t input) {
+	acc += input * HS_PRIME2;
+	acc = hs_rotl(acc, 31);
+	return acc * HS_PRIME1;
+}
+
+
+/**
+ * Merges a lane accumulator into the final hash value.
+ *
+ * @param[in] acc - hash value
+ * @param[in] lane - lane accumulator
+ * @return new hash value
+ */
+static uint64_t hs_merge(uint64_t acc, const uint64_t lane) {
+	acc ^= hs_round(0, lane);
+	return (acc * HS_PRIME1) + HS_PRIME4;
+}
+
+
+/**
+ * Processes a single 32 byte stripe.
+ *
+ * @param[in,out] state - hash state
+ * @param[in] stripe - input stripe (32 bytes)
+ */
+static void hs_stripe(tHash64 * state, const uint8_t * stripe) {
+	state->v[0] = hs_round(state->v[0], hs_getU64(stripe));
+	state->v[1] = hs_round(state->v[1], hs_getU64(stripe + 8));
+	state->v[2] = hs_round(state->v[2], hs_getU64(stripe + 16));
+	state->v[3] = hs_round(state->v[3], hs_getU64(stripe + 24));
+}
+
+
+/**
+ * Initializes the given hash state.
+ *
+ * @param[out] state - hash state
+ * @param[in] seed - hash seed
+ */
+void hs_init(tHash64 * state, const uint64_t seed) {
+	if (state == NULL) return;
+	state->total = 0;
+	state->v[0] = seed + HS_PRIME1 + HS_PRIME2;
+	state->v[1] = seed + HS_PRIME2;
+	state->v[2] = seed;
+	state->v[3] = seed - HS_PRIME1;
+	state->seed = seed;
+	state->bufLen = 0;
+}
+
+
+/**
+ * Adds the given data to the hash.
+ *
+ * @param[in,out] state - hash state
+ * @param[in] data - input data
+ * @param[in] len - input length in bytes
+ */
+void hs_update(tHash64 * state, const void * data, const size_t len) {
+	const uint8_t * ptr = (const uint8_t *)data;
+	const uint8_t * end = ptr + len;
+	if (state == NULL || (data == NULL && len > 0)) return;
+	state->total += (uint64_t)len;
+	if (state->bufLen > 0) {
+		/* complete the pending stripe first */
+		size_t fill = sizeof(state->buf) - state->bufLen;
+		if (fill > len) fill = len;
+		memcpy(state->buf + state->bufLen, ptr, fill);
+		state->bufLen += fill;
+		ptr += fill;
+		if (state->bufLen < sizeof(state->buf)) return;
+		hs_stripe(state, state->buf);
+		state->bufLen = 0;
+	}
+	while ((size_t)(end - ptr) >= sizeof(state->buf)) {
+		hs_stripe(state, ptr);
+		ptr += sizeof(state->buf);
+	}
+	if (ptr < end) {
+		state->bufLen = (size_t)(end - ptr);
+		memcpy(state->buf, ptr, state->bufLen);
+	}
+}
+
+
+/**
+ * Returns the hash of all data added so far. The state is not modified and can be updated
+ * further.
+ *
+ * @param[in] state - hash state
+ * @return 64-bit hash value
+ */
+uint64_t hs_final(const tHash64 * state) {
+	const uint8_t * ptr = state->buf;
+	const uint8_t * end = ptr + state->bufLen;
+	uint64_t res;
+	if (state->total >= sizeof(state->buf)) {
+		res = hs_rotl(state->v[0], 1) + hs_rotl(state->v[1], 7) + hs_rotl(state->v[2], 12) + hs_rotl(state->v[3], 18);
+		res = hs_merge(res, state->v[0]);
+		res = hs_merge(res, state->v[1]);
+		res = hs_merge(res, state->v[2]);
+		res = hs_merge(res, state->v[3]);
+	} else {
+		res = state->seed + HS_PRIME5;
+	}
+	res += state->total;
+	while ((end - ptr) >= 8) {
+		res ^= hs_round(0, hs_getU64(ptr));
+		res = (hs_rotl(res, 27) * HS_PRIME1) + HS_PRIME4;
+		ptr += 8;
+	}
+	if ((end - ptr) >= 4) {
+		res ^= (uint64_t)hs_getU32(ptr) * HS_PRIME1;
+		res = (hs_rotl(res, 23) * HS_PRIME2) + HS_PRIME3;
+		ptr += 4;
+	}
+	while (ptr < end) {
+		res ^= (uint64_t)(*ptr) * HS_PRIME5;
+		res = hs_rotl(res, 11) * HS_PRIME1;
+		ptr++;
+	}
+	/* avalanche */
+	res ^= res >> 33;
+	res *= HS_PRIME2;
+	res ^= res >> 29;
+	res *= HS_PRIME3;
+	res ^= res >> 32;
+	return res;
+}
+
+
+/**
+ * Computes the hash of the given data in one step.
+ *
+ * @param[in] data - input data
+ * @param[in] len - input length in bytes
+ * @param[in] seed - hash seed
+ * @return 64-bit hash value
+ */
+uint64_t hs_hash64(const void * data, const size_t len, const uint64_t seed) {
+	tHash64 state;
+	hs_init(&state, seed);
+	hs_update(&state, data, len);
+	return hs_final(&state);
+}
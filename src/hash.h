@@ -0,0 +1,58 @@
+/**
+ * @file hash.h
+ * @author Daniel Starke
+ * @see hash.c
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "target.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Streaming 64-bit hash state (XXH64 compatible). The state can be copied to fork the
+ * computation.
+ */
+typedef struct {
+	uint64_t total;  /**< number of bytes hashed so far */
+	uint64_t v[4];   /**< lane accumulators */
+	uint64_t seed;   /**< initial seed */
+	uint8_t buf[32]; /**< pending input of an incomplete stripe */
+	size_t bufLen;   /**< number of pending bytes in buf */
+} tHash64;
+
+
+void hs_init(tHash64 * state, const uint64_t seed);
+void hs_update(tHash64 * state, const void * data, const size_t len);
+uint64_t hs_final(const tHash64 * state);
+uint64_t hs_hash64(const void * data, const size_t len, const uint64_t seed);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* __HASH_H__ */
@@ -1,6 +1,6 @@
 CWFLAGS = -Wall -Wextra -Wformat -pedantic -Wshadow -Wno-format -std=c99
-CFLAGS = -O2 -DNDEBUG -D_BSD_SOURCE -D_POSIX_C_SOURCE=200112L -D_ATFILE_SOURCE -D_FILE_OFFSET_BITS=64 -mstackrealign -fno-ident
+CFLAGS = -O2 -DNDEBUG -D_BSD_SOURCE -D_POSIX_C_SOURCE=200112L -D_ATFILE_SOURCE -D_FILE_OFFSET_BITS=64 -pthread -mstackrealign -fno-ident
 LDFLAGS = -s -fno-ident
 PATHS = 
-LIBS = 
+LIBS = -pthread
 BINEXT = 
\ No newline at end of file
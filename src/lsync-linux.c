@@ -2,7 +2,7 @@
  * @file lsync-linux.c
  * @author Daniel Starke
  * @date 2017-05-22
- * @version 2026-06-20
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -21,9 +21,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include "lsync.h"
 
 
@@ -32,6 +37,30 @@
 #endif
 
 
+#ifndef FICLONE
+/* share the data blocks of another file (Linux 4.5, see linux/fs.h) */
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#ifndef O_TMPFILE
+/* unnamed file in the given directory (Linux 3.11, only declared with _GNU_SOURCE) */
+#ifdef __O_TMPFILE
+#define O_TMPFILE __O_TMPFILE
+#else
+#define O_TMPFILE (020000000 | O_DIRECTORY)
+#endif
+#endif
+
+#ifndef AT_EMPTY_PATH
+/* operate on the passed file descriptor (Linux 2.6.39, only declared with _GNU_SOURCE) */
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+
+/** Set once the destination file system rejected O_TMPFILE to skip further attempts. */
+static volatile int noTmpFile = 0;
+
+
 /**
  * Writes the last error message (errno) to standard error.
  *
@@ -52,7 +81,7 @@ static void printLastError(const TCHAR * obj, const TCHAR * msg) {
  * @param[in] verbose - verbosity level
  * @return 1 on success (or if the path does not exist), 0 on failure
  */
-static int removePath(const TCHAR * path, const int verbose) {
+int removePath(const TCHAR * path, const int verbose) {
 	struct stat stats;
 	if (lstat(path, &stats) < 0) {
 		if (errno == ENOENT) return 1; /* nothing to remove */
@@ -106,6 +135,164 @@ static int removePath(const TCHAR * path, const int verbose) {
 }
 
 
+/**
+ * Removes the given path unless it is a directory. Symlinks are unlinked without
+ * following them.
+ *
+ * @param[in] path - path to remove
+ * @param[in] verbose - verbosity level
+ * @return 1 on success (or if the path does not exist), 0 on failure, -1 if path is a directory
+ */
+int removeFile(const TCHAR * path, const int verbose) {
+	if (unlink(path) == 0 || errno == ENOENT) return 1;
+	if (errno == EISDIR) return -1; /* cheaper than querying the type in advance */
+	if (verbose > 0) printLastError(path, "unlink():"TO_STR2(__LINE__));
+	return 0;
+}
+
+
+/**
+ * Prints the path of the given --prune job by following its parent chain.
+ *
+ * @param[in] dir - directory removal job
+ */
+static void printPrunePath(const tPruneDir * dir) {
+	if (dir->parent != NULL) {
+		printPrunePath(dir->parent);
+		fputc('/', stderr);
+	}
+	fputs(dir->name, stderr);
+}
+
+
+/**
+ * Prints the last error for the given entry of a --prune job.
+ *
+ * @param[in] dir - directory removal job
+ * @param[in] name - entry within the directory (may be NULL for the directory itself)
+ * @param[in] prefix - failed function
+ */
+static void printPruneError(const tPruneDir * dir, const char * name, const char * prefix) {
+	const int error = errno;
+	printPrunePath(dir);
+	if (name != NULL) fprintf(stderr, "/%s", name);
+	fputc(':', stderr);
+	errno = error;
+	perror(prefix);
+}
+
+
+/**
+ * Raises the soft limit of open file descriptors to the hard limit. --prune keeps each
+ * directory open until its sub directories were removed.
+ *
+ * @return usable number of file descriptors
+ */
+size_t raiseFileLimit(void) {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 1024;
+	if (limit.rlim_cur < limit.rlim_max) {
+		const rlim_t cur = limit.rlim_cur;
+		limit.rlim_cur = limit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &limit) != 0) limit.rlim_cur = cur;
+	}
+	if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > (rlim_t)INT_MAX) return (size_t)INT_MAX;
+	return (size_t)limit.rlim_cur;
+}
+
+
+/**
+ * Removes all non-directory entries of the directory of the given --prune job. The
+ * directory is opened relative to the opened parent directory without following symbolic
+ * links and listed through that descriptor, so a replaced path component cannot redirect
+ * the removal. Sub directories are added to `dir->subDirs` to be emptied by other workers.
+ * The directory stays open in `dir->fd` for these.
+ *
+ * @param[in,out] dir - directory removal job
+ * @param[in] verbose - verbosity level
+ * @return 1 on success (or if the directory does not exist), 0 on failure
+ */
+int emptyDirectory(tPruneDir * dir, const int verbose) {
+	int result = 0;
+	char * names = NULL;
+	size_t size, pos;
+	/* never follow a symbolic link which replaced the directory */
+	if (dir->parent == NULL) {
+		dir->fd = open(dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	} else {
+		dir->fd = openat(dir->parent->fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	}
+	if (dir->fd < 0) {
+		if (errno == ENOENT) return 1; /* nothing to remove */
+		if (verbose > 0) printPruneError(dir, NULL, (dir->parent == NULL) ? "open():"TO_STR2(__LINE__) : "openat():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if (tds_listDirFd(dir->fd, &names, &size) == 0) {
+		if (verbose > 0) printPruneError(dir, NULL, "tds_listDirFd():"TO_STR2(__LINE__));
+		return 0;
+	}
+	result = 1;
+	for (pos = 0; pos < size && signalReceived == 0; pos += strlen(names + pos) + 1) {
+		const char * name = names + pos;
+		wp_pace(&(dir->item));
+		if (unlinkat(dir->fd, name, 0) == 0) {
+			dir->files++;
+			continue;
+		}
+		if (errno == ENOENT) continue;
+		if (errno == EISDIR) {
+			/* cheaper than querying the type of each entry in advance */
+			tPruneDir * subDir = newPruneDir(dir->ctx, dir, name);
+			if (subDir == NULL) {
+				result = 0;
+				continue;
+			}
+			subDir->next = dir->subDirs;
+			dir->subDirs = subDir;
+			continue;
+		}
+		if (verbose > 0) printPruneError(dir, name, "unlinkat():"TO_STR2(__LINE__));
+		result = 0;
+	}
+	if (signalReceived != 0) result = 0;
+	if (names != NULL) free(names);
+	return result;
+}
+
+
+/**
+ * Closes the directory of the given --prune job if it is still open.
+ *
+ * @param[in,out] dir - directory removal job
+ */
+void closeDirectory(tPruneDir * dir) {
+	if (dir->fd < 0) return;
+	close(dir->fd);
+	dir->fd = -1;
+}
+
+
+/**
+ * Removes the emptied directory of the given --prune job relative to the opened parent
+ * directory.
+ *
+ * @param[in,out] dir - directory removal job
+ * @param[in] verbose - verbosity level
+ * @return 1 on success (or if the directory does not exist), 0 on failure
+ */
+int removeDirectory(tPruneDir * dir, const int verbose) {
+	closeDirectory(dir);
+	if (dir->parent == NULL) {
+		if (rmdir(dir->name) == 0 || errno == ENOENT) return 1;
+		if (verbose > 0) printPruneError(dir, NULL, "rmdir():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if (unlinkat(dir->parent->fd, dir->name, AT_REMOVEDIR) == 0 || errno == ENOENT) return 1;
+	if (verbose > 0) printPruneError(dir, NULL, "unlinkat():"TO_STR2(__LINE__));
+	return 0;
+}
+
+
 /**
  * Checks if the given path exists and is not a directory.
  * 
@@ -162,18 +349,53 @@ int realPath(const TCHAR * path, TCHAR * buf, const size_t len) {
 
 
 /**
- * Creates the passed directory path recursively.
+ * Makes the given path absolute by prepending the current working directory if it is
+ * relative. Symbolic links and "." or ".." components are kept as is.
+ *
+ * @param[in] path - path to make absolute
+ * @param[out] buf - receives the absolute path
+ * @param[in] len - size of buf in characters
+ * @return 1 on success, 0 on error
+ */
+int absolutePath(const TCHAR * path, TCHAR * buf, const size_t len) {
+	char cwd[PATH_MAX];
+	int n;
+	if (path[0] == '/') {
+		n = snprintf(buf, len, "%s", path);
+	} else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) return 0;
+		n = snprintf(buf, len, "%s/%s", cwd, path);
+	}
+	return (n >= 0 && (size_t)n < len) ? 1 : 0;
+}
+
+
+/**
+ * Creates the passed directory path recursively. If the parent directory is known to exist,
+ * the directory is created with a single mkdir() without checking each path component.
  * 
  * @param[in] dst - destination path
+ * @param[in] existing - length of the prefix of dst known to be an existing directory (0 if unknown)
  * @param[in] verbose - verbosity level
  * @return 1 on success, 0 on failure
  */
-int createDirectory(const TCHAR * dst, const int verbose) {
+int createDirectory(const TCHAR * dst, const size_t existing, const int verbose) {
 	if (dst == NULL || *dst == 0) return 0;
 	int result = 0;
 	const size_t len = _tcslen(dst);
 	TCHAR * end = NULL; /* pointer to the end of the current path part */
-	TCHAR * dir = malloc(sizeof(TCHAR) * (len + 1));
+	TCHAR * dir;
+	if (existing > 0 && existing < len && _tcspbrk(dst + existing + 1, PATH_SEPS) == NULL) {
+		if (mkdir(dst, 0777) == 0) {
+			if (verbose > 1) {
+				fprintf(stdout, "Created directory \"%s\".\n", dst);
+			}
+			return 1;
+		}
+		if (errno == EEXIST && isDirectory(dst) != 0) return 1;
+		/* non-directory at this path or parent vanished -> check each path component */
+	}
+	dir = malloc(sizeof(TCHAR) * (len + 1));
 	if (dir == NULL) {
 		if (verbose > 0) {
 			fprintf(
@@ -268,27 +490,269 @@ int renameFile(const TCHAR * src, const TCHAR * dst, const int verbose) {
 }
 
 
+/**
+ * Writes the given data completely to a file.
+ *
+ * @param[in] fd - file descriptor
+ * @param[in] buf - data to write
+ * @param[in] len - number of bytes to write
+ * @return 1 on success, 0 on error (errno is set)
+ */
+static int writeFully(const int fd, const char * buf, size_t len) {
+	while (len > 0) {
+		const ssize_t done = write(fd, buf, len);
+		if (done < 0) {
+			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+			return 0;
+		}
+		buf += done;
+		len -= (size_t)done;
+	}
+	return 1;
+}
+
+
+/**
+ * Creates a new file for writing which replaces `dst` once completed with commitTempFile().
+ * The file is created without a name (O_TMPFILE) in the destination directory if supported
+ * by the file system, else under a unique temporary name next to `dst`. The file is created
+ * with the given permissions masked by the current umask to spare a later chmod().
+ *
+ * @param[in] dst - final destination path the file belongs to
+ * @param[in] mode - permission bits to create the file with
+ * @param[out] tmp - receives the allocated temporary path (NULL for an unnamed file)
+ * @param[in] verbose - verbosity level
+ * @return file descriptor or -1 on error
+ */
+static int createTempFile(const TCHAR * dst, const mode_t mode, TCHAR ** tmp, const int verbose) {
+	int fd;
+	*tmp = NULL;
+	if (noTmpFile == 0) {
+		const TCHAR * sep = strrchr(dst, '/');
+		const size_t dirLen = (sep != NULL) ? PCF_MAX((size_t)(sep - dst), 1) : 0;
+		TCHAR dirBuf[256];
+		/* most directory paths are short -> avoid the allocation */
+		TCHAR * dir = (dirLen + 2 <= sizeof(dirBuf)) ? dirBuf : (TCHAR *)malloc(dirLen + 2);
+		if (dir == NULL) {
+			if (verbose > 0) fprintf(stderr, "Failed to allocate %u bytes.\n", (unsigned)(dirLen + 2));
+			return -1;
+		}
+		if (dirLen > 0) {
+			memcpy(dir, dst, dirLen);
+			dir[dirLen] = 0;
+		} else {
+			memcpy(dir, ".", 2);
+		}
+		/* readable to allow copyTempFile() if it cannot be linked */
+		fd = open(dir, O_TMPFILE | O_RDWR, mode);
+		if (dir != dirBuf) free(dir);
+		if (fd >= 0) return fd;
+		/* older kernels report EISDIR as they ignore the unknown flag */
+		if (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL) noTmpFile = 1;
+	}
+	if (createTempName(dst, tmp, verbose) == 0) return -1;
+	/* create with the mode masked by the current umask right away as umask() cannot be
+	 * queried without changing it process wide (races with concurrent file operations) */
+	fd = open(*tmp, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (verbose > 0) printLastError(*tmp, "open():"TO_STR2(__LINE__));
+		free(*tmp);
+		*tmp = NULL;
+	}
+	return fd;
+}
+
+
+/**
+ * Gives the unnamed file behind the passed descriptor the given name. Fails with EEXIST if
+ * the name is already taken.
+ *
+ * @param[in] fd - file descriptor of the unnamed file
+ * @param[in] path - new path of the file
+ * @return 0 on success, -1 on error
+ */
+static int linkTempFile(const int fd, const TCHAR * path) {
+	char procPath[32];
+	/* AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH -> use the link in /proc if mounted */
+	snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+	if (linkat(AT_FDCWD, procPath, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == 0) return 0;
+	if (errno != ENOENT) return -1;
+	return linkat(fd, "", AT_FDCWD, path, AT_EMPTY_PATH);
+}
+
+
+/**
+ * Copies the unnamed file behind the passed descriptor to a new file under a temporary name
+ * and renames that over `dst`. This is the fallback if the unnamed file cannot be linked,
+ * e.g. without /proc and without the permission for AT_EMPTY_PATH. Further files are created
+ * with a temporary name right away.
+ *
+ * @param[in] fd - file descriptor of the unnamed file
+ * @param[in] dst - destination path
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+static int copyTempFile(const int fd, const TCHAR * dst, const int verbose) {
+	int result = 0;
+	int out = -1;
+	TCHAR * tmp = NULL;
+	char buffer[16384];
+	ssize_t got;
+	struct stat stats;
+	noTmpFile = 1;
+	if (fstat(fd, &stats) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+		if (verbose > 0) printLastError(dst, "lseek():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if (createTempName(dst, &tmp, verbose) == 0) return 0;
+	/* the unnamed file was created with the umask applied already */
+	out = open(tmp, O_WRONLY | O_CREAT | O_EXCL, (mode_t)(stats.st_mode & 0777));
+	if (out < 0) {
+		if (verbose > 0) printLastError(tmp, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	for (;;) {
+		got = read(fd, buffer, sizeof(buffer));
+		if (got < 0) {
+			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+			if (verbose > 0) printLastError(dst, "read():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		if (got == 0) break; /* end of file */
+		if (writeFully(out, buffer, (size_t)got) == 0) {
+			if (verbose > 0) printLastError(tmp, "write():"TO_STR2(__LINE__));
+			goto onError;
+		}
+	}
+	if (close(out) < 0) {
+		out = -1;
+		if (verbose > 0) printLastError(tmp, "close():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	out = -1;
+	if (renameFile(tmp, dst, verbose) == 0) goto onError;
+	result = 1;
+onError:
+	if (out >= 0) close(out);
+	if (result == 0) unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
+/**
+ * Closes the file created by createTempFile() and atomically moves it in place of `dst`. A
+ * directory at the destination path is removed unless the destination is known to be absent
+ * (CP_NEW). The file is removed on failure.
+ *
+ * @param[in,out] fd - file descriptor (set to -1)
+ * @param[in] tmp - temporary path (NULL for an unnamed file)
+ * @param[in] dst - destination path
+ * @param[in] mask - copy mask (only CP_NEW is evaluated)
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+static int commitTempFile(int * fd, const TCHAR * tmp, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	int result = 0;
+	TCHAR * name = NULL;
+	size_t dstLen;
+	int i;
+	if (tmp != NULL) {
+		/* flush and close the temporary file before swapping it */
+		const int res = close(*fd);
+		*fd = -1;
+		if (res < 0) {
+			if (verbose > 0) printLastError(tmp, "close():"TO_STR2(__LINE__));
+			goto onError;
+		}
+	}
+	/* replace a directory at destination path */
+	if ((mask & CP_NEW) == 0 && isDirectory(dst) != 0 && removePath(dst, verbose) == 0) goto onError;
+	if (tmp != NULL) {
+		if (renameFile(tmp, dst, verbose) == 0) goto onError;
+		result = 1;
+		goto onError;
+	}
+	/* new destination -> a single link suffices */
+	if (linkTempFile(*fd, dst) == 0) {
+		result = 1;
+		goto onError;
+	}
+	if (errno != EEXIST) {
+		/* not linkable at all -> copy it to a named file instead */
+		result = copyTempFile(*fd, dst, verbose);
+		goto onError;
+	}
+	/* existing destination -> link under a free temporary name and rename() it over */
+	dstLen = strlen(dst);
+	name = (TCHAR *)malloc(dstLen + 8); /* dst + ".XXXXXX" + NUL */
+	if (name == NULL) {
+		if (verbose > 0) fprintf(stderr, "Failed to allocate %u bytes.\n", (unsigned)(dstLen + 8));
+		goto onError;
+	}
+	memcpy(name, dst, dstLen);
+	for (i = 0; ; i++) {
+		/* open descriptors are unique within the process -> only leftovers of other runs collide */
+		snprintf(name + dstLen, 8, ".%06x", (unsigned int)(((unsigned int)getpid() * 31u + ((unsigned int)(*fd) << 8) + (unsigned int)i) & 0xFFFFFFu));
+		if (linkTempFile(*fd, name) == 0) break;
+		if (errno != EEXIST) {
+			/* not linkable at all -> copy it to a named file instead */
+			result = copyTempFile(*fd, dst, verbose);
+			goto onError;
+		}
+		if (i >= 100) {
+			if (verbose > 0) printLastError(name, "linkat():"TO_STR2(__LINE__));
+			goto onError;
+		}
+	}
+	if (renameFile(name, dst, verbose) == 0) {
+		unlink(name);
+		goto onError;
+	}
+	result = 1;
+onError:
+	if (*fd >= 0) {
+		if (close(*fd) < 0 && result != 0) {
+			if (verbose > 0) printLastError(dst, "close():"TO_STR2(__LINE__));
+			result = 0;
+		}
+		*fd = -1;
+	}
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(name);
+	return result;
+}
+
+
 /**
  * Creates a hardlink for the destination pointing to the given path at source.
  * The function overwrites the destination file or hardlink.
  *
  * @param[in] src - source path
  * @param[in] dst - destination path
+ * @param[in] mask - copy mask (only CP_NEW is evaluated)
  * @param[in] verbose - verbosity level
  * @return 1 on success, 0 on failure
  */
-int createHardLink(const TCHAR * src, const TCHAR * dst, const int verbose) {
+int createHardLink(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
 	if (src == NULL || dst == NULL) return 0;
 	int result = 0;
 	TCHAR * tmp = NULL;
-	/* link under a temporary name and rename() it so a failed link never
-	 * destroys the existing destination (atomic replace) */
-	if (createTempName(dst, &tmp, verbose) == 0) return 0;
-	if (link(src, tmp) < 0) {
-		if (verbose > 0) printLastError(tmp, "link():"TO_STR2(__LINE__));
-		goto onError;
+	/* a destination known to be absent is linked directly */
+	if ((mask & CP_NEW) == 0 || link(src, dst) < 0) {
+		if ((mask & CP_NEW) != 0 && errno != EEXIST) {
+			if (verbose > 0) printLastError(dst, "link():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		/* link under a temporary name and rename() it so a failed link never
+		 * destroys the existing destination (atomic replace) */
+		if (createTempName(dst, &tmp, verbose) == 0) goto onError;
+		if (link(src, tmp) < 0) {
+			if (verbose > 0) printLastError(tmp, "link():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		if (renameFile(tmp, dst, verbose) == 0) goto onError;
 	}
-	if (renameFile(tmp, dst, verbose) == 0) goto onError;
 	result = 1;
 	if (verbose > 1) {
 		_ftprintf(stdout, "Created hardlink \"%s\" pointing to \"%s\".\n", dst, src);
@@ -300,9 +764,66 @@ onError:
 }
 
 
+/**
+ * Creates a device, symlink, named pipe or socket like the given source at `path`.
+ *
+ * @param[in] path - path to create
+ * @param[in] stats - source file status
+ * @param[in] target - symlink target (ignored for other types)
+ * @return 0 on success, -1 on error
+ */
+static int createNode(const TCHAR * path, const struct stat * stats, const char * target) {
+	if ( S_ISLNK(stats->st_mode) ) return symlink(target, path);
+	if ( S_ISFIFO(stats->st_mode) ) return mkfifo(path, 0777);
+	/* sockets have no device number -> recreate inode with mknod (no privilege
+	 * needed for FIFO/socket types, unlike block/character devices) */
+	return mknod(path, stats->st_mode, S_ISSOCK(stats->st_mode) ? 0 : stats->st_rdev);
+}
+
+
+/**
+ * Creates a device, symlink, named pipe or socket like the given source at the destination
+ * path. A destination known to be absent (CP_NEW) is created directly. Otherwise, the entry
+ * is created under a temporary name and renamed into place so a failed create never destroys
+ * the existing destination (atomic replace).
+ *
+ * @param[in] dst - destination path
+ * @param[in] stats - source file status
+ * @param[in] target - symlink target (ignored for other types)
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+static int createEntry(const TCHAR * dst, const struct stat * stats, const char * target, const tCopyMask mask, const int verbose) {
+	const char * func = S_ISLNK(stats->st_mode) ? "symlink():"TO_STR2(__LINE__) : (S_ISFIFO(stats->st_mode) ? "mkfifo():"TO_STR2(__LINE__) : "mknod():"TO_STR2(__LINE__));
+	int result = 0;
+	TCHAR * tmp = NULL;
+	if ((mask & CP_NEW) == 0 || createNode(dst, stats, target) < 0) {
+		if ((mask & CP_NEW) != 0 && errno != EEXIST) {
+			if (verbose > 0) printLastError(dst, func);
+			goto onError;
+		}
+		if (createTempName(dst, &tmp, verbose) == 0) goto onError;
+		if (createNode(tmp, stats, target) < 0) {
+			if (verbose > 0) printLastError(tmp, func);
+			goto onError;
+		}
+		if (isDirectory(dst) != 0 && removePath(dst, verbose) == 0) goto onError;
+		if (renameFile(tmp, dst, verbose) == 0) goto onError;
+	}
+	result = 1;
+onError:
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
 /**
  * Copies the source file to the destination file. The destination needs to be a file path.
- * The function overwrites the destination file or hardlink.
+ * The function overwrites the destination file or hardlink. The temporary file and rename
+ * are omitted for entries other than regular files if the destination is known to be absent
+ * (CP_NEW).
  * 
  * @param[in] src - source file
  * @param[in] dst - destination file
@@ -316,9 +837,10 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 	int in = -1;
 	int out = -1;
 	char buffer[16384];
-	char * outPtr;
 	char * tmp = NULL;
-	ssize_t got, done;
+	ssize_t got;
+	uint64_t total = 0;
+	int last = 0;
 	struct stat stats;
 	if (lstat(src, &stats) < 0) {
 		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
@@ -330,15 +852,7 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 			if (verbose > 0) fprintf(stderr, "Skipping device \"%s\" (requires --devices).\n", src);
 			return 1;
 		}
-		/* create under a temporary name and rename() it so a failed create never
-		 * destroys the existing destination (atomic replace) */
-		if (createTempName(dst, &tmp, verbose) == 0) goto onError;
-		if (mknod(tmp, stats.st_mode, stats.st_rdev) < 0) {
-			if (verbose > 0) printLastError(tmp, "mknod():"TO_STR2(__LINE__));
-			goto onError;
-		}
-		if (isDirectory(dst) != 0 && removePath(dst, verbose) == 0) goto onError;
-		if (renameFile(tmp, dst, verbose) == 0) goto onError;
+		if (createEntry(dst, &stats, NULL, mask, verbose) == 0) goto onError;
 		result = 1;
 		if (verbose > 1) {
 			fprintf(stdout, "Copied device \"%s\" to \"%s\".\n", src, dst);
@@ -376,20 +890,11 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 			bufSize *= 2;
 		}
 		buf[linkLen] = 0;
-		/* create under a temporary name and rename() it so a failed create never
-		 * destroys the existing destination (atomic replace) */
-		if (createTempName(dst, &tmp, verbose) == 0) {
-			free(buf);
-			goto onError;
-		}
-		if (symlink(buf, tmp) < 0) {
-			if (verbose > 0) printLastError(tmp, "symlink():"TO_STR2(__LINE__));
+		if (createEntry(dst, &stats, buf, mask, verbose) == 0) {
 			free(buf);
 			goto onError;
 		}
 		free(buf);
-		if (isDirectory(dst) != 0 && removePath(dst, verbose) == 0) goto onError;
-		if (renameFile(tmp, dst, verbose) == 0) goto onError;
 		result = 1;
 		if (verbose > 1) {
 			fprintf(stdout, "Copied symbolic link \"%s\" to \"%s\".\n", src, dst);
@@ -402,17 +907,7 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 			if (verbose > 0) fprintf(stderr, "Skipping special file \"%s\" (requires --specials).\n", src);
 			return 1;
 		}
-		/* create under a temporary name and rename() it so a failed create never
-		 * destroys the existing destination (atomic replace) */
-		if (createTempName(dst, &tmp, verbose) == 0) goto onError;
-		/* sockets have no device number -> recreate inode with mknod (no privilege
-		 * needed for FIFO/socket types, unlike block/character devices) */
-		if (S_ISFIFO(stats.st_mode) ? (mkfifo(tmp, 0777) < 0) : (mknod(tmp, stats.st_mode, 0) < 0)) {
-			if (verbose > 0) printLastError(tmp, S_ISFIFO(stats.st_mode) ? "mkfifo():"TO_STR2(__LINE__) : "mknod():"TO_STR2(__LINE__));
-			goto onError;
-		}
-		if (isDirectory(dst) != 0 && removePath(dst, verbose) == 0) goto onError;
-		if (renameFile(tmp, dst, verbose) == 0) goto onError;
+		if (createEntry(dst, &stats, NULL, mask, verbose) == 0) goto onError;
 		result = 1;
 		if (verbose > 1) {
 			fprintf(stdout, "Copied special file \"%s\" to \"%s\".\n", src, dst);
@@ -427,21 +922,408 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
 		goto onError;
 	}
-	if (createTempName(dst, &tmp, verbose) == 0) goto onError;
-	out = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
-	if (out < 0) {
-		if (verbose > 0) printLastError(tmp, "open():"TO_STR2(__LINE__));
+	/* created with the final permissions -> no chmod() needed */
+	out = createTempFile(dst, (mode_t)(stats.st_mode & 0777), &tmp, verbose);
+	if (out < 0) goto onError;
+	if ((uint64_t)stats.st_size < (uint64_t)sizeof(buffer)) {
+		/* small file -> the buffer holds it completely: one read() and one write() */
+		do {
+			got = read(in, buffer, sizeof(buffer));
+		} while (got < 0 && errno == EINTR);
+		if (got < 0) {
+			if (verbose > 0) printLastError(src, "read():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		if (writeFully(out, buffer, (size_t)got) == 0) {
+			if (verbose > 0) printLastError(dst, "write():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		total = (uint64_t)got;
+		/* a filled buffer means the file grew since lstat() -> copy the rest below */
+		last = ((size_t)got < sizeof(buffer)) ? 1 : 0;
+	}
+	while (last == 0) {
+		got = read(in, buffer, sizeof(buffer));
+		if (got < 0) {
+			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+			if (verbose > 0) printLastError(src, "read():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		if (got == 0) break; /* end of file */
+		total += (uint64_t)got;
+		/* a short read at the known file size is the end of the file -> spare the final read() */
+		last = ((size_t)got < sizeof(buffer) && total >= (uint64_t)stats.st_size) ? 1 : 0;
+		if (writeFully(out, buffer, (size_t)got) == 0) {
+			if (verbose > 0) printLastError(dst, "write():"TO_STR2(__LINE__));
+			goto onError;
+		}
+	}
+	/* atomically replace the destination with the newly written copy */
+	if (commitTempFile(&out, tmp, dst, mask, verbose) == 0) goto onError;
+	result = 1;
+	if (verbose > 1) {
+		fprintf(stdout, "Copied file \"%s\" to \"%s\".\n", src, dst);
+	}
+onError:
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
+/**
+ * Clones the source file to the destination file. Regular files share the data blocks of
+ * the source if the file system supports this (reflink), else they are copied like copyFile().
+ * The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file (usually on the same file system as the destination)
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int cloneFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || dst == NULL) return 0;
+	int result = 0;
+	int in = -1;
+	int out = -1;
+	char * tmp = NULL;
+	struct stat stats;
+	if (lstat(src, &stats) < 0) {
+		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if ( ! S_ISREG(stats.st_mode) ) return copyFile(src, dst, mask, verbose);
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
 		goto onError;
 	}
-	/* the file is created with mode 0600 -> set it to 0777 masked by current umask */
-	const mode_t fileMask = umask(0);
-	umask(fileMask);
-	if (fchmod(out, (mode_t)(0777 & ~fileMask)) < 0) {
-		if (verbose > 0) printLastError(tmp, "fchmod():"TO_STR2(__LINE__));
+	out = createTempFile(dst, (mode_t)(stats.st_mode & 0777), &tmp, verbose);
+	if (out < 0) goto onError;
+	if (ioctl(out, FICLONE, in) < 0) {
+		/* not supported (e.g. different file system) -> plain copy */
+		close(out);
+		out = -1;
+		if (tmp != NULL) unlink(tmp);
+		free(tmp);
+		tmp = NULL;
+		close(in);
+		in = -1;
+		return copyFile(src, dst, mask, verbose);
+	}
+	if (commitTempFile(&out, tmp, dst, mask, verbose) == 0) goto onError;
+	result = 1;
+	if (verbose > 1) {
+		fprintf(stdout, "Cloned file \"%s\" to \"%s\".\n", src, dst);
+	}
+onError:
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
+/**
+ * Reads up to the given number of bytes at the current file position. Less bytes are only
+ * returned at the end of the file.
+ *
+ * @param[in] fd - file descriptor
+ * @param[out] buf - output buffer
+ * @param[in] len - number of bytes to read
+ * @return number of bytes read or -1 on error
+ */
+static ssize_t readFully(const int fd, char * buf, const size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		const ssize_t got = read(fd, buf + total, len - total);
+		if (got < 0) {
+			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+			return -1;
+		}
+		if (got == 0) break; /* end of file */
+		total += (size_t)got;
+	}
+	return (ssize_t)total;
+}
+
+
+/**
+ * Writes all blocks of the input file which differ from the old file to the output file at
+ * the same offsets. The output file is truncated to the input size afterwards. Old and
+ * output file may be the same file descriptor. The old file is read from its current position
+ * and the input file until its end.
+ *
+ * @param[in] in - input file descriptor
+ * @param[in] old - file descriptor of the previous content
+ * @param[in] out - output file descriptor (holds the previous content)
+ * @param[in] src - input file path (for messages)
+ * @param[in] ref - old file path (for messages)
+ * @param[in] dst - output file path (for messages)
+ * @param[out] size - receives the input size in bytes
+ * @param[out] written - receives the number of bytes written
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+static int writeChangedBlocks(const int in, const int old, const int out, const TCHAR * src, const TCHAR * ref, const TCHAR * dst, uint64_t * size, uint64_t * written, const int verbose) {
+	int result = 0;
+	char * buffer;
+	off_t offset = 0;
+	ssize_t got, oldGot, done, pos, len;
+	*written = 0;
+	buffer = (char *)malloc(2 * BUFFER_SIZE);
+	if (buffer == NULL) {
+		if (verbose > 0) fprintf(stderr, "Failed to allocate %u bytes.\n", (unsigned)(2 * BUFFER_SIZE));
+		return 0;
+	}
+	for (;;) {
+		got = readFully(in, buffer, BUFFER_SIZE);
+		if (got < 0) {
+			if (verbose > 0) printLastError(src, "read():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		if (got == 0) break; /* end of file */
+		oldGot = readFully(old, buffer + BUFFER_SIZE, (size_t)got);
+		if (oldGot < 0) {
+			if (verbose > 0) printLastError(ref, "read():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		/* rewrite only the differing blocks to keep the others untouched */
+		for (pos = 0; pos < got; pos += len) {
+			len = got - pos;
+			if (len > DELTA_BLOCK_SIZE) len = DELTA_BLOCK_SIZE;
+			if (pos + len <= oldGot && memcmp(buffer + pos, buffer + BUFFER_SIZE + pos, (size_t)len) == 0) continue;
+			for (done = 0; done < len; ) {
+				const ssize_t res = pwrite(out, buffer + pos + done, (size_t)(len - done), offset + pos + done);
+				if (res < 0) {
+					if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+					if (verbose > 0) printLastError(dst, "pwrite():"TO_STR2(__LINE__));
+					goto onError;
+				}
+				done += res;
+			}
+			*written += (uint64_t)len;
+		}
+		offset += (off_t)got;
+	}
+	/* drop the old data beyond the end of the input */
+	if (ftruncate(out, offset) < 0) {
+		if (verbose > 0) printLastError(dst, "ftruncate():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	*size = (uint64_t)offset;
+	result = 1;
+onError:
+	free(buffer);
+	return result;
+}
+
+
+/**
+ * Creates the destination file from the source file based on a similar reference file.
+ * The reference is cloned (reflink) and only the blocks which differ from the source are
+ * written afterwards. Hence, the destination shares all unchanged blocks with the reference.
+ * Falls back to copyFile() if the file system does not support cloning or the source is no
+ * regular file. The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] ref - reference file with similar content (on the same file system as dst)
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int deltaFile(const TCHAR * src, const TCHAR * ref, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || ref == NULL || dst == NULL) return 0;
+	int result = 0;
+	int in = -1;
+	int old = -1;
+	int out = -1;
+	char * tmp = NULL;
+	uint64_t size = 0;
+	uint64_t written = 0;
+	struct stat stats, refStats;
+	if (lstat(src, &stats) < 0) {
+		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if ( ! S_ISREG(stats.st_mode) ) return copyFile(src, dst, mask, verbose);
+	/* never block on special files or follow symlinks at the reference path */
+	old = open(ref, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+	if (old < 0 || fstat(old, &refStats) < 0 || ! S_ISREG(refStats.st_mode)) {
+		if (old >= 0) close(old);
+		return copyFile(src, dst, mask, verbose);
+	}
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	out = createTempFile(dst, (mode_t)(stats.st_mode & 0777), &tmp, verbose);
+	if (out < 0) goto onError;
+	if (ioctl(out, FICLONE, old) < 0) {
+		/* not supported (e.g. different file system) -> plain copy */
+		close(out);
+		out = -1;
+		if (tmp != NULL) unlink(tmp);
+		free(tmp);
+		tmp = NULL;
+		close(in);
+		in = -1;
+		close(old);
+		old = -1;
+		return copyFile(src, dst, mask, verbose);
+	}
+	if (writeChangedBlocks(in, old, out, src, ref, dst, &size, &written, verbose) == 0) goto onError;
+	if (commitTempFile(&out, tmp, dst, mask, verbose) == 0) goto onError;
+	result = 1;
+	if (verbose > 1) {
+		fprintf(stdout, "Updated file \"%s\" from \"%s\" to \"%s\" (%llu of %llu bytes written).\n", src, ref, dst, (unsigned long long)written, (unsigned long long)size);
+	}
+onError:
+	if (in >= 0) close(in);
+	if (old >= 0) close(old);
+	if (out >= 0) close(out);
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
+/**
+ * Computes the hash of the given number of bytes from the start of the file. The file
+ * position is left behind the hashed range.
+ *
+ * @param[in] fd - file descriptor
+ * @param[in] path - file path (for messages)
+ * @param[in] len - number of bytes to hash
+ * @param[in,out] buffer - work buffer of BUFFER_SIZE bytes
+ * @param[out] hash - receives the hash value
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure or if the file is shorter
+ */
+static int hashFilePrefix(const int fd, const TCHAR * path, uint64_t len, char * buffer, uint64_t * hash, const int verbose) {
+	tHash64 state;
+	ssize_t got;
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		if (verbose > 0) printLastError(path, "lseek():"TO_STR2(__LINE__));
+		return 0;
+	}
+	hs_init(&state, 0);
+	while (len > 0) {
+		got = readFully(fd, buffer, (len < BUFFER_SIZE) ? (size_t)len : BUFFER_SIZE);
+		if (got < 0) {
+			if (verbose > 0) printLastError(path, "read():"TO_STR2(__LINE__));
+			return 0;
+		}
+		if (got == 0) return 0; /* file shrunk */
+		hs_update(&state, buffer, (size_t)got);
+		len -= (uint64_t)got;
+	}
+	*hash = hs_final(&state);
+	return 1;
+}
+
+
+/**
+ * Creates the destination file from the source file based on a previous version which is
+ * a prefix of the source (e.g. a growing log file). The prefix is verified by comparing the
+ * hashes of both ranges. The previous version is cloned (reflink) and only the remaining tail
+ * of the source is appended. Without reflink support, the tail is appended in place if the
+ * previous version is the destination file itself and has no further hardlinks. Falls back
+ * to copyFile() in all other cases. The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] old - previous version of the file (destination or reference file)
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int appendFile(const TCHAR * src, const TCHAR * old, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || old == NULL || dst == NULL) return 0;
+	int result = 0;
+	int in = -1;
+	int prev = -1;
+	int out = -1;
+	int inPlace = 0;
+	char * buffer = NULL;
+	char * tmp = NULL;
+	char * outPtr;
+	uint64_t srcHash, oldHash, written = 0;
+	off_t prefix;
+	ssize_t got, done;
+	struct stat stats, prevStats;
+	if (lstat(src, &stats) < 0) {
+		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if ( ! S_ISREG(stats.st_mode) ) return copyFile(src, dst, mask, verbose);
+	prefix = stats.st_size;
+	/* never block on special files or follow symlinks at the previous version path */
+	prev = open(old, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+	if (prev < 0 || fstat(prev, &prevStats) < 0 || ! S_ISREG(prevStats.st_mode) || prevStats.st_size >= prefix) {
+		if (prev >= 0) close(prev);
+		return copyFile(src, dst, mask, verbose);
+	}
+	prefix = prevStats.st_size;
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	buffer = (char *)malloc(BUFFER_SIZE);
+	if (buffer == NULL) {
+		if (verbose > 0) fprintf(stderr, "Failed to allocate %u bytes.\n", (unsigned)BUFFER_SIZE);
+		goto onError;
+	}
+	if (hashFilePrefix(prev, old, (uint64_t)prefix, buffer, &oldHash, verbose) == 0
+		|| hashFilePrefix(in, src, (uint64_t)prefix, buffer, &srcHash, verbose) == 0
+		|| oldHash != srcHash) {
+		/* not appended only -> full copy */
+		close(in);
+		in = -1;
+		close(prev);
+		prev = -1;
+		free(buffer);
+		return copyFile(src, dst, mask, verbose);
+	}
+	/* the source position is now at the end of the verified prefix */
+	out = createTempFile(dst, (mode_t)(stats.st_mode & 0777), &tmp, verbose);
+	if (out < 0) goto onError;
+	if (ioctl(out, FICLONE, prev) < 0) {
+		close(out);
+		out = -1;
+		if (tmp != NULL) unlink(tmp);
+		free(tmp);
+		tmp = NULL;
+		if (strcmp(old, dst) != 0 || prevStats.st_nlink > 1) {
+			/* cannot share the previous version -> full copy */
+			close(in);
+			in = -1;
+			close(prev);
+			prev = -1;
+			free(buffer);
+			return copyFile(src, dst, mask, verbose);
+		}
+		/* append to the destination itself (not atomic, like --inplace) */
+		inPlace = 1;
+		out = open(dst, O_WRONLY | O_NOFOLLOW);
+		if (out < 0) {
+			if (verbose > 0) printLastError(dst, "open():"TO_STR2(__LINE__));
+			goto onError;
+		}
+	}
+	if (lseek(out, prefix, SEEK_SET) < 0) {
+		if (verbose > 0) printLastError(dst, "lseek():"TO_STR2(__LINE__));
 		goto onError;
 	}
 	for (;;) {
-		got = read(in, buffer, sizeof(buffer));
+		got = read(in, buffer, BUFFER_SIZE);
 		if (got < 0) {
 			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
 			if (verbose > 0) printLastError(src, "read():"TO_STR2(__LINE__));
@@ -449,6 +1331,7 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 		}
 		if (got == 0) break; /* end of file */
 		outPtr = buffer;
+		written += (uint64_t)got;
 		while (got > 0) {
 			done = write(out, outPtr, (size_t)got);
 			if (done < 0) {
@@ -460,10 +1343,221 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 			got -= done;
 		}
 	}
-	/* flush and close the temporary file before swapping it */
+	if (inPlace == 0) {
+		if (commitTempFile(&out, tmp, dst, mask, verbose) == 0) goto onError;
+	} else {
+		if (close(out) < 0) {
+			out = -1;
+			if (verbose > 0) printLastError(dst, "close():"TO_STR2(__LINE__));
+			goto onError;
+		}
+		out = -1;
+	}
+	result = 1;
+	if (verbose > 1) {
+		fprintf(stdout, "Appended file \"%s\" to \"%s\" based on \"%s\" (%llu of %llu bytes written).\n", src, dst, old, (unsigned long long)written, (unsigned long long)((uint64_t)prefix + written));
+	}
+onError:
+	if (in >= 0) close(in);
+	if (prev >= 0) close(prev);
+	if (out >= 0) close(out);
+	if (result == 0 && tmp != NULL) unlink(tmp);
+	free(tmp);
+	free(buffer);
+	return result;
+}
+
+
+/**
+ * Makes the partially copied data durable and records its state in the sidecar file. The
+ * recorded offset only covers data which reached the storage.
+ *
+ * @param[in] out - partial file descriptor
+ * @param[in] part - partial file path
+ * @param[in] info - sidecar file path
+ * @param[in] srcStats - source file status
+ * @param[in] hash - hash state of the copied data
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+static int savePartialState(const int out, const TCHAR * part, const TCHAR * info, const tFileStat * srcStats, const tHash64 * hash, const int verbose) {
+	FILE * fp;
+	if (fdatasync(out) < 0) {
+		if (verbose > 0) printLastError(part, "fdatasync():"TO_STR2(__LINE__));
+		return 0;
+	}
+	fp = fopen(info, "w");
+	if (fp == NULL) {
+		if (verbose > 0) printLastError(info, "fopen():"TO_STR2(__LINE__));
+		return 0;
+	}
+	fprintf(fp, "%s %llu %lld %lu %llu %016llx\n", PARTIAL_MAGIC, (unsigned long long)srcStats->size, (long long)srcStats->mtime, (unsigned long)srcStats->mtimeNs, (unsigned long long)hash->total, (unsigned long long)hs_final(hash));
+	if (fclose(fp) != 0) {
+		if (verbose > 0) printLastError(info, "fclose():"TO_STR2(__LINE__));
+		return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Returns the verified number of bytes of the partial file which can be kept to resume the
+ * copy of the given source file. The hash state is updated with the kept data.
+ *
+ * @param[in] out - partial file descriptor (file position is undefined afterwards)
+ * @param[in] part - partial file path
+ * @param[in] info - sidecar file path
+ * @param[in] srcStats - source file status
+ * @param[in,out] hash - initialized hash state
+ * @param[in,out] buffer - work buffer of BUFFER_SIZE bytes
+ * @param[in] verbose - verbosity level
+ * @return number of bytes to keep (0 to start over)
+ */
+static uint64_t loadPartialState(const int out, const TCHAR * part, const TCHAR * info, const tFileStat * srcStats, tHash64 * hash, char * buffer, const int verbose) {
+	char magic[16];
+	unsigned long long size, offset, value;
+	long long mtime;
+	unsigned long mtimeNs;
+	uint64_t left;
+	ssize_t got;
+	int res;
+	FILE * fp = fopen(info, "r");
+	if (fp == NULL) return 0;
+	res = fscanf(fp, "%15s %llu %lld %lu %llu %llx", magic, &size, &mtime, &mtimeNs, &offset, &value);
+	fclose(fp);
+	/* the partial data is only valid for the same source file version */
+	if (res != 6 || strcmp(magic, PARTIAL_MAGIC) != 0 || size != srcStats->size
+		|| mtime != srcStats->mtime || mtimeNs != srcStats->mtimeNs || offset > size) {
+		return 0;
+	}
+	/* verify the kept data against the recorded hash */
+	for (left = offset; left > 0; left -= (uint64_t)got) {
+		got = readFully(out, buffer, (left < BUFFER_SIZE) ? (size_t)left : BUFFER_SIZE);
+		if (got <= 0) {
+			if (got < 0 && verbose > 0) printLastError(part, "read():"TO_STR2(__LINE__));
+			break;
+		}
+		hs_update(hash, buffer, (size_t)got);
+	}
+	if (left > 0 || hs_final(hash) != (uint64_t)value) {
+		hs_init(hash, 0);
+		return 0;
+	}
+	return (uint64_t)offset;
+}
+
+
+/**
+ * Copies the source file to the destination file via a partial file with a stable name.
+ * The copy progress is recorded in a sidecar file regularly and on interruption (signal or
+ * error). The partial file is kept in these cases to resume the copy at the last verified
+ * offset on the next call with the same, unchanged source file. The partial file stays owner
+ * writable until it is renamed into place. The function overwrites the destination file or
+ * hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int resumeFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || dst == NULL) return 0;
+	int result = 0;
+	int in = -1;
+	int out = -1;
+	char * buffer = NULL;
+	char * outPtr;
+	TCHAR * part = NULL;
+	TCHAR * info = NULL;
+	const size_t dstLen = strlen(dst);
+	const size_t partLen = dstLen + sizeof(PARTIAL_SUFFIX);
+	uint64_t offset, synced;
+	ssize_t got, done;
+	tFileStat srcStats;
+	tHash64 hash;
+	if (getFileStat(src, &srcStats, verbose) != 1) return 0;
+	if ( ! S_ISREG(srcStats.mode) ) return copyFile(src, dst, mask, verbose);
+	part = (TCHAR *)malloc((2 * partLen) + sizeof(PARTIAL_INFO_SUFFIX) - 1);
+	buffer = (char *)malloc(BUFFER_SIZE);
+	if (part == NULL || buffer == NULL) {
+		if (verbose > 0) fprintf(stderr, "Failed to allocate %u bytes.\n", (unsigned)((2 * partLen) + sizeof(PARTIAL_INFO_SUFFIX) - 1 + BUFFER_SIZE));
+		goto onError;
+	}
+	/* "<dst>.lsync-partial\0<dst>.lsync-partial.info" */
+	info = part + partLen;
+	memcpy(part, dst, dstLen);
+	memcpy(part + dstLen, PARTIAL_SUFFIX, sizeof(PARTIAL_SUFFIX));
+	memcpy(info, part, partLen - 1);
+	memcpy(info + partLen - 1, PARTIAL_INFO_SUFFIX, sizeof(PARTIAL_INFO_SUFFIX));
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	/* like copyFile(): the source permissions masked by the umask, but owner writable to
+	 * allow the next run to resume a read-only source (dropped again below) */
+	out = open(part, O_RDWR | O_CREAT | O_NOFOLLOW, (mode_t)((srcStats.mode & 0777) | S_IRUSR | S_IWUSR));
+	if (out < 0) {
+		if (verbose > 0) printLastError(part, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	hs_init(&hash, 0);
+	offset = loadPartialState(out, part, info, &srcStats, &hash, buffer, verbose);
+	if (ftruncate(out, (off_t)offset) < 0 || lseek(out, (off_t)offset, SEEK_SET) < 0 || lseek(in, (off_t)offset, SEEK_SET) < 0) {
+		if (verbose > 0) printLastError(part, "lseek():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	if (offset > 0 && verbose > 1) {
+		fprintf(stdout, "Resuming copy of \"%s\" to \"%s\" at offset %llu.\n", src, dst, (unsigned long long)offset);
+	}
+	synced = offset;
+	for (;;) {
+		if (signalReceived != 0) {
+			/* interrupted -> keep the partial file for the next run */
+			savePartialState(out, part, info, &srcStats, &hash, verbose);
+			goto onError;
+		}
+		got = read(in, buffer, BUFFER_SIZE);
+		if (got < 0) {
+			if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+			if (verbose > 0) printLastError(src, "read():"TO_STR2(__LINE__));
+			savePartialState(out, part, info, &srcStats, &hash, verbose);
+			goto onError;
+		}
+		if (got == 0) break; /* end of file */
+		outPtr = buffer;
+		while (got > 0) {
+			done = write(out, outPtr, (size_t)got);
+			if (done < 0) {
+				if (errno == EINTR) continue; /* interrupted by a signal -> retry */
+				if (verbose > 0) printLastError(part, "write():"TO_STR2(__LINE__));
+				/* the failed write may have left data behind the hashed range */
+				if (ftruncate(out, (off_t)hash.total) == 0) savePartialState(out, part, info, &srcStats, &hash, verbose);
+				goto onError;
+			}
+			hs_update(&hash, outPtr, (size_t)done);
+			outPtr += done;
+			got -= done;
+		}
+		if ((hash.total - synced) >= PARTIAL_SYNC_SIZE) {
+			/* record the progress to survive a crash */
+			if (savePartialState(out, part, info, &srcStats, &hash, verbose) == 0) goto onError;
+			synced = hash.total;
+		}
+	}
+	if ((srcStats.mode & (S_IRUSR | S_IWUSR)) != (S_IRUSR | S_IWUSR)) {
+		/* apply the source permissions before the file is renamed into place */
+		struct stat stats;
+		if (fstat(out, &stats) < 0 || fchmod(out, (mode_t)((stats.st_mode & 0777) & ~((S_IRUSR | S_IWUSR) & ~srcStats.mode))) < 0) {
+			if (verbose > 0) printLastError(part, "fchmod():"TO_STR2(__LINE__));
+			savePartialState(out, part, info, &srcStats, &hash, verbose);
+			goto onError;
+		}
+	}
 	if (close(out) < 0) {
 		out = -1;
-		if (verbose > 0) printLastError(tmp, "close():"TO_STR2(__LINE__));
+		if (verbose > 0) printLastError(part, "close():"TO_STR2(__LINE__));
 		goto onError;
 	}
 	out = -1;
@@ -471,8 +1565,8 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 	if (isDirectory(dst) != 0) {
 		if (removePath(dst, verbose) == 0) goto onError;
 	}
-	/* atomically replace the destination with the newly written copy */
-	if (renameFile(tmp, dst, verbose) == 0) goto onError;
+	if (renameFile(part, dst, verbose) == 0) goto onError;
+	unlink(info);
 	result = 1;
 	if (verbose > 1) {
 		fprintf(stdout, "Copied file \"%s\" to \"%s\".\n", src, dst);
@@ -480,39 +1574,106 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 onError:
 	if (in >= 0) close(in);
 	if (out >= 0) close(out);
-	if (result == 0 && tmp != NULL) unlink(tmp);
-	free(tmp);
+	free(part);
+	free(buffer);
+	return result;
+}
+
+
+/**
+ * Updates the existing destination file in place by writing only the blocks which differ
+ * from the source file. This is not atomic: the destination is inconsistent while being
+ * updated and on failure. Falls back to copyFile() if source or destination is no regular
+ * file or the destination has further hardlinks (these would be changed as well).
+ *
+ * @param[in] src - source file
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int updateFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || dst == NULL) return 0;
+	int result = 0;
+	int in = -1;
+	int out = -1;
+	uint64_t size = 0;
+	uint64_t written = 0;
+	struct stat stats;
+	if (lstat(src, &stats) < 0) {
+		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
+		return 0;
+	}
+	if ( ! S_ISREG(stats.st_mode) ) return copyFile(src, dst, mask, verbose);
+	/* never block on special files or follow symlinks at the destination path */
+	out = open(dst, O_RDWR | O_NONBLOCK | O_NOFOLLOW);
+	if (out < 0 || fstat(out, &stats) < 0 || ! S_ISREG(stats.st_mode) || stats.st_nlink > 1) {
+		if (out >= 0) close(out);
+		return copyFile(src, dst, mask, verbose);
+	}
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (verbose > 0) printLastError(src, "open():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	if (writeChangedBlocks(in, out, out, src, dst, dst, &size, &written, verbose) == 0) goto onError;
+	if (close(out) < 0) {
+		out = -1;
+		if (verbose > 0) printLastError(dst, "close():"TO_STR2(__LINE__));
+		goto onError;
+	}
+	out = -1;
+	result = 1;
+	if (verbose > 1) {
+		fprintf(stdout, "Updated file \"%s\" in place at \"%s\" (%llu of %llu bytes written).\n", src, dst, (unsigned long long)written, (unsigned long long)size);
+	}
+onError:
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
 	return result;
 }
 
 
 /**
  * Copies the path attributes and security settings for the given path to the destination path
- * according to the mask passed.
+ * according to the mask passed. Only attributes which differ are written to avoid needless
+ * inode updates.
  * 
  * @param[in] src - source path
  * @param[in] dst - destination path
  * @param[in] mask - copy mask
  * @param[in] verbose - verbosity level
- * @return 1 on success, 0 on failure
+ * @return 1 on success, 2 if all attributes matched already, 0 on failure
  */
 int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, const int verbose) {
 	if (src == NULL || dst == NULL) return 0;
 	if (mask == AT_NONE) return 1;
 	int result = 0;
-	struct stat stats;
+	int changed = 0;
+	struct stat stats, dstStats;
 	if (lstat(src, &stats) < 0) {
 		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
 		return 0;
 	}
-	if ((mask & (AT_GROUP | AT_OWNER)) != 0) {
+	if (lstat(dst, &dstStats) < 0) {
+		/* unknown -> write all attributes to report the actual error */
+		memset(&dstStats, 0, sizeof(dstStats));
+		dstStats.st_uid = (uid_t)(-1);
+		dstStats.st_gid = (gid_t)(-1);
+		dstStats.st_mode = (mode_t)(~stats.st_mode & (S_IFMT | 07777));
+	}
+	if (((mask & AT_OWNER) != 0 && stats.st_uid != dstStats.st_uid) || ((mask & AT_GROUP) != 0 && stats.st_gid != dstStats.st_gid)) {
 		if (lchown(dst, ((mask & AT_OWNER) != 0) ? stats.st_uid : (uid_t)(-1), ((mask & AT_GROUP) != 0) ? stats.st_gid : (gid_t)(-1)) < 0) {
 			if (verbose > 0) printLastError(dst, "lchown():"TO_STR2(__LINE__));
 			goto onError;
 		}
+		/* changing the owner may clear the set-user-ID and set-group-ID bits */
+		dstStats.st_mode = (mode_t)(dstStats.st_mode & ~(mode_t)(S_ISUID | S_ISGID));
+		changed = 1;
 	}
 	/* symlinks have no permission bits on Linux -> skip here */
-	if ((mask & AT_PERMS) != 0 && ! S_ISLNK(stats.st_mode)) {
+	if ((mask & AT_PERMS) != 0 && ! S_ISLNK(stats.st_mode) && (stats.st_mode & 07777) != (dstStats.st_mode & 07777)) {
+		changed = 1;
 		if (chmod(dst, stats.st_mode) < 0) {
 			if (verbose > 0) printLastError(dst, "chmod():"TO_STR2(__LINE__));
 			goto onError;
@@ -526,9 +1687,13 @@ int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, c
 		times[0] = stats.st_atim;
 		/* last modification time */
 		times[1] = stats.st_mtim;
-		if (utimensat(AT_FDCWD, dst, times, S_ISLNK(stats.st_mode) ? AT_SYMLINK_NOFOLLOW : 0) < 0) {
-			if (verbose > 0) printLastError(dst, "utimensat():"TO_STR2(__LINE__));
-			goto onError;
+		/* the access time alone is not worth an inode update */
+		if (stats.st_mtim.tv_sec != dstStats.st_mtim.tv_sec || stats.st_mtim.tv_nsec != dstStats.st_mtim.tv_nsec) {
+			changed = 1;
+			if (utimensat(AT_FDCWD, dst, times, S_ISLNK(stats.st_mode) ? AT_SYMLINK_NOFOLLOW : 0) < 0) {
+				if (verbose > 0) printLastError(dst, "utimensat():"TO_STR2(__LINE__));
+				goto onError;
+			}
 		}
 #else
 		/* copy times with second precision (sub second fields are not portable here) */
@@ -539,57 +1704,295 @@ int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, c
 		/* last modification time */
 		times[1].tv_sec = stats.st_mtime;
 		times[1].tv_usec = 0;
-		if (utimes(dst, times) < 0) {
-			if (verbose > 0) printLastError(dst, "utimes():"TO_STR2(__LINE__));
-			goto onError;
+		if (stats.st_mtime != dstStats.st_mtime) {
+			changed = 1;
+			if (utimes(dst, times) < 0) {
+				if (verbose > 0) printLastError(dst, "utimes():"TO_STR2(__LINE__));
+				goto onError;
+			}
 		}
 #endif
 	}
-	if (verbose > 1) {
+	if (changed != 0 && verbose > 1) {
 		fprintf(stdout, "Copied attributes from file \"%s\" to \"%s\".\n", src, dst);
 	}
-	result = 1;
+	result = (changed != 0) ? 1 : 2;
 onError:
 	return result;
 }
 
 
 /**
- * Compares source file against destination file to find out which file was
- * modified more recently.
+ * Converts the given system file status.
+ * 
+ * @param[in] st - system file status
+ * @param[out] stats - receives the file status
+ */
+static void toFileStat(const struct stat * st, tFileStat * stats) {
+	stats->size = (uint64_t)st->st_size;
+	stats->mtime = (int64_t)st->st_mtime;
+	stats->ctime = (int64_t)st->st_ctime;
+#if defined(_BSD_SOURCE) || defined(_SVID_SOURCE) || (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L) || (defined(_XOPEN_SOURCE) && _XOPEN_SOURCE >= 700)
+	stats->mtimeNs = (uint32_t)st->st_mtim.tv_nsec;
+	stats->ctimeNs = (uint32_t)st->st_ctim.tv_nsec;
+#else
+	stats->mtimeNs = 0;
+	stats->ctimeNs = 0;
+#endif
+	stats->ino = (uint64_t)st->st_ino;
+	stats->mode = (uint32_t)st->st_mode;
+	stats->dev = (uint64_t)st->st_dev;
+}
+
+
+/**
+ * Retrieves the file status of the given path without following symlinks.
  * 
- * @param[in] src - older file
- * @param[in] dst - newer file
+ * @param[in] path - query this path
+ * @param[out] stats - receives the file status
  * @param[in] verbose - verbosity level
- * @return 1 if `dst` differs from `src` (changed), 0 if unchanged and -1 on error
- */
-int isNewerFile(const TCHAR * src, const TCHAR * dst, const int verbose) {
-	if (src == NULL || dst == NULL) return -1;
-	int result = -1;
-	struct stat srcStats, dstStats;
-	/* matched symlinks by link */
-	if (lstat(src, &srcStats) < 0) {
-		if (verbose > 0) printLastError(src, "lstat():"TO_STR2(__LINE__));
-		goto onError;
+ * @return 1 on success, 0 if the path does not exist and -1 on error
+ */
+int getFileStat(const TCHAR * path, tFileStat * stats, const int verbose) {
+	if (path == NULL || stats == NULL) return -1;
+	struct stat st;
+	if (lstat(path, &st) < 0) {
+		if (errno == ENOENT) return 0;
+		if (verbose > 0) printLastError(path, "lstat():"TO_STR2(__LINE__));
+		return -1;
 	}
-	if (lstat(dst, &dstStats) < 0) {
-		if (errno != ENOENT) {
-			if (verbose > 0) printLastError(dst, "lstat():"TO_STR2(__LINE__));
-			result = 1;
+	toFileStat(&st, stats);
+	return 1;
+}
+
+
+/**
+ * Retrieves the file status of the given entries of a directory without following symlinks.
+ * The directory is opened once, read through that descriptor and merge-joined with the given
+ * names. Only the entries found this way are queried relative to the opened directory. Missing
+ * entries cost nothing.
+ * 
+ * @param[in] dir - directory path
+ * @param[in] names - entry names in ascending order
+ * @param[in] count - number of names
+ * @param[out] stats - receives the file status of each found entry
+ * @param[in] stride - distance between the status entries of consecutive names
+ * @param[in,out] found - receives the given bit for each found entry
+ * @param[in] bit - bit to set in found
+ * @return 1 on success, 0 on error
+ */
+int getDirFileStats(const TCHAR * dir, const TCHAR * const * names, const size_t count, tFileStat * stats, const size_t stride, uint32_t * found, const uint32_t bit) {
+	int result = 0;
+	int fd = -1;
+	char * entries = NULL;
+	const char ** sorted = NULL;
+	size_t size, entryCount, capacity = 0, i, j;
+	struct stat st;
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) goto onError;
+	if (tds_listDirFd(fd, &entries, &size) == 0) goto onError;
+	if (sortNames(entries, size, &sorted, &entryCount, &capacity) == 0) goto onError;
+	for (i = 0, j = 0; i < count && j < entryCount; ) {
+		const int cmp = strcmp(names[i], sorted[j]);
+		if (cmp < 0) {
+			i++;
+		} else if (cmp > 0) {
+			j++;
 		} else {
-			result = 0;
+			/* vanished entries are simply missing */
+			if (fstatat(fd, names[i], &st, AT_SYMLINK_NOFOLLOW) == 0) {
+				toFileStat(&st, stats + (i * stride));
+				found[i] |= bit;
+			}
+			i++;
+			j++;
 		}
-		goto onError;
-	}
-	result = 0;
-	if (srcStats.st_size == dstStats.st_size) {
-		/* ctime is ignored so that metadata only change still do --link-dest hardlink deduplication */
-		if (srcStats.st_mtime != dstStats.st_mtime) {
-			result = 1;
-		}
-	} else {
-		result = 1;
 	}
+	result = 1;
 onError:
+	if (sorted != NULL) free((void *)sorted);
+	if (entries != NULL) free(entries);
+	if (fd >= 0) close(fd);
 	return result;
 }
+
+
+/**
+ * Retrieves the identity of the given regular file if it has more than one name.
+ * 
+ * @param[in] path - query this path
+ * @param[out] dev - receives the device number
+ * @param[out] ino - receives the inode number
+ * @return 1 if the path is a regular file with multiple names, 0 if not and -1 on error
+ */
+int getHardLinkId(const TCHAR * path, uint64_t * dev, uint64_t * ino) {
+	if (path == NULL || dev == NULL || ino == NULL) return -1;
+	struct stat st;
+	if (lstat(path, &st) < 0) return -1;
+	if (S_ISREG(st.st_mode) == 0 || st.st_nlink < 2) return 0;
+	*dev = (uint64_t)st.st_dev;
+	*ino = (uint64_t)st.st_ino;
+	return 1;
+}
+
+
+/**
+ * Fills in the Unix domain socket address for the given path.
+ *
+ * @param[out] addr - socket address
+ * @param[in] path - socket file path
+ * @return 1 on success, 0 if the path is too long
+ */
+static int setSocketAddress(struct sockaddr_un * addr, const TCHAR * path) {
+	const size_t len = strlen(path);
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (len >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "Error: Socket path \"%s\" is too long.\n", path);
+		return 0;
+	}
+	memcpy(addr->sun_path, path, len + 1);
+	return 1;
+}
+
+
+/**
+ * Creates a Unix domain socket at the given path and listens on it. A stale socket file
+ * at the given path is replaced. Only the owner may connect to the socket.
+ *
+ * @param[in] path - socket file path
+ * @return socket descriptor or -1 on error
+ */
+int listenSocket(const TCHAR * path) {
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+	if (setSocketAddress(&addr, path) == 0) return -1;
+	/* peers which disconnect early shall not terminate the process */
+	signal(SIGPIPE, SIG_IGN);
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		printLastError(path, "socket():"TO_STR2(__LINE__));
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printLastError(path, "bind():"TO_STR2(__LINE__));
+		close(fd);
+		return -1;
+	}
+	/* restrict access before connections are accepted (the umask may permit more) */
+	if (chmod(path, S_IRUSR | S_IWUSR) != 0) {
+		printLastError(path, "chmod():"TO_STR2(__LINE__));
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	if (listen(fd, 16) != 0) {
+		printLastError(path, "listen():"TO_STR2(__LINE__));
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * Connects to the Unix domain socket at the given path.
+ *
+ * @param[in] path - socket file path
+ * @return socket descriptor or -1 on error
+ */
+int connectSocket(const TCHAR * path) {
+	struct sockaddr_un addr;
+	int fd;
+	if (setSocketAddress(&addr, path) == 0) return -1;
+	signal(SIGPIPE, SIG_IGN);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		printLastError(path, "socket():"TO_STR2(__LINE__));
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printLastError(path, "connect():"TO_STR2(__LINE__));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * Waits for the next connection on the given listening socket.
+ *
+ * @param[in] fd - listening socket descriptor
+ * @param[in] timeout - maximum time to wait in milliseconds
+ * @return connected socket descriptor, -1 on timeout or signal and -2 on error
+ */
+int acceptSocket(const int fd, const int timeout) {
+	struct pollfd pfd;
+	int res;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	res = poll(&pfd, 1, timeout);
+	if (res < 0) return (errno == EINTR) ? -1 : -2;
+	if (res == 0) return -1;
+	res = accept(fd, NULL, NULL);
+	if (res < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) return -1;
+		perror("accept():"TO_STR2(__LINE__));
+		return -2;
+	}
+	fcntl(res, F_SETFD, FD_CLOEXEC);
+	return res;
+}
+
+
+/**
+ * Checks whether the peer of the given connected socket runs with the effective user ID
+ * of this process.
+ *
+ * @param[in] fd - connected socket descriptor
+ * @return 1 if the peer has the same user ID, else 0
+ */
+int isSocketPeerOwner(const int fd) {
+	/* layout of struct ucred (only declared with _GNU_SOURCE) */
+	struct {
+		pid_t pid;
+		uid_t uid;
+		gid_t gid;
+	} cred;
+	socklen_t len = (socklen_t)sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != (socklen_t)sizeof(cred)) {
+		perror("getsockopt():"TO_STR2(__LINE__));
+		return 0;
+	}
+	return (cred.uid == geteuid()) ? 1 : 0;
+}
+
+
+/**
+ * Writes the given data completely to a socket.
+ *
+ * @param[in] fd - socket descriptor
+ * @param[in] data - data to write
+ * @param[in] len - number of bytes to write
+ * @return 1 on success, 0 on error (e.g. peer disconnected)
+ */
+int sendSocket(const int fd, const void * data, const size_t len) {
+	const char * ptr = (const char *)data;
+	size_t left = len;
+	while (left > 0) {
+		const ssize_t written = write(fd, ptr, left);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return 0;
+		}
+		ptr += written;
+		left -= (size_t)written;
+	}
+	return 1;
+}
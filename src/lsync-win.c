@@ -2,7 +2,7 @@
  * @file lsync-win.c
  * @author Daniel Starke
  * @date 2017-05-22
- * @version 2026-06-19
+ * @version 2026-10-18
  * 
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -220,7 +220,7 @@ static size_t rootPrefixLen(const TCHAR * path) {
  * @param[in] verbose - verbosity level
  * @return 1 on success (or if the path does not exist), 0 on failure
  */
-static int removePath(const TCHAR * path, const int verbose) {
+int removePath(const TCHAR * path, const int verbose) {
 	const DWORD attr = GetFileAttributes(path);
 	if (attr == INVALID_FILE_ATTRIBUTES) return 1; /* nothing to remove */
 	if ((attr & FILE_ATTRIBUTE_DIRECTORY) == 0) {
@@ -276,18 +276,31 @@ static int removePath(const TCHAR * path, const int verbose) {
 
 
 /**
- * Creates the passed directory path recursively.
+ * Creates the passed directory path recursively. If the parent directory is known to exist,
+ * the directory is created with a single CreateDirectory() without checking each path
+ * component.
  *
  * @param[in] dst - destination path
+ * @param[in] existing - length of the prefix of dst known to be an existing directory (0 if unknown)
  * @param[in] verbose - verbosity level
  * @return 1 on success, 0 on failure
  */
-int createDirectory(const TCHAR * dst, const int verbose) {
+int createDirectory(const TCHAR * dst, const size_t existing, const int verbose) {
 	if (dst == NULL || *dst == 0) return 0;
 	int result = 0;
 	const size_t len = _tcslen(dst);
 	/* nothing to create if the path is only a root prefix (drive, UNC share, ...) */
 	if (rootPrefixLen(dst) >= len) return 1;
+	if (existing > 0 && existing < len && _tcspbrk(dst + existing + 1, PATH_SEPS) == NULL) {
+		if (CreateDirectory(dst, NULL) != 0) {
+			if (verbose > 1) {
+				_ftprintf(stdout, _T("Created directory \"%s\".\n"), dst);
+			}
+			return 1;
+		}
+		if (GetLastError() == ERROR_ALREADY_EXISTS && isDirectory(dst) != 0) return 1;
+		/* non-directory at this path or parent vanished -> check each path component */
+	}
 	TCHAR * end = NULL; /* pointer to the end of the current path part */
 	TCHAR * dir = (TCHAR *)malloc(sizeof(TCHAR) * (len + 1));
 	if (dir == NULL) {
@@ -396,27 +409,35 @@ int renameFile(const TCHAR * src, const TCHAR * dst, const int verbose) {
  *
  * @param[in] src - source path
  * @param[in] dst - destination path
+ * @param[in] mask - copy mask (only CP_NEW is evaluated)
  * @param[in] verbose - verbosity level
  * @return 1 on success, 0 on failure
  */
-int createHardLink(const TCHAR * src, const TCHAR * dst, const int verbose) {
+int createHardLink(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
 	if (src == NULL || dst == NULL) return 0;
 	int result = 0;
 	TCHAR * tmpPath = NULL;
-	/* link under a temporary name and rename it into place so a failed link never
-	 * destroys the existing destination (atomic replace, like the copy path) */
-	if (createTempName(dst, &tmpPath, verbose) == 0) return 0;
-	if (CreateHardLink(tmpPath, src, NULL) == 0) {
-		if (verbose > 0) printLastError(tmpPath, _T("CreateHardLink():")_T2(TO_STR2(__LINE__)));
-		goto onError;
+	/* a destination known to be absent is linked directly */
+	if ((mask & CP_NEW) == 0 || CreateHardLink(dst, src, NULL) == 0) {
+		if ((mask & CP_NEW) != 0 && GetLastError() != ERROR_ALREADY_EXISTS) {
+			if (verbose > 0) printLastError(dst, _T("CreateHardLink():")_T2(TO_STR2(__LINE__)));
+			return 0;
+		}
+		/* link under a temporary name and rename it into place so a failed link never
+		 * destroys the existing destination (atomic replace, like the copy path) */
+		if (createTempName(dst, &tmpPath, verbose) == 0) return 0;
+		if (CreateHardLink(tmpPath, src, NULL) == 0) {
+			if (verbose > 0) printLastError(tmpPath, _T("CreateHardLink():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+		if (renameFile(tmpPath, dst, verbose) == 0) goto onError;
 	}
-	if (renameFile(tmpPath, dst, verbose) == 0) goto onError;
 	result = 1;
 	if (verbose > 1) {
 		_ftprintf(stdout, _T("Created hardlink \"%s\" pointing to \"%s\".\n"), dst, src);
 	}
 onError:
-	if (result == 0) DeleteFile(tmpPath); /* discard the temp link on failure */
+	if (result == 0 && tmpPath != NULL) DeleteFile(tmpPath); /* discard the temp link on failure */
 	free(tmpPath);
 	return result;
 }
@@ -430,10 +451,11 @@ onError:
  *
  * @param[in] src - source symlink
  * @param[in] dst - destination path
+ * @param[in] mask - copy mask (only CP_NEW is evaluated)
  * @param[in] verbose - verbosity level
  * @return 1 on success or skip, 0 on failure
  */
-static int copySymbolicLink(const TCHAR * src, const TCHAR * dst, const int verbose) {
+static int copySymbolicLink(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
 	typedef BOOLEAN (WINAPI * tCreateSymbolicLink)(LPCTSTR, LPCTSTR, DWORD);
 	/* resolved dynamically so the executable still loads on Windows XP */
 	static tCreateSymbolicLink createSymbolicLink = NULL;
@@ -515,10 +537,21 @@ static int copySymbolicLink(const TCHAR * src, const TCHAR * dst, const int verb
 		if (verbose > 0) _ftprintf(stderr, _T("Skipping symbolic link \"%s\" (creating symbolic links requires Windows Vista or newer).\n"), src);
 		return 1;
 	}
-	/* create the link under a temporary name and rename it so that failed creation
-	 * never destroys the existing destination (atomic replace) */
 	const DWORD dwFlags = (isDir != 0) ? SYMBOLIC_LINK_FLAG_DIRECTORY : 0;
 	TCHAR * tmpPath = NULL;
+	/* a destination known to be absent is created directly */
+	if ((mask & CP_NEW) != 0) {
+		if ((*createSymbolicLink)(dst, target, (DWORD)(dwFlags | SYMBOLIC_LINK_FLAG_ALLOW_UNPRIVILEGED_CREATE)) != 0
+			|| (*createSymbolicLink)(dst, target, dwFlags) != 0) {
+			if (verbose > 1) {
+				_ftprintf(stdout, _T("Copied symbolic link \"%s\" to \"%s\".\n"), src, dst);
+			}
+			return 1;
+		}
+		/* retry via a temporary name below which also reports failures */
+	}
+	/* create the link under a temporary name and rename it so that failed creation
+	 * never destroys the existing destination (atomic replace) */
 	if (createTempName(dst, &tmpPath, verbose) == 0) return 0;
 	/* try the unprivileged create flag first (Windows 10 1703+ with developer mode), then
 	 * without it for older systems that reject the unknown flag */
@@ -566,64 +599,254 @@ int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const i
 	if (src == NULL || dst == NULL) return 0;
 	if (isSymlink(src) != 0) {
 		if ((mask & CP_LINKS) != 0) {
-			return copySymbolicLink(src, dst, verbose);
+			return copySymbolicLink(src, dst, mask, verbose);
 		}
 		if (verbose > 0) _ftprintf(stderr, _T("Skipping symbolic link \"%s\" (requires --links).\n"), src);
 		return 1;
 	}
 	int result = 0;
 	TCHAR * tmpPath = NULL;
-	/* copy to a temporary file first then atomically replace the destination so
-	 * a failed copy never destroys the existing destination file */
-	if (createTempName(dst, &tmpPath, verbose) == 0) return 0;
 	/* symlinks are handled above -> only regular files reach this point */
 	/* COPY_FILE_NO_BUFFERING is Vista+; COPY_FILE_FAIL_IF_EXISTS makes the copy fail-closed
 	 * so a process racing for the temporary name cannot have its file silently overwritten */
 	DWORD dwCopyFlags = COPY_FILE_FAIL_IF_EXISTS | ((LOBYTE(LOWORD(GetVersion())) < 6) ? 0 : COPY_FILE_NO_BUFFERING);
-	if (CopyFileEx(src, tmpPath, NULL, NULL, FALSE, dwCopyFlags) == 0) {
-		if (verbose > 0) printLastError(tmpPath, _T("CopyFileEx():")_T2(TO_STR2(__LINE__)));
-		goto onError;
-	}
-	/* replace a directory at destination path (type change) */
-	if (isDirectory(dst) != 0) {
-		if (removePath(dst, verbose) == 0) goto onError;
+	/* a destination known to be absent is written directly */
+	if ((mask & CP_NEW) == 0 || CopyFileEx(src, dst, NULL, NULL, FALSE, dwCopyFlags) == 0) {
+		if ((mask & CP_NEW) != 0 && GetLastError() != ERROR_FILE_EXISTS && GetLastError() != ERROR_ALREADY_EXISTS) {
+			if (verbose > 0) printLastError(dst, _T("CopyFileEx():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+		/* copy to a temporary file first then atomically replace the destination so
+		 * a failed copy never destroys the existing destination file */
+		if (createTempName(dst, &tmpPath, verbose) == 0) goto onError;
+		if (CopyFileEx(src, tmpPath, NULL, NULL, FALSE, dwCopyFlags) == 0) {
+			if (verbose > 0) printLastError(tmpPath, _T("CopyFileEx():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+		/* replace a directory at destination path (type change) */
+		if (isDirectory(dst) != 0) {
+			if (removePath(dst, verbose) == 0) goto onError;
+		}
+		if (renameFile(tmpPath, dst, verbose) == 0) goto onError;
 	}
-	if (renameFile(tmpPath, dst, verbose) == 0) goto onError;
 	result = 1;
 	if (verbose > 1) {
 		_ftprintf(stdout, _T("Copied file \"%s\" to \"%s\".\n"), src, dst);
 	}
 onError:
-	if (result == 0) DeleteFile(tmpPath);
+	if (result == 0 && tmpPath != NULL) DeleteFile(tmpPath);
 	free(tmpPath);
 	return result;
 }
 
 
+/**
+ * Clones the source file to the destination file. Windows has no portable block cloning
+ * API, but CopyFileEx() clones on file systems which support it (e.g. ReFS on newer
+ * versions). The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int cloneFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	return copyFile(src, dst, mask, verbose);
+}
+
+
+/**
+ * Creates the destination file from the source file based on a similar reference file.
+ * Windows has no portable block cloning API, hence the source is copied like copyFile().
+ * The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] ref - reference file with similar content (unused)
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int deltaFile(const TCHAR * src, const TCHAR * ref, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	PCF_UNUSED(ref)
+	return copyFile(src, dst, mask, verbose);
+}
+
+
+/**
+ * Creates the destination file from the source file based on a previous version which is
+ * a prefix of the source. Windows has no portable block cloning API, hence the source is
+ * copied like copyFile(). The function overwrites the destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] old - previous version of the file (unused)
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int appendFile(const TCHAR * src, const TCHAR * old, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	PCF_UNUSED(old)
+	return copyFile(src, dst, mask, verbose);
+}
+
+
+/**
+ * Copies the source file to the destination file. Resuming partial copies is not supported
+ * on this platform, hence the file is copied like copyFile(). The function overwrites the
+ * destination file or hardlink.
+ *
+ * @param[in] src - source file
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int resumeFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	return copyFile(src, dst, mask, verbose);
+}
+
+
+/**
+ * Reads up to the given number of bytes at the current file position. Less bytes are only
+ * returned at the end of the file.
+ *
+ * @param[in] file - file handle
+ * @param[out] buf - output buffer
+ * @param[in] len - number of bytes to read
+ * @param[out] got - receives the number of bytes read
+ * @return 1 on success, 0 on failure
+ */
+static int readFully(HANDLE file, char * buf, const DWORD len, DWORD * got) {
+	DWORD res;
+	*got = 0;
+	while (*got < len) {
+		if (ReadFile(file, buf + *got, len - *got, &res, NULL) == 0) return 0;
+		if (res == 0) break; /* end of file */
+		*got += res;
+	}
+	return 1;
+}
+
+
+/**
+ * Updates the existing destination file in place by writing only the blocks which differ
+ * from the source file. This is not atomic: the destination is inconsistent while being
+ * updated and on failure. Falls back to copyFile() if the source is a symlink or the
+ * destination has further hardlinks (these would be changed as well).
+ *
+ * @param[in] src - source file
+ * @param[in] dst - destination file
+ * @param[in] mask - copy mask
+ * @param[in] verbose - verbosity level
+ * @return 1 on success, 0 on failure
+ */
+int updateFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose) {
+	if (src == NULL || dst == NULL) return 0;
+	if (isSymlink(src) != 0 || isSymlink(dst) != 0) return copyFile(src, dst, mask, verbose);
+	int result = 0;
+	HANDLE in = INVALID_HANDLE_VALUE;
+	HANDLE out = INVALID_HANDLE_VALUE;
+	BY_HANDLE_FILE_INFORMATION info;
+	LARGE_INTEGER offset;
+	ULONGLONG written = 0;
+	char * buffer = NULL;
+	DWORD got, oldGot, pos, len, done;
+	out = CreateFile(dst, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (out == INVALID_HANDLE_VALUE || GetFileInformationByHandle(out, &info) == 0
+		|| (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 || info.nNumberOfLinks > 1) {
+		if (out != INVALID_HANDLE_VALUE) CloseHandle(out);
+		return copyFile(src, dst, mask, verbose);
+	}
+	in = CreateFile(src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (in == INVALID_HANDLE_VALUE) {
+		if (verbose > 0) printLastError(src, _T("CreateFile():")_T2(TO_STR2(__LINE__)));
+		goto onError;
+	}
+	buffer = (char *)malloc(2 * BUFFER_SIZE);
+	if (buffer == NULL) {
+		if (verbose > 0) _ftprintf(stderr, _T("Failed to allocate %u bytes.\n"), (unsigned)(2 * BUFFER_SIZE));
+		goto onError;
+	}
+	offset.QuadPart = 0;
+	for (;;) {
+		if (readFully(in, buffer, BUFFER_SIZE, &got) == 0) {
+			if (verbose > 0) printLastError(src, _T("ReadFile():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+		if (got == 0) break; /* end of file */
+		if (readFully(out, buffer + BUFFER_SIZE, got, &oldGot) == 0) {
+			if (verbose > 0) printLastError(dst, _T("ReadFile():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+		/* rewrite only the differing blocks to keep the others untouched */
+		for (pos = 0; pos < got; pos += len) {
+			OVERLAPPED at;
+			len = got - pos;
+			if (len > DELTA_BLOCK_SIZE) len = DELTA_BLOCK_SIZE;
+			if (pos + len <= oldGot && memcmp(buffer + pos, buffer + BUFFER_SIZE + pos, (size_t)len) == 0) continue;
+			/* positioned write; the sequential read position is updated as well -> restored below */
+			ZeroMemory(&at, sizeof(at));
+			at.Offset = (DWORD)((ULONGLONG)(offset.QuadPart + pos) & 0xFFFFFFFF);
+			at.OffsetHigh = (DWORD)((ULONGLONG)(offset.QuadPart + pos) >> 32);
+			if (WriteFile(out, buffer + pos, len, &done, &at) == 0 || done != len) {
+				if (verbose > 0) printLastError(dst, _T("WriteFile():")_T2(TO_STR2(__LINE__)));
+				goto onError;
+			}
+			written += (ULONGLONG)len;
+		}
+		offset.QuadPart += (LONGLONG)got;
+		if (SetFilePointerEx(out, offset, NULL, FILE_BEGIN) == 0) {
+			if (verbose > 0) printLastError(dst, _T("SetFilePointerEx():")_T2(TO_STR2(__LINE__)));
+			goto onError;
+		}
+	}
+	/* drop the old data beyond the end of the source */
+	if (SetFilePointerEx(out, offset, NULL, FILE_BEGIN) == 0 || SetEndOfFile(out) == 0) {
+		if (verbose > 0) printLastError(dst, _T("SetEndOfFile():")_T2(TO_STR2(__LINE__)));
+		goto onError;
+	}
+	result = 1;
+	if (verbose > 1) {
+		_ftprintf(stdout, _T("Updated file \"%s\" in place at \"%s\" (%I64u of %I64u bytes written).\n"), src, dst, written, (ULONGLONG)offset.QuadPart);
+	}
+onError:
+	if (in != INVALID_HANDLE_VALUE) CloseHandle(in);
+	if (out != INVALID_HANDLE_VALUE) CloseHandle(out);
+	free(buffer);
+	return result;
+}
+
+
 /**
  * Copies the path attributes and security settings for the given path to the destination path
- * according to the mask passed.
+ * according to the mask passed. Only attributes which differ are written to avoid needless
+ * metadata updates.
  * 
  * @param[in] src - source path
  * @param[in] dst - destination path
  * @param[in] mask - copy mask
  * @param[in] verbose - verbosity level
- * @return 1 on success, 0 on failure
+ * @return 1 on success, 2 if all attributes matched already, 0 on failure
  */
 int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, const int verbose) {
 	if (src == NULL || dst == NULL) return 0;
 	if (mask == AT_NONE) return 1;
 	int result = 0;
+	int changed = 0;
 	SECURITY_INFORMATION flags = 0;
 	PSID owner, group;
 	PACL dacl;
 	HANDLE file = INVALID_HANDLE_VALUE;
-	FILETIME times[3];
+	FILETIME times[3], dstTimes[3];
 	const int isLink = (isSymlink(src) != 0);
 	const DWORD reparseFlag = (isLink != 0) ? FILE_FLAG_OPEN_REPARSE_POINT : 0;
 	const size_t len = _tcslen(dst);
 	char buffer[4096];
+	char dstBuffer[4096];
 	DWORD neededLength = 0;
+	DWORD dstLength = 0;
 	PSECURITY_DESCRIPTOR sd = (PSECURITY_DESCRIPTOR)buffer;
 	void * sdAlloc = NULL;
 	TCHAR * dstCpy = (TCHAR *)malloc(sizeof(TCHAR) * (len + 1));
@@ -658,9 +881,16 @@ int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, c
 				goto onError;
 			}
 		}
-		if (SetFileSecurity(dstCpy, flags, sd) == 0) {
-			if (verbose > 0) printLastError(dstCpy, _T("SetFileSecurity():")_T2(TO_STR2(__LINE__)));
-			goto onError;
+		/* self-relative descriptors with equal bytes are equal; anything else is written */
+		const DWORD sdLength = GetSecurityDescriptorLength(sd);
+		if (GetFileSecurity(dst, flags, (PSECURITY_DESCRIPTOR)dstBuffer, sizeof(dstBuffer), &dstLength) == 0
+			|| GetSecurityDescriptorLength((PSECURITY_DESCRIPTOR)dstBuffer) != sdLength
+			|| memcmp(dstBuffer, sd, (size_t)sdLength) != 0) {
+			changed = 1;
+			if (SetFileSecurity(dstCpy, flags, sd) == 0) {
+				if (verbose > 0) printLastError(dstCpy, _T("SetFileSecurity():")_T2(TO_STR2(__LINE__)));
+				goto onError;
+			}
 		}
 	}
 	/* copy file times */
@@ -675,20 +905,26 @@ int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, c
 			goto onError;
 		}
 		CloseHandle(file);
-		file = CreateFile(dst, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | reparseFlag, NULL);
+		file = CreateFile(dst, FILE_READ_ATTRIBUTES | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | reparseFlag, NULL);
 		if (file == INVALID_HANDLE_VALUE) {
 			if (verbose > 0) printLastError(dst, _T("CreateFile():")_T2(TO_STR2(__LINE__)));
 			goto onError;
 		}
-		if (SetFileTime(file, times, times + 1, times + 2) == 0) {
-			if (verbose > 0) printLastError(dst, _T("SetFileTime():")_T2(TO_STR2(__LINE__)));
-			goto onError;
+		/* the access time alone is not worth a metadata update */
+		if (GetFileTime(file, dstTimes, dstTimes + 1, dstTimes + 2) == 0
+			|| CompareFileTime(times, dstTimes) != 0
+			|| CompareFileTime(times + 2, dstTimes + 2) != 0) {
+			changed = 1;
+			if (SetFileTime(file, times, times + 1, times + 2) == 0) {
+				if (verbose > 0) printLastError(dst, _T("SetFileTime():")_T2(TO_STR2(__LINE__)));
+				goto onError;
+			}
 		}
 	}
-	if (verbose > 1) {
+	if (changed != 0 && verbose > 1) {
 		_ftprintf(stdout, _T("Copied attributes from file \"%s\" to \"%s\".\n"), src, dst);
 	}
-	result = 1;
+	result = (changed != 0) ? 1 : 2;
 onError:
 	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
 	if (sdAlloc != NULL) free(sdAlloc);
@@ -698,71 +934,90 @@ onError:
 
 
 /**
- * Compares source file against destination file to find out which file was
- * modified more recently.
+ * Converts the given FILETIME to seconds and nanoseconds since the Unix epoch.
+ *
+ * @param[in] ft - file time to convert
+ * @param[out] sec - receives the seconds since the Unix epoch
+ * @param[out] nsec - receives the nanosecond part
+ */
+static void fileTimeToUnix(const FILETIME * ft, int64_t * sec, uint32_t * nsec) {
+	ULARGE_INTEGER stamp;
+	stamp.LowPart = ft->dwLowDateTime;
+	stamp.HighPart = ft->dwHighDateTime;
+	/* 100ns units since 1601-01-01 -> since 1970-01-01 */
+	const int64_t units = (int64_t)(stamp.QuadPart - 116444736000000000ULL);
+	int64_t s = units / 10000000;
+	int64_t r = units % 10000000;
+	if (r < 0) {
+		s--;
+		r += 10000000;
+	}
+	*sec = s;
+	*nsec = (uint32_t)(r * 100);
+}
+
+
+/**
+ * Retrieves the file status of the given path without following symlinks.
+ * The creation time is reported as status change time and the file attributes as mode.
  * 
- * @param[in] src - older file
- * @param[in] dst - newer file
+ * @param[in] path - query this path
+ * @param[out] stats - receives the file status
  * @param[in] verbose - verbosity level
- * @return 1 if `dst` differs from `src` (changed), 0 if unchanged and -1 on error
+ * @return 1 on success, 0 if the path does not exist and -1 on error
  */
-int isNewerFile(const TCHAR * src, const TCHAR * dst, const int verbose) {
-	if (src == NULL || dst == NULL) return -1;
+int getFileStat(const TCHAR * path, tFileStat * stats, const int verbose) {
+	if (path == NULL || stats == NULL) return -1;
 	int result = -1;
-	HANDLE file = INVALID_HANDLE_VALUE;
-	FILETIME srcTime, dstTime;
-	LARGE_INTEGER srcSize, dstSize;
-	ULARGE_INTEGER srcStamp, dstStamp;
-	const DWORD srcFlags = (isSymlink(src) != 0) ? (FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS) : FILE_ATTRIBUTE_NORMAL;
-	file = CreateFile(src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, srcFlags, NULL);
-	if (file == INVALID_HANDLE_VALUE) {
-		if (verbose > 0) printLastError(src, _T("CreateFile():")_T2(TO_STR2(__LINE__)));
-		goto onError;
-	}
-	if (GetFileTime(file, NULL, NULL, &srcTime) == 0) {
-		if (verbose > 0) printLastError(src, _T("GetFileTime():")_T2(TO_STR2(__LINE__)));
-		goto onError;
-	}
-	if (GetFileSizeEx(file, &srcSize) == 0) {
-		if (verbose > 0) printLastError(src, _T("GetFileSizeEx():")_T2(TO_STR2(__LINE__)));
-		goto onError;
-	}
-	CloseHandle(file);
-	const DWORD dstFlags = (isSymlink(dst) != 0) ? (FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS) : FILE_ATTRIBUTE_NORMAL;
-	file = CreateFile(dst, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, dstFlags, NULL);
+	BY_HANDLE_FILE_INFORMATION info;
+	const DWORD flags = (isSymlink(path) != 0) ? (FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS) : FILE_ATTRIBUTE_NORMAL;
+	HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
 	if (file == INVALID_HANDLE_VALUE) {
 		const DWORD err = GetLastError();
-		if (err != ERROR_FILE_NOT_FOUND && err != ERROR_PATH_NOT_FOUND) {
-			if (verbose > 0) printLastError(dst, _T("CreateFile():")_T2(TO_STR2(__LINE__)));
-			result = 1;
-		} else {
-			result = 0;
-		}
-		goto onError;
+		if (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) return 0;
+		if (verbose > 0) printLastError(path, _T("CreateFile():")_T2(TO_STR2(__LINE__)));
+		return -1;
 	}
-	if (GetFileTime(file, NULL, NULL, &dstTime) == 0) {
-		if (verbose > 0) printLastError(dst, _T("GetFileTime():")_T2(TO_STR2(__LINE__)));
+	if (GetFileInformationByHandle(file, &info) == 0) {
+		if (verbose > 0) printLastError(path, _T("GetFileInformationByHandle():")_T2(TO_STR2(__LINE__)));
 		goto onError;
 	}
-	if (GetFileSizeEx(file, &dstSize) == 0) {
-		if (verbose > 0) printLastError(dst, _T("GetFileSizeEx():")_T2(TO_STR2(__LINE__)));
+	stats->size = (((uint64_t)info.nFileSizeHigh) << 32) | ((uint64_t)info.nFileSizeLow);
+	fileTimeToUnix(&(info.ftLastWriteTime), &(stats->mtime), &(stats->mtimeNs));
+	fileTimeToUnix(&(info.ftCreationTime), &(stats->ctime), &(stats->ctimeNs));
+	stats->ino = (((uint64_t)info.nFileIndexHigh) << 32) | ((uint64_t)info.nFileIndexLow);
+	stats->mode = (uint32_t)info.dwFileAttributes;
+	stats->dev = (uint64_t)info.dwVolumeSerialNumber;
+	result = 1;
+onError:
+	CloseHandle(file);
+	return result;
+}
+
+
+/**
+ * Retrieves the identity of the given regular file if it has more than one name.
+ * 
+ * @param[in] path - query this path
+ * @param[out] dev - receives the volume serial number
+ * @param[out] ino - receives the file index
+ * @return 1 if the path is a regular file with multiple names, 0 if not and -1 on error
+ */
+int getHardLinkId(const TCHAR * path, uint64_t * dev, uint64_t * ino) {
+	if (path == NULL || dev == NULL || ino == NULL) return -1;
+	int result = -1;
+	BY_HANDLE_FILE_INFORMATION info;
+	HANDLE file = CreateFile(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (file == INVALID_HANDLE_VALUE) return -1;
+	if (GetFileInformationByHandle(file, &info) == 0) goto onError;
+	if ((info.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) != 0 || info.nNumberOfLinks < 2) {
+		result = 0;
 		goto onError;
 	}
-	srcStamp.LowPart = srcTime.dwLowDateTime;
-	srcStamp.HighPart = srcTime.dwHighDateTime;
-	dstStamp.LowPart = dstTime.dwLowDateTime;
-	dstStamp.HighPart = dstTime.dwHighDateTime;
-	result = 0;
-	if (srcSize.QuadPart == dstSize.QuadPart) {
-		/* compare modification time with one second granularity (100ns FILETIME units per
-		 * second) to match the POSIX backend and tolerate coarser filesystem timestamps */
-		if ((srcStamp.QuadPart / 10000000ULL) != (dstStamp.QuadPart / 10000000ULL)) {
-			result = 1;
-		}
-	} else {
-		result = 1;
-	}
+	*dev = (uint64_t)info.dwVolumeSerialNumber;
+	*ino = (((uint64_t)info.nFileIndexHigh) << 32) | ((uint64_t)info.nFileIndexLow);
+	result = 1;
 onError:
-	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	CloseHandle(file);
 	return result;
 }
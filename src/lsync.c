@@ -2,7 +2,7 @@
  * @file lsync.c
  * @author Daniel Starke
  * @date 2017-05-17
- * @version 2026-06-28
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -41,28 +41,9 @@ volatile sig_atomic_t signalReceived = 0;
  * Main entry point.
  */
 int _tmain(int argc, TCHAR ** argv) {
-	int res = EXIT_FAILURE;
-	TCHAR * buffer = NULL;
+	int res;
 	char POSIXLY_CORRECT[] = "POSIXLY_CORRECT=";
 	tContext ctx;
-	memset(&ctx, 0, sizeof(ctx));
-	struct option longOptions[] = {
-		{_T("link-dest"), required_argument, NULL,           GETOPT_LINK_DEST},
-		{_T("version"),   no_argument,       NULL,           GETOPT_VERSION},
-		{_T("devices"),   no_argument,       &ctx.devices,       0 },
-		{_T("specials"),  no_argument,       &ctx.specials,      0 },
-		{_T("archive"),   no_argument,       NULL,           _T('a')},
-		{_T(""),          no_argument,       NULL,           _T('D')},
-		{_T("group"),     no_argument,       NULL,           _T('g')},
-		{_T("help"),      no_argument,       NULL,           _T('h')},
-		{_T("links"),     no_argument,       &ctx.links,     _T('l')},
-		{_T("owner"),     no_argument,       &ctx.owner,     _T('o')},
-		{_T("perms"),     no_argument,       &ctx.perms,     _T('p')},
-		{_T("recursive"), no_argument,       &ctx.recursive, _T('r')},
-		{_T("times"),     no_argument,       &ctx.times,     _T('t')},
-		{_T("verbose"),   no_argument,       NULL,           _T('v')},
-		{NULL, 0, NULL, 0}
-	};
 
 	/* ensure that the environment does not change the argument parser behavior */
 	putenv(POSIXLY_CORRECT);
@@ -78,34 +59,182 @@ int _tmain(int argc, TCHAR ** argv) {
 		return EXIT_FAILURE;
 	}
 
+	res = parseOptions(&ctx, argc, argv);
+	if (res >= 0) return res;
+
+	/* install signal handlers */
+	signalReceived = 0;
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+
+	if (ctx.jobsFile != NULL) return runJobsFile(&ctx);
+#ifndef UNICODE
+	if (ctx.prune != NULL) return runPrune(&ctx);
+	if (ctx.serve != NULL) return serveJobs(&ctx);
+	if (ctx.connect != NULL) return submitJob(&ctx, argc, argv);
+#endif
+	return runBackup(&ctx);
+}
+
+
+/**
+ * Parses the command-line arguments into a new backup context.
+ *
+ * @param[out] ctx - backup processing context
+ * @param[in] argc - number of arguments
+ * @param[in] argv - arguments (referenced by the context)
+ * @return -1 to continue with the backup, else the process exit code
+ */
+int parseOptions(tContext * ctx, int argc, TCHAR ** argv) {
+	int res;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->progressFd = -1;
+	struct option longOptions[] = {
+		{_T("append-verify"), no_argument,     NULL,         GETOPT_APPEND_VERIFY},
+		{_T("checkpoint"), no_argument,      NULL,           GETOPT_CHECKPOINT},
+		{_T("connect"),   required_argument, NULL,           GETOPT_CONNECT},
+		{_T("copy-dest"), required_argument, NULL,           GETOPT_COPY_DEST},
+		{_T("delete"),    no_argument,       NULL,           GETOPT_DELETE},
+		{_T("dir-cache"), no_argument,       NULL,           GETOPT_DIR_CACHE},
+		{_T("dirs-first"), no_argument,      NULL,           GETOPT_DIRS_FIRST},
+		{_T("jobs-file"), required_argument, NULL,           GETOPT_JOBS_FILE},
+		{_T("inplace"),   no_argument,       NULL,           GETOPT_INPLACE},
+		{_T("link-dest"), required_argument, NULL,           GETOPT_LINK_DEST},
+		{_T("manifest"),  no_argument,       NULL,           GETOPT_MANIFEST},
+		{_T("max-iops"),  required_argument, NULL,           GETOPT_MAX_IOPS},
+		{_T("partial"),   no_argument,       NULL,           GETOPT_PARTIAL},
+		{_T("prune"),     required_argument, NULL,           GETOPT_PRUNE},
+		{_T("queue-depth"), required_argument, NULL,         GETOPT_QUEUE_DEPTH},
+		{_T("reflink-delta"), no_argument,     NULL,         GETOPT_REFLINK_DELTA},
+		{_T("serve"),     required_argument, NULL,           GETOPT_SERVE},
+		{_T("tree-digest"), no_argument,     NULL,           GETOPT_TREE_DIGEST},
+		{_T("version"),   no_argument,       NULL,           GETOPT_VERSION},
+		{_T("watch"),     no_argument,       NULL,           GETOPT_WATCH},
+		{_T("workers"),   required_argument, NULL,           GETOPT_WORKERS},
+		{_T("devices"),   no_argument,       &ctx->devices,       0 },
+		{_T("specials"),  no_argument,       &ctx->specials,      0 },
+		{_T("archive"),   no_argument,       NULL,           _T('a')},
+		{_T(""),          no_argument,       NULL,           _T('D')},
+		{_T("group"),     no_argument,       NULL,           _T('g')},
+		{_T("hard-links"), no_argument,      NULL,           _T('H')},
+		{_T("help"),      no_argument,       NULL,           _T('h')},
+		{_T("links"),     no_argument,       &ctx->links,     _T('l')},
+		{_T("owner"),     no_argument,       &ctx->owner,     _T('o')},
+		{_T("perms"),     no_argument,       &ctx->perms,     _T('p')},
+		{_T("recursive"), no_argument,       &ctx->recursive, _T('r')},
+		{_T("times"),     no_argument,       &ctx->times,     _T('t')},
+		{_T("verbose"),   no_argument,       NULL,           _T('v')},
+		{NULL, 0, NULL, 0}
+	};
+
+	optind = 1; /* allows to parse multiple argument lists (e.g. jobs of --serve) */
 	for (;;) {
-		res = getopt_long(argc, argv, _T(":aDghloprtv"), longOptions, NULL);
+		res = getopt_long(argc, argv, _T(":aDgHhloprtv"), longOptions, NULL);
 
 		if (res == -1) break;
 		switch (res) {
+		case GETOPT_CONNECT:
+			ctx->connect = optarg;
+			break;
+		case GETOPT_DIR_CACHE:
+			ctx->dirCache = 1;
+			break;
+		case GETOPT_DELETE:
+			ctx->deleteExtra = 1;
+			break;
+		case GETOPT_DIRS_FIRST:
+			ctx->dirsFirst = 1;
+			break;
+		case GETOPT_JOBS_FILE:
+			ctx->jobsFile = optarg;
+			break;
+		case GETOPT_COPY_DEST:
 		case GETOPT_LINK_DEST:
-			ctx.linkDest = optarg;
+			if (ctx->linkDestCount > 0 && ctx->copyDest != (res == GETOPT_COPY_DEST)) {
+				_ftprintf(stderr, _T("Error: --copy-dest cannot be combined with --link-dest.\n"));
+				return EXIT_FAILURE;
+			}
+			ctx->copyDest = (res == GETOPT_COPY_DEST);
+			if (ctx->linkDestCount >= MAX_LINK_DESTS) {
+				_ftprintf(stderr, _T("Error: Too many reference directories (at most %u).\n"), (unsigned)MAX_LINK_DESTS);
+				return EXIT_FAILURE;
+			}
+			ctx->linkDests[ctx->linkDestCount++] = optarg;
+			ctx->linkDestMaxLen = PCF_MAX(ctx->linkDestMaxLen, _tcslen(optarg));
+			break;
+		case GETOPT_MANIFEST:
+			ctx->manifest = 1;
+			break;
+		case GETOPT_MAX_IOPS:
+			if (parseCount(optarg, MAX_IOPS, &ctx->maxIops) == 0 || ctx->maxIops == 0) {
+				_ftprintf(stderr, _T("Error: Invalid operation rate '%s'.\n"), optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case GETOPT_QUEUE_DEPTH:
+			if (parseCount(optarg, (size_t)UINT_MAX, &ctx->queueDepth) == 0 || ctx->queueDepth == 0) {
+				_ftprintf(stderr, _T("Error: Invalid queue depth '%s'.\n"), optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case GETOPT_APPEND_VERIFY:
+			ctx->appendVerify = 1;
+			break;
+		case GETOPT_CHECKPOINT:
+			ctx->checkpoint = 1;
+			break;
+		case GETOPT_INPLACE:
+			ctx->inplace = 1;
+			break;
+		case GETOPT_PARTIAL:
+			ctx->partial = 1;
+			break;
+		case GETOPT_PRUNE:
+			ctx->prune = optarg;
+			break;
+		case GETOPT_REFLINK_DELTA:
+			ctx->reflinkDelta = 1;
+			break;
+		case GETOPT_SERVE:
+			ctx->serve = optarg;
+			break;
+		case GETOPT_TREE_DIGEST:
+			ctx->treeDigest = 1;
+			break;
+		case GETOPT_WATCH:
+			ctx->watch = 1;
 			break;
 		case GETOPT_VERSION:
 			_putts(PROGRAM_VERSION);
-			res = EXIT_SUCCESS;
-			goto onError;
+			return EXIT_SUCCESS;
+		case GETOPT_WORKERS:
+			if (_tcscmp(optarg, _T("auto")) == 0) {
+				ctx->autoTune = 1;
+				ctx->workers = 1; /* start low and climb (works best for single disks) */
+			} else if (parseCount(optarg, WP_MAX_WORKERS, &ctx->workers) == 0 || ctx->workers == 0) {
+				_ftprintf(stderr, _T("Error: Invalid worker count '%s'.\n"), optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case _T('a'):
-			ctx.devices   = 1;
-			ctx.group     = 1;
-			ctx.links     = 1;
-			ctx.owner     = 1;
-			ctx.perms     = 1;
-			ctx.recursive = 1;
-			ctx.specials  = 1;
-			ctx.times     = 1;
+			ctx->devices   = 1;
+			ctx->group     = 1;
+			ctx->links     = 1;
+			ctx->owner     = 1;
+			ctx->perms     = 1;
+			ctx->recursive = 1;
+			ctx->specials  = 1;
+			ctx->times     = 1;
 			break;
 		case _T('D'):
-			ctx.devices  = 1;
-			ctx.specials = 1;
+			ctx->devices  = 1;
+			ctx->specials = 1;
 			break;
 		case _T('g'):
-			ctx.group = 1;
+			ctx->group = 1;
+			break;
+		case _T('H'):
+			ctx->hardLinks = 1;
 			break;
 		case 0:
 		case _T('l'):
@@ -115,16 +244,14 @@ int _tmain(int argc, TCHAR ** argv) {
 		case _T('t'):
 			break; /* already handled by flags */
 		case _T('v'):
-			ctx.verbose++;
+			ctx->verbose++;
 			break;
 		case _T('h'):
 			printHelp();
-			res = EXIT_SUCCESS;
-			goto onError;
+			return EXIT_SUCCESS;
 		case _T(':'):
 			_ftprintf(stderr, _T("Error: Option argument is missing for '%s'.\n"), argv[optind - 1]);
-			res = EXIT_FAILURE;
-			goto onError;
+			return EXIT_FAILURE;
 		case _T('?'):
 			if (_istprint(optopt) != 0) {
 				_ftprintf(stderr, _T("Error: Unknown or ambiguous option '-%c'.\n"), optopt);
@@ -133,214 +260,1522 @@ int _tmain(int argc, TCHAR ** argv) {
 			} else {
 				_ftprintf(stderr, _T("Error: Unknown option character '0x%02X'.\n"), (int)optopt);
 			}
-			res = EXIT_FAILURE;
-			goto onError;
+			return EXIT_FAILURE;
 		default:
 			abort();
 		}
 	}
 
-	res = EXIT_FAILURE; /* default on goto onError from here on */
+	if (ctx->reflinkDelta != 0 && ctx->linkDestCount == 0) {
+		_ftprintf(stderr, _T("Error: --reflink-delta requires --link-dest or --copy-dest.\n"));
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->maxIops != 0 && ctx->prune == NULL) {
+		_ftprintf(stderr, _T("Error: --max-iops requires --prune.\n"));
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->prune != NULL) {
+#ifdef UNICODE
+		_ftprintf(stderr, _T("Error: --prune is not supported on this platform.\n"));
+		return EXIT_FAILURE;
+#else
+		if (ctx->jobsFile != NULL || ctx->serve != NULL || ctx->connect != NULL || ctx->watch != 0) {
+			_ftprintf(stderr, _T("Error: --prune cannot be combined with --jobs-file, --serve, --connect or --watch.\n"));
+			return EXIT_FAILURE;
+		}
+		if (optind < argc) {
+			_ftprintf(stderr, _T("Error: --prune does not accept source or destination paths.\n"));
+			return EXIT_FAILURE;
+		}
+		{
+			/* like rm -rf: neither the root nor "." or ".." as last component */
+			size_t end = _tcslen(ctx->prune);
+			size_t start;
+			while (end > 0 && _tcschr(PATH_SEPS, ctx->prune[end - 1]) != NULL) end--;
+			for (start = end; start > 0 && _tcschr(PATH_SEPS, ctx->prune[start - 1]) == NULL; start--);
+			if (end == 0 || (ctx->prune[start] == _T('.') && (end - start == 1 || (end - start == 2 && ctx->prune[start + 1] == _T('.'))))) {
+				_ftprintf(stderr, _T("Error: Refusing to prune \"%s\".\n"), ctx->prune);
+				return EXIT_FAILURE;
+			}
+		}
+		if (containsWorkDir(ctx->prune) != 0) {
+			_ftprintf(stderr, _T("Error: Refusing to prune \"%s\" which contains the working directory.\n"), ctx->prune);
+			return EXIT_FAILURE;
+		}
+		return -1;
+#endif
+	}
+
+	if (ctx->jobsFile != NULL) {
+		if (ctx->serve != NULL || ctx->connect != NULL || ctx->watch != 0) {
+			_ftprintf(stderr, _T("Error: --jobs-file cannot be combined with --serve, --connect or --watch.\n"));
+			return EXIT_FAILURE;
+		}
+		if (optind < argc) {
+			_ftprintf(stderr, _T("Error: --jobs-file does not accept source or destination paths.\n"));
+			return EXIT_FAILURE;
+		}
+		return -1;
+	}
+
+	if (ctx->serve != NULL || ctx->connect != NULL) {
+#ifdef UNICODE
+		_ftprintf(stderr, _T("Error: Backup service is not supported on this platform.\n"));
+		return EXIT_FAILURE;
+#else
+		if (ctx->serve != NULL && ctx->connect != NULL) {
+			_ftprintf(stderr, _T("Error: --serve cannot be combined with --connect.\n"));
+			return EXIT_FAILURE;
+		}
+		if (ctx->connect != NULL && ctx->watch != 0) {
+			/* jobs of the service need to finish to serve the next one */
+			_ftprintf(stderr, _T("Error: --connect cannot be combined with --watch.\n"));
+			return EXIT_FAILURE;
+		}
+		if (ctx->serve != NULL) {
+			if (optind < argc) {
+				_ftprintf(stderr, _T("Error: --serve does not accept source or destination paths.\n"));
+				return EXIT_FAILURE;
+			}
+			return -1;
+		}
+#endif
+	}
 
 	if (optind >= argc) {
 		_ftprintf(stderr, _T("Error: Missing source and destination path.\n"));
-		goto onError;
+		return EXIT_FAILURE;
 	} else if ((optind + 1) >= argc) {
 		_ftprintf(stderr, _T("Error: Missing destination path.\n"));
-		goto onError;
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->watch != 0) {
+#ifdef UNICODE
+		_ftprintf(stderr, _T("Error: Watching for changes is not supported on this platform.\n"));
+		return EXIT_FAILURE;
+#else
+		if (ctx->treeDigest != 0) {
+			/* incremental updates would leave outdated tree digests behind */
+			_ftprintf(stderr, _T("Error: --watch cannot be combined with --tree-digest.\n"));
+			return EXIT_FAILURE;
+		}
+#endif
+	}
+
+	ctx->srcArgs = argv + optind;
+	ctx->srcCount = argc - optind - 1;
+	ctx->dstArg = argv[argc - 1];
+
+	if (ctx->deleteExtra != 0) {
+#ifdef UNICODE
+		_ftprintf(stderr, _T("Error: --delete is not supported on this platform.\n"));
+		return EXIT_FAILURE;
+#else
+		int i;
+		for (i = 0; ctx->srcCount > 1 && i < ctx->srcCount; i++) {
+			const size_t len = _tcslen(ctx->srcArgs[i]);
+			if (len > 0 && _tcschr(PATH_SEPS, ctx->srcArgs[i][len - 1]) != NULL) {
+				/* the contents would be merged into the destination root and delete each other */
+				_ftprintf(stderr, _T("Error: --delete requires a single source if its contents are copied (trailing separator).\n"));
+				return EXIT_FAILURE;
+			}
+		}
+#endif
 	}
+	return -1;
+}
+
+
+/**
+ * Runs the backup described by the given context. A work pool given by the context is
+ * shared and kept, else a new one is created for this backup.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return process exit code
+ */
+int runBackup(tContext * ctx) {
+	int res = EXIT_FAILURE; /* default on goto onError */
+	const int ownPool = (ctx->pool == NULL) ? 1 : 0;
+	TCHAR * buffer = NULL;
+	int i;
 
 	/* prepare options */
-	ctx.srcArgs = argv + optind;
-	ctx.srcCount = argc - optind - 1;
-	ctx.dstArg = argv[argc - 1];
-	buffer = (TCHAR *)malloc(sizeof(TCHAR) * (BUFFER_SIZE * 2));
+	buffer = (TCHAR *)malloc(sizeof(TCHAR) * (BUFFER_SIZE * 4));
 	if (buffer == NULL) {
-		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * (BUFFER_SIZE * 2)));
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * (BUFFER_SIZE * 4)));
 		goto onError;
 	}
-	ctx.dst = buffer;
-	ctx.ref = buffer + BUFFER_SIZE;
-	ctx.attrMask = (tAttrMask)(
-		  ((ctx.group != 0) ? AT_GROUP : AT_NONE)
-		| ((ctx.owner != 0) ? AT_OWNER : AT_NONE)
-		| ((ctx.perms != 0) ? AT_PERMS : AT_NONE)
-		| ((ctx.times != 0) ? AT_TIMES : AT_NONE)
+	ctx->dst = buffer;
+	ctx->ref = buffer + BUFFER_SIZE;
+	ctx->dir = buffer + (BUFFER_SIZE * 2);
+	ctx->knownDir = buffer + (BUFFER_SIZE * 3);
+	ctx->knownDirLen = 0;
+	ctx->attrMask = (tAttrMask)(
+		  ((ctx->group != 0) ? AT_GROUP : AT_NONE)
+		| ((ctx->owner != 0) ? AT_OWNER : AT_NONE)
+		| ((ctx->perms != 0) ? AT_PERMS : AT_NONE)
+		| ((ctx->times != 0) ? AT_TIMES : AT_NONE)
 	);
-	ctx.copyMask = (tCopyMask)(
-		  ((ctx.devices  != 0) ? CP_DEVICES  : CP_NONE)
-		| ((ctx.links    != 0) ? CP_LINKS    : CP_NONE)
-		| ((ctx.specials != 0) ? CP_SPECIALS : CP_NONE)
+	ctx->copyMask = (tCopyMask)(
+		  ((ctx->devices  != 0) ? CP_DEVICES  : CP_NONE)
+		| ((ctx->links    != 0) ? CP_LINKS    : CP_NONE)
+		| ((ctx->specials != 0) ? CP_SPECIALS : CP_NONE)
 	);
 	/* be verbose by default */
-	ctx.verbose++;
+	ctx->verbose++;
+	if (ownPool != 0) {
+		ctx->pool = wp_create(ctx->workers, ctx->queueDepth, ctx->autoTune, backupFile, backupFileDone, ctx);
+		if (ctx->pool == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+			goto onError;
+		}
+	}
 
 	/* single file destination check */
 	{
-		const size_t argLen = _tcslen(ctx.dstArg);
-		const int hasTrailingSep = (argLen > 0 && _tcschr(PATH_SEPS, ctx.dstArg[argLen - 1]) != NULL);
-		if (ctx.srcCount == 1 && hasTrailingSep == 0 && isDirectory(ctx.dstArg) == 0 && (isSymlink(ctx.srcArgs[0]) != 0 || isFile(ctx.srcArgs[0]) != 0)) {
-			ctx.dstIsFile = 1;
+		const size_t argLen = _tcslen(ctx->dstArg);
+		const int hasTrailingSep = (argLen > 0 && _tcschr(PATH_SEPS, ctx->dstArg[argLen - 1]) != NULL);
+		if (ctx->srcCount == 1 && hasTrailingSep == 0 && isDirectory(ctx->dstArg) == 0 && (isSymlink(ctx->srcArgs[0]) != 0 || isFile(ctx->srcArgs[0]) != 0)) {
+			ctx->dstIsFile = 1;
 		}
 	}
 
-	/* install signal handlers */
-	signalReceived = 0;
-	signal(SIGINT, handleSignal);
-	signal(SIGTERM, handleSignal);
-
-	if (ctx.dstIsFile != 0) {
+	if (ctx->dstIsFile != 0) {
 		/* create parent directory of the destination file */
-		const TCHAR * sep = _tcsrpbrk(ctx.dstArg, PATH_SEPS);
-		if (sep != NULL && sep != ctx.dstArg) {
-			const size_t parentLen = (size_t)(sep - ctx.dstArg);
+		const TCHAR * sep = _tcsrpbrk(ctx->dstArg, PATH_SEPS);
+		if (sep != NULL && sep != ctx->dstArg) {
+			const size_t parentLen = (size_t)(sep - ctx->dstArg);
 			if (parentLen < BUFFER_SIZE) {
-				memcpy(ctx.dst, ctx.dstArg, sizeof(TCHAR) * parentLen);
-				ctx.dst[parentLen] = 0;
-				if (createDirectory(ctx.dst, ctx.verbose) == 0) goto onError;
+				memcpy(ctx->dst, ctx->dstArg, sizeof(TCHAR) * parentLen);
+				ctx->dst[parentLen] = 0;
+				if (createDirectory(ctx->dst, 0, ctx->verbose) == 0) goto onError;
 			}
 		}
 	} else {
-		if (createDirectory(ctx.dstArg, ctx.verbose) == 0) goto onError;
-	}
-	for (ctx.srcIndex = 0; signalReceived == 0 && ctx.srcIndex < ctx.srcCount; ctx.srcIndex++) {
-		TCHAR * src = ctx.srcArgs[ctx.srcIndex];
-		if (isSymlink(src) != 0 || isFile(src) != 0) {
-			/* file / symbolic link copied as a link (or skipped) and never followed */
-			/* separator after a link resolves to the target (handled below)  */
-			if (backupVisitor(src, NULL, NULL, 0, 0, &ctx) == 0) goto onError; /* signal */
-			if (ctx.verbose > 1) _ftprintf(stderr, _T("Finished backing up \"%s\".\n"), src);
-		} else if (isDirectory(src) != 0) {
-			if (destWithinSource(src, ctx.dstArg) != 0) {
-				/* endless recursion case */
-				_ftprintf(stderr, _T("Error: Cannot back up directory \"%s\" into itself \"%s\".\n"), src, ctx.dstArg);
-				ctx.hadError = 1;
-				continue;
+		if (createDestDirectory(ctx, ctx->dstArg) == 0) goto onError;
+		if (ctx->manifest != 0) {
+			/* fall back to query the file system if a manifest cannot be used */
+			ctx->dstManifest = mf_open(ctx->dstArg, MANIFEST_NAME, 1);
+			if (ctx->dstManifest == NULL && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to open the manifest of \"%s\".\n"), ctx->dstArg);
 			}
-			/* needed to create output folder (errors are flagged inside, not fatal) */
-			ctx.rootModified = 0;
-			backupVisitor(src, NULL, NULL, 1, 0, &ctx);
-			/* process directory tree */
-			const int visited = td_traverse(src, (ctx.recursive == 0) ? 0 : -1, TDO_DIRECTORY | TDO_ITEM | TDO_ERRORS, backupVisitor, &ctx);
-			ds_consume(&ctx.dirStack, 0, dirStackFinalize, &ctx);
-			if (visited != 1 && visited != -1) goto onError; /* visitor aborted (signal) */
-			if (visited == -1) {
-				/* partial backup due to errors -> keep going */
-				ctx.hadError = 1;
-			}
-			/* correct the root directory timestamp if any top-level child was written */
-			if (ctx.rootModified != 0 && (ctx.attrMask & AT_TIMES) != 0 && signalReceived == 0) {
-				backupVisitor(src, NULL, NULL, 1, 0, &ctx);
-			}
-			if (ctx.verbose > 1) _ftprintf(stderr, _T("Finished backing up \"%s\".\n"), src);
-		} else {
-			_ftprintf(stderr, _T("Error: Could not find source \"%s\".\n"), src);
-			ctx.hadError = 1;
+			for (i = 0; i < ctx->linkDestCount; i++) {
+				ctx->refManifests[i] = openCachedManifest(ctx, ctx->linkDests[i], MANIFEST_NAME);
+				if (ctx->refManifests[i] == NULL && ctx->verbose > 0) {
+					_ftprintf(stderr, _T("Warning: Failed to open the manifest of \"%s\".\n"), ctx->linkDests[i]);
+				}
+			}
+		}
+#ifndef UNICODE
+		/* references without manifest are joined with the source listing of each directory */
+		for (i = 0; i < ctx->linkDestCount; i++) {
+			if (ctx->refManifests[i] == NULL) ctx->joinRefs = 1;
+		}
+#endif
+		if (ctx->dirCache != 0) {
+#ifdef UNICODE
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Directory listing cache is not supported on this platform.\n"));
+#else
+			ctx->dirCacheMf = mf_open(ctx->dstArg, DIRCACHE_NAME, 1);
+			if (ctx->dirCacheMf == NULL && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to open the directory listing cache of \"%s\".\n"), ctx->dstArg);
+			}
+#endif
+		}
+		if (ctx->checkpoint != 0 && openCheckpoint(ctx) == 0) {
+			_ftprintf(stderr, _T("Error: Failed to open the checkpoint journal of \"%s\".\n"), ctx->dstArg);
+			goto onError;
 		}
+		if (ctx->treeDigest != 0) {
+			ctx->dstDigestMf = mf_open(ctx->dstArg, DIGEST_NAME, 1);
+			if (ctx->dstDigestMf == NULL && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to open the tree digests of \"%s\".\n"), ctx->dstArg);
+			}
+			for (i = 0; i < ctx->linkDestCount; i++) {
+				ctx->refDigestMfs[i] = openCachedManifest(ctx, ctx->linkDests[i], DIGEST_NAME);
+				if (ctx->refDigestMfs[i] == NULL && ctx->verbose > 0) {
+					_ftprintf(stderr, _T("Warning: Failed to open the tree digests of \"%s\".\n"), ctx->linkDests[i]);
+				}
+			}
+		}
+	}
+#ifndef UNICODE
+	if (ctx->watch != 0) {
+		/* watch before the initial backup to not miss changes during it */
+		ctx->watcher = wt_create();
+		if (ctx->watcher == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to create the file system watcher.\n"));
+			goto onError;
+		}
+		for (ctx->srcIndex = 0; ctx->srcIndex < ctx->srcCount; ctx->srcIndex++) {
+			if (wt_add(ctx->watcher, ctx->srcArgs[ctx->srcIndex], (size_t)ctx->srcIndex) == 0 && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to watch \"%s\" for changes.\n"), ctx->srcArgs[ctx->srcIndex]);
+			}
+		}
+		if (ctx->verbose > 1) _tprintf(_T("Watching for changes via %s.\n"), wt_backend(ctx->watcher));
+	}
+#endif
+	for (ctx->srcIndex = 0; signalReceived == 0 && ctx->srcIndex < ctx->srcCount; ctx->srcIndex++) {
+		if (backupSource(ctx) == 0) break; /* signal -> report it below */
+	}
+	/* changes while watching are not covered by the checkpoint journal */
+	drainOperations(ctx);
+	closeCheckpoint(ctx, (signalReceived == 0) ? 1 : 0);
+#ifndef UNICODE
+	if (ctx->watch != 0 && signalReceived == 0) {
+		drainOperations(ctx);
+		if (watchSources(ctx) == 0) goto onError;
+	}
+#endif
+
+	drainOperations(ctx);
+	if (ctx->verbose > 1) {
+		_tprintf(_T("Attribute updates: %lu applied, %lu skipped\n"), (unsigned long)ctx->attrApplied, (unsigned long)ctx->attrSkipped);
+	}
+	if (ownPool != 0 && ctx->autoTune != 0 && ctx->verbose > 0) {
+		size_t workers, depth;
+		wp_settings(ctx->pool, &workers, &depth);
+		_tprintf(_T("Tuned concurrency: --workers=%u --queue-depth=%u\n"), (unsigned)workers, (unsigned)depth);
 	}
 
-	res = (signalReceived != 0) ? EXIT_SIGNAL : ((ctx.hadError != 0) ? EXIT_PARTIAL : EXIT_SUCCESS);
+	res = (signalReceived != 0) ? EXIT_SIGNAL : ((ctx->hadError != 0) ? EXIT_PARTIAL : EXIT_SUCCESS);
 onError:
+	/* completes outstanding operations -> close manifests afterwards */
+	drainOperations(ctx);
+	wp_destroy(ctx->prunePool);
+	ctx->prunePool = NULL;
+	if (ownPool != 0) {
+		wp_destroy(ctx->pool);
+		ctx->pool = NULL;
+	}
+	if (mf_close(ctx->dstManifest) == 0 && ctx->verbose > 0) {
+		_ftprintf(stderr, _T("Warning: Failed to update the manifest of \"%s\".\n"), ctx->dstArg);
+	}
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		closeCachedManifest(ctx, ctx->refManifests[i]);
+		closeCachedManifest(ctx, ctx->refDigestMfs[i]);
+		ctx->refManifests[i] = NULL;
+		ctx->refDigestMfs[i] = NULL;
+	}
+	if (mf_close(ctx->dirCacheMf) == 0 && ctx->verbose > 0) {
+		_ftprintf(stderr, _T("Warning: Failed to update the directory listing cache of \"%s\".\n"), ctx->dstArg);
+	}
+	/* digests of an incomplete backup could match by accident -> drop them */
+	if (res != EXIT_SUCCESS) mf_invalidate(ctx->dstDigestMf);
+	if (mf_close(ctx->dstDigestMf) == 0 && ctx->verbose > 0 && res == EXIT_SUCCESS) {
+		_ftprintf(stderr, _T("Warning: Failed to update the tree digests of \"%s\".\n"), ctx->dstArg);
+	}
+	ctx->dstManifest = NULL;
+	ctx->dirCacheMf = NULL;
+	ctx->dstDigestMf = NULL;
+	clearTreeDigests(ctx);
+	wt_destroy(ctx->watcher);
+	ctx->watcher = NULL;
+	clearJournal(ctx);
+	closeCheckpoint(ctx, 0);
 	if (buffer != NULL) free(buffer);
-	ds_clear(&ctx.dirStack);
+	if (ctx->refMasks != NULL) free(ctx->refMasks);
+	ctx->refMasks = NULL;
+	ctx->refMaskCapacity = 0;
+	clearHardLinks(ctx);
+	clearListings(ctx);
+	if (ctx->skeleton != NULL) free(ctx->skeleton);
+	ctx->skeleton = NULL;
+	ctx->skeletonLen = 0;
+	ctx->skeletonCapacity = 0;
+	ds_clear(&ctx->dirStack);
 	return res;
 }
 
 
+#ifndef UNICODE
 /**
- * Write the help for this application to standard out.
+ * Removes the snapshot given by `ctx->prune`. Each directory is emptied by a worker which
+ * reports its sub directories. These are submitted in turn and their parent is removed
+ * once all of them were removed. A snapshot which is not a directory is simply removed.
+ *
+ * @param[in,out] ctx - prune context
+ * @return process exit code
  */
-void printHelp() {
-	_tprintf(
-	_T("lsync [options] [<source> ...] <destination>\n")
-	_T("\n")
-	_T("This is free and unencumbered software released into the public domain.\n")
-	_T("\n")
-	_T("-a, --archive\n")
-	_T("      Archive mode (same as -rlptgoD).\n")
-	_T("    --devices\n")
-	_T("      Preserves device files.\n")
-	_T("-D\n")
-	_T("      Same as --devices --specials.\n")
-	_T("-g, --group\n")
-	_T("      Preserves group.\n")
-	_T("-h, --help\n")
-	_T("      Print short usage instruction.\n")
-	_T("    --link-dest <reference>\n")
-	_T("      Hardlink to files from reference in destination if unchanged.\n")
-	_T("-l, --links\n")
-	_T("      Copy symlinks as symlinks.\n")
-	_T("-o, --owner\n")
-	_T("      Preserves owner.\n")
-	_T("-p  --perms\n")
-	_T("      Preserves permissions.\n")
-	_T("-r, --recursive\n")
-	_T("      Traverses given directories recursive.\n")
-	_T("    --specials\n")
-	_T("      Preserves special files.\n")
-	_T("-t, --times\n")
-	_T("      Preserves modification times.\n")
-	_T("-v\n")
-	_T("      Increases verbosity.\n")
-	_T("    --version\n")
-	_T("      Outputs the program version.\n")
-	_T("\n")
-	_T("lsync %s\n")
-	_T("https://github.com/daniel-starke/lsync\n")
-	, PROGRAM_VERSION);
+int runPrune(tContext * ctx) {
+	int res = EXIT_FAILURE; /* default on goto onError */
+	/* be verbose by default */
+	ctx->verbose++;
+	if (isSymlink(ctx->prune) != 0 || isDirectory(ctx->prune) == 0) {
+		if (removePath(ctx->prune, ctx->verbose) == 0) {
+			_ftprintf(stderr, _T("Error: Failed to remove \"%s\".\n"), ctx->prune);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+	if (ctx->workers == 0 && ctx->autoTune == 0) ctx->workers = PRUNE_WORKERS;
+	ctx->pool = wp_create(ctx->workers, ctx->queueDepth, ctx->autoTune, pruneDirectory, pruneDirectoryDone, ctx);
+	if (ctx->pool == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+		goto onError;
+	}
+	wp_limit(ctx->pool, ctx->maxIops);
+	ctx->pruneMaxOpen = pruneOpenLimit();
+	ctx->pruneQueue = newPruneDir(ctx, NULL, ctx->prune);
+	if (ctx->pruneQueue == NULL) goto onError;
+	drainPruneDirs(ctx, ctx->pool);
+	if (ctx->verbose > 1) {
+		_tprintf(_T("Removed %lu files and %lu directories.\n"), (unsigned long)ctx->prunedFiles, (unsigned long)ctx->prunedDirs);
+	}
+	if (ctx->autoTune != 0 && ctx->verbose > 0) {
+		size_t workers, depth;
+		wp_settings(ctx->pool, &workers, &depth);
+		_tprintf(_T("Tuned concurrency: --workers=%u --queue-depth=%u\n"), (unsigned)workers, (unsigned)depth);
+	}
+	res = (signalReceived != 0) ? EXIT_SIGNAL : ((ctx->hadError != 0) ? EXIT_PARTIAL : EXIT_SUCCESS);
+onError:
+	wp_destroy(ctx->pool);
+	ctx->pool = NULL;
+	return res;
 }
 
 
 /**
- * Handles external signals.
- * 
- * @param[in] signum - received signal number
+ * Creates a new directory removal job for --prune. Sub directories are referenced by name
+ * and opened relative to their opened parent directory.
+ *
+ * @param[in,out] ctx - prune context
+ * @param[in,out] parent - job of the parent directory (NULL for the snapshot root)
+ * @param[in] name - directory name within parent or snapshot path for the root
+ * @return new job or NULL on error
  */
-void handleSignal(int signum) {
-	PCF_UNUSED(signum)
-	signalReceived = 1;
-	/* signal handlers may only call async-signal-safe functions -> avoid non-reentrant stdio */
-	static const char msg[] = "Received signal. Finishing current operation.\n";
-#if defined(PCF_IS_WIN)
-	DWORD written;
-	WriteFile(GetStdHandle(STD_ERROR_HANDLE), msg, (DWORD)(sizeof(msg) - 1), &written, NULL);
-#else
-	write(STDERR_FILENO, msg, sizeof(msg) - 1);
-#endif
+tPruneDir * newPruneDir(tContext * ctx, tPruneDir * parent, const TCHAR * name) {
+	const size_t len = _tcslen(name) + 1;
+	const size_t size = sizeof(tPruneDir) + (sizeof(TCHAR) * len);
+	tPruneDir * dir = (tPruneDir *)malloc(size);
+	if (dir == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)size);
+		return NULL;
+	}
+	memset(dir, 0, sizeof(*dir));
+	dir->ctx = ctx;
+	dir->parent = parent;
+	dir->fd = -1;
+	dir->name = (TCHAR *)(dir + 1);
+	memcpy(dir->name, name, sizeof(TCHAR) * len);
+	return dir;
 }
 
 
 /**
- * Joins "base/item" or, if rel is not NULL, "base/item/rel" into the given buffer.
+ * Completes the given directory removal job of --prune whose sub directories were all
+ * completed. Its directory is closed as no sub directory needs it anymore. An emptied
+ * directory is queued for its own removal. Otherwise, the job is freed and the parent
+ * completed if this was its last sub directory. A removed destination directory of
+ * --delete is reported via finishDirRemoval().
  *
- * @param[out] buf - destination buffer
- * @param[in] len - destination buffer length in characters
- * @param[in] base - leading path part
- * @param[in] item - path element appended to base
- * @param[in] rel - trailing path part appended after item, or NULL to omit
- * @return 1 on success, 0 on truncation
+ * @param[in,out] ctx - prune context
+ * @param[in,out] dir - directory removal job
  */
-int joinPath(TCHAR * buf, const size_t len, const TCHAR * base, const TCHAR * item, const TCHAR * rel) {
-	const int n = (rel == NULL)
-		? _sntprintf(buf, len, _T("%s") _T2(PCF_PATH_SEP) _T("%s"), base, item)
-		: _sntprintf(buf, len, _T("%s") _T2(PCF_PATH_SEP) _T("%s") _T2(PCF_PATH_SEP) _T("%s"), base, item, rel);
-	buf[len - 1] = 0;
-	return (n >= 0 && (size_t)n < len) ? 1 : 0;
+void finishPruneDir(tContext * ctx, tPruneDir * dir) {
+	tPruneDir * parent;
+	for (; dir != NULL; dir = parent) {
+		parent = dir->parent;
+		if (dir->fd >= 0) {
+			closeDirectory(dir);
+			ctx->pruneOpen--;
+		}
+		if (dir->removed == 0 && dir->failed == 0 && signalReceived == 0) {
+			dir->next = ctx->pruneQueue;
+			ctx->pruneQueue = dir;
+			return;
+		}
+		if (dir->removed != 0) {
+			ctx->prunedDirs++;
+		} else {
+			/* the parent cannot be removed either */
+			if (dir->failed != 0) ctx->hadError = 1;
+			if (parent != NULL) parent->failed = 1;
+		}
+		if (parent == NULL && ctx->prune == NULL) finishDirRemoval(ctx, dir);
+		free(dir);
+		if (parent == NULL) return;
+		parent->children--;
+		if (parent->children > 0) return;
+	}
 }
 
 
 /**
- * Tests whether the destination is at or below the source directory. Such an overlap would
- * make the backup copy the source into its own subtree and recurse infinitely.
+ * Executes the given directory removal job of --prune. The directory is emptied first.
+ * It is removed right away if it had no sub directories, else after these were removed.
+ * This is called from a worker thread.
  *
- * @param[in] src - source directory
- * @param[in] dst - destination directory
- * @return 1 if dst is src or within it, 0 otherwise or on error
+ * @param[in,out] item - directory removal job
+ * @param[in,out] param - prune context
  */
-int destWithinSource(const TCHAR * src, const TCHAR * dst) {
-	TCHAR * realSrc = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE * 2);
-	int res = 0;
-	if (realSrc == NULL) return 0;
+void pruneDirectory(tWorkItem * item, void * param) {
+	tPruneDir * dir = (tPruneDir *)item;
+	const tContext * ctx = (const tContext *)param;
+	if (dir->emptied == 0) {
+		dir->emptied = 1;
+		if (emptyDirectory(dir, ctx->verbose) == 0) dir->failed = 1;
+		/* only the sub directories need the directory to stay open */
+		if (dir->subDirs == NULL) closeDirectory(dir);
+		/* remove as much as possible even if some entries failed */
+		if (dir->subDirs != NULL || dir->failed != 0) return;
+	}
+	wp_pace(item);
+	if (removeDirectory(dir, ctx->verbose) == 0) {
+		dir->failed = 1;
+		return;
+	}
+	dir->removed = 1;
+}
+
+
+/**
+ * Completes the given directory removal job of --prune. Found sub directories are queued
+ * for submission. This is called from the thread which submits the jobs.
+ *
+ * @param[in,out] item - directory removal job
+ * @param[in,out] param - prune context
+ */
+void pruneDirectoryDone(tWorkItem * item, void * param) {
+	tContext * ctx = (tContext *)param;
+	tPruneDir * dir = (tPruneDir *)item;
+	tPruneDir * subDir;
+	ctx->pruneActive--;
+	ctx->prunedFiles += dir->files;
+	dir->files = 0;
+	if (dir->fd >= 0) ctx->pruneOpen++;
+	while ((subDir = dir->subDirs) != NULL) {
+		dir->subDirs = subDir->next;
+		subDir->next = ctx->pruneQueue;
+		ctx->pruneQueue = subDir;
+		dir->children++;
+	}
+	if (dir->children == 0) finishPruneDir(ctx, dir);
+}
+
+
+/**
+ * Returns the number of directories the removal workers may keep open at once. This is
+ * the raised file descriptor limit minus PRUNE_FD_RESERVE.
+ *
+ * @return maximum number of open directories
+ */
+size_t pruneOpenLimit(void) {
+	const size_t limit = raiseFileLimit();
+	return (limit > (2 * PRUNE_FD_RESERVE)) ? (limit - PRUNE_FD_RESERVE) : (limit / 2);
+}
+
+
+/**
+ * Submits the queued directory removal jobs to the given work pool handle. Each worker
+ * may open two descriptors. Submission pauses if this would exceed `ctx->pruneMaxOpen`.
+ * The queue is LIFO, so the deepest directories complete first and release theirs.
+ *
+ * @param[in,out] ctx - prune or backup processing context
+ * @param[in,out] pool - work pool handle with the callbacks of --prune
+ */
+void submitPruneDirs(tContext * ctx, tWorkPool * pool) {
+	tPruneDir * dir;
+	/* completions may queue further directories meanwhile */
+	while ((dir = ctx->pruneQueue) != NULL && (ctx->pruneActive == 0 || (ctx->pruneOpen + (2 * ctx->pruneActive)) < ctx->pruneMaxOpen)) {
+		ctx->pruneQueue = dir->next;
+		if (signalReceived != 0) {
+			finishPruneDir(ctx, dir);
+			continue;
+		}
+		ctx->pruneActive++;
+		wp_submit(pool, &(dir->item));
+	}
+}
+
+
+/**
+ * Submits and completes directory removal jobs until none are left.
+ *
+ * @param[in,out] ctx - prune or backup processing context
+ * @param[in,out] pool - work pool handle with the callbacks of --prune
+ */
+void drainPruneDirs(tContext * ctx, tWorkPool * pool) {
+	for (;;) {
+		submitPruneDirs(ctx, pool);
+		if (ctx->pruneActive == 0 && ctx->pruneQueue == NULL) break;
+		wp_reap(pool, 1);
+	}
+}
+
+
+/**
+ * Hands the destination directory of the given removal job of --delete to the removal
+ * workers of --prune. These share the work pool of the backup via `ctx->prunePool`. The
+ * directory stack frame of the job stays pending until finishDirRemoval() was called.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] job - completed removal job with the destination directory
+ * @return 1 on success, 0 on error
+ */
+int queueDirRemoval(tContext * ctx, const tBackupJob * job) {
+	tPruneDir * dir;
+	if (ctx->prunePool == NULL) {
+		ctx->prunePool = wp_share(ctx->pool, pruneDirectory, pruneDirectoryDone, ctx);
+		if (ctx->prunePool == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+			ctx->hadError = 1;
+			return 0;
+		}
+		ctx->pruneMaxOpen = pruneOpenLimit();
+	}
+	dir = newPruneDir(ctx, NULL, job->dst);
+	if (dir == NULL) {
+		ctx->hadError = 1;
+		return 0;
+	}
+	dir->depth = job->depth;
+	dir->next = ctx->pruneQueue;
+	ctx->pruneQueue = dir;
+	submitPruneDirs(ctx, ctx->prunePool);
+	return 1;
+}
+
+
+/**
+ * Completes the removal of a destination directory of --delete like backupFileDone() does
+ * for other destination entries.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] dir - completed directory removal job of the removed destination directory
+ */
+void finishDirRemoval(tContext * ctx, const tPruneDir * dir) {
+	if (dir->removed != 0) {
+		ctx->writeCount++;
+		if (ctx->verbose > 1) _tprintf(_T("Deleted \"%s\".\n"), dir->name);
+	}
+	if (dir->depth > 0) {
+		tDirStackFrame * frame = ctx->dirStack.frames + dir->depth - 1;
+		frame->pending--;
+		if (dir->removed != 0) frame->modified = 1;
+	} else if (dir->removed != 0) {
+		ctx->rootModified = 1;
+	}
+}
+
+
+/**
+ * Accepts backup jobs on the socket given by `ctx->serve` and runs them one after another
+ * until a signal is received. The work pool and the reference manifests are kept between
+ * the jobs. Reference listings and file status without manifest are not cached. The working directory of the service is restored after each job.
+ *
+ * @param[in,out] ctx - service context
+ * @return process exit code
+ */
+int serveJobs(tContext * ctx) {
+	int res = EXIT_FAILURE;
+	int fd = -1;
+	int cwd = -1;
+	tManifestCache * cache = NULL;
+	TCHAR * path = NULL;
+	/* be verbose by default */
+	ctx->verbose++;
+	/* jobs change the working directory -> refer to the socket by its absolute path */
+	path = (TCHAR *)malloc(sizeof(TCHAR) * PATH_MAX);
+	if (path == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * PATH_MAX));
+		goto onError;
+	}
+	if (absolutePath(ctx->serve, path, PATH_MAX) == 0) {
+		_ftprintf(stderr, _T("Error: Failed to resolve the socket path \"%s\".\n"), ctx->serve);
+		goto onError;
+	}
+	cwd = open(".", O_RDONLY | O_DIRECTORY);
+	if (cwd < 0) {
+		_ftprintf(stderr, _T("Error: Failed to open the current working directory.\n"));
+		goto onError;
+	}
+	cache = (tManifestCache *)calloc(1, sizeof(tManifestCache));
+	if (cache == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)sizeof(tManifestCache));
+		goto onError;
+	}
+	ctx->mfCache = cache;
+	ctx->pool = wp_create(ctx->workers, ctx->queueDepth, ctx->autoTune, backupFile, backupFileDone, ctx);
+	if (ctx->pool == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+		goto onError;
+	}
+	fd = listenSocket(path);
+	if (fd < 0) goto onError;
+	if (ctx->verbose > 1) _tprintf(_T("Waiting for backup jobs on \"%s\".\n"), path);
+	while (signalReceived == 0) {
+		const int client = acceptSocket(fd, 1000);
+		if (client == -2) goto onError;
+		if (client < 0) continue; /* timeout or signal */
+		serveJob(ctx, client);
+		close(client);
+		if (fchdir(cwd) != 0) {
+			_ftprintf(stderr, _T("Error: Failed to restore the working directory of the service.\n"));
+			goto onError;
+		}
+	}
+	res = EXIT_SUCCESS;
+onError:
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+	if (cwd >= 0) close(cwd);
+	if (path != NULL) free(path);
+	wp_destroy(ctx->pool);
+	ctx->pool = NULL;
+	clearManifestCache(cache);
+	free(cache);
+	ctx->mfCache = NULL;
+	return res;
+}
+
+
+/**
+ * Runs a single backup job received from the given socket. The request consists of the
+ * decimal number of following strings, the working directory and the command-line arguments
+ * of the job, each terminated by a null character. Empty arguments are thus passed as they
+ * are. The job reports
+ * "progress <visited> <written>" lines while running and ends with "exit <code>".
+ *
+ * @param[in,out] ctx - service context
+ * @param[in] fd - connected socket
+ * @return 1 if the job was run, 0 on error
+ */
+int serveJob(tContext * ctx, const int fd) {
+	char * request = NULL;
+	TCHAR ** args = NULL;
+	TCHAR line[64];
+	size_t len = 0;
+	size_t strings = 0, expected = 0;
+	int argc = 0;
+	int i, res = EXIT_FAILURE;
+	tContext job;
+	/* jobs run with the privileges of the service -> only accept them from its own user */
+	if (isSocketPeerOwner(fd) == 0) {
+		_ftprintf(stderr, _T("Error: Rejected a backup job of another user.\n"));
+		goto onError;
+	}
+	request = (char *)malloc(SERVE_MAX_REQUEST);
+	if (request == NULL) goto onError;
+	/* read until the announced number of strings arrived */
+	while (expected == 0 || strings < expected) {
+		const ssize_t got = read(fd, request + len, SERVE_MAX_REQUEST - len);
+		size_t k;
+		if (got < 0 && errno == EINTR && signalReceived == 0) continue;
+		if (got <= 0 || (len + (size_t)got) >= SERVE_MAX_REQUEST) goto onInvalid;
+		for (k = len, len += (size_t)got; k < len; k++) {
+			if (request[k] == 0) strings++;
+		}
+		if (expected == 0 && strings > 0) {
+			char * end;
+			const unsigned long value = strtoul(request, &end, 10);
+			if (end == request || *end != 0 || value < 1 || value >= SERVE_MAX_REQUEST) goto onInvalid;
+			expected = (size_t)value + 1;
+		}
+		if (expected != 0 && strings > expected) goto onInvalid;
+	}
+	/* split into the working directory and arguments (argv[0] is the program name) */
+	argc = (int)(expected - 1);
+	args = (TCHAR **)malloc(sizeof(TCHAR *) * (size_t)(argc + 1));
+	if (args == NULL) goto onError;
+	len = _tcslen(request) + 1;
+	args[0] = request + len;
+	for (i = 1; i < argc; i++) {
+		len += _tcslen(request + len) + 1;
+		args[i] = request + len;
+	}
+	args[argc] = NULL;
+	if (chdir(args[0]) != 0) {
+		_ftprintf(stderr, _T("Error: Failed to change into the working directory \"%s\" of the job.\n"), args[0]);
+		goto onError;
+	}
+	res = parseOptions(&job, argc, args);
+	if (res >= 0) goto onError;
+	if (job.serve != NULL || job.watch != 0 || job.jobsFile != NULL || job.prune != NULL) {
+		_ftprintf(stderr, _T("Error: --serve, --watch, --jobs-file and --prune are not permitted within a backup job.\n"));
+		res = EXIT_FAILURE;
+		goto onError;
+	}
+	if (ctx->verbose > 1) _tprintf(_T("Running backup job to \"%s\".\n"), job.dstArg);
+	/* the work pool of the service is used -> concurrency options of the job are ignored */
+	job.pool = ctx->pool;
+	job.mfCache = ctx->mfCache;
+	job.progressFd = fd;
+	res = runBackup(&job);
+	reportProgress(&job);
+	if (ctx->verbose > 1) _tprintf(_T("Finished backup job to \"%s\" with exit code %i.\n"), job.dstArg, res);
+	goto onError;
+onInvalid:
+	if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Received an invalid backup job request.\n"));
+onError:
+	_sntprintf(line, sizeof(line) / sizeof(*line), _T("exit %i\n"), res);
+	sendSocket(fd, line, _tcslen(line));
+	if (args != NULL) free(args);
+	if (request != NULL) free(request);
+	return (res != EXIT_FAILURE) ? 1 : 0;
+}
+
+
+/**
+ * Submits the backup job given by the command-line to the lsync service at `ctx->connect`
+ * and waits for its completion.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] argc - number of arguments
+ * @param[in] argv - arguments to forward
+ * @return exit code of the job
+ */
+int submitJob(tContext * ctx, int argc, TCHAR ** argv) {
+	char buf[256];
+	char cwd[PATH_MAX];
+	size_t len = 0;
+	int i, res = EXIT_FAILURE;
+	int fd;
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to get the current working directory.\n"));
+		return EXIT_FAILURE;
+	}
+	fd = connectSocket(ctx->connect);
+	if (fd < 0) return EXIT_FAILURE;
+	/* number of strings, the working directory takes the place of the program name */
+	_sntprintf(buf, sizeof(buf) / sizeof(*buf), _T("%i"), argc);
+	if (sendSocket(fd, buf, _tcslen(buf) + 1) == 0) goto onError;
+	if (sendSocket(fd, cwd, strlen(cwd) + 1) == 0) goto onError;
+	for (i = 1; i < argc; i++) {
+		if (sendSocket(fd, argv[i], _tcslen(argv[i]) + 1) == 0) goto onError;
+	}
+	/* process the reported lines */
+	for (;;) {
+		char * end;
+		const ssize_t got = read(fd, buf + len, sizeof(buf) - len - 1);
+		if (got < 0 && errno == EINTR) continue; /* the service handles the signal */
+		if (got <= 0) break;
+		len += (size_t)got;
+		buf[len] = 0;
+		while ((end = strchr(buf, '\n')) != NULL) {
+			unsigned long visited, written;
+			int code;
+			*end = 0;
+			if (sscanf(buf, "progress %lu %lu", &visited, &written) == 2) {
+				if (ctx->verbose > 0) _tprintf(_T("Visited %lu items, wrote %lu items.\n"), visited, written);
+			} else if (sscanf(buf, "exit %i", &code) == 1) {
+				res = code;
+			}
+			len -= (size_t)(end + 1 - buf);
+			memmove(buf, end + 1, len + 1);
+		}
+		if (len >= (sizeof(buf) - 1)) len = 0; /* drop overlong lines */
+	}
+onError:
+	close(fd);
+	return res;
+}
+
+
+/**
+ * Reports the job progress to `ctx->progressFd` at most once per second. A failed report
+ * disables further reports as the peer is gone.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void reportProgress(tContext * ctx) {
+	TCHAR line[64];
+	const time_t now = time(NULL);
+	if (ctx->progressFd < 0 || now == ctx->progressTime) return;
+	ctx->progressTime = now;
+	_sntprintf(line, sizeof(line) / sizeof(*line), _T("progress %lu %lu\n"), (unsigned long)ctx->itemCount, (unsigned long)ctx->writeCount);
+	if (sendSocket(ctx->progressFd, line, _tcslen(line)) == 0) ctx->progressFd = -1;
+}
+#endif /* not UNICODE */
+
+
+/**
+ * Splits the given line into white space separated arguments in place. Double quotes
+ * group an argument which contains white space.
+ *
+ * @param[in,out] line - line to split
+ * @param[out] args - receives the arguments (may be NULL to count only)
+ * @return number of arguments or -1 on unbalanced quotes
+ */
+int splitArguments(TCHAR * line, TCHAR ** args) {
+	const TCHAR * in = line;
+	TCHAR * out = line;
+	int count = 0;
+	for (;;) {
+		int quoted = 0;
+		while (*in == _T(' ') || *in == _T('\t') || *in == _T('\r') || *in == _T('\n')) in++;
+		if (*in == 0) break;
+		if (args != NULL) args[count] = out;
+		count++;
+		for (; *in != 0; in++) {
+			if (*in == _T('"')) {
+				quoted = !quoted;
+			} else if (quoted == 0 && (*in == _T(' ') || *in == _T('\t') || *in == _T('\r') || *in == _T('\n'))) {
+				break;
+			} else if (args != NULL) {
+				*out++ = *in;
+			}
+		}
+		if (quoted != 0) return -1;
+		if (args == NULL) continue;
+		if (*in != 0) in++;
+		*out++ = 0;
+	}
+	return count;
+}
+
+
+/**
+ * Normalizes the given path for comparison. The longest existing prefix is resolved by
+ * realPath() and the remaining components are appended with "." and ".." applied. This
+ * allows to compare paths which do not exist yet.
+ *
+ * @param[in] path - path to normalize
+ * @param[out] buf - receives the normalized path (BUFFER_SIZE characters)
+ * @return 1 on success, 0 on error
+ */
+int normalizePath(const TCHAR * path, TCHAR * buf) {
+	TCHAR * prefix;
+	const TCHAR * rest;
+	size_t len, end;
+	int res = 0;
+	len = _tcslen(path);
+	if (len >= BUFFER_SIZE) return 0;
+	prefix = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE);
+	if (prefix == NULL) return 0;
+	memcpy(prefix, path, sizeof(TCHAR) * (len + 1));
+	/* strip components until an existing prefix remains */
+	for (end = len; end > 0; ) {
+		prefix[end] = 0;
+		if (realPath(prefix, buf, BUFFER_SIZE) != 0) break;
+		while (end > 0 && _tcschr(PATH_SEPS, prefix[end - 1]) == NULL) end--;
+		while (end > 1 && _tcschr(PATH_SEPS, prefix[end - 1]) != NULL) end--;
+		if (end == 1 && _tcschr(PATH_SEPS, prefix[0]) != NULL) break; /* root */
+	}
+	if (end == 0) {
+		/* relative path without existing prefix */
+		if (realPath(_T("."), buf, BUFFER_SIZE) == 0) goto onError;
+	} else if (end == 1 && _tcschr(PATH_SEPS, prefix[0]) != NULL) {
+		prefix[1] = 0;
+		if (realPath(prefix, buf, BUFFER_SIZE) == 0) goto onError;
+	}
+	/* apply the remaining components */
+	for (rest = path + end; *rest != 0; ) {
+		size_t compLen, bufLen;
+		while (*rest != 0 && _tcschr(PATH_SEPS, *rest) != NULL) rest++;
+		for (compLen = 0; rest[compLen] != 0 && _tcschr(PATH_SEPS, rest[compLen]) == NULL; compLen++);
+		if (compLen == 0 || (compLen == 1 && rest[0] == _T('.'))) {
+			rest += compLen;
+			continue;
+		}
+		bufLen = _tcslen(buf);
+		if (compLen == 2 && rest[0] == _T('.') && rest[1] == _T('.')) {
+			/* the root has no parent */
+			const TCHAR * sep = _tcsrpbrk(buf, PATH_SEPS);
+			const TCHAR * first = _tcspbrk(buf, PATH_SEPS);
+			if (sep != NULL) buf[(size_t)(sep - buf) + ((sep == first) ? 1 : 0)] = 0;
+			rest += compLen;
+			continue;
+		}
+		if ((bufLen + compLen + 2) > BUFFER_SIZE) goto onError;
+		if (bufLen == 0 || _tcschr(PATH_SEPS, buf[bufLen - 1]) == NULL) buf[bufLen++] = PCF_PATH_SEPT[0];
+		memcpy(buf + bufLen, rest, sizeof(TCHAR) * compLen);
+		buf[bufLen + compLen] = 0;
+		rest += compLen;
+	}
+	res = 1;
+onError:
+	free(prefix);
+	return res;
+}
+
+
+/**
+ * Checks whether both paths refer to the same directory or one is located within the other.
+ * Both are normalized by normalizePath() before the comparison.
+ *
+ * @param[in] a - first path
+ * @param[in] b - second path
+ * @return 1 if overlapping, else 0
+ */
+int isOverlappingPath(const TCHAR * a, const TCHAR * b) {
+	TCHAR * normA;
+	TCHAR * normB;
+	size_t aLen, bLen, len;
+	int res = 0;
+	if (a == NULL || b == NULL) return 0;
+	normA = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE * 2);
+	if (normA == NULL) return 1; /* keep the jobs apart if unsure */
+	normB = normA + BUFFER_SIZE;
+	if (normalizePath(a, normA) == 0 || normalizePath(b, normB) == 0) {
+		free(normA);
+		return 1;
+	}
+	aLen = _tcslen(normA);
+	bLen = _tcslen(normB);
+	/* the shorter one needs to be a prefix of the other ending at a separator */
+	len = PCF_MIN(aLen, bLen);
+	if (PATH_NCMP(normA, normB, len) == 0) {
+		const TCHAR * longer = (aLen > bLen) ? normA : normB;
+		if (aLen == bLen || _tcschr(PATH_SEPS, longer[len]) != NULL || _tcschr(PATH_SEPS, longer[len - 1]) != NULL) res = 1;
+	}
+	free(normA);
+	return res;
+}
+
+
+
+/**
+ * Checks whether the current working directory is the given path or lies within it.
+ * Both paths are compared after resolving symbolic links.
+ *
+ * @param[in] path - path to check
+ * @return 1 if the working directory is within path (or if this cannot be decided), else 0
+ */
+int containsWorkDir(const TCHAR * path) {
+	TCHAR * normPath;
+	TCHAR * normCwd;
+	size_t len;
+	int res = 0;
+	normPath = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE * 2);
+	if (normPath == NULL) return 1;
+	normCwd = normPath + BUFFER_SIZE;
+	if (normalizePath(path, normPath) == 0 || normalizePath(_T("."), normCwd) == 0) {
+		free(normPath);
+		return 1;
+	}
+	len = _tcslen(normPath);
+	if (PATH_NCMP(normPath, normCwd, len) == 0) {
+		if (normCwd[len] == 0 || _tcschr(PATH_SEPS, normCwd[len]) != NULL || _tcschr(PATH_SEPS, normPath[len - 1]) != NULL) res = 1;
+	}
+	free(normPath);
+	return res;
+}
+
+/**
+ * Checks whether the given job needs to wait for the completion of another job. This is the
+ * case if one of them reads the destination of the other or both write the same one. Paths
+ * within each other count as the same.
+ *
+ * @param[in] job - backup context of the job to check
+ * @param[in] other - backup context of the other job
+ * @return 1 if dependent, else 0
+ */
+int dependsOnJob(const tContext * job, const tContext * other) {
+	int i;
+	if (isOverlappingPath(job->dstArg, other->dstArg) != 0) return 1;
+	for (i = 0; i < job->linkDestCount; i++) {
+		if (isOverlappingPath(job->linkDests[i], other->dstArg) != 0) return 1;
+	}
+	for (i = 0; i < other->linkDestCount; i++) {
+		if (isOverlappingPath(other->linkDests[i], job->dstArg) != 0) return 1;
+	}
+	for (i = 0; i < job->srcCount; i++) {
+		if (isOverlappingPath(job->srcArgs[i], other->dstArg) != 0) return 1;
+	}
+	for (i = 0; i < other->srcCount; i++) {
+		if (isOverlappingPath(other->srcArgs[i], job->dstArg) != 0) return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Reads and parses the backup jobs from `ctx->jobsFile`. Each line holds the command-line
+ * arguments of one backup job. Empty lines and lines starting with '#' are ignored.
+ *
+ * @param[in] ctx - backup processing context
+ * @param[out] jobs - receives the parsed jobs
+ * @param[out] count - receives the number of parsed jobs
+ * @return 1 on success, 0 on error
+ */
+int readJobsFile(tContext * ctx, tBatchJob ** jobs, size_t * count) {
+	TCHAR * buffer = NULL;
+	size_t capacity = 0;
+	unsigned int lineNo = 0;
+	int res = 0;
+	FILE * fp;
+	*jobs = NULL;
+	*count = 0;
+	fp = _tfopen(ctx->jobsFile, _T("r"));
+	if (fp == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to open the jobs file \"%s\".\n"), ctx->jobsFile);
+		return 0;
+	}
+	buffer = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE);
+	if (buffer == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * BUFFER_SIZE));
+		goto onError;
+	}
+	while (_fgetts(buffer, BUFFER_SIZE, fp) != NULL) {
+		const size_t len = _tcslen(buffer);
+		tBatchJob * job;
+		int argc;
+		lineNo++;
+		if (len > 0 && buffer[len - 1] != _T('\n') && feof(fp) == 0) {
+			_ftprintf(stderr, _T("Error: Line %u of the jobs file \"%s\" is too long.\n"), lineNo, ctx->jobsFile);
+			goto onError;
+		}
+		argc = splitArguments(buffer, NULL);
+		if (argc < 0) {
+			_ftprintf(stderr, _T("Error: Unbalanced quotes in line %u of the jobs file \"%s\".\n"), lineNo, ctx->jobsFile);
+			goto onError;
+		}
+		if (argc == 0) continue;
+		if (*count >= capacity) {
+			const size_t newCapacity = (capacity > 0) ? (capacity * 2) : 16;
+			tBatchJob * newJobs = (tBatchJob *)realloc(*jobs, sizeof(tBatchJob) * newCapacity);
+			if (newJobs == NULL) {
+				_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(tBatchJob) * newCapacity));
+				goto onError;
+			}
+			*jobs = newJobs;
+			capacity = newCapacity;
+		}
+		job = *jobs + *count;
+		memset(job, 0, sizeof(*job));
+		job->lineNo = lineNo;
+		job->line = (TCHAR *)malloc(sizeof(TCHAR) * (len + 1));
+		job->args = (TCHAR **)malloc(sizeof(TCHAR *) * (size_t)(argc + 2));
+		(*count)++;
+		if (job->line == NULL || job->args == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to allocate memory for the job in line %u.\n"), lineNo);
+			goto onError;
+		}
+		memcpy(job->line, buffer, sizeof(TCHAR) * (len + 1));
+		job->args[0] = ctx->jobsFile; /* takes the place of the program name */
+		splitArguments(job->line, job->args + 1);
+		job->args[argc + 1] = NULL;
+		if (job->args[1][0] == _T('#')) {
+			/* comment */
+			(*count)--;
+			free(job->line);
+			free(job->args);
+			continue;
+		}
+		if (parseOptions(&(job->ctx), argc + 1, job->args) >= 0) {
+			_ftprintf(stderr, _T("Error: Invalid backup job in line %u of the jobs file \"%s\".\n"), lineNo, ctx->jobsFile);
+			goto onError;
+		}
+		if (job->ctx.serve != NULL || job->ctx.connect != NULL || job->ctx.watch != 0 || job->ctx.jobsFile != NULL || job->ctx.prune != NULL) {
+			_ftprintf(stderr, _T("Error: --serve, --connect, --watch, --jobs-file and --prune are not permitted in line %u of the jobs file \"%s\".\n"), lineNo, ctx->jobsFile);
+			goto onError;
+		}
+	}
+	if (ferror(fp) != 0) {
+		_ftprintf(stderr, _T("Error: Failed to read the jobs file \"%s\".\n"), ctx->jobsFile);
+		goto onError;
+	}
+	res = 1;
+onError:
+	if (buffer != NULL) free(buffer);
+	fclose(fp);
+	return res;
+}
+
+
+/**
+ * Runs the backup jobs of `ctx->jobsFile`. Independent jobs run concurrently and share the
+ * same file operation work pool. A job which depends on previous jobs is submitted once
+ * these completed, while independent jobs after it start right away.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return process exit code
+ */
+int runJobsFile(tContext * ctx) {
+	tBatchJob * jobs = NULL;
+	tWorkPool * jobPool = NULL;
+	size_t count = 0;
+	size_t i;
+	int res = EXIT_FAILURE;
+	/* be verbose by default */
+	ctx->verbose++;
+	if (readJobsFile(ctx, &jobs, &count) == 0) goto onError;
+	ctx->pool = wp_create(ctx->workers, ctx->queueDepth, ctx->autoTune, backupFile, backupFileDone, ctx);
+	jobPool = wp_create(PCF_MIN(PCF_MAX(count, 1), BATCH_MAX_PARALLEL), 1, 0, runBatchJob, finishBatchJob, ctx);
+	if (ctx->pool == NULL || jobPool == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+		goto onError;
+	}
+	for (;;) {
+		int waiting = 0;
+		for (i = 0; i < count && signalReceived == 0; i++) {
+			tBatchJob * job = jobs + i;
+			if (job->submitted != 0) continue;
+			/* each pair of jobs is checked only once as finished jobs stay finished */
+			while (job->scanned < i) {
+				tBatchJob * other = jobs + job->scanned;
+				if (other->finished == 0 && (job->blocked != 0 || dependsOnJob(&(job->ctx), &(other->ctx)) != 0)) {
+					job->blocked = 1;
+					break;
+				}
+				job->blocked = 0;
+				job->scanned++;
+			}
+			if (job->scanned < i) {
+				waiting = 1;
+				continue;
+			}
+			job->submitted = 1;
+			wp_submit(jobPool, &(job->item));
+		}
+		if (waiting == 0 || signalReceived != 0) break;
+		/* the first waiting job depends on a submitted job, hence this completes at least one */
+		if (wp_reap(jobPool, 1) == 0) break;
+	}
+	wp_drain(jobPool);
+	if (ctx->autoTune != 0 && ctx->verbose > 0) {
+		size_t workers, depth;
+		wp_settings(ctx->pool, &workers, &depth);
+		_tprintf(_T("Tuned concurrency: --workers=%u --queue-depth=%u\n"), (unsigned)workers, (unsigned)depth);
+	}
+	res = (signalReceived != 0) ? EXIT_SIGNAL : ((ctx->hadError != 0) ? EXIT_PARTIAL : EXIT_SUCCESS);
+onError:
+	wp_destroy(jobPool);
+	wp_destroy(ctx->pool);
+	ctx->pool = NULL;
+	for (i = 0; i < count; i++) {
+		if (jobs[i].line != NULL) free(jobs[i].line);
+		if (jobs[i].args != NULL) free(jobs[i].args);
+	}
+	if (jobs != NULL) free(jobs);
+	return res;
+}
+
+
+/**
+ * Runs a single backup job of --jobs-file. This is called by the job pool, possibly
+ * concurrently to other backup jobs.
+ *
+ * @param[in,out] item - batch job
+ * @param[in] param - backup processing context of the jobs file
+ */
+void runBatchJob(tWorkItem * item, void * param) {
+	tBatchJob * job = (tBatchJob *)item;
+	tContext * ctx = (tContext *)param;
+	job->result = EXIT_FAILURE;
+	if (signalReceived != 0) return;
+	/* concurrency options of the job are ignored in favor of the shared work pool */
+	job->ctx.pool = wp_share(ctx->pool, backupFile, backupFileDone, &(job->ctx));
+	if (job->ctx.pool == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to create the work pool.\n"));
+		return;
+	}
+	if (job->ctx.verbose > 0) _tprintf(_T("Running backup job in line %u.\n"), job->lineNo);
+	job->result = runBackup(&(job->ctx));
+	wp_destroy(job->ctx.pool);
+	job->ctx.pool = NULL;
+}
+
+
+/**
+ * Completes a single backup job of --jobs-file. This is called from the thread which
+ * submits the jobs.
+ *
+ * @param[in,out] item - batch job
+ * @param[in] param - backup processing context of the jobs file
+ */
+void finishBatchJob(tWorkItem * item, void * param) {
+	tBatchJob * job = (tBatchJob *)item;
+	tContext * ctx = (tContext *)param;
+	job->finished = 1;
+	if (job->result == EXIT_SUCCESS) return;
+	ctx->hadError = 1;
+	if (signalReceived == 0) {
+		_ftprintf(stderr, _T("Error: Backup job in line %u of the jobs file \"%s\" failed with exit code %i.\n"), job->lineNo, ctx->jobsFile, job->result);
+	}
+}
+
+
+/**
+ * Opens the given read-only manifest. The manifest is kept loaded for subsequent jobs
+ * with --serve and re-loaded once its files changed.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] root - manifest root directory
+ * @param[in] name - manifest file name
+ * @return manifest or NULL on error
+ */
+tManifest * openCachedManifest(tContext * ctx, const TCHAR * root, const TCHAR * name) {
+	tManifestCache * cache = ctx->mfCache;
+	tCachedManifest * entry = NULL;
+	tCachedManifest fresh;
+	size_t i;
+	int k;
+	if (cache == NULL) return mf_open(root, name, 0);
+	/* the buffers are free before the backup starts */
+	if (realPath(root, ctx->dir, BUFFER_SIZE) == 0) return NULL;
+	memset(&fresh, 0, sizeof(fresh));
+	for (k = 0; k < 2; k++) {
+		const int n = _sntprintf(ctx->ref, BUFFER_SIZE, _T("%s") _T2(PCF_PATH_SEP) _T("%s%s"), ctx->dir, name, (k == 0) ? _T("") : MF_LOG_SUFFIX);
+		if (n < 0 || n >= BUFFER_SIZE) return NULL;
+		fresh.state[k] = getFileStat(ctx->ref, fresh.stats + k, 0);
+	}
+	for (i = 0; i < cache->count; i++) {
+		if (cache->entries[i].name == name && _tcscmp(cache->entries[i].root, ctx->dir) == 0) {
+			entry = cache->entries + i;
+			break;
+		}
+	}
+	if (entry != NULL) {
+		/* still up-to-date? */
+		for (k = 0; k < 2; k++) {
+			if (entry->state[k] != fresh.state[k]) break;
+			if (fresh.state[k] == 1 && (isChangedFile(entry->stats + k, 1, fresh.stats + k) != 0 || entry->stats[k].ino != fresh.stats[k].ino)) break;
+		}
+		if (k == 2) return entry->mf;
+		/* outdated -> reload in place */
+		mf_close(entry->mf);
+		entry->mf = NULL;
+	} else {
+		if (cache->count >= SERVE_CACHE_SIZE) {
+			/* replace the least recently loaded manifest */
+			mf_close(cache->entries[0].mf);
+			free(cache->entries[0].root);
+			memmove(cache->entries, cache->entries + 1, sizeof(tCachedManifest) * (SERVE_CACHE_SIZE - 1));
+			cache->count--;
+		}
+		const size_t rootLen = _tcslen(ctx->dir) + 1;
+		fresh.root = (TCHAR *)malloc(sizeof(TCHAR) * rootLen);
+		if (fresh.root == NULL) return NULL;
+		memcpy(fresh.root, ctx->dir, sizeof(TCHAR) * rootLen);
+		fresh.name = name;
+		entry = cache->entries + cache->count;
+		*entry = fresh;
+		cache->count++;
+	}
+	entry->state[0] = fresh.state[0];
+	entry->state[1] = fresh.state[1];
+	entry->stats[0] = fresh.stats[0];
+	entry->stats[1] = fresh.stats[1];
+	entry->mf = mf_open(ctx->dir, name, 0);
+	return entry->mf;
+}
+
+
+/**
+ * Closes a manifest opened via openCachedManifest(). Manifests cached for --serve are kept.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] mf - manifest to close (may be NULL)
+ */
+void closeCachedManifest(tContext * ctx, tManifest * mf) {
+	if (ctx->mfCache == NULL) mf_close(mf);
+}
+
+
+/**
+ * Closes all manifests of the given cache.
+ *
+ * @param[in,out] cache - manifest cache (may be NULL)
+ */
+void clearManifestCache(tManifestCache * cache) {
+	size_t i;
+	if (cache == NULL) return;
+	for (i = 0; i < cache->count; i++) {
+		mf_close(cache->entries[i].mf);
+		free(cache->entries[i].root);
+	}
+	cache->count = 0;
+}
+
+
+/**
+ * Write the help for this application to standard out.
+ */
+void printHelp() {
+	_tprintf(
+	_T("lsync [options] [<source> ...] <destination>\n")
+	_T("lsync [options] --prune <snapshot>\n")
+	_T("\n")
+	_T("This is free and unencumbered software released into the public domain.\n")
+	_T("\n")
+	_T("    --append-verify\n")
+	_T("      Files which grew are only appended if the previous version in destination or\n")
+	_T("      reference is a prefix of the source (verified by hash). The previous version\n")
+	_T("      is cloned (reflink) or appended in place if it is the destination file.\n")
+	_T("-a, --archive\n")
+	_T("      Archive mode (same as -rlptgoD).\n")
+	_T("    --checkpoint\n")
+	_T("      Records completed directories in \".lsync.checkpoint\" within the destination.\n")
+	_T("      A backup of the same sources interrupted by a signal is resumed by the next\n")
+	_T("      run with this option, which skips the recorded directories entirely.\n")
+	_T("    --connect <socket>\n")
+	_T("      Run the backup within the lsync service listening on the given socket.\n")
+	_T("    --copy-dest <reference>\n")
+	_T("      Like --link-dest, but unchanged files are cloned (reflink) or copied from\n")
+	_T("      the reference instead of hardlinked. Cannot be combined with --link-dest.\n")
+	_T("    --delete\n")
+	_T("      Remove destination entries which do not exist in the source (Linux).\n")
+	_T("      Directories are emptied concurrently like with --prune.\n")
+	_T("    --devices\n")
+	_T("      Preserves device files.\n")
+	_T("-D\n")
+	_T("      Same as --devices --specials.\n")
+	_T("    --dir-cache\n")
+	_T("      Cache the source directory listings within the destination and re-use\n")
+	_T("      them while the directory modification and status change times match.\n")
+	_T("    --dirs-first\n")
+	_T("      Create all destination directories before copying the files. Directory\n")
+	_T("      attributes and timestamps are applied once all files have been copied.\n")
+	);
+	/* split to stay within the string literal length supported by C99 compilers */
+	_tprintf(
+	_T("-g, --group\n")
+	_T("      Preserves group.\n")
+	_T("-H, --hard-links\n")
+	_T("      Preserves hard links between the copied source files.\n")
+	_T("-h, --help\n")
+	_T("      Print short usage instruction.\n")
+	_T("    --inplace\n")
+	_T("      Updates changed destination files in place by writing only the blocks which\n")
+	_T("      differ from the source. Faster for large files with few changes, but files\n")
+	_T("      are no longer replaced atomically. Files with further hardlinks are copied.\n")
+	_T("    --jobs-file <file>\n")
+	_T("      Run the backup jobs given in the file, one per line with the same options\n")
+	_T("      and paths as on the command-line. Independent jobs run concurrently and\n")
+	_T("      share the worker threads. Concurrency options of the jobs are ignored.\n")
+	_T("    --link-dest <reference>\n")
+	_T("      Hardlink to files from reference in destination if unchanged.\n")
+	_T("      Up to %u references are checked in the given order.\n")
+	_T("-l, --links\n")
+	_T("      Copy symlinks as symlinks.\n")
+	_T("    --manifest\n")
+	_T("      Record the backed up files in a manifest within the destination and use\n")
+	_T("      the manifests of destination and reference instead of querying each file.\n")
+	_T("      Requires that these are only modified by lsync.\n")
+	_T("    --max-iops <count>\n")
+	_T("      Maximum number of removals per second of --prune to leave I/O capacity\n")
+	_T("      for other processes (default: unlimited).\n")
+	_T("-o, --owner\n")
+	_T("      Preserves owner.\n")
+	_T("-p  --perms\n")
+	_T("      Preserves permissions.\n")
+	_T("    --partial\n")
+	_T("      Files are copied via \"<file>.lsync-partial\" which is kept on\n")
+	_T("      interruption together with a progress record. The next run resumes the copy\n")
+	_T("      at the last verified offset if the source file is unchanged.\n")
+	_T("    --prune <snapshot>\n")
+	_T("      Remove the given snapshot directory tree instead of running a backup.\n")
+	_T("      Directories are emptied concurrently by the workers (default: 8).\n")
+	_T("      Sub directories are opened relative to their parent without following\n")
+	_T("      symbolic links. Paths ending in \".\" or \"..\" and the working directory or\n")
+	_T("      its parents are refused.\n")
+	_T("    --queue-depth <count>\n")
+	_T("      Maximum number of queued file operations (default: twice the workers).\n")
+	_T("-r, --recursive\n")
+	_T("      Traverses given directories recursive.\n")
+	_T("    --reflink-delta\n")
+	_T("      Changed files of at least 1 MiB are cloned from the first reference holding\n")
+	_T("      a previous version and only the differing blocks are written. Requires\n")
+	_T("      --link-dest or --copy-dest on a file system with reflink support.\n")
+	_T("    --serve <socket>\n")
+	_T("      Keep running as service and accept backup jobs via --connect on the given\n")
+	_T("      Unix domain socket. Worker threads and the --manifest manifests of the\n")
+	_T("      references stay loaded between the jobs. Other reference listings and\n")
+	_T("      file status are read again by each job. Concurrency options of the jobs\n")
+	_T("      are ignored.\n")
+	_T("      Only jobs of the same user are accepted.\n")
+	_T("    --specials\n")
+	_T("      Preserves special files.\n")
+	_T("-t, --times\n")
+	_T("      Preserves modification times.\n")
+	_T("    --tree-digest\n")
+	_T("      Record a digest of each source directory tree within the destination and\n")
+	_T("      hardlink whole subtrees whose digest matches the one of the reference.\n")
+	_T("-v\n")
+	_T("      Increases verbosity.\n")
+	_T("    --version\n")
+	_T("      Outputs the program version.\n")
+	_T("    --watch\n")
+	_T("      Keep running after the backup and back up changed source paths as\n")
+	_T("      reported by the file system. Everything is rescanned if changes got lost.\n")
+	_T("      Cannot be combined with --tree-digest.\n")
+	_T("    --workers <count|auto>\n")
+	_T("      Number of concurrent file operations (default: 1). \"auto\" tunes the\n")
+	_T("      worker count and queue depth from the measured throughput and latency.\n")
+	_T("\n")
+	_T("lsync %s\n")
+	_T("https://github.com/daniel-starke/lsync\n")
+	, (unsigned)MAX_LINK_DESTS, PROGRAM_VERSION);
+}
+
+
+/**
+ * Handles external signals.
+ * 
+ * @param[in] signum - received signal number
+ */
+void handleSignal(int signum) {
+	PCF_UNUSED(signum)
+	signalReceived = 1;
+	/* signal handlers may only call async-signal-safe functions -> avoid non-reentrant stdio */
+	static const char msg[] = "Received signal. Finishing current operation.\n";
+#if defined(PCF_IS_WIN)
+	DWORD written;
+	WriteFile(GetStdHandle(STD_ERROR_HANDLE), msg, (DWORD)(sizeof(msg) - 1), &written, NULL);
+#else
+	write(STDERR_FILENO, msg, sizeof(msg) - 1);
+#endif
+}
+
+
+/**
+ * Parses a decimal count.
+ *
+ * @param[in] str - string to parse
+ * @param[in] maxValue - maximum accepted value
+ * @param[out] value - receives the parsed value
+ * @return 1 on success, 0 on invalid or out of range input
+ */
+int parseCount(const TCHAR * str, const size_t maxValue, size_t * value) {
+	TCHAR * end = NULL;
+	unsigned long val;
+	if (str == NULL || *str < _T('0') || *str > _T('9')) return 0;
+	errno = 0;
+	val = _tcstoul(str, &end, 10);
+	if (errno != 0 || end == NULL || *end != 0 || val > maxValue) return 0;
+	*value = (size_t)val;
+	return 1;
+}
+
+
+/**
+ * Joins "base/item" or, if rel is not NULL, "base/item/rel" into the given buffer.
+ *
+ * @param[out] buf - destination buffer
+ * @param[in] len - destination buffer length in characters
+ * @param[in] base - leading path part
+ * @param[in] item - path element appended to base
+ * @param[in] rel - trailing path part appended after item, or NULL to omit
+ * @return 1 on success, 0 on truncation
+ */
+int joinPath(TCHAR * buf, const size_t len, const TCHAR * base, const TCHAR * item, const TCHAR * rel) {
+	const int n = (rel == NULL)
+		? _sntprintf(buf, len, _T("%s") _T2(PCF_PATH_SEP) _T("%s"), base, item)
+		: _sntprintf(buf, len, _T("%s") _T2(PCF_PATH_SEP) _T("%s") _T2(PCF_PATH_SEP) _T("%s"), base, item, rel);
+	buf[len - 1] = 0;
+	return (n >= 0 && (size_t)n < len) ? 1 : 0;
+}
+
+
+/**
+ * Tests whether the destination is at or below the source directory. Such an overlap would
+ * make the backup copy the source into its own subtree and recurse infinitely.
+ *
+ * @param[in] src - source directory
+ * @param[in] dst - destination directory
+ * @return 1 if dst is src or within it, 0 otherwise or on error
+ */
+int destWithinSource(const TCHAR * src, const TCHAR * dst) {
+	TCHAR * realSrc = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE * 2);
+	int res = 0;
+	if (realSrc == NULL) return 0;
 	TCHAR * realDst = realSrc + BUFFER_SIZE;
 	if (realPath(src, realSrc, BUFFER_SIZE) != 0 && realPath(dst, realDst, BUFFER_SIZE) != 0) {
 		const size_t len = _tcslen(realSrc);
@@ -348,38 +1783,1543 @@ int destWithinSource(const TCHAR * src, const TCHAR * dst) {
 			res = 1;
 		}
 	}
-	free(realSrc);
-	return res;
+	free(realSrc);
+	return res;
+}
+
+
+/**
+ * Determines the references which contain the current destination directory `ctx->dst`.
+ * References with a manifest are assumed to contain it as their manifest is queried
+ * without accessing the file system.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] parentMask - references which contain the parent directory
+ * @return references which contain the directory (bit per reference)
+ */
+uint32_t getRefMask(tContext * ctx, const uint32_t parentMask) {
+	const size_t dstArgLen = _tcslen(ctx->dstArg);
+	const TCHAR * rel = (_tcslen(ctx->dst) > dstArgLen) ? (ctx->dst + dstArgLen + 1) : NULL;
+	uint32_t mask = 0;
+	int i;
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		const uint32_t bit = UINT32_C(1) << i;
+		if ((parentMask & bit) == 0) continue;
+		if (ctx->refManifests[i] != NULL) {
+			mask |= bit;
+		} else if (rel == NULL) {
+			if (isDirectory(ctx->linkDests[i]) != 0) mask |= bit;
+		} else if (joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDests[i], rel, NULL) != 0 && isDirectory(ctx->ref) != 0) {
+			mask |= bit;
+		}
+	}
+	return mask;
+}
+
+
+/**
+ * Sets the references to check for the entries at the given traversal level.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] level - traversal level of the directory entries
+ * @param[in] mask - references which contain the directory (bit per reference)
+ * @return 1 on success, 0 on allocation error
+ */
+int setRefMask(tContext * ctx, const unsigned int level, const uint32_t mask) {
+	if (level >= ctx->refMaskCapacity) {
+		const size_t capacity = PCF_MAX((size_t)level + 1, ctx->refMaskCapacity * 2);
+		uint32_t * masks = (uint32_t *)realloc(ctx->refMasks, sizeof(uint32_t) * capacity);
+		if (masks == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(uint32_t) * capacity));
+			return 0;
+		}
+		/* unknown levels check all references */
+		while (ctx->refMaskCapacity < capacity) masks[ctx->refMaskCapacity++] = ~UINT32_C(0);
+		ctx->refMasks = masks;
+	}
+	ctx->refMasks[level] = mask;
+	return 1;
+}
+
+
+/**
+ * Returns the references to check for the given traversal item.
+ *
+ * @param[in] ctx - backup processing context
+ * @param[in] item - item name (NULL for root and single file calls)
+ * @param[in] level - traversal level of the item
+ * @return references to check (bit per reference)
+ */
+uint32_t currentRefMask(const tContext * ctx, const TCHAR * item, const unsigned int level) {
+	const uint32_t all = (UINT32_C(1) << ctx->linkDestCount) - 1;
+	if (item == NULL || level >= ctx->refMaskCapacity) return all;
+	return ctx->refMasks[level] & all;
+}
+
+
+/**
+ * Compares the file status of a destination or reference file against the source file.
+ * Only size and modification time (in seconds) are compared. The status change time is
+ * ignored so that metadata only changes still do --link-dest hardlink deduplication.
+ *
+ * @param[in] stats - destination or reference file status
+ * @param[in] srcState - result of getFileStat() for the source file
+ * @param[in] srcStats - source file status
+ * @return 1 if the source file changed, 0 if unchanged
+ */
+int isChangedFile(const tFileStat * stats, const int srcState, const tFileStat * srcStats) {
+	if (srcState == 0) return 0; /* source vanished -> keep what exists */
+	if (srcState < 0) return 1;
+	return (stats->size != srcStats->size || stats->mtime != srcStats->mtime) ? 1 : 0;
+}
+
+
+/**
+ * Checks whether both file status belong to the same file (hardlinks of each other). A
+ * status taken from a manifest lacks the device. It is queried from the file system in
+ * that case, which is only needed if the inode numbers already match.
+ *
+ * @param[in] a - first file status
+ * @param[in] pathA - path of the first file
+ * @param[in] b - second file status
+ * @param[in] pathB - path of the second file
+ * @return 1 if the same file, else 0
+ */
+int isSameInode(const tFileStat * a, const TCHAR * pathA, const tFileStat * b, const TCHAR * pathB) {
+	tFileStat statsA, statsB;
+	if (a->ino == 0 || a->ino != b->ino) return 0;
+	if (a->dev == 0) {
+		if (getFileStat(pathA, &statsA, 0) != 1) return 0;
+		a = &statsA;
+	}
+	if (b->dev == 0) {
+		if (getFileStat(pathB, &statsB, 0) != 1) return 0;
+		b = &statsB;
+	}
+	return (a->ino == b->ino && a->dev == b->dev) ? 1 : 0;
+}
+
+
+/**
+ * Accounts the result of copyAttributes() in the attribute update counters.
+ *
+ * @param[in,out] ctx - backup context
+ * @param[in] result - copyAttributes() result (0 is not counted)
+ * @return the given result
+ */
+int countAttributes(tContext * ctx, const int result) {
+	if (result == 1) {
+		ctx->attrApplied++;
+	} else if (result == 2) {
+		ctx->attrSkipped++;
+	}
+	return result;
+}
+
+
+/**
+ * Retrieves the file status of a destination or reference file. The status recorded in the
+ * given manifest is used if available to avoid querying the file system.
+ *
+ * @param[in] mf - manifest of the destination or reference (may be NULL)
+ * @param[in] key - path relative to the manifest root (may be NULL without manifest)
+ * @param[in] path - full path of the file
+ * @param[out] stats - receives the file status
+ * @param[out] cached - set to 1 if taken from the manifest, else 0
+ * @return 1 on success, 0 if the file does not exist and -1 on error
+ */
+int lookupFileStat(const tManifest * mf, const TCHAR * key, const TCHAR * path, tFileStat * stats, int * cached) {
+	if (mf != NULL && key != NULL && mf_find(mf, key, stats, NULL, NULL) != 0) {
+		*cached = 1;
+		return 1;
+	}
+	*cached = 0;
+	return getFileStat(path, stats, 0);
+}
+
+
+/**
+ * Retrieves the destination file status of the given job. A destination known to be absent
+ * from the directory listing is not queried.
+ *
+ * @param[in] job - backup job
+ * @param[out] stats - receives the file status
+ * @param[out] cached - set to 1 if taken from the manifest, else 0
+ * @return 1 on success, 0 if the file does not exist and -1 on error
+ */
+int lookupDestStat(const tBackupJob * job, tFileStat * stats, int * cached) {
+	if (job->dstAbsent != 0) {
+		*cached = 0;
+		return 0;
+	}
+	return lookupFileStat(job->ctx->dstManifest, job->key, job->dst, stats, cached);
+}
+
+
+/**
+ * Maps a path of the current source argument to the corresponding path below the given root.
+ * "src/" maps the contents of src and "src" the src directory itself (like rsync).
+ *
+ * @param[in] ctx - backup processing context
+ * @param[in] src - source path (the current source argument or a path below it)
+ * @param[in] root - destination or reference root
+ * @param[in] singleFile - set if src is a single file source argument
+ * @param[out] buf - destination buffer
+ * @param[in] len - destination buffer length in characters
+ * @return 1 on success, 0 on truncation
+ */
+int mapPath(const tContext * ctx, const TCHAR * src, const TCHAR * root, const int singleFile, TCHAR * buf, const size_t len) {
+	const TCHAR * srcArg = ctx->srcArgs[ctx->srcIndex];
+	size_t srcLen = _tcslen(srcArg);
+	const int trailingSep = (srcLen > 0 && _tcschr(PATH_SEPS, srcArg[srcLen - 1]) != NULL);
+	const TCHAR * srcBase = _tcsrpbrk(srcArg, PATH_SEPS);
+	if (srcBase == NULL) {
+		srcBase = srcArg;
+	} else {
+		srcBase++; /* skip path separator */
+	}
+	if (_tcslen(src) > srcLen && trailingSep == 0) {
+		srcLen++; /* skip separator between source and relative path */
+	}
+	const TCHAR * rel = src + srcLen; /* path relative to source ("" for the root) */
+	if (singleFile != 0) {
+		/* single file */
+		return joinPath(buf, len, root, srcBase, NULL);
+	} else if (trailingSep != 0) {
+		/* "src/" copies the contents of src into the destination */
+		return joinPath(buf, len, root, rel, NULL);
+	}
+	/* "src" copies the src directory itself into the destination */
+	return joinPath(buf, len, root, srcBase, rel);
+}
+
+
+/**
+ * Checks whether the given path relative to the destination root is used by lsync itself.
+ *
+ * @param[in] key - path relative to the destination root
+ * @return 1 if reserved, else 0
+ */
+int isReservedName(const TCHAR * key) {
+	static const TCHAR * const names[] = {MANIFEST_NAME, DIRCACHE_NAME, DIGEST_NAME, CHECKPOINT_NAME};
+	size_t i;
+	for (i = 0; i < (sizeof(names) / sizeof(*names)); i++) {
+		const size_t len = _tcslen(names[i]);
+		if (_tcsncmp(key, names[i], len) != 0) continue;
+		if (key[len] == 0 || _tcscmp(key + len, MF_LOG_SUFFIX) == 0 || _tcscmp(key + len, MF_TMP_SUFFIX) == 0) return 1;
+	}
+	return 0;
+}
+
+
+#ifndef UNICODE
+/**
+ * Directory lister which re-uses the cached listing of a source directory as long as its
+ * modification and status change times match. Any change of the directory entries updates
+ * these. New listings are recorded in the cache.
+ *
+ * @param[in] path - source directory path
+ * @param[out] names - receives an allocated buffer of NUL terminated entry names
+ * @param[out] size - receives the size of names in bytes
+ * @param[in,out] param - backup processing context
+ * @return 1 on success, 0 on error
+ */
+int listDirectory(const char * path, char ** names, size_t * size, void * param) {
+	tContext * ctx = (tContext *)param;
+	tFileStat stats, cached;
+	const void * data;
+	size_t dataLen;
+	const char * key;
+	if (ctx->dirCacheMf == NULL || mapPath(ctx, path, ctx->dstArg, 0, ctx->dir, BUFFER_SIZE) == 0
+		|| getFileStat(path, &stats, 0) != 1) {
+		return tds_listDir(path, names, size);
+	}
+	key = ctx->dir + _tcslen(ctx->dstArg) + 1;
+	if (mf_find(ctx->dirCacheMf, key, &cached, &data, &dataLen) != 0
+		&& cached.mtime == stats.mtime && cached.mtimeNs == stats.mtimeNs
+		&& cached.ctime == stats.ctime && cached.ctimeNs == stats.ctimeNs
+		&& cached.ino == stats.ino && cached.size == stats.size
+		&& (dataLen == 0 || ((const char *)data)[dataLen - 1] == 0)) {
+		*names = (char *)malloc((dataLen > 0) ? dataLen : 1);
+		if (*names == NULL) return 0;
+		if (dataLen > 0) memcpy(*names, data, dataLen);
+		*size = dataLen;
+		return 1;
+	}
+	/* the stamps were taken before reading -> concurrent changes update them again */
+	if (tds_listDir(path, names, size) == 0) return 0;
+	/* changes within the time stamp granularity keep the stamps -> only cache settled directories */
+	if (stats.ctime < (((int64_t)time(NULL)) - DIRCACHE_SETTLE)) {
+		mf_append(ctx->dirCacheMf, key, &stats, *names, *size);
+	}
+	return 1;
+}
+
+
+/**
+ * Compares two entry name pointers in ascending byte order.
+ *
+ * @param[in] a - left entry name pointer
+ * @param[in] b - right entry name pointer
+ * @return <0, 0 or >0 like strcmp()
+ */
+int cmpNamePtr(const void * a, const void * b) {
+	return strcmp(*((const char * const *)a), *((const char * const *)b));
+}
+
+
+/**
+ * Sorts the given directory listing by name.
+ *
+ * @param[in] names - NUL terminated entry names
+ * @param[in] size - size of names in bytes
+ * @param[in,out] sorted - receives the sorted entry names pointing into names (re-allocated as needed)
+ * @param[out] count - receives the number of entry names
+ * @param[in,out] capacity - allocated entries in sorted
+ * @return 1 on success, 0 on allocation failure
+ */
+int sortNames(const char * names, const size_t size, const char *** sorted, size_t * count, size_t * capacity) {
+	size_t pos, n = 0;
+	for (pos = 0; pos < size; pos += strlen(names + pos) + 1) n++;
+	if (n > *capacity) {
+		const size_t newCapacity = (n > (*capacity * 2)) ? n : (*capacity * 2);
+		const char ** newSorted = (const char **)realloc((void *)(*sorted), sizeof(char *) * newCapacity);
+		if (newSorted == NULL) return 0;
+		*sorted = newSorted;
+		*capacity = newCapacity;
+	}
+	for (pos = 0, n = 0; pos < size; pos += strlen(names + pos) + 1) (*sorted)[n++] = names + pos;
+	qsort((void *)(*sorted), n, sizeof(char *), cmpNamePtr);
+	*count = n;
+	return 1;
+}
+
+
+/**
+ * Directory lister for --delete and the reference comparison. The source entry names are
+ * returned in sorted order as the traversal reports the entries in this order. They are
+ * kept per traversal level and merge-joined with the sorted listings of the corresponding
+ * destination and reference directories. joinEntry() provides the results per entry.
+ *
+ * @param[in] path - source directory path
+ * @param[out] names - receives an allocated buffer of NUL terminated entry names
+ * @param[out] size - receives the size of names in bytes
+ * @param[in,out] param - backup processing context
+ * @return 1 on success, 0 on error
+ */
+int joinDirectory(const char * path, char ** names, size_t * size, void * param) {
+	tContext * ctx = (tContext *)param;
+	const unsigned int level = ctx->listLevel;
+	const size_t refCount = (size_t)ctx->linkDestCount;
+	tDirListing * listing;
+	char * sortedNames;
+	size_t oldCapacity, pos, i;
+	if (listDirectory(path, names, size, param) == 0) return 0;
+	if (level >= ctx->listingCapacity) {
+		const size_t capacity = (size_t)level + 16;
+		tDirListing * listings = (tDirListing *)realloc(ctx->listings, sizeof(tDirListing) * capacity);
+		if (listings == NULL) goto onError;
+		memset(listings + ctx->listingCapacity, 0, sizeof(tDirListing) * (capacity - ctx->listingCapacity));
+		ctx->listings = listings;
+		ctx->listingCapacity = capacity;
+	}
+	listing = ctx->listings + level;
+	listing->count = 0;
+	listing->next = 0;
+	listing->dstKnown = 0;
+	listing->refKnown = 0;
+	oldCapacity = listing->capacity;
+	if (sortNames(*names, *size, &(listing->names), &(listing->count), &(listing->capacity)) == 0) goto onError;
+	sortedNames = (char *)malloc((*size > 0) ? *size : 1);
+	if (sortedNames == NULL) goto onError;
+	for (i = 0, pos = 0; i < listing->count; i++) {
+		const size_t len = strlen(listing->names[i]) + 1;
+		memcpy(sortedNames + pos, listing->names[i], len);
+		listing->names[i] = sortedNames + pos;
+		pos += len;
+	}
+	free(*names);
+	*names = sortedNames;
+	/* the entry arrays follow the capacity of the name array */
+	if (listing->capacity != oldCapacity || listing->dstFound == NULL) {
+		unsigned char * const dstFound = (unsigned char *)realloc(listing->dstFound, listing->capacity + 1);
+		if (dstFound != NULL) listing->dstFound = dstFound;
+		uint32_t * const refFound = (uint32_t *)realloc(listing->refFound, sizeof(uint32_t) * (listing->capacity + 1));
+		if (refFound != NULL) listing->refFound = refFound;
+		tFileStat * const refStats = (tFileStat *)realloc(listing->refStats, sizeof(tFileStat) * ((listing->capacity * refCount) + 1));
+		if (refStats != NULL) listing->refStats = refStats;
+		if (dstFound == NULL || refFound == NULL || refStats == NULL) {
+			/* allocate all of them again next time */
+			free(listing->dstFound);
+			free(listing->refFound);
+			free(listing->refStats);
+			listing->dstFound = NULL;
+			listing->refFound = NULL;
+			listing->refStats = NULL;
+			listing->count = 0;
+			goto onError;
+		}
+	}
+	memset(listing->dstFound, 0, listing->count);
+	memset(listing->refFound, 0, sizeof(uint32_t) * listing->count);
+	if (mapPath(ctx, path, ctx->dstArg, 0, ctx->dir, BUFFER_SIZE) == 0) goto onError;
+	if (ctx->deleteExtra != 0) joinDestination(ctx, listing);
+	if (ctx->joinRefs != 0 && ctx->linkTree == 0) joinReferences(ctx, listing, level);
+	return 1;
+onError:
+	/* the source listing is still valid -> back up without the joined listings */
+	if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Failed to join the listings of \"%s\".\n"), path);
+	if (ctx->deleteExtra != 0) ctx->hadError = 1; /* nothing deleted */
+	return 1;
+}
+
+
+/**
+ * Merge-joins the destination directory `ctx->dir` with the given source listing for
+ * --delete. Destination entries missing in the source are queued for removal. A destination
+ * directory which cannot be listed is left as is.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in,out] listing - sorted source listing
+ */
+void joinDestination(tContext * ctx, tDirListing * listing) {
+	char * dstNames = NULL;
+	size_t dstSize, dstCount, dirLen, i, j;
+	if (tds_listDir(ctx->dir, &dstNames, &dstSize) == 0
+		|| sortNames(dstNames, dstSize, &(ctx->joinNames), &dstCount, &(ctx->joinCapacity)) == 0) {
+		if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Skipping deletion within \"%s\".\n"), ctx->dir);
+		ctx->hadError = 1;
+		if (dstNames != NULL) free(dstNames);
+		return;
+	}
+	listing->dstKnown = 1;
+	dirLen = strlen(ctx->dir);
+	if (dirLen > 0 && ctx->dir[dirLen - 1] == '/') dirLen--; /* root of "src/" */
+	for (i = 0, j = 0; j < dstCount; j++) {
+		const char * name = ctx->joinNames[j];
+		while (i < listing->count && strcmp(listing->names[i], name) < 0) i++;
+		if (i < listing->count && strcmp(listing->names[i], name) == 0) {
+			listing->dstFound[i] = 1;
+			continue;
+		}
+		/* interrupted copies are kept to be resumed */
+		if (ctx->partial != 0 && isPartialName(name) != 0) continue;
+		if ((dirLen + strlen(name) + 2) > BUFFER_SIZE) {
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Error: Destination path \"%s/%s\" is too long.\n"), ctx->dir, name);
+			ctx->hadError = 1;
+			continue;
+		}
+		ctx->dir[dirLen] = '/';
+		strcpy(ctx->dir + dirLen + 1, name);
+		if (isReservedName(ctx->dir + _tcslen(ctx->dstArg) + 1) == 0) queueRemoval(ctx, ctx->dir);
+		ctx->dir[dirLen] = 0;
+	}
+	free(dstNames);
+}
+
+
+/**
+ * Checks whether the given destination entry name belongs to an interrupted copy of
+ * --partial, i.e. ends in PARTIAL_SUFFIX or PARTIAL_SUFFIX PARTIAL_INFO_SUFFIX.
+ *
+ * @param[in] name - destination entry name
+ * @return 1 if this is a partial file or its progress record, else 0
+ */
+int isPartialName(const TCHAR * name) {
+	const size_t partLen = (sizeof(PARTIAL_SUFFIX) / sizeof(TCHAR)) - 1;
+	const size_t infoLen = partLen + (sizeof(PARTIAL_INFO_SUFFIX) / sizeof(TCHAR)) - 1;
+	const size_t len = _tcslen(name);
+	if (len > partLen && _tcscmp(name + len - partLen, PARTIAL_SUFFIX) == 0) return 1;
+	if (len > infoLen
+		&& _tcsncmp(name + len - infoLen, PARTIAL_SUFFIX, partLen) == 0
+		&& _tcscmp(name + len - infoLen + partLen, PARTIAL_INFO_SUFFIX) == 0) return 1;
+	return 0;
+}
+
+/**
+ * Merge-joins the reference directories which correspond to the destination directory
+ * `ctx->dir` with the given source listing. The status of the entries found in a reference
+ * is fetched right away. References with manifest are looked up there instead.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in,out] listing - sorted source listing
+ * @param[in] level - traversal level of the listed entries
+ */
+void joinReferences(tContext * ctx, tDirListing * listing, const unsigned int level) {
+	const size_t dstArgLen = _tcslen(ctx->dstArg);
+	const TCHAR * rel = (_tcslen(ctx->dir) > (dstArgLen + 1)) ? (ctx->dir + dstArgLen + 1) : NULL;
+	const uint32_t refMask = currentRefMask(ctx, ctx->dir, level);
+	int i;
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		const uint32_t bit = UINT32_C(1) << i;
+		if ((refMask & bit) == 0 || ctx->refManifests[i] != NULL) continue;
+		if (rel != NULL && joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDests[i], rel, NULL) == 0) continue;
+		if (getDirFileStats((rel != NULL) ? ctx->ref : ctx->linkDests[i], listing->names, listing->count,
+			listing->refStats + i, (size_t)ctx->linkDestCount, listing->refFound, bit) != 0) {
+			listing->refKnown |= bit;
+		}
+	}
+}
+#endif /* not UNICODE */
+
+
+/**
+ * Retrieves the join result of the given source entry from the joined listing of its
+ * traversal level. The entries need to be passed in listing order.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] item - source entry name
+ * @param[in] level - traversal level of the entry
+ * @param[out] join - receives the join result (nothing known if not listed)
+ */
+void joinEntry(tContext * ctx, const TCHAR * item, const unsigned int level, tJoinResult * join) {
+	tDirListing * listing;
+	memset(join, 0, sizeof(*join));
+	if (item == NULL || level >= ctx->listingCapacity) return;
+	listing = ctx->listings + level;
+	while (listing->next < listing->count && _tcscmp(listing->names[listing->next], item) < 0) listing->next++;
+	if (listing->next >= listing->count || _tcscmp(listing->names[listing->next], item) != 0) return;
+	join->dstAbsent = (listing->dstKnown != 0 && listing->dstFound[listing->next] == 0) ? 1 : 0;
+	join->refKnown = listing->refKnown;
+	join->refFound = listing->refFound[listing->next];
+	join->refStats = listing->refStats + (listing->next * (size_t)ctx->linkDestCount);
+}
+
+
+/**
+ * Frees the joined directory listings.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void clearListings(tContext * ctx) {
+	size_t i;
+	for (i = 0; i < ctx->listingCapacity; i++) {
+		if (ctx->listings[i].names != NULL) free((void *)(ctx->listings[i].names));
+		if (ctx->listings[i].dstFound != NULL) free(ctx->listings[i].dstFound);
+		if (ctx->listings[i].refFound != NULL) free(ctx->listings[i].refFound);
+		if (ctx->listings[i].refStats != NULL) free(ctx->listings[i].refStats);
+	}
+	if (ctx->listings != NULL) free(ctx->listings);
+	if (ctx->joinNames != NULL) free((void *)(ctx->joinNames));
+	ctx->listings = NULL;
+	ctx->listingCapacity = 0;
+	ctx->joinNames = NULL;
+	ctx->joinCapacity = 0;
+}
+
+
+/**
+ * Serializes the given tree digest in little endian byte order.
+ *
+ * @param[out] buf - output buffer (DIGEST_SIZE bytes)
+ * @param[in] digest - tree digest (2 values)
+ */
+void putDigest(uint8_t * buf, const uint64_t * digest) {
+	size_t i;
+	for (i = 0; i < DIGEST_SIZE; i++) {
+		buf[i] = (uint8_t)(digest[i / 8] >> (8 * (i % 8)));
+	}
+}
+
+
+/**
+ * Starts the record hashes of a directory child. The record covers the name, type, size,
+ * modification time and mode. Size and modification time are left out for directories
+ * as their tree digest is added instead.
+ *
+ * @param[out] record - record hashes (2 states)
+ * @param[in] name - item name
+ * @param[in] stats - item status
+ * @param[in] isDir - set if the item is a directory
+ */
+void initDigestRecord(tHash64 * record, const TCHAR * name, const tFileStat * stats, const int isDir) {
+	uint8_t buf[21];
+	const uint64_t size = (isDir != 0) ? 0 : stats->size;
+	const uint64_t mtime = (isDir != 0) ? 0 : (uint64_t)stats->mtime;
+	size_t i;
+	buf[0] = (uint8_t)((isDir != 0) ? 1 : 0);
+	for (i = 0; i < 8; i++) {
+		buf[1 + i] = (uint8_t)(size >> (8 * i));
+		buf[9 + i] = (uint8_t)(mtime >> (8 * i));
+	}
+	for (i = 0; i < 4; i++) buf[17 + i] = (uint8_t)(stats->mode >> (8 * i));
+	for (i = 0; i < 2; i++) {
+		hs_init(record + i, (uint64_t)(i + 1));
+		hs_update(record + i, name, sizeof(TCHAR) * (_tcslen(name) + 1));
+		hs_update(record + i, buf, sizeof(buf));
+	}
+}
+
+
+/**
+ * Adds the record hashes of a directory child to the tree digest of its parent. Summing up
+ * keeps the digest independent of the directory listing order.
+ *
+ * @param[in,out] sum - tree digest of the parent directory (2 values)
+ * @param[in,out] record - record hashes of the child (2 states)
+ * @param[in] digest - tree digest of the child directory or NULL for other items
+ */
+void addDigestRecord(uint64_t * sum, tHash64 * record, const uint64_t * digest) {
+	uint8_t buf[DIGEST_SIZE];
+	size_t i;
+	if (digest != NULL) putDigest(buf, digest);
+	for (i = 0; i < 2; i++) {
+		if (digest != NULL) hs_update(record + i, buf, sizeof(buf));
+		sum[i] += hs_final(record + i);
+	}
+}
+
+
+/**
+ * Adds a new directory to the digest scan.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] src - source directory path
+ * @param[in] item - directory name (NULL for the source root)
+ * @param[in] childLevel - traversal level of the direct children
+ * @param[in] stats - source directory status
+ * @return 1 on success, 0 on error
+ */
+int pushDigestFrame(tContext * ctx, const TCHAR * src, const TCHAR * item, const unsigned int childLevel, const tFileStat * stats) {
+	tDigestEntry * entry;
+	tDigestFrame * frame;
+	const TCHAR * key;
+	size_t keyLen;
+	if (mapPath(ctx, src, ctx->dstArg, 0, ctx->dir, BUFFER_SIZE) == 0) return 0;
+	key = ctx->dir + _tcslen(ctx->dstArg) + 1;
+	keyLen = _tcslen(key) + 1;
+	if (ctx->digestCount >= ctx->digestCapacity) {
+		const size_t capacity = (ctx->digestCapacity > 0) ? (ctx->digestCapacity * 2) : 64;
+		tDigestEntry * digests = (tDigestEntry *)realloc(ctx->digests, sizeof(tDigestEntry) * capacity);
+		if (digests == NULL) return 0;
+		ctx->digests = digests;
+		ctx->digestCapacity = capacity;
+	}
+	if (ctx->digestDepth >= ctx->digestFrameCapacity) {
+		const size_t capacity = (ctx->digestFrameCapacity > 0) ? (ctx->digestFrameCapacity * 2) : 16;
+		tDigestFrame * frames = (tDigestFrame *)realloc(ctx->digestFrames, sizeof(tDigestFrame) * capacity);
+		if (frames == NULL) return 0;
+		ctx->digestFrames = frames;
+		ctx->digestFrameCapacity = capacity;
+	}
+	entry = ctx->digests + ctx->digestCount;
+	entry->key = (TCHAR *)malloc(sizeof(TCHAR) * keyLen);
+	if (entry->key == NULL) return 0;
+	memcpy(entry->key, key, sizeof(TCHAR) * keyLen);
+	entry->digest[0] = 0;
+	entry->digest[1] = 0;
+	entry->stats = *stats;
+	frame = ctx->digestFrames + ctx->digestDepth;
+	frame->childLevel = childLevel;
+	frame->entry = ctx->digestCount;
+	if (item != NULL) initDigestRecord(frame->record, item, stats, 1);
+	ctx->digestCount++;
+	ctx->digestDepth++;
+	return 1;
+}
+
+
+/**
+ * Completes the tree digests of the directories whose subtree was fully scanned and adds
+ * them to their parent directories.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] level - traversal level of the next item
+ * @param[in] all - set to complete all directories
+ */
+void popDigestFrames(tContext * ctx, const unsigned int level, const int all) {
+	while (ctx->digestDepth > 0) {
+		tDigestFrame * frame = ctx->digestFrames + ctx->digestDepth - 1;
+		if (all == 0 && frame->childLevel <= level) break;
+		ctx->digestDepth--;
+		if (ctx->digestDepth > 0) {
+			const tDigestFrame * parent = ctx->digestFrames + ctx->digestDepth - 1;
+			addDigestRecord(ctx->digests[parent->entry].digest, frame->record, ctx->digests[frame->entry].digest);
+		}
+	}
+}
+
+
+/**
+ * Traversing visitor to compute the tree digests of the source directories.
+ *
+ * @param[in] src - full path to the object
+ * @param[in] item - file name of the object
+ * @param[in] ext - file extension of the object
+ * @param[in] flags - item flags
+ * @param[in] level - current recursion depth
+ * @param[in] param - backup parameters (see tContext)
+ * @return 1 on success, 0 to abort
+ */
+int digestVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, const int flags,
+	const unsigned int level, void * param) {
+	tContext * ctx = (tContext *)param;
+	tFileStat stats;
+	tHash64 record[2];
+	PCF_UNUSED(ext)
+	if (signalReceived != 0) return 0;
+	popDigestFrames(ctx, level, 0);
+	if ((flags & TDF_ERROR) != 0 || getFileStat(src, &stats, 0) != 1) {
+		/* an incomplete scan could match by accident */
+		ctx->digestFailed = 1;
+		return 0;
+	}
+	if ((flags & TDF_DIR) != 0 && (flags & TDF_LINK) == 0) {
+		if (pushDigestFrame(ctx, src, item, level + 1, &stats) == 0) {
+			ctx->digestFailed = 1;
+			return 0;
+		}
+		return 1;
+	}
+	/* symlinks (file or directory) are never descended -> plain item */
+	initDigestRecord(record, item, &stats, 0);
+	addDigestRecord(ctx->digests[ctx->digestFrames[ctx->digestDepth - 1].entry].digest, record, NULL);
+	return 1;
+}
+
+
+/**
+ * Compares two tree digest entries by key.
+ *
+ * @param[in] a - first entry
+ * @param[in] b - second entry
+ * @return <0 if a < b, 0 if equal and >0 if a > b
+ */
+int cmpDigestEntry(const void * a, const void * b) {
+	return _tcscmp(((const tDigestEntry *)a)->key, ((const tDigestEntry *)b)->key);
+}
+
+
+/**
+ * Computes the tree digests of all directories of the given source directory.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] src - source directory path
+ * @return 1 on success, 0 on error
+ */
+int scanTreeDigests(tContext * ctx, const TCHAR * src) {
+	tFileStat stats;
+	clearTreeDigests(ctx);
+	ctx->digestFailed = 0;
+	if (getFileStat(src, &stats, 0) != 1 || pushDigestFrame(ctx, src, NULL, 0, &stats) == 0
+		|| td_traverseList(src, -1, TDO_DIRECTORY | TDO_ITEM | TDO_ERRORS, digestVisitor, (ctx->dirCacheMf != NULL) ? listDirectory : NULL, ctx) != 1) {
+		ctx->digestFailed = 1;
+	}
+	if (ctx->digestFailed != 0) {
+		/* digestFailed is kept to drop the outdated digests of the destination */
+		clearTreeDigests(ctx);
+		return 0;
+	}
+	popDigestFrames(ctx, 0, 1);
+	qsort(ctx->digests, ctx->digestCount, sizeof(tDigestEntry), cmpDigestEntry);
+	return 1;
+}
+
+
+/**
+ * Checks whether the given source directory tree matches the tree recorded for one of the
+ * references. The references are checked in priority order.
+ *
+ * @param[in] ctx - backup processing context
+ * @param[in] key - directory path relative to the destination root
+ * @param[in] refMask - references to check (bit per reference)
+ * @return index of the matching reference or -1
+ */
+int matchTreeDigest(const tContext * ctx, const TCHAR * key, const uint32_t refMask) {
+	tDigestEntry needle;
+	const tDigestEntry * entry;
+	tFileStat stats;
+	const void * data;
+	size_t dataLen;
+	uint8_t buf[DIGEST_SIZE];
+	int i;
+	if (ctx->digestCount == 0) return -1;
+	needle.key = (TCHAR *)key;
+	entry = (const tDigestEntry *)bsearch(&needle, ctx->digests, ctx->digestCount, sizeof(tDigestEntry), cmpDigestEntry);
+	if (entry == NULL) return -1;
+	putDigest(buf, entry->digest);
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		if ((refMask & (UINT32_C(1) << i)) == 0 || ctx->refDigestMfs[i] == NULL) continue;
+		if (mf_find(ctx->refDigestMfs[i], key, &stats, &data, &dataLen) != 0 && dataLen == DIGEST_SIZE
+			&& memcmp(buf, data, DIGEST_SIZE) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Records the tree digests of the current source in the destination.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void recordTreeDigests(tContext * ctx) {
+	uint8_t buf[DIGEST_SIZE];
+	size_t i;
+	for (i = 0; i < ctx->digestCount; i++) {
+		const tDigestEntry * entry = ctx->digests + i;
+		putDigest(buf, entry->digest);
+		if (mf_append(ctx->dstDigestMf, entry->key, &(entry->stats), buf, DIGEST_SIZE) == 0) break;
+	}
+}
+
+
+/**
+ * Frees the tree digests of the current source.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void clearTreeDigests(tContext * ctx) {
+	size_t i;
+	for (i = 0; i < ctx->digestCount; i++) free(ctx->digests[i].key);
+	free(ctx->digests);
+	free(ctx->digestFrames);
+	ctx->digests = NULL;
+	ctx->digestCount = 0;
+	ctx->digestCapacity = 0;
+	ctx->digestFrames = NULL;
+	ctx->digestDepth = 0;
+	ctx->digestFrameCapacity = 0;
+}
+
+
+#ifndef UNICODE
+/**
+ * Watch visitor which records a changed source path in the journal.
+ *
+ * @param[in] path - changed source path
+ * @param[in] kind - kind of change
+ * @param[in] id - index of the source argument
+ * @param[in,out] param - backup processing context
+ */
+void journalVisitor(const char * path, const tWatchKind kind, const size_t id, void * param) {
+	tContext * ctx = (tContext *)param;
+	tJournalEntry * entry;
+	size_t len;
+	if (kind == WTK_OVERFLOW) {
+		ctx->journalOverflow = 1;
+		return;
+	}
+	if (ctx->journalOverflow != 0) return; /* everything is rescanned anyway */
+	if (ctx->journalCount >= ctx->journalCapacity) {
+		const size_t capacity = (ctx->journalCapacity > 0) ? (ctx->journalCapacity * 2) : 64;
+		tJournalEntry * journal = (tJournalEntry *)realloc(ctx->journal, sizeof(tJournalEntry) * capacity);
+		if (journal == NULL) {
+			ctx->journalOverflow = 1;
+			return;
+		}
+		ctx->journal = journal;
+		ctx->journalCapacity = capacity;
+	}
+	entry = ctx->journal + ctx->journalCount;
+	len = _tcslen(path) + 1;
+	entry->path = (TCHAR *)malloc(sizeof(TCHAR) * len);
+	if (entry->path == NULL) {
+		ctx->journalOverflow = 1;
+		return;
+	}
+	memcpy(entry->path, path, sizeof(TCHAR) * len);
+	entry->kind = kind;
+	entry->id = id;
+	ctx->journalCount++;
+}
+
+
+/**
+ * Compares two journal entries by source argument and path.
+ *
+ * @param[in] a - first entry
+ * @param[in] b - second entry
+ * @return <0 if a < b, 0 if equal and >0 if a > b
+ */
+int cmpJournalEntry(const void * a, const void * b) {
+	const tJournalEntry * left = (const tJournalEntry *)a;
+	const tJournalEntry * right = (const tJournalEntry *)b;
+	if (left->id != right->id) return (left->id < right->id) ? -1 : 1;
+	return _tcscmp(left->path, right->path);
+}
+
+
+/**
+ * Checks whether the given journal entry is already covered by the entry of a parent
+ * directory. Whole trees cover all paths below them. The direct entries of a directory
+ * cover changes of its files.
+ *
+ * @param[in] ctx - backup processing context (journal sorted and unique)
+ * @param[in] entry - journal entry to check
+ * @return 1 if covered, else 0
+ */
+int isJournalCovered(const tContext * ctx, const tJournalEntry * entry) {
+	const size_t srcLen = _tcslen(ctx->srcArgs[entry->id]);
+	size_t len = _tcslen(entry->path);
+	tJournalEntry needle;
+	int res = 0;
+	int parent = 1;
+	if (len <= srcLen) return 0; /* source root */
+	needle.id = entry->id;
+	needle.path = (TCHAR *)malloc(sizeof(TCHAR) * (len + 1));
+	if (needle.path == NULL) return 0;
+	memcpy(needle.path, entry->path, sizeof(TCHAR) * (len + 1));
+	while (res == 0 && len > srcLen) {
+		const tJournalEntry * found;
+		/* strip the last path element (keep the separator of a source argument like "src/") */
+		while (len > 0 && _tcschr(PATH_SEPS, needle.path[len - 1]) == NULL) len--;
+		if (len == 0) break;
+		needle.path[(len == srcLen) ? len : (len - 1)] = 0;
+		len--;
+		found = (const tJournalEntry *)bsearch(&needle, ctx->journal, ctx->journalCount, sizeof(tJournalEntry), cmpJournalEntry);
+		if (found != NULL && (found->kind == WTK_TREE || (parent != 0 && found->kind == WTK_DIR && entry->kind == WTK_FILE))) {
+			res = 1;
+		}
+		parent = 0;
+	}
+	free(needle.path);
+	return res;
+}
+
+
+/**
+ * Completes the backup of changed files within the given source directory by correcting
+ * the timestamps of the corresponding destination directory.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] parent - source directory of the changed files
+ */
+void finishJournalParent(tContext * ctx, const TCHAR * parent) {
+	drainOperations(ctx);
+	dirStackConsume(ctx, 0);
+	if (ctx->rootModified != 0 && (ctx->attrMask & AT_TIMES) != 0 && signalReceived == 0) {
+		backupVisitor(parent, NULL, NULL, TDF_DIR, 0, ctx);
+	}
+	ctx->rootModified = 0;
+}
+
+
+/**
+ * Backs up the changed source paths of the journal. Directories are processed without their
+ * sub directories unless these appeared as a whole.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return 1 on success, 0 if aborted (signal)
+ */
+int backupJournal(tContext * ctx) {
+	size_t i, count = 0;
+	TCHAR * parent = NULL;
+	int res = 1;
+	if (ctx->journalCount == 0) return 1;
+	/* sort and merge duplicates into the widest kind of change */
+	qsort(ctx->journal, ctx->journalCount, sizeof(tJournalEntry), cmpJournalEntry);
+	for (i = 0; i < ctx->journalCount; i++) {
+		if (count > 0 && cmpJournalEntry(ctx->journal + count - 1, ctx->journal + i) == 0) {
+			if (ctx->journal[i].kind > ctx->journal[count - 1].kind) ctx->journal[count - 1].kind = ctx->journal[i].kind;
+			free(ctx->journal[i].path);
+		} else {
+			ctx->journal[count++] = ctx->journal[i];
+		}
+	}
+	ctx->journalCount = count;
+	if (ctx->verbose > 1) _tprintf(_T("Backing up %u changed paths.\n"), (unsigned)count);
+	for (i = 0; res != 0 && i < ctx->journalCount && signalReceived == 0; i++) {
+		const tJournalEntry * entry = ctx->journal + i;
+		const TCHAR * path = entry->path;
+		if ((int)entry->id >= ctx->srcCount || isJournalCovered(ctx, entry) != 0) continue;
+		ctx->srcIndex = (int)entry->id;
+		if (isSymlink(path) == 0 && isDirectory(path) != 0) {
+			res = backupTree(ctx, path, (entry->kind == WTK_TREE) ? -1 : 0);
+		} else if (_tcscmp(path, ctx->srcArgs[ctx->srcIndex]) == 0) {
+			/* file or symbolic link as source argument */
+			res = backupSource(ctx);
+		} else if (isSymlink(path) != 0 || isFile(path) != 0) {
+			const TCHAR * item = _tcsrpbrk(path, PATH_SEPS);
+			const TCHAR * ext;
+			const size_t parentLen = (item != NULL) ? (size_t)(item - path) : 0;
+			item = (item != NULL) ? (item + 1) : path;
+			ext = _tcsrchr(item, _T('.'));
+			if (ext == NULL) ext = item + _tcslen(item);
+			/* the parent times are corrected once all changed files within it are done */
+			if (parent == NULL || _tcsncmp(parent, path, parentLen) != 0 || parent[parentLen] != 0) {
+				if (parent != NULL) {
+					finishJournalParent(ctx, parent);
+					free(parent);
+				}
+				parent = (TCHAR *)malloc(sizeof(TCHAR) * (parentLen + 1));
+				if (parent == NULL) {
+					_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * (parentLen + 1)));
+					ctx->hadError = 1;
+					continue;
+				}
+				memcpy(parent, path, sizeof(TCHAR) * parentLen);
+				parent[parentLen] = 0;
+				ctx->rootModified = 0;
+				ctx->linkTree = 0;
+				if (ctx->linkDestCount > 0 && setRefMask(ctx, 0, ~UINT32_C(0)) == 0) ctx->hadError = 1;
+			}
+			if (res != 0) res = backupVisitor(path, item, ext, TDF_FILE, 0, ctx);
+		} /* else: removed meanwhile -> nothing to back up */
+	}
+	if (parent != NULL) {
+		finishJournalParent(ctx, parent);
+		free(parent);
+	}
+	drainOperations(ctx);
+	clearJournal(ctx);
+	return res;
+}
+
+
+/**
+ * Watches the sources for changes and backs up the changed paths until a signal is received.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return 1 on success, 0 on error or if aborted within a backup
+ */
+int watchSources(tContext * ctx) {
+	time_t first = 0;
+	for (;;) {
+		const int rc = wt_read(ctx->watcher, WATCH_SETTLE_MS, journalVisitor, ctx);
+		if (signalReceived != 0) return 1;
+		if (rc < 0) {
+			_ftprintf(stderr, _T("Error: Failed to read the file system changes.\n"));
+			return 0;
+		}
+		if (ctx->journalCount == 0 && ctx->journalOverflow == 0) continue;
+		if (first == 0) first = time(NULL);
+		/* wait until the changes settle down (but not forever) */
+		if (rc > 0 && (time(NULL) - first) < WATCH_MAX_DELAY) continue;
+		first = 0;
+		if (ctx->dstManifest != NULL) {
+			/* entries appended by the last backup are only visible after reopening */
+			if (mf_close(ctx->dstManifest) == 0 && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to update the manifest of \"%s\".\n"), ctx->dstArg);
+			}
+			ctx->dstManifest = mf_open(ctx->dstArg, MANIFEST_NAME, 1);
+			if (ctx->dstManifest == NULL && ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to open the manifest of \"%s\".\n"), ctx->dstArg);
+			}
+		}
+		if (ctx->journalOverflow != 0) {
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Lost file system changes. Rescanning all sources.\n"));
+			clearJournal(ctx);
+			for (ctx->srcIndex = 0; ctx->srcIndex < ctx->srcCount; ctx->srcIndex++) {
+				if (wt_add(ctx->watcher, ctx->srcArgs[ctx->srcIndex], (size_t)ctx->srcIndex) == 0 && ctx->verbose > 0) {
+					_ftprintf(stderr, _T("Warning: Failed to watch \"%s\" for changes.\n"), ctx->srcArgs[ctx->srcIndex]);
+				}
+			}
+			for (ctx->srcIndex = 0; signalReceived == 0 && ctx->srcIndex < ctx->srcCount; ctx->srcIndex++) {
+				if (backupSource(ctx) == 0) return 0; /* signal */
+			}
+			drainOperations(ctx);
+		} else if (backupJournal(ctx) == 0) {
+			return 0; /* signal */
+		}
+	}
+}
+#endif /* not UNICODE */
+
+
+/**
+ * Frees the journal of changed source paths.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void clearJournal(tContext * ctx) {
+	size_t i;
+	for (i = 0; i < ctx->journalCount; i++) free(ctx->journal[i].path);
+	free(ctx->journal);
+	ctx->journal = NULL;
+	ctx->journalCount = 0;
+	ctx->journalCapacity = 0;
+	ctx->journalOverflow = 0;
+}
+
+
+/**
+ * Compares two checkpoint entries by source argument index and key.
+ *
+ * @param[in] a - left entry
+ * @param[in] b - right entry
+ * @return <0 if a < b, 0 if a == b, >0 if a > b
+ */
+int cmpCheckpointEntry(const void * a, const void * b) {
+	const tCheckpointEntry * left = (const tCheckpointEntry *)a;
+	const tCheckpointEntry * right = (const tCheckpointEntry *)b;
+	if (left->id != right->id) return (left->id < right->id) ? -1 : 1;
+	return _tcscmp(left->key, right->key);
+}
+
+
+/**
+ * Reads the line of the checkpoint journal into the given buffer without its line break.
+ *
+ * @param[in,out] fp - checkpoint journal
+ * @param[out] buf - line buffer of BUFFER_SIZE characters
+ * @return 1 on success, 0 at the end of the journal or for an incomplete line
+ */
+int readCheckpointLine(FILE * fp, TCHAR * buf) {
+	size_t len;
+	if (_fgetts(buf, BUFFER_SIZE, fp) == NULL) return 0;
+	len = _tcslen(buf);
+	/* a line without line break was cut by an interruption or is too long */
+	if (len == 0 || buf[len - 1] != _T('\n')) return 0;
+	buf[len - 1] = 0;
+	return 1;
+}
+
+
+/**
+ * Loads the completed directories from the given checkpoint journal if it was written for
+ * the same source arguments.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] path - checkpoint journal path
+ * @return 1 if the journal was loaded, 0 if it is missing, invalid or for other sources
+ */
+int loadCheckpoint(tContext * ctx, const TCHAR * path) {
+	TCHAR * buffer = NULL;
+	TCHAR * end;
+	size_t capacity = 0;
+	int res = 0;
+	int i;
+	FILE * fp = _tfopen(path, _T("r"));
+	if (fp == NULL) return 0;
+	buffer = (TCHAR *)malloc(sizeof(TCHAR) * BUFFER_SIZE);
+	if (buffer == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * BUFFER_SIZE));
+		goto onError;
+	}
+	/* header: format, source arguments and an empty line */
+	if (readCheckpointLine(fp, buffer) == 0 || _tcscmp(buffer, CHECKPOINT_MAGIC) != 0) goto onError;
+	for (i = 0; i < ctx->srcCount; i++) {
+		if (readCheckpointLine(fp, buffer) == 0 || _tcscmp(buffer, ctx->srcArgs[i]) != 0) goto onError;
+	}
+	if (readCheckpointLine(fp, buffer) == 0 || *buffer != 0) goto onError;
+	/* completed directories as "<source index>\t<key>" */
+	while (readCheckpointLine(fp, buffer) != 0) {
+		tCheckpointEntry * entry;
+		size_t keyLen;
+		const unsigned long id = _tcstoul(buffer, &end, 10);
+		if (end == buffer || *end != _T('\t') || id >= (unsigned long)ctx->srcCount) break;
+		if (ctx->checkpointCount >= capacity) {
+			const size_t newCapacity = (capacity > 0) ? (capacity * 2) : 256;
+			tCheckpointEntry * newEntries = (tCheckpointEntry *)realloc(ctx->checkpoints, sizeof(tCheckpointEntry) * newCapacity);
+			if (newEntries == NULL) break;
+			ctx->checkpoints = newEntries;
+			capacity = newCapacity;
+		}
+		keyLen = _tcslen(end + 1) + 1;
+		entry = ctx->checkpoints + ctx->checkpointCount;
+		entry->id = (size_t)id;
+		entry->key = (TCHAR *)malloc(sizeof(TCHAR) * keyLen);
+		if (entry->key == NULL) break;
+		memcpy(entry->key, end + 1, sizeof(TCHAR) * keyLen);
+		ctx->checkpointCount++;
+	}
+	if (ctx->checkpointCount > 0) {
+		qsort(ctx->checkpoints, ctx->checkpointCount, sizeof(tCheckpointEntry), cmpCheckpointEntry);
+	}
+	res = 1;
+onError:
+	fclose(fp);
+	if (buffer != NULL) free(buffer);
+	return res;
+}
+
+
+/**
+ * Opens the checkpoint journal within the destination. The completed directories of an
+ * interrupted backup of the same sources are loaded and further ones are appended. Otherwise
+ * a new journal is started.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return 1 on success, 0 on error
+ */
+int openCheckpoint(tContext * ctx) {
+	int i;
+	if (joinPath(ctx->ref, BUFFER_SIZE, ctx->dstArg, CHECKPOINT_NAME, NULL) == 0) return 0;
+	if (loadCheckpoint(ctx, ctx->ref) != 0) {
+		ctx->checkpointFp = _tfopen(ctx->ref, _T("a"));
+		if (ctx->checkpointFp == NULL) return 0;
+		if (ctx->verbose > 1) _tprintf(_T("Resuming with %u completed directories.\n"), (unsigned)ctx->checkpointCount);
+	} else {
+		ctx->checkpointFp = _tfopen(ctx->ref, _T("w"));
+		if (ctx->checkpointFp == NULL) return 0;
+		_ftprintf(ctx->checkpointFp, _T("%s\n"), CHECKPOINT_MAGIC);
+		for (i = 0; i < ctx->srcCount; i++) _ftprintf(ctx->checkpointFp, _T("%s\n"), ctx->srcArgs[i]);
+		_ftprintf(ctx->checkpointFp, _T("\n"));
+	}
+	ctx->checkpointTime = time(NULL);
+	return (fflush(ctx->checkpointFp) == 0) ? 1 : 0;
+}
+
+
+/**
+ * Checks whether the given destination directory was completed by the interrupted backup.
+ *
+ * @param[in] ctx - backup processing context
+ * @param[in] key - destination directory relative to the destination root
+ * @return 1 if completed, else 0
+ */
+int isCheckpointed(const tContext * ctx, const TCHAR * key) {
+	tCheckpointEntry entry;
+	if (ctx->checkpointCount == 0) return 0;
+	entry.id = (size_t)ctx->srcIndex;
+	entry.key = (TCHAR *)key;
+	return (bsearch(&entry, ctx->checkpoints, ctx->checkpointCount, sizeof(tCheckpointEntry), cmpCheckpointEntry) != NULL) ? 1 : 0;
+}
+
+
+/**
+ * Records the given destination directory as completed in the checkpoint journal. The
+ * journal is written at most every CHECKPOINT_INTERVAL seconds.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] key - destination directory relative to the destination root
+ */
+void recordCheckpoint(tContext * ctx, const TCHAR * key) {
+	time_t now;
+	/* line breaks within the name cannot be recorded -> process the directory again */
+	if (_tcschr(key, _T('\n')) != NULL) return;
+	_ftprintf(ctx->checkpointFp, _T("%u\t%s\n"), (unsigned)ctx->srcIndex, key);
+	now = time(NULL);
+	if ((now - ctx->checkpointTime) >= CHECKPOINT_INTERVAL) {
+		fflush(ctx->checkpointFp);
+		ctx->checkpointTime = now;
+	}
+}
+
+
+/**
+ * Closes the checkpoint journal. It is removed if the backup was not interrupted as the
+ * recorded state is outdated by the next backup.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] complete - the backup was not interrupted
+ */
+void closeCheckpoint(tContext * ctx, const int complete) {
+	size_t i;
+	if (ctx->checkpointFp != NULL) {
+		if (fclose(ctx->checkpointFp) != 0 && complete == 0 && ctx->verbose > 0) {
+			_ftprintf(stderr, _T("Warning: Failed to write the checkpoint journal of \"%s\".\n"), ctx->dstArg);
+		}
+		ctx->checkpointFp = NULL;
+		if (complete != 0 && joinPath(ctx->ref, BUFFER_SIZE, ctx->dstArg, CHECKPOINT_NAME, NULL) != 0) {
+			_tremove(ctx->ref);
+		}
+	}
+	for (i = 0; i < ctx->checkpointCount; i++) free(ctx->checkpoints[i].key);
+	free(ctx->checkpoints);
+	ctx->checkpoints = NULL;
+	ctx->checkpointCount = 0;
+}
+
+
+/**
+ * Creates the given destination directory. The last created directory is remembered as all
+ * its ancestors exist as well. Hence, a sub directory in depth-first order is created with a
+ * single call instead of checking each path component.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] path - destination directory path
+ * @return 1 on success, 0 on failure
+ */
+int createDestDirectory(tContext * ctx, const TCHAR * path) {
+	size_t existing = 0;
+	size_t i;
+	/* longest common ancestor of both paths (the path itself is checked again) */
+	for (i = 0; path[i] != 0 && i <= ctx->knownDirLen; i++) {
+		if (_tcschr(PATH_SEPS, path[i]) != NULL && (i == ctx->knownDirLen || _tcschr(PATH_SEPS, ctx->knownDir[i]) != NULL)) {
+			existing = i;
+		}
+		if (i == ctx->knownDirLen || path[i] != ctx->knownDir[i]) break;
+	}
+	if (createDirectory(path, existing, ctx->verbose) == 0) {
+		ctx->knownDirLen = existing;
+		return 0;
+	}
+	i = _tcslen(path);
+	if (i < BUFFER_SIZE) {
+		memcpy(ctx->knownDir, path, sizeof(TCHAR) * i);
+		ctx->knownDirLen = i;
+	} else {
+		ctx->knownDirLen = existing;
+	}
+	return 1;
+}
+
+
+/**
+ * Directory stack finalizer. Re-applies the modification time if the subtree changed and
+ * records the completed directory in the checkpoint journal (unless created in advance).
+ *
+ * @param[in] frame - directory frame being finalized
+ * @param[in,out] param - backup processing context
+ */
+void dirStackFinalize(const tDirStackFrame * frame, void * param) {
+	tContext * ctx = (tContext *)param;
+	if (frame->modified != 0 && signalReceived == 0 && (ctx->attrMask & AT_TIMES) != 0 && ctx->skeletonBuilt == 0) {
+		if (countAttributes(ctx, copyAttributes(frame->src, frame->dst, (tAttrMask)(ctx->attrMask & AT_TIMES), ctx->verbose)) == 0) {
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Failed to correct timestamps on \"%s\".\n"), frame->dst);
+			ctx->hadError = 1;
+		}
+	}
+	/* only a subtree without any failure so far is known to be complete; directories
+	 * created in advance are recorded by finishSkeleton() once their attributes are set */
+	if (ctx->checkpointFp != NULL && signalReceived == 0 && ctx->hadError == 0 && ctx->skeletonBuilt == 0) {
+		recordCheckpoint(ctx, frame->dst + _tcslen(ctx->dstArg) + 1);
+	}
+}
+
+
+/**
+ * Marks the parent directory of the item currently processed as modified so its
+ * timestamps are corrected when its subtree completes.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void dirStackMarkParent(tContext * ctx) {
+	if (ds_markTop(&ctx->dirStack) == 0) {
+		ctx->rootModified = 1;
+	}
+}
+
+
+/**
+ * Waits for the outstanding file operations of all directories at or below the given level
+ * and finalizes them afterwards.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] level - finalize every directory with this level or deeper
+ */
+void dirStackConsume(tContext * ctx, const unsigned int level) {
+	while (ds_pending(&ctx->dirStack, level) > 0) {
+		if (reapOperations(ctx) == 0) break; /* nothing outstanding anymore */
+	}
+	ds_consume(&ctx->dirStack, level, dirStackFinalize, ctx);
+}
+
+
+/**
+ * Waits until at least one file operation or directory removal of --delete completed and
+ * completes all finished ones.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return number of completed work items (0 if none was outstanding)
+ */
+size_t reapOperations(tContext * ctx) {
+#ifndef UNICODE
+	size_t count;
+	if (ctx->prunePool != NULL) {
+		submitPruneDirs(ctx, ctx->prunePool);
+		count = wp_reap(ctx->pool, (ctx->pruneActive == 0) ? 1 : 0) + wp_reap(ctx->prunePool, 0);
+		if (count == 0 && ctx->pruneActive > 0) count = wp_reap(ctx->prunePool, 1);
+		return count;
+	}
+#endif
+	return wp_reap(ctx->pool, 1);
+}
+
+
+/**
+ * Waits until all file operations and directory removals of --delete completed.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void drainOperations(tContext * ctx) {
+	wp_drain(ctx->pool);
+#ifndef UNICODE
+	/* removals never queue further file operations */
+	if (ctx->prunePool != NULL) drainPruneDirs(ctx, ctx->prunePool);
+#endif
+}
+
+
+/**
+ * Backs up the current source argument `ctx->srcArgs[ctx->srcIndex]`.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @return 1 on success, 0 if aborted (signal)
+ */
+int backupSource(tContext * ctx) {
+	TCHAR * src = ctx->srcArgs[ctx->srcIndex];
+	if (isSymlink(src) != 0 || isFile(src) != 0) {
+		/* file / symbolic link copied as a link (or skipped) and never followed */
+		/* separator after a link resolves to the target (handled below)  */
+		if (backupVisitor(src, NULL, NULL, 0, 0, ctx) == 0) return 0; /* signal */
+		if (ctx->verbose > 1) _ftprintf(stderr, _T("Finished backing up \"%s\".\n"), src);
+	} else if (isDirectory(src) != 0) {
+		if (destWithinSource(src, ctx->dstArg) != 0) {
+			/* endless recursion case */
+			_ftprintf(stderr, _T("Error: Cannot back up directory \"%s\" into itself \"%s\".\n"), src, ctx->dstArg);
+			ctx->hadError = 1;
+			return 1;
+		}
+		/* digests are needed before the first directory can be matched against the reference */
+		if (ctx->treeDigest != 0 && (ctx->dstDigestMf != NULL || ctx->linkDestCount > 0) && ctx->recursive != 0
+			&& scanTreeDigests(ctx, src) == 0 && signalReceived == 0 && ctx->verbose > 0) {
+			_ftprintf(stderr, _T("Warning: Failed to compute the tree digests of \"%s\".\n"), src);
+		}
+		if (backupTree(ctx, src, (ctx->recursive == 0) ? 0 : -1) == 0) return 0; /* signal */
+		if (ctx->dstDigestMf != NULL) {
+			/* only a complete backup may be described by its tree digests */
+			if (ctx->hadError == 0 && ctx->digestFailed == 0 && signalReceived == 0) {
+				recordTreeDigests(ctx);
+			} else {
+				mf_invalidate(ctx->dstDigestMf);
+			}
+		}
+		clearTreeDigests(ctx);
+		if (ctx->verbose > 1) _ftprintf(stderr, _T("Finished backing up \"%s\".\n"), src);
+	} else {
+		_ftprintf(stderr, _T("Error: Could not find source \"%s\".\n"), src);
+		ctx->hadError = 1;
+	}
+	return 1;
 }
 
 
 /**
- * Directory stack finalizer. Re-applies the modification time if the subtree changed.
+ * Creates the destination directories of the given source tree in advance (--dirs-first).
+ * The directories are listed without querying the status of each entry. Their source paths
+ * are recorded to apply the directory attributes once all files have been copied. This way
+ * the following traversal only queues file operations without waiting for any directory to
+ * complete. It handles the directories as usual if the skeleton could not be recorded.
  *
- * @param[in] frame - directory frame being finalized
- * @param[in,out] param - backup processing context
+ * @param[in,out] ctx - backup processing context
+ * @param[in] src - source directory path
+ * @param[in] maxLevel - maximum traversal depth (-1 for unlimited)
+ * @return 1 on success, 0 if aborted (signal)
  */
-void dirStackFinalize(const tDirStackFrame * frame, void * param) {
+int buildSkeleton(tContext * ctx, const TCHAR * src, const int maxLevel) {
+	int visited;
+	ctx->skeletonLen = 0;
+	ctx->skeletonBuilt = 1;
+	visited = td_traverse(src, maxLevel, TDO_DIRECTORY | TDO_NO_STAT, skeletonVisitor, ctx);
+	if (signalReceived != 0) {
+		ctx->skeletonBuilt = 0;
+		return 0;
+	}
+	if (visited == 0) ctx->skeletonBuilt = 0; /* out of memory */
+	return 1;
+}
+
+
+/**
+ * Traversing visitor to create a single destination directory in advance.
+ *
+ * @param[in] src - full path to the source directory
+ * @param[in] item - file name of the source directory
+ * @param[in] ext - file extension of the source directory
+ * @param[in] flags - item flags
+ * @param[in] level - current recursion depth
+ * @param[in] param - backup parameters (see tContext)
+ * @return 1 on success, TDR_SKIP to skip the sub directories, 0 to abort
+ */
+int skeletonVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, const int flags,
+	const unsigned int level, void * param) {
+	if (signalReceived != 0) return 0;
+	PCF_UNUSED(item)
+	PCF_UNUSED(ext)
 	tContext * ctx = (tContext *)param;
-	if (frame->modified != 0 && signalReceived == 0 && (ctx->attrMask & AT_TIMES) != 0) {
-		if (copyAttributes(frame->src, frame->dst, (tAttrMask)(ctx->attrMask & AT_TIMES), ctx->verbose) == 0) {
-			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Failed to correct timestamps on \"%s\".\n"), frame->dst);
+	/* errors and symlinks are reported by the following traversal */
+	if (flags != TDF_DIR) return 1;
+	if (mapPath(ctx, src, ctx->dstArg, 0, ctx->dst, BUFFER_SIZE) == 0) return TDR_SKIP;
+	if (ctx->checkpointCount > 0 && isCheckpointed(ctx, ctx->dst + _tcslen(ctx->dstArg) + 1) != 0) {
+		return TDR_SKIP;
+	}
+	if (createDestDirectory(ctx, ctx->dst) == 0) {
+		/* the files below fail and are reported by the following traversal */
+		_ftprintf(stderr, _T("Error: Failed creating destination path \"%s\".\n"), ctx->dst);
+		ctx->hadError = 1;
+		return TDR_SKIP;
+	}
+	if (level == 0) ctx->rootModified = 1;
+	const size_t len = _tcslen(src) + 1;
+	if ((ctx->skeletonLen + len) > ctx->skeletonCapacity) {
+		size_t capacity = (ctx->skeletonCapacity > 0) ? (ctx->skeletonCapacity * 2) : (BUFFER_SIZE * 4);
+		while (capacity < (ctx->skeletonLen + len)) capacity *= 2;
+		TCHAR * skeleton = (TCHAR *)realloc(ctx->skeleton, sizeof(TCHAR) * capacity);
+		if (skeleton == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * capacity));
+			return 0;
+		}
+		ctx->skeleton = skeleton;
+		ctx->skeletonCapacity = capacity;
+	}
+	memcpy(ctx->skeleton + ctx->skeletonLen, src, sizeof(TCHAR) * len);
+	ctx->skeletonLen += len;
+	return 1;
+}
+
+
+/**
+ * Applies the attributes of the directories created in advance by buildSkeleton() and
+ * records them in the checkpoint journal afterwards. The deepest directories are handled
+ * first as their parents are not modified afterwards.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void finishSkeleton(tContext * ctx) {
+	size_t end = ctx->skeletonLen;
+	while (end > 0 && signalReceived == 0) {
+		size_t start = end - 1;
+		while (start > 0 && ctx->skeleton[start - 1] != 0) start--;
+		const TCHAR * src = ctx->skeleton + start;
+		end = start;
+		if (mapPath(ctx, src, ctx->dstArg, 0, ctx->dst, BUFFER_SIZE) == 0) continue;
+		if (countAttributes(ctx, copyAttributes(src, ctx->dst, ctx->attrMask, ctx->verbose)) == 0) {
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Failed to copy attributes to \"%s\".\n"), ctx->dst);
 			ctx->hadError = 1;
 		}
+		/* complete only now -> an interrupted run needs to apply the attributes again */
+		if (ctx->checkpointFp != NULL && signalReceived == 0 && ctx->hadError == 0 && _tcslen(ctx->dst) > _tcslen(ctx->dstArg)) {
+			recordCheckpoint(ctx, ctx->dst + _tcslen(ctx->dstArg) + 1);
+		}
 	}
+	ctx->skeletonLen = 0;
+	ctx->skeletonBuilt = 0;
 }
 
 
 /**
- * Marks the parent directory of the item currently processed as modified so its
- * timestamps are corrected when its subtree completes.
+ * Backs up the given source directory of the current source argument and its entries.
  *
  * @param[in,out] ctx - backup processing context
+ * @param[in] src - source directory path (the source argument or a path below it)
+ * @param[in] maxLevel - maximum traversal depth (-1 for unlimited, 0 for direct entries only)
+ * @return 1 on success, 0 if aborted (signal)
  */
-void dirStackMarkParent(tContext * ctx) {
-	if (ds_markTop(&ctx->dirStack) == 0) {
-		ctx->rootModified = 1;
+int backupTree(tContext * ctx, const TCHAR * src, const int maxLevel) {
+	int visited;
+	/* needed to create output folder (errors are flagged inside, not fatal) */
+	ctx->rootModified = 0;
+	ctx->linkTree = 0;
+	ctx->skeletonBuilt = 0;
+	backupVisitor(src, NULL, NULL, TDF_DIR, 0, ctx);
+	if (ctx->dirsFirst != 0 && ctx->recursive != 0 && maxLevel != 0) {
+		if (buildSkeleton(ctx, src, maxLevel) == 0) return 0; /* signal */
+	}
+	/* process directory tree */
+	visited = td_traverseList(src, maxLevel, TDO_DIRECTORY | TDO_ITEM | TDO_ERRORS, backupVisitor,
+		(ctx->deleteExtra != 0 || ctx->joinRefs != 0) ? joinDirectory : ((ctx->dirCacheMf != NULL) ? listDirectory : NULL), ctx);
+	drainOperations(ctx);
+	dirStackConsume(ctx, 0);
+	ctx->linkTree = 0;
+	clearListings(ctx);
+	if (visited != 1 && visited != -1) {
+		ctx->skeletonBuilt = 0;
+		return 0; /* visitor aborted (signal) */
 	}
+	if (visited == -1) {
+		/* partial backup due to errors -> keep going */
+		ctx->hadError = 1;
+	}
+	if (ctx->skeletonBuilt != 0) finishSkeleton(ctx);
+	/* correct the root directory timestamp if any top-level child was written */
+	if (ctx->rootModified != 0 && (ctx->attrMask & AT_TIMES) != 0 && signalReceived == 0) {
+		backupVisitor(src, NULL, NULL, TDF_DIR, 0, ctx);
+	}
+	return 1;
 }
 
 
@@ -401,8 +3341,15 @@ int backupVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, cons
 	tContext * ctx = (tContext *)param;
 	/* ignore root and single file calls */
 	const int fromTraversal = (item != NULL);
+	ctx->itemCount++;
+#ifndef UNICODE
+	if (ctx->progressFd >= 0) reportProgress(ctx);
+#endif
+	if (ctx->linkTree != 0 && fromTraversal && level < ctx->linkLevel) {
+		ctx->linkTree = 0; /* left the subtree matching the reference tree digest */
+	}
 	if ((flags & TDF_ERROR) != 0) {
-		if ( fromTraversal ) ds_consume(&ctx->dirStack, level, dirStackFinalize, ctx);
+		if ( fromTraversal ) dirStackConsume(ctx, level);
 		_ftprintf(stderr, _T("Error: Failed to read directory \"%s\".\n"), src);
 		ctx->hadError = 1;
 		return 1;
@@ -414,40 +3361,23 @@ int backupVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, cons
 	}
 	/* without --recursive sub directories are skipped entirely */
 	if (itemFlags == TDF_DIR && fromTraversal && ctx->recursive == 0) {
-		ds_consume(&ctx->dirStack, level, dirStackFinalize, ctx);
+		dirStackConsume(ctx, level);
 		return 1;
 	}
 	/* finalize directories whose subtree is now complete before handling this item */
-	if ( fromTraversal ) ds_consume(&ctx->dirStack, level, dirStackFinalize, ctx);
+	if ( fromTraversal ) dirStackConsume(ctx, level);
 	const TCHAR * srcArg = ctx->srcArgs[ctx->srcIndex];
-	size_t srcLen = _tcslen(srcArg);
+	const size_t srcLen = _tcslen(srcArg);
 	int ok;
 	const int trailingSep = (srcLen > 0 && _tcschr(PATH_SEPS, srcArg[srcLen - 1]) != NULL);
-	const TCHAR * srcBase = _tcsrpbrk(srcArg, PATH_SEPS);
-	if (srcBase == NULL) {
-		srcBase = srcArg;
-	} else {
-		srcBase++; /* skip path separator */
-	}
-	if (_tcslen(src) > srcLen && trailingSep == 0) {
-		srcLen++; /* skip separator between source and relative path */
-	}
-	const TCHAR * rel = src + srcLen; /* path relative to source ("" for the root) */
 	/* construct destination path */
 	if (ctx->dstIsFile != 0) {
 		/* single file copied to an explicit destination file path */
 		const size_t dstArgLen = _tcslen(ctx->dstArg);
 		ok = (dstArgLen < BUFFER_SIZE) ? 1 : 0;
 		if (ok != 0) memcpy(ctx->dst, ctx->dstArg, sizeof(TCHAR) * (dstArgLen + 1));
-	} else if (itemFlags == TDF_FILE && item == NULL) {
-		/* single file */
-		ok = joinPath(ctx->dst, BUFFER_SIZE, ctx->dstArg, srcBase, NULL);
-	} else if (trailingSep != 0) {
-		/* "src/" copies the contents of src into the destination */
-		ok = joinPath(ctx->dst, BUFFER_SIZE, ctx->dstArg, rel, NULL);
 	} else {
-		/* "src" copies the src directory itself into the destination */
-		ok = joinPath(ctx->dst, BUFFER_SIZE, ctx->dstArg, srcBase, rel);
+		ok = mapPath(ctx, src, ctx->dstArg, (itemFlags == TDF_FILE && item == NULL) ? 1 : 0, ctx->dst, BUFFER_SIZE);
 	}
 	if (ok == 0) {
 		if (ctx->verbose > 0) _ftprintf(stderr, _T("Error: Destination path \"%s\" is too long.\n"), ctx->dst);
@@ -456,100 +3386,560 @@ int backupVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, cons
 	}
 	/* backup source to destination */
 	if (itemFlags == TDF_DIR) {
-		if (createDirectory(ctx->dst, ctx->verbose) == 0) {
-			/* recoverable single directory failure -> partial backup, keep going */
-			_ftprintf(stderr, _T("Error: Failed creating destination path \"%s\".\n"), ctx->dst);
-			ctx->hadError = 1;
-			return 1;
+		if (fromTraversal && ctx->checkpointCount > 0 && isCheckpointed(ctx, ctx->dst + _tcslen(ctx->dstArg) + 1) != 0) {
+			/* completed by the interrupted backup */
+			if (ctx->verbose > 1) _tprintf(_T("Skipping completed directory \"%s\".\n"), src);
+			return TDR_SKIP;
 		}
-		/* update parent's mtime on sub directory creation */
-		if ( fromTraversal ) dirStackMarkParent(ctx);
-		/* "src/" copies the contents into the destination root and leaves the
-		 * root's own attributes/timestamps untouched (like rsync) */
-		if ((item != NULL || trailingSep == 0)
-			&& copyAttributes(src, ctx->dst, ctx->attrMask, ctx->verbose) == 0) {
-			if (ctx->verbose > 0) {
-				_ftprintf(stderr, _T("Warning: Failed to copy attributes to \"%s\".\n"), ctx->dst);
+		/* the directory is listed next if descended */
+		ctx->listLevel = fromTraversal ? (level + 1) : 0;
+		/* directories created in advance get their attributes after all files were copied */
+		const int skeleton = (fromTraversal && ctx->skeletonBuilt != 0);
+		if (skeleton == 0) {
+			if (createDestDirectory(ctx, ctx->dst) == 0) {
+				/* recoverable single directory failure -> partial backup, keep going */
+				_ftprintf(stderr, _T("Error: Failed creating destination path \"%s\".\n"), ctx->dst);
+				ctx->hadError = 1;
+				return 1;
+			}
+			/* update parent's mtime on sub directory creation */
+			if ( fromTraversal ) dirStackMarkParent(ctx);
+			/* "src/" copies the contents into the destination root and leaves the
+			 * root's own attributes/timestamps untouched (like rsync) */
+			if ((item != NULL || trailingSep == 0 || _tcscmp(src, srcArg) != 0)
+				&& countAttributes(ctx, copyAttributes(src, ctx->dst, ctx->attrMask, ctx->verbose)) == 0) {
+				if (ctx->verbose > 0) {
+					_ftprintf(stderr, _T("Warning: Failed to copy attributes to \"%s\".\n"), ctx->dst);
+				}
+				ctx->hadError = 1;
 			}
-			ctx->hadError = 1;
 		}
-		/* defer directory timestamp until subtree is done */
-		if (fromTraversal && (ctx->attrMask & AT_TIMES) != 0) {
+		/* defer directory timestamp and checkpoint until subtree is done */
+		if (fromTraversal && (((ctx->attrMask & AT_TIMES) != 0 && skeleton == 0) || ctx->checkpointFp != NULL)) {
 			if (ds_push(&ctx->dirStack, src, ctx->dst, level) == 0) ctx->hadError = 1;
 		}
-		return 1;
-	} else if (itemFlags == TDF_FILE) {
-		int wrote = 0;
-		int hardlinked = 0;
-		if (ctx->linkDest == NULL) {
-			/* no reference directory: copy only when missing or changed */
-			if (isNewerFile(ctx->dst, src, 0) != 0) {
-				if (copyFile(src, ctx->dst, ctx->copyMask, ctx->verbose) == 0) {
-					ctx->hadError = 1;
-					return 1;
+		if (ctx->linkDestCount > 0 && ctx->linkTree == 0) {
+			/* references which contain this directory (and thus may contain its entries) */
+			tJoinResult join;
+			joinEntry(ctx, fromTraversal ? item : NULL, level, &join);
+			/* references without this entry in their joined listing are known not to contain it */
+			const uint32_t refMask = getRefMask(ctx, fromTraversal ? (currentRefMask(ctx, item, level) & ~(join.refKnown & ~join.refFound)) : ~UINT32_C(0));
+			const unsigned int childLevel = fromTraversal ? (level + 1) : 0;
+			if (setRefMask(ctx, childLevel, refMask) == 0) ctx->hadError = 1;
+			if (ctx->treeDigest != 0 && ctx->copyDest == 0 && ctx->dstIsFile == 0) {
+				const int linkRef = matchTreeDigest(ctx, ctx->dst + _tcslen(ctx->dstArg) + 1, refMask);
+				if (linkRef >= 0) {
+					/* unchanged subtree -> hardlink all files without comparing them */
+					ctx->linkTree = 1;
+					ctx->linkLevel = childLevel;
+					ctx->linkRef = linkRef;
+					if (ctx->verbose > 1) _tprintf(_T("Linking unchanged tree \"%s\".\n"), src);
 				}
-				wrote = 1;
 			}
-		} else {
-			/* construct reference file path (same layout as destination) */
+		}
+		return 1;
+	} else if (itemFlags == TDF_FILE) {
+		const TCHAR * rel = NULL;
+		uint32_t refMask = 0;
+		if (ctx->linkDestCount > 0) {
+			/* reference file paths share the layout of the destination below their roots */
 			if (ctx->dstIsFile != 0) {
 				/* reference same name under reference directory */
-				const TCHAR * dstBase = _tcsrpbrk(ctx->dstArg, PATH_SEPS);
-				dstBase = (dstBase == NULL) ? ctx->dstArg : (dstBase + 1);
-				ok = joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDest, dstBase, NULL);
-			} else if (itemFlags == TDF_FILE && item == NULL) {
-				ok = joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDest, srcBase, NULL);
-			} else if (trailingSep != 0) {
-				ok = joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDest, rel, NULL);
+				rel = _tcsrpbrk(ctx->dstArg, PATH_SEPS);
+				rel = (rel == NULL) ? ctx->dstArg : (rel + 1);
 			} else {
-				ok = joinPath(ctx->ref, BUFFER_SIZE, ctx->linkDest, srcBase, rel);
+				rel = ctx->dst + _tcslen(ctx->dstArg) + 1;
 			}
-			if (ok == 0) {
-				if (ctx->verbose > 0) _ftprintf(stderr, _T("Error: Reference path \"%s\" is too long.\n"), ctx->ref);
+			if ((ctx->linkDestMaxLen + _tcslen(rel) + 2) > BUFFER_SIZE) {
+				if (ctx->verbose > 0) _ftprintf(stderr, _T("Error: Reference path for \"%s\" is too long.\n"), ctx->dst);
 				ctx->hadError = 1;
 				return 1; /* ignore this path */
 			}
-			switch (isNewerFile(ctx->ref, src, 0)) {
-			case 0: /* source matches reference */
-				if (createHardLink(ctx->ref, ctx->dst, ctx->verbose) == 0) {
-					/* fallback to copy on hardlink error */
-					if (ctx->verbose > 0) {
-						_ftprintf(stderr, _T("Warning: Hardlink at \"%s\" failed. Falling back to copy.\n"), ctx->dst);
-					}
-					if (isNewerFile(ctx->dst, src, 0) != 0) {
-						if (copyFile(src, ctx->dst, ctx->copyMask, ctx->verbose) == 0) {
-							ctx->hadError = 1;
-							return 1;
-						}
-					}
-				} else {
-					hardlinked = 1;
-				}
-				wrote = 1;
-				break;
-			case 1: /* source differs from reference */
-			default: /* reference or source does not exist */
-				if (isNewerFile(ctx->dst, src, 0) != 0) {
-					if (copyFile(src, ctx->dst, ctx->copyMask, ctx->verbose) == 0) {
-						ctx->hadError = 1;
-						return 1;
-					}
-					wrote = 1;
-				}
-				break;
+			refMask = (ctx->linkTree != 0) ? (UINT32_C(1) << ctx->linkRef) : currentRefMask(ctx, item, level);
+		}
+		/* the joined directory listings tell which destination and reference entries exist */
+		tJoinResult join;
+		joinEntry(ctx, fromTraversal ? item : NULL, level, &join);
+		refMask &= ~(join.refKnown & ~join.refFound);
+		return queueBackupFile(ctx, src, rel, refMask, fromTraversal, &join);
+	}
+	return 1;
+}
+
+
+/**
+ * Returns the first hash table slot to probe for the given source file identity.
+ *
+ * @param[in] dev - device or volume serial number
+ * @param[in] ino - inode or file index
+ * @param[in] mask - number of slots minus one
+ * @return slot index
+ */
+size_t hardLinkSlot(const uint64_t dev, const uint64_t ino, const size_t mask) {
+	const uint64_t id[2] = {dev, ino};
+	return (size_t)(hs_hash64(id, sizeof(id), 0) & mask);
+}
+
+
+/**
+ * Looks up the source file of the given path if it has multiple names (--hard-links).
+ * The first name is added to the table and backed up as usual. For any later name this
+ * waits until the backup of the first name completed.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] src - source file path
+ * @param[out] added - set to 1 if the returned entry was added for this name, else 0
+ * @return added entry, entry of the backed up first name or NULL to back up the file on its own
+ */
+tHardLink * findHardLink(tContext * ctx, const TCHAR * src, int * added) {
+	uint64_t dev, ino;
+	size_t i, mask, slot, len;
+	uint32_t index;
+	tHardLink * entry;
+	*added = 0;
+	if (getHardLinkId(src, &dev, &ino) != 1) return NULL;
+	/* keep the load below 75% for short probe sequences */
+	if (((ctx->hardLinkCount + 1) * 4) > (ctx->hardLinkSlotCount * 3)) {
+		const size_t count = (ctx->hardLinkSlotCount > 0) ? (ctx->hardLinkSlotCount * 2) : 1024;
+		uint32_t * slots = (uint32_t *)calloc(count, sizeof(uint32_t));
+		if (slots == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(uint32_t) * count));
+			return NULL;
+		}
+		for (i = 0; i < ctx->hardLinkCount; i++) {
+			entry = ctx->hardLinkEntries + i;
+			for (slot = hardLinkSlot(entry->dev, entry->ino, count - 1); slots[slot] != 0; slot = (slot + 1) & (count - 1));
+			slots[slot] = (uint32_t)(i + 1);
+		}
+		if (ctx->hardLinkSlots != NULL) free(ctx->hardLinkSlots);
+		ctx->hardLinkSlots = slots;
+		ctx->hardLinkSlotCount = count;
+	}
+	mask = ctx->hardLinkSlotCount - 1;
+	for (slot = hardLinkSlot(dev, ino, mask); (index = ctx->hardLinkSlots[slot]) != 0; slot = (slot + 1) & mask) {
+		entry = ctx->hardLinkEntries + index - 1;
+		if (entry->dev != dev || entry->ino != ino) continue;
+		/* the first name needs to be complete before it can be linked */
+		while (entry->state == 0 && wp_reap(ctx->pool, 1) > 0);
+		return (entry->state > 0) ? entry : NULL;
+	}
+	if (ctx->hardLinkCount >= ctx->hardLinkCapacity) {
+		const size_t capacity = (ctx->hardLinkCapacity > 0) ? (ctx->hardLinkCapacity * 2) : 256;
+		tHardLink * entries = (tHardLink *)realloc(ctx->hardLinkEntries, sizeof(tHardLink) * capacity);
+		if (entries == NULL) {
+			_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(tHardLink) * capacity));
+			return NULL;
+		}
+		ctx->hardLinkEntries = entries;
+		ctx->hardLinkCapacity = capacity;
+	}
+	entry = ctx->hardLinkEntries + ctx->hardLinkCount;
+	len = _tcslen(ctx->dst) + 1;
+	entry->dst = (TCHAR *)malloc(sizeof(TCHAR) * len);
+	if (entry->dst == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)(sizeof(TCHAR) * len));
+		return NULL;
+	}
+	memcpy(entry->dst, ctx->dst, sizeof(TCHAR) * len);
+	entry->dev = dev;
+	entry->ino = ino;
+	entry->state = 0;
+	ctx->hardLinkSlots[slot] = (uint32_t)(++(ctx->hardLinkCount));
+	*added = 1;
+	return entry;
+}
+
+
+/**
+ * Frees the table of source files with multiple names.
+ *
+ * @param[in,out] ctx - backup processing context
+ */
+void clearHardLinks(tContext * ctx) {
+	size_t i;
+	for (i = 0; i < ctx->hardLinkCount; i++) free(ctx->hardLinkEntries[i].dst);
+	if (ctx->hardLinkEntries != NULL) free(ctx->hardLinkEntries);
+	if (ctx->hardLinkSlots != NULL) free(ctx->hardLinkSlots);
+	ctx->hardLinkEntries = NULL;
+	ctx->hardLinkCount = 0;
+	ctx->hardLinkCapacity = 0;
+	ctx->hardLinkSlots = NULL;
+	ctx->hardLinkSlotCount = 0;
+}
+
+
+/**
+ * Queues the removal of a destination entry which is missing in the source (--delete).
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] path - destination path to remove
+ * @return 1 on success, 0 on allocation failure
+ */
+int queueRemoval(tContext * ctx, const TCHAR * path) {
+	const size_t len = _tcslen(path) + 1;
+	const size_t size = sizeof(tBackupJob) + (sizeof(TCHAR) * len);
+	tBackupJob * job = (tBackupJob *)malloc(size);
+	if (job == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)size);
+		ctx->hadError = 1;
+		return 0;
+	}
+	memset(job, 0, sizeof(*job));
+	job->ctx = ctx;
+	job->src = (TCHAR *)(job + 1);
+	job->dst = job->src;
+	memcpy(job->dst, path, sizeof(TCHAR) * len);
+	job->remove = 1;
+	job->fromTraversal = 1;
+	/* the topmost frame is the listed directory -> its timestamps change as well */
+	job->depth = ctx->dirStack.size;
+	if (job->depth > 0) ctx->dirStack.frames[job->depth - 1].pending++;
+	wp_submit(ctx->pool, &(job->item));
+	return 1;
+}
+
+
+/**
+ * Queues the backup of a single file to the current destination path `ctx->dst`.
+ * The paths are copied so that the shared path buffers can be re-used immediately.
+ *
+ * @param[in,out] ctx - backup processing context
+ * @param[in] src - source file path
+ * @param[in] rel - path relative to the reference roots (within `ctx->dst` or `ctx->dstArg`)
+ * or NULL without --link-dest
+ * @param[in] refMask - references which may contain the file (bit per reference)
+ * @param[in] fromTraversal - item was reported by the directory traversal?
+ * @param[in] join - join result of the directory listings (may be NULL)
+ * @return 1 to continue, 0 to abort (signal)
+ */
+int queueBackupFile(tContext * ctx, const TCHAR * src, const TCHAR * rel, const uint32_t refMask, const int fromTraversal, const tJoinResult * join) {
+	const size_t srcLen = _tcslen(src) + 1;
+	const size_t dstLen = _tcslen(ctx->dst) + 1;
+	const size_t relLen = (rel != NULL) ? (_tcslen(rel) + 1) : 0;
+	/* a single buffer is enough as the references are checked one after another */
+	const size_t refLen = (rel != NULL && refMask != 0) ? (ctx->linkDestMaxLen + 1 + relLen) : 0;
+	/* files of a subtree linked from the reference keep the links of the reference */
+	const tHardLink * hardLink = NULL;
+	int added = 0;
+	if (ctx->hardLinks != 0 && ctx->dstIsFile == 0 && ctx->linkTree == 0) hardLink = findHardLink(ctx, src, &added);
+	const size_t linkLen = (hardLink != NULL && added == 0) ? (_tcslen(hardLink->dst) + 1) : 0;
+	/* the status from the reference listings precedes the paths to keep it aligned */
+	const size_t statCount = (refLen > 0 && join != NULL && (join->refKnown & refMask) != 0) ? (size_t)ctx->linkDestCount : 0;
+	const size_t size = sizeof(tBackupJob) + (sizeof(tFileStat) * statCount) + (sizeof(TCHAR) * (srcLen + dstLen + relLen + refLen + linkLen));
+	tBackupJob * job = (tBackupJob *)malloc(size);
+	if (job == NULL) {
+		_ftprintf(stderr, _T("Error: Failed to allocate %u bytes.\n"), (unsigned)size);
+		if (added != 0) ctx->hardLinkEntries[ctx->hardLinkCount - 1].state = -1;
+		ctx->hadError = 1;
+		return 1; /* ignore this path */
+	}
+	memset(job, 0, sizeof(*job));
+	job->ctx = ctx;
+	job->src = (TCHAR *)(((tFileStat *)(job + 1)) + statCount);
+	job->dst = job->src + srcLen;
+	memcpy(job->src, src, sizeof(TCHAR) * srcLen);
+	memcpy(job->dst, ctx->dst, sizeof(TCHAR) * dstLen);
+	if (statCount > 0) {
+		tFileStat * refStats = (tFileStat *)(job + 1);
+		memcpy(refStats, join->refStats, sizeof(tFileStat) * statCount);
+		job->refStats = refStats;
+		job->refKnown = join->refKnown;
+	}
+	if (refLen > 0) {
+		TCHAR * relCopy = job->dst + dstLen;
+		memcpy(relCopy, rel, sizeof(TCHAR) * relLen);
+		job->rel = relCopy;
+		job->ref = relCopy + relLen;
+		job->refMask = refMask;
+	}
+	if (linkLen > 0) {
+		TCHAR * linkCopy = job->dst + dstLen + relLen + refLen;
+		memcpy(linkCopy, hardLink->dst, sizeof(TCHAR) * linkLen);
+		job->linkTarget = linkCopy;
+	} else if (added != 0) {
+		job->hardLink = ctx->hardLinkCount;
+	}
+	if ((ctx->manifest != 0 || ctx->dirCache != 0 || ctx->treeDigest != 0 || ctx->checkpoint != 0) && ctx->dstIsFile == 0) {
+		/* destination and reference paths share the same layout below their roots */
+		const TCHAR * key = job->dst + _tcslen(ctx->dstArg) + 1;
+		if (isReservedName(key) != 0) {
+			if (ctx->verbose > 0) _ftprintf(stderr, _T("Warning: Skipping \"%s\" as it conflicts with the manifest.\n"), src);
+			ctx->hadError = 1;
+			free(job);
+			return 1;
+		}
+		if (ctx->manifest != 0) job->key = key;
+	}
+	job->fromTraversal = fromTraversal;
+	job->dstAbsent = (join != NULL) ? join->dstAbsent : 0;
+	job->linkOnly = (refLen > 0) ? ctx->linkTree : 0;
+	/* the topmost frame is the parent directory -> keep it until the operation completed */
+	job->depth = (fromTraversal != 0) ? ctx->dirStack.size : 0;
+	if (job->depth > 0) ctx->dirStack.frames[job->depth - 1].pending++;
+	wp_submit(ctx->pool, &(job->item));
+	return (signalReceived != 0) ? 0 : 1;
+}
+
+
+/**
+ * Retrieves the status of the reference file `job->ref` of the given reference. The status
+ * taken from the joined reference listing is used if available.
+ *
+ * @param[in] job - backup job
+ * @param[in] i - index of the reference
+ * @param[out] stats - receives the file status
+ * @param[out] cached - set to 1 if taken from the manifest, else 0
+ * @return 1 on success, 0 if the file does not exist and -1 on error
+ */
+int lookupRefStat(const tBackupJob * job, const int i, tFileStat * stats, int * cached) {
+	const tContext * ctx = job->ctx;
+	if (job->refStats != NULL && (job->refKnown & (UINT32_C(1) << i)) != 0) {
+		/* the reference mask only contains found entries of joined references */
+		*stats = job->refStats[i];
+		*cached = 0;
+		return 1;
+	}
+	return lookupFileStat(ctx->refManifests[i], job->key, job->ref, stats, cached);
+}
+
+
+/**
+ * Searches the references in priority order for an unchanged copy of the source file of
+ * the given job. The path of the found reference file is left in `job->ref`.
+ *
+ * @param[in] job - backup job
+ * @param[in] srcState - getFileStat() result of the source file
+ * @param[in] srcStats - source file status
+ * @param[out] refStats - receives the status of the found reference file
+ * @param[out] cached - receives whether the status was taken from the manifest
+ * @return index of the found reference or -1
+ */
+int findReference(const tBackupJob * job, const int srcState, const tFileStat * srcStats, tFileStat * refStats, int * cached) {
+	const tContext * ctx = job->ctx;
+	int i;
+	if (job->ref == NULL) return -1;
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		if ((job->refMask & (UINT32_C(1) << i)) == 0) continue;
+		joinPath(job->ref, ctx->linkDestMaxLen + 1 + _tcslen(job->rel) + 1, ctx->linkDests[i], job->rel, NULL);
+		if (lookupRefStat(job, i, refStats, cached) == 1 && isChangedFile(refStats, srcState, srcStats) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Searches the references in priority order for any previous version of the source file of
+ * the given job, regardless of its status. The path of the found reference file is left in
+ * `job->ref`.
+ *
+ * @param[in] job - backup job
+ * @return index of the found reference or -1
+ */
+int findSimilarReference(const tBackupJob * job) {
+	const tContext * ctx = job->ctx;
+	tFileStat refStats;
+	int i, cached;
+	if (job->ref == NULL) return -1;
+	for (i = 0; i < ctx->linkDestCount; i++) {
+		if ((job->refMask & (UINT32_C(1) << i)) == 0) continue;
+		joinPath(job->ref, ctx->linkDestMaxLen + 1 + _tcslen(job->rel) + 1, ctx->linkDests[i], job->rel, NULL);
+		if (lookupRefStat(job, i, &refStats, &cached) == 1 && refStats.size > 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Backs up a single file. This is called by the work pool, possibly concurrently to other
+ * file operations and the directory traversal. Hence, only the job may be modified here.
+ *
+ * @param[in,out] item - backup job
+ * @param[in] param - unused
+ */
+void backupFile(tWorkItem * item, void * param) {
+	tBackupJob * job = (tBackupJob *)item;
+	const tContext * ctx = job->ctx;
+	tFileStat srcStats, refStats, dstStats;
+	int srcState, dstState, cached, dstCached;
+	int hardlinked = 0;
+	int copied = 0;
+	int i;
+	PCF_UNUSED(param)
+	if (signalReceived != 0) return; /* skip remaining operations */
+	if (job->remove != 0) {
+#ifndef UNICODE
+		/* directories are removed concurrently by the --prune workers (see backupFileDone()) */
+		const int removed = removeFile(job->dst, ctx->verbose);
+		if (removed < 0) {
+			job->removeDir = 1;
+			return;
+		}
+#else
+		const int removed = removePath(job->dst, ctx->verbose);
+#endif
+		if (removed == 0) {
+			job->failed = 1;
+		} else {
+			job->wrote = 1;
+			if (ctx->verbose > 1) _tprintf(_T("Deleted \"%s\".\n"), job->dst);
+		}
+		return;
+	}
+	if (job->linkTarget != NULL) {
+		/* later name of a source file with multiple names -> link to the first one */
+		dstState = lookupDestStat(job, &dstStats, &dstCached);
+		if (dstState == 1 && getFileStat(job->linkTarget, &(job->stats), 0) == 1
+			&& isSameInode(&dstStats, job->dst, &(job->stats), job->linkTarget) != 0) {
+			/* already linked (e.g. re-run into the same destination) -> nothing to do */
+			job->record = (ctx->dstManifest != NULL && job->key != NULL && dstCached == 0) ? 1 : 0;
+			return;
+		}
+		if (createHardLink(job->linkTarget, job->dst, (dstState == 0) ? CP_NEW : CP_NONE, ctx->verbose) != 0) {
+			job->wrote = 1;
+			if (ctx->dstManifest != NULL && job->key != NULL) {
+				job->record = (getFileStat(job->dst, &(job->stats), 0) == 1) ? 1 : 0;
 			}
+			return;
 		}
-		/* never copy attributes to a hardlinked destination */
-		if (hardlinked == 0) {
-			if (copyAttributes(src, ctx->dst, ctx->attrMask, ctx->verbose) == 0) {
-				if (ctx->verbose > 0) {
-					_ftprintf(stderr, _T("Warning: Failed to copy attributes to \"%s\".\n"), ctx->dst);
-				}
-				ctx->hadError = 1; /* attributes not fully preserved -> partial backup */
+		if (ctx->verbose > 0) {
+			_ftprintf(stderr, _T("Warning: Hardlink at \"%s\" failed. Falling back to copy.\n"), job->dst);
+		}
+	}
+	if (job->linkOnly != 0) {
+		/* the subtree matches the reference tree digest -> no comparison needed */
+		for (i = 0; (job->refMask & (UINT32_C(1) << i)) == 0; i++);
+		joinPath(job->ref, ctx->linkDestMaxLen + 1 + _tcslen(job->rel) + 1, ctx->linkDests[i], job->rel, NULL);
+		dstState = lookupDestStat(job, &dstStats, &dstCached);
+		if (dstState == 1
+			&& lookupFileStat(ctx->refManifests[i], job->key, job->ref, &(job->stats), &cached) == 1
+			&& isSameInode(&dstStats, job->dst, &(job->stats), job->ref) != 0) {
+			/* already linked (e.g. re-run into the same destination) -> nothing to do */
+			job->record = (ctx->dstManifest != NULL && job->key != NULL && dstCached == 0) ? 1 : 0;
+			return;
+		}
+		if (createHardLink(job->ref, job->dst, (dstState == 0) ? CP_NEW : CP_NONE, 0) != 0) {
+			job->wrote = 1;
+			if (ctx->dstManifest != NULL && job->key != NULL) {
+				job->record = (lookupFileStat(ctx->refManifests[i], job->key, job->ref, &(job->stats), &cached) == 1) ? 1 : 0;
 			}
+			return;
 		}
-		if (wrote != 0 && fromTraversal) dirStackMarkParent(ctx);
-		return 1;
 	}
-	return 1;
+	srcState = getFileStat(job->src, &srcStats, 0);
+	if (ctx->copyDest == 0 && findReference(job, srcState, &srcStats, &refStats, &cached) >= 0) {
+		/* source matches reference */
+		dstState = lookupDestStat(job, &dstStats, &dstCached);
+		if (dstState == 1 && isSameInode(&dstStats, job->dst, &refStats, job->ref) != 0) {
+			/* already linked (e.g. re-run into the same destination) -> nothing to do */
+			hardlinked = 1;
+			job->stats = refStats;
+			job->record = (dstCached == 0) ? 1 : 0;
+		} else if (createHardLink(job->ref, job->dst, (dstState == 0) ? CP_NEW : CP_NONE, ctx->verbose) == 0) {
+			/* fallback to copy on hardlink error */
+			if (ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Hardlink at \"%s\" failed. Falling back to copy.\n"), job->dst);
+			}
+			job->wrote = 1;
+		} else {
+			hardlinked = 1;
+			job->stats = refStats;
+			job->record = 1;
+			job->wrote = 1;
+		}
+	}
+	/* never copy attributes to a hardlinked destination */
+	if (hardlinked == 0) {
+		/* copy only when missing or changed (reference differs or does not exist) */
+		dstState = lookupDestStat(job, &(job->stats), &cached);
+		if (dstState != 1 || isChangedFile(&(job->stats), srcState, &srcStats) != 0) {
+			/* nothing to replace atomically if the destination does not exist */
+			const tCopyMask copyMask = (tCopyMask)((dstState == 0) ? (ctx->copyMask | CP_NEW) : ctx->copyMask);
+			int ok;
+			if (ctx->copyDest != 0 && findReference(job, srcState, &srcStats, &refStats, &cached) >= 0) {
+				/* unchanged data is taken from the (usually faster) reference */
+				ok = cloneFile(job->ref, job->dst, copyMask, ctx->verbose);
+			} else if (ctx->appendVerify != 0 && srcState == 1 && dstState == 1 && job->stats.size < srcStats.size) {
+				/* grown file -> append the new tail to the existing destination */
+				ok = appendFile(job->src, job->dst, job->dst, copyMask, ctx->verbose);
+			} else if (ctx->appendVerify != 0 && srcState == 1 && dstState == 0 && findSimilarReference(job) >= 0) {
+				/* possibly grown file -> append the new tail to the reference version */
+				ok = appendFile(job->src, job->ref, job->dst, copyMask, ctx->verbose);
+			} else if (ctx->reflinkDelta != 0 && srcState == 1 && srcStats.size >= DELTA_MIN_SIZE
+				&& findSimilarReference(job) >= 0) {
+				/* large changed file -> share the unchanged blocks with the previous version */
+				ok = deltaFile(job->src, job->ref, job->dst, copyMask, ctx->verbose);
+			} else if (ctx->inplace != 0 && dstState == 1 && srcState == 1) {
+				/* changed file -> write only the differing blocks of the existing destination */
+				ok = updateFile(job->src, job->dst, copyMask, ctx->verbose);
+			} else if (ctx->partial != 0 && srcState == 1) {
+				/* keep the copied data on interruption to resume later */
+				ok = resumeFile(job->src, job->dst, copyMask, ctx->verbose);
+			} else {
+				ok = copyFile(job->src, job->dst, copyMask, ctx->verbose);
+			}
+			if (ok == 0) {
+				job->failed = 1;
+				return;
+			}
+			job->wrote = 1;
+			copied = 1;
+		}
+		job->attrResult = copyAttributes(job->src, job->dst, ctx->attrMask, ctx->verbose);
+		if (job->attrResult == 0) {
+			if (ctx->verbose > 0) {
+				_ftprintf(stderr, _T("Warning: Failed to copy attributes to \"%s\".\n"), job->dst);
+			}
+			job->failed = 1; /* attributes not fully preserved -> partial backup */
+		}
+		/* record the final state unless it is already known */
+		if (ctx->dstManifest != NULL && job->key != NULL) {
+			if (copied != 0) {
+				job->record = (getFileStat(job->dst, &(job->stats), 0) == 1) ? 1 : 0;
+			} else {
+				job->record = (cached == 0 && dstState == 1) ? 1 : 0;
+			}
+		}
+	}
+}
+
+
+/**
+ * Completes a single file backup. This is called from the traversing thread and merges the
+ * job result into the backup context.
+ *
+ * @param[in,out] item - backup job (freed here)
+ * @param[in] param - unused
+ */
+void backupFileDone(tWorkItem * item, void * param) {
+	tBackupJob * job = (tBackupJob *)item;
+	tContext * ctx = job->ctx;
+	const int modified = (job->wrote != 0 && job->fromTraversal != 0) ? 1 : 0;
+	PCF_UNUSED(param)
+#ifndef UNICODE
+	/* the directory stack frame stays pending until the directory was removed */
+	if (job->removeDir != 0 && signalReceived == 0 && queueDirRemoval(ctx, job) != 0) {
+		free(job);
+		return;
+	}
+#endif
+	if (job->failed != 0) ctx->hadError = 1;
+	if (job->wrote != 0) ctx->writeCount++;
+	if (job->hardLink > 0) {
+		/* later names of the source file may be linked now */
+		ctx->hardLinkEntries[job->hardLink - 1].state = (job->failed != 0 || signalReceived != 0) ? -1 : 1;
+	}
+	countAttributes(ctx, job->attrResult);
+	if (job->record != 0 && ctx->dstManifest != NULL) mf_append(ctx->dstManifest, job->key, &(job->stats), NULL, 0);
+	if (job->depth > 0) {
+		tDirStackFrame * frame = ctx->dirStack.frames + job->depth - 1;
+		frame->pending--;
+		if (modified != 0) frame->modified = 1;
+	} else if (modified != 0) {
+		ctx->rootModified = 1;
+	}
+	free(job);
 }
@@ -2,7 +2,7 @@
  * @file lsync.h
  * @author Daniel Starke
  * @date 2017-05-17
- * @version 2026-06-28
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -21,21 +21,120 @@
 #define __LSYNC_H__
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "target.h"
 #include "tchar.h"
 #include "dirstack.h"
+#include "hash.h"
+#include "manifest.h"
+#include "watch.h"
+#include "workpool.h"
 
 
-#define PROGRAM_VERSION _T("2.1.0 2026-06-28")
+#define PROGRAM_VERSION _T("2.2.0 2026-10-18")
 
 
 #define BUFFER_SIZE 32768
 
 
+/** File name of the file status manifest within the destination. */
+#define MANIFEST_NAME _T(".lsync.manifest")
+
+
+/** File name of the directory listing cache within the destination. */
+#define DIRCACHE_NAME _T(".lsync.dircache")
+
+
+/** File name of the per-directory tree digests within the destination. */
+#define DIGEST_NAME _T(".lsync.digest")
+
+
+/** Size of a serialized directory tree digest in bytes. */
+#define DIGEST_SIZE 16
+
+
+/** File name of the checkpoint journal within the destination. */
+#define CHECKPOINT_NAME _T(".lsync.checkpoint")
+
+
+/** Format identifier in the first line of the checkpoint journal. */
+#define CHECKPOINT_MAGIC _T("lsync-checkpoint-1")
+
+
+/** Maximum seconds between writes of completed directories to the checkpoint journal. */
+#define CHECKPOINT_INTERVAL 5
+
+
+/** Seconds a directory needs to be unchanged before its listing is cached. */
+#define DIRCACHE_SETTLE 2
+
+
+/** Milliseconds without further changes before --watch backs up the changed paths. */
+#define WATCH_SETTLE_MS 1000
+
+
+/** Maximum seconds --watch defers the backup of changed paths during continuous changes. */
+#define WATCH_MAX_DELAY 10
+
+
+/** Maximum number of --link-dest reference directories. */
+#define MAX_LINK_DESTS 20
+
+
+/** Minimum file size in bytes to update from a cloned reference with --reflink-delta. */
+#define DELTA_MIN_SIZE 1048576
+
+
+/** Block size in bytes compared and rewritten by --reflink-delta and --inplace (file system block multiple). */
+#define DELTA_BLOCK_SIZE 4096
+
+
+/** File name suffix of a partially copied file kept by --partial. */
+#define PARTIAL_SUFFIX _T(".lsync-partial")
+
+
+/** File name suffix of the progress record of a partially copied file (appended to PARTIAL_SUFFIX). */
+#define PARTIAL_INFO_SUFFIX _T(".info")
+
+
+/** Format identifier of the --partial progress record. */
+#define PARTIAL_MAGIC "lsync-partial-1"
+
+
+/** Number of bytes copied by --partial between progress records. */
+#define PARTIAL_SYNC_SIZE 67108864
+
+
+/** Maximum size of a job request sent to the --serve socket in bytes. */
+#define SERVE_MAX_REQUEST 65536
+
+
+/** Maximum number of backup jobs of --jobs-file running at the same time. */
+#define BATCH_MAX_PARALLEL 4
+
+
+/** Number of reference manifests kept loaded by --serve between jobs. */
+#define SERVE_CACHE_SIZE 16
+
+
+/** Default number of concurrent removals of --prune. */
+#define PRUNE_WORKERS 8
+
+
+/** File descriptors kept free of open directories for the other file operations. */
+#define PRUNE_FD_RESERVE 256
+
+
+/** Upper limit of --max-iops. */
+#define MAX_IOPS 1000000
+
+
 /** Exit code for a backup that was interrupted by a signal. */
 #define EXIT_SIGNAL 20
 
@@ -54,8 +153,12 @@
 #define TDO_ITEM TDUSO_ITEM
 #define TDO_FOLLOW_LINKS TDUSO_FOLLOW_LINKS
 #define TDO_ERRORS TDUSO_ERRORS
+#define TDO_NO_STAT TDUSO_NO_STAT
 #define TDO_ALL TDUSO_ALL
+#define TDR_SKIP TDUS_SKIP
 #define td_traverse tdus_traverse
+/* directory listings are not cached on Windows as these already include the item types */
+#define td_traverseList(path, maxLevel, options, visitor, lister, param) tdus_traverse(path, maxLevel, options, visitor, param)
 #else
 #include "tdirs.h"
 #define TDF_FILE TDSF_FILE
@@ -66,14 +169,36 @@
 #define TDO_ITEM TDSO_ITEM
 #define TDO_FOLLOW_LINKS TDSO_FOLLOW_LINKS
 #define TDO_ERRORS TDSO_ERRORS
+#define TDO_NO_STAT TDSO_NO_STAT
 #define TDO_ALL TDSO_ALL
+#define TDR_SKIP TDS_SKIP
 #define td_traverse tds_traverse
+#define td_traverseList tds_traverseList
 #endif
 
 
 typedef enum {
-	GETOPT_LINK_DEST = 1,
+	GETOPT_APPEND_VERIFY = 1,
+	GETOPT_CHECKPOINT,
+	GETOPT_CONNECT,
+	GETOPT_COPY_DEST,
+	GETOPT_DELETE,
+	GETOPT_DIRS_FIRST,
+	GETOPT_DIR_CACHE,
+	GETOPT_INPLACE,
+	GETOPT_JOBS_FILE,
+	GETOPT_LINK_DEST,
+	GETOPT_MANIFEST,
+	GETOPT_MAX_IOPS,
+	GETOPT_PARTIAL,
+	GETOPT_PRUNE,
+	GETOPT_QUEUE_DEPTH,
+	GETOPT_REFLINK_DELTA,
+	GETOPT_SERVE,
+	GETOPT_TREE_DIGEST,
 	GETOPT_VERSION,
+	GETOPT_WATCH,
+	GETOPT_WORKERS,
 } tLongOption;
 
 
@@ -92,21 +217,143 @@ typedef enum {
 	CP_DEVICES  = 0x01,
 	CP_LINKS    = 0x02,
 	CP_SPECIALS = 0x04,
+	CP_NEW      = 0x08, /**< destination is known to be absent (no atomic replace needed) */
 	CP_ALL = CP_DEVICES | CP_LINKS | CP_SPECIALS
 } tCopyMask;
 
 
+/**
+ * Tree digest of a single source directory.
+ */
+typedef struct {
+	TCHAR * key; /**< directory path relative to the destination root (owned copy) */
+	uint64_t digest[2]; /**< order independent sum of the child record hashes */
+	tFileStat stats; /**< source directory status */
+} tDigestEntry;
+
+
+/**
+ * Directory whose tree digest is being computed.
+ */
+typedef struct {
+	unsigned int childLevel; /**< traversal level of the direct children */
+	size_t entry; /**< index of the digest entry */
+	tHash64 record[2]; /**< record hashes of the directory within its parent (without digest) */
+} tDigestFrame;
+
+
+/**
+ * Changed source path recorded by --watch.
+ */
+typedef struct {
+	TCHAR * path; /**< changed path (owned copy) */
+	tWatchKind kind; /**< kind of change */
+	size_t id; /**< index of the source argument */
+} tJournalEntry;
+
+
+/**
+ * Directory completed by an interrupted backup as recorded in the checkpoint journal.
+ */
+typedef struct {
+	size_t id; /**< index of the source argument */
+	TCHAR * key; /**< destination path relative to the destination root (owned copy) */
+} tCheckpointEntry;
+
+
+/**
+ * Source file with multiple names seen by --hard-links.
+ */
+typedef struct {
+	uint64_t dev; /**< device or volume serial number */
+	uint64_t ino; /**< inode or file index */
+	TCHAR * dst; /**< destination path of the first name (owned copy) */
+	int state; /**< 0 while its backup is outstanding, 1 if completed, -1 if failed */
+} tHardLink;
+
+
+/**
+ * Source directory listing of a traversal level joined with the listings of the
+ * corresponding destination (--delete) and reference directories.
+ */
+typedef struct {
+	const TCHAR ** names; /**< sorted source entry names (point into the listing of the traversal) */
+	size_t count; /**< number of entries in names */
+	size_t capacity; /**< allocated entries per entry array */
+	size_t next; /**< first entry which may match the next reported source entry */
+	unsigned char * dstFound; /**< per entry: set if the destination contains it */
+	uint32_t * refFound; /**< per entry: joined references which contain it (bit per reference) */
+	tFileStat * refStats; /**< per entry: status within each reference (linkDestCount entries) */
+	int dstKnown; /**< the destination directory was joined */
+	uint32_t refKnown; /**< references whose directory was joined (bit per reference) */
+} tDirListing;
+
+
+/**
+ * Join result of a single source directory entry.
+ */
+typedef struct {
+	int dstAbsent; /**< the destination is known to be absent */
+	uint32_t refKnown; /**< references whose status of the entry is known (bit per reference) */
+	uint32_t refFound; /**< references which contain the entry (subset of refKnown) */
+	const tFileStat * refStats; /**< status within each reference (valid for refFound) */
+} tJoinResult;
+
+
+/**
+ * Read-only manifest kept loaded between the jobs of --serve.
+ */
+typedef struct {
+	TCHAR * root; /**< canonical path of the manifest root directory (owned copy) */
+	const TCHAR * name; /**< manifest file name */
+	int state[2]; /**< getFileStat() result of the manifest and its log when loaded */
+	tFileStat stats[2]; /**< status of the manifest and its log when loaded */
+	tManifest * mf; /**< loaded manifest */
+} tCachedManifest;
+
+
+/**
+ * Reference manifests kept loaded by --serve. The least recently loaded one is replaced first.
+ */
+typedef struct {
+	tCachedManifest entries[SERVE_CACHE_SIZE];
+	size_t count;
+} tManifestCache;
+
+
+typedef struct tPruneDir tPruneDir;
+
+
 typedef struct {
 	int devices;
+	int dirCache;
 	int group;
+	int hardLinks;
 	int links;
+	int manifest;
 	int owner;
 	int perms;
 	int recursive;
 	int specials;
 	int times;
+	int treeDigest;
 	int verbose;
-	TCHAR * linkDest;
+	int watch;
+	TCHAR * connect; /**< socket of the lsync service to run the backup (NULL for local) */
+	TCHAR * serve; /**< socket to accept backup jobs on (NULL if not serving) */
+	TCHAR * jobsFile; /**< file with the backup jobs to run (NULL for a single backup) */
+	TCHAR * prune; /**< snapshot to remove instead of running a backup (NULL if none) */
+	TCHAR * linkDests[MAX_LINK_DESTS]; /**< reference directories in priority order */
+	int linkDestCount; /**< number of entries in linkDests */
+	size_t linkDestMaxLen; /**< length of the longest reference directory path */
+	int copyDest; /**< unchanged files are cloned from the references instead of hardlinked (--copy-dest) */
+	int checkpoint; /**< record completed directories to resume an interrupted backup (--checkpoint) */
+	int appendVerify; /**< grown files are appended to a verified previous version (--append-verify) */
+	int partial; /**< interrupted copies are kept and resumed by the next run (--partial) */
+	int inplace; /**< changed destination files are updated in place, block by block (--inplace) */
+	int reflinkDelta; /**< changed files are cloned from the reference and only differing blocks written (--reflink-delta) */
+	int dirsFirst; /**< all destination directories are created before the files are copied (--dirs-first) */
+	int deleteExtra; /**< destination entries missing in the source are removed (--delete) */
 	TCHAR ** srcArgs;
 	int srcIndex;
 	int srcCount;
@@ -114,23 +361,254 @@ typedef struct {
 	int dstIsFile; /**< destination is a single explicit file path (rsync single-file semantics) */
 	TCHAR * dst; /**< destination path string buffer to avoid allocations */
 	TCHAR * ref; /**< reference path string buffer to avoid allocations */
+	TCHAR * dir; /**< directory path string buffer for the listing cache */
+	TCHAR * knownDir; /**< last created destination directory (not terminated, its ancestors exist as well) */
+	size_t knownDirLen; /**< length of knownDir (0 if none) */
 	tAttrMask attrMask;
 	tCopyMask copyMask;
 	int hadError; /**< set when a recoverable error occurred (partial backup) */
 	tDirStack dirStack; /**< stack of open directories for timestamp correction */
 	int rootModified; /**< set when a top level child was written to update the root mtime */
+	int skeletonBuilt; /**< the destination directories of the current tree were created in advance */
+	TCHAR * skeleton; /**< NUL terminated source paths of these directories in traversal order */
+	size_t skeletonLen; /**< used characters in skeleton */
+	size_t skeletonCapacity; /**< allocated characters in skeleton */
+	size_t workers; /**< number of concurrent file operations */
+	size_t queueDepth; /**< maximum number of queued file operations (0 for twice the workers) */
+	int autoTune; /**< adjust workers and queue depth from measured throughput and latency */
+	size_t maxIops; /**< maximum number of removals per second of --prune (0 for unlimited) */
+	tWorkPool * pool; /**< executes the file operations */
+	tManifest * dstManifest; /**< manifest of the destination (NULL without --manifest) */
+	tManifest * refManifests[MAX_LINK_DESTS]; /**< manifests of the references (NULL without --manifest) */
+	tManifest * dirCacheMf; /**< directory listing cache of the destination (NULL without --dir-cache) */
+	tManifest * dstDigestMf; /**< tree digests of the destination (NULL without --tree-digest) */
+	tManifest * refDigestMfs[MAX_LINK_DESTS]; /**< tree digests of the references (NULL without --tree-digest) */
+	uint32_t * refMasks; /**< references containing the directory per traversal level (bit per reference) */
+	size_t refMaskCapacity; /**< allocated entries in refMasks */
+	tDigestEntry * digests; /**< tree digests of the current source sorted by key after the scan */
+	size_t digestCount; /**< number of entries in digests */
+	size_t digestCapacity; /**< allocated entries in digests */
+	tDigestFrame * digestFrames; /**< stack of directories during the digest scan */
+	size_t digestDepth; /**< number of entries in digestFrames */
+	size_t digestFrameCapacity; /**< allocated entries in digestFrames */
+	int digestFailed; /**< the digest scan of the current source was incomplete */
+	int linkTree; /**< within a subtree that matches the reference tree digest */
+	unsigned int linkLevel; /**< traversal level of the direct children of that subtree */
+	int linkRef; /**< index of the reference whose tree digest matches that subtree */
+	tWatch * watcher; /**< source change notification (NULL without --watch) */
+	tJournalEntry * journal; /**< changed source paths since the last backup */
+	size_t journalCount; /**< number of entries in journal */
+	size_t journalCapacity; /**< allocated entries in journal */
+	int journalOverflow; /**< changes were lost -> rescan all sources */
+	FILE * checkpointFp; /**< checkpoint journal receiving completed directories (NULL without --checkpoint) */
+	time_t checkpointTime; /**< time of the last checkpoint journal write */
+	tCheckpointEntry * checkpoints; /**< completed directories of the interrupted backup sorted by source and key */
+	size_t checkpointCount; /**< number of entries in checkpoints */
+	tManifestCache * mfCache; /**< reference manifests shared between jobs (NULL without --serve) */
+	int progressFd; /**< socket receiving the job progress (-1 if none) */
+	time_t progressTime; /**< time of the last progress report */
+	size_t itemCount; /**< number of visited source items */
+	size_t writeCount; /**< number of written destination items */
+	size_t attrApplied; /**< number of items with updated attributes */
+	size_t attrSkipped; /**< number of items whose attributes matched already */
+	tHardLink * hardLinkEntries; /**< source files with multiple names in the order of appearance (--hard-links) */
+	size_t hardLinkCount; /**< number of entries in hardLinkEntries */
+	size_t hardLinkCapacity; /**< allocated entries in hardLinkEntries */
+	uint32_t * hardLinkSlots; /**< open addressing hash table of hardLinkEntries indices + 1 (0 if empty) */
+	size_t hardLinkSlotCount; /**< number of slots in hardLinkSlots (power of two) */
+	int joinRefs; /**< reference directories without manifest are listed and joined with the source */
+	tDirListing * listings; /**< joined listing per traversal level (--delete or joinRefs) */
+	size_t listingCapacity; /**< allocated entries in listings */
+	unsigned int listLevel; /**< traversal level of the entries of the next listed directory */
+	const TCHAR ** joinNames; /**< sorted destination entry names of the listed directory */
+	size_t joinCapacity; /**< allocated entries in joinNames */
+	tWorkPool * prunePool; /**< handle of the work pool for directory removals of --delete */
+	tPruneDir * pruneQueue; /**< directories waiting to be submitted (--prune or --delete) */
+	size_t pruneActive; /**< number of submitted directories not completed yet */
+	size_t prunedFiles; /**< number of removed non-directory entries */
+	size_t prunedDirs; /**< number of removed directories */
+	size_t pruneOpen; /**< number of directories kept open for their sub directories */
+	size_t pruneMaxOpen; /**< maximum number of open directories (file descriptor limit) */
 } tContext;
 
 
+/**
+ * Single file backup operation executed by the work pool.
+ */
+typedef struct {
+	tWorkItem item; /**< work pool item header */
+	tContext * ctx; /**< owning backup context */
+	TCHAR * src; /**< source path */
+	TCHAR * dst; /**< destination path */
+	TCHAR * ref; /**< reference path buffer (NULL without --link-dest) */
+	const TCHAR * rel; /**< destination path relative to the destination and reference roots */
+	uint32_t refMask; /**< references to check (bit per reference in priority order) */
+	const TCHAR * key; /**< path relative to the destination and reference root (NULL without --manifest) */
+	size_t depth; /**< directory stack size at submission (0 if the parent has no frame) */
+	int fromTraversal; /**< item was reported by the directory traversal */
+	int wrote; /**< destination was written */
+	int failed; /**< item could not be backed up */
+	int record; /**< stats shall be recorded in the destination manifest */
+	int linkOnly; /**< hardlink the single reference without comparison (matching tree digest) */
+	const TCHAR * linkTarget; /**< destination of the first name of the same source file (NULL if none) */
+	size_t hardLink; /**< index + 1 of the hard link entry completed by this job (0 if none) */
+	int dstAbsent; /**< the destination is known to be absent from the directory listing */
+	uint32_t refKnown; /**< references whose status was taken from the directory listing (bit per reference) */
+	const tFileStat * refStats; /**< status within each reference (valid for refKnown and refMask) */
+	int remove; /**< remove the destination instead of backing up the source (--delete) */
+	int removeDir; /**< the destination to remove is a directory which is handed to the --prune workers */
+	int attrResult; /**< copyAttributes() result (0 if not called) */
+	tFileStat stats; /**< destination file status */
+} tBackupJob;
+
+
+/**
+ * Directory removal of --prune and --delete executed by the work pool. The directory is
+ * emptied first and removed once all its sub directories were removed.
+ */
+struct tPruneDir {
+	tWorkItem item; /**< work pool item header */
+	tContext * ctx; /**< owning context */
+	tPruneDir * parent; /**< parent directory (NULL for the snapshot root) */
+	size_t depth; /**< directory stack size of the removed destination directory (--delete) */
+	tPruneDir * next; /**< next directory in the queue or list of sub directories */
+	tPruneDir * subDirs; /**< sub directories found while emptying the directory */
+	size_t children; /**< sub directories not completed yet */
+	size_t files; /**< number of removed non-directory entries */
+	int emptied; /**< the non-directory entries were removed already */
+	int removed; /**< the directory itself was removed */
+	int failed; /**< the directory or one of its entries could not be removed */
+	int fd; /**< opened directory while its entries are removed (-1 if closed) */
+	TCHAR * name; /**< name within the parent directory (snapshot path for the root) */
+};
+
+
+/**
+ * Backup job of --jobs-file executed by the job pool.
+ */
+typedef struct {
+	tWorkItem item; /**< work pool item header */
+	tContext ctx; /**< backup context of the job */
+	TCHAR * line; /**< argument strings of the job (owned) */
+	TCHAR ** args; /**< argument list of the job (owned, args[0] is the jobs file) */
+	unsigned int lineNo; /**< line number within the jobs file */
+	size_t scanned; /**< number of previous jobs checked for a dependency */
+	int blocked; /**< previous job `scanned` is a dependency of this job */
+	int submitted; /**< job passed to the job pool */
+	int finished; /**< job completed */
+	int result; /**< exit code of the job */
+} tBatchJob;
+
+
 extern volatile sig_atomic_t signalReceived;
 
 
+int parseOptions(tContext * ctx, int argc, TCHAR ** argv);
+int runBackup(tContext * ctx);
+#ifndef UNICODE
+int runPrune(tContext * ctx);
+tPruneDir * newPruneDir(tContext * ctx, tPruneDir * parent, const TCHAR * name);
+void finishPruneDir(tContext * ctx, tPruneDir * dir);
+void pruneDirectory(tWorkItem * item, void * param);
+void pruneDirectoryDone(tWorkItem * item, void * param);
+size_t pruneOpenLimit(void);
+void submitPruneDirs(tContext * ctx, tWorkPool * pool);
+void drainPruneDirs(tContext * ctx, tWorkPool * pool);
+int queueDirRemoval(tContext * ctx, const tBackupJob * job);
+void finishDirRemoval(tContext * ctx, const tPruneDir * dir);
+int serveJobs(tContext * ctx);
+int serveJob(tContext * ctx, const int fd);
+int submitJob(tContext * ctx, int argc, TCHAR ** argv);
+void reportProgress(tContext * ctx);
+#endif
+int splitArguments(TCHAR * line, TCHAR ** args);
+int normalizePath(const TCHAR * path, TCHAR * buf);
+int isOverlappingPath(const TCHAR * a, const TCHAR * b);
+int containsWorkDir(const TCHAR * path);
+int dependsOnJob(const tContext * job, const tContext * other);
+int readJobsFile(tContext * ctx, tBatchJob ** jobs, size_t * count);
+int runJobsFile(tContext * ctx);
+void runBatchJob(tWorkItem * item, void * param);
+void finishBatchJob(tWorkItem * item, void * param);
+tManifest * openCachedManifest(tContext * ctx, const TCHAR * root, const TCHAR * name);
+void closeCachedManifest(tContext * ctx, tManifest * mf);
+void clearManifestCache(tManifestCache * cache);
 void printHelp();
 void handleSignal(int signum);
+int parseCount(const TCHAR * str, const size_t maxValue, size_t * value);
 int joinPath(TCHAR * buf, const size_t len, const TCHAR * base, const TCHAR * item, const TCHAR * rel);
 int destWithinSource(const TCHAR * src, const TCHAR * dst);
+int mapPath(const tContext * ctx, const TCHAR * src, const TCHAR * root, const int singleFile, TCHAR * buf, const size_t len);
+int isReservedName(const TCHAR * key);
+#ifndef UNICODE
+int listDirectory(const char * path, char ** names, size_t * size, void * param);
+int cmpNamePtr(const void * a, const void * b);
+int sortNames(const char * names, const size_t size, const char *** sorted, size_t * count, size_t * capacity);
+int joinDirectory(const char * path, char ** names, size_t * size, void * param);
+void joinDestination(tContext * ctx, tDirListing * listing);
+int isPartialName(const TCHAR * name);
+void joinReferences(tContext * ctx, tDirListing * listing, const unsigned int level);
+#endif
+void joinEntry(tContext * ctx, const TCHAR * item, const unsigned int level, tJoinResult * join);
+void clearListings(tContext * ctx);
+void putDigest(uint8_t * buf, const uint64_t * digest);
+void initDigestRecord(tHash64 * record, const TCHAR * name, const tFileStat * stats, const int isDir);
+void addDigestRecord(uint64_t * sum, tHash64 * record, const uint64_t * digest);
+int pushDigestFrame(tContext * ctx, const TCHAR * src, const TCHAR * item, const unsigned int childLevel, const tFileStat * stats);
+void popDigestFrames(tContext * ctx, const unsigned int level, const int all);
+int digestVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, const int flags,
+	const unsigned int level, void * param);
+int cmpDigestEntry(const void * a, const void * b);
+int scanTreeDigests(tContext * ctx, const TCHAR * src);
+int matchTreeDigest(const tContext * ctx, const TCHAR * key, const uint32_t refMask);
+void recordTreeDigests(tContext * ctx);
+void clearTreeDigests(tContext * ctx);
+uint32_t getRefMask(tContext * ctx, const uint32_t parentMask);
+int setRefMask(tContext * ctx, const unsigned int level, const uint32_t mask);
+uint32_t currentRefMask(const tContext * ctx, const TCHAR * item, const unsigned int level);
+int isSameInode(const tFileStat * a, const TCHAR * pathA, const tFileStat * b, const TCHAR * pathB);
+int countAttributes(tContext * ctx, const int result);
+int isChangedFile(const tFileStat * stats, const int srcState, const tFileStat * srcStats);
+int lookupDestStat(const tBackupJob * job, tFileStat * stats, int * cached);
+int lookupFileStat(const tManifest * mf, const TCHAR * key, const TCHAR * path, tFileStat * stats, int * cached);
+#ifndef UNICODE
+void journalVisitor(const char * path, const tWatchKind kind, const size_t id, void * param);
+int cmpJournalEntry(const void * a, const void * b);
+int isJournalCovered(const tContext * ctx, const tJournalEntry * entry);
+void finishJournalParent(tContext * ctx, const TCHAR * parent);
+int backupJournal(tContext * ctx);
+int watchSources(tContext * ctx);
+#endif
+void clearJournal(tContext * ctx);
+int cmpCheckpointEntry(const void * a, const void * b);
+int readCheckpointLine(FILE * fp, TCHAR * buf);
+int loadCheckpoint(tContext * ctx, const TCHAR * path);
+int openCheckpoint(tContext * ctx);
+int isCheckpointed(const tContext * ctx, const TCHAR * key);
+void recordCheckpoint(tContext * ctx, const TCHAR * key);
+void closeCheckpoint(tContext * ctx, const int complete);
+int createDestDirectory(tContext * ctx, const TCHAR * path);
 void dirStackFinalize(const tDirStackFrame * frame, void * param);
 void dirStackMarkParent(tContext * ctx);
+void dirStackConsume(tContext * ctx, const unsigned int level);
+size_t reapOperations(tContext * ctx);
+void drainOperations(tContext * ctx);
+size_t hardLinkSlot(const uint64_t dev, const uint64_t ino, const size_t mask);
+tHardLink * findHardLink(tContext * ctx, const TCHAR * src, int * added);
+void clearHardLinks(tContext * ctx);
+int queueRemoval(tContext * ctx, const TCHAR * path);
+int queueBackupFile(tContext * ctx, const TCHAR * src, const TCHAR * rel, const uint32_t refMask, const int fromTraversal, const tJoinResult * join);
+int lookupRefStat(const tBackupJob * job, const int i, tFileStat * stats, int * cached);
+int findReference(const tBackupJob * job, const int srcState, const tFileStat * srcStats, tFileStat * refStats, int * cached);
+int findSimilarReference(const tBackupJob * job);
+void backupFile(tWorkItem * item, void * param);
+void backupFileDone(tWorkItem * item, void * param);
+int backupSource(tContext * ctx);
+int buildSkeleton(tContext * ctx, const TCHAR * src, const int maxLevel);
+int skeletonVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, const int flags,
+	const unsigned int level, void * param);
+void finishSkeleton(tContext * ctx);
+int backupTree(tContext * ctx, const TCHAR * src, const int maxLevel);
 int backupVisitor(const TCHAR * src, const TCHAR * item, const TCHAR * ext, const int isDir,
 	const unsigned int level, void * param);
 
@@ -140,13 +618,36 @@ int isFile(const TCHAR * src);
 int isDirectory(const TCHAR * src);
 int isSymlink(const TCHAR * src);
 int realPath(const TCHAR * path, TCHAR * buf, const size_t len);
-int createDirectory(const TCHAR * dst, const int verbose);
+int createDirectory(const TCHAR * dst, const size_t existing, const int verbose);
 int createTempName(const TCHAR * dst, TCHAR ** tmp, const int verbose);
 int renameFile(const TCHAR * src, const TCHAR * dst, const int verbose);
-int createHardLink(const TCHAR * src, const TCHAR * dst, const int verbose);
+int removePath(const TCHAR * path, const int verbose);
+int createHardLink(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose);
 int copyFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose);
+int cloneFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose);
+int deltaFile(const TCHAR * src, const TCHAR * ref, const TCHAR * dst, const tCopyMask mask, const int verbose);
+int appendFile(const TCHAR * src, const TCHAR * old, const TCHAR * dst, const tCopyMask mask, const int verbose);
+int resumeFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose);
+int updateFile(const TCHAR * src, const TCHAR * dst, const tCopyMask mask, const int verbose);
 int copyAttributes(const TCHAR * src, const TCHAR * dst, const tAttrMask mask, const int verbose);
-int isNewerFile(const TCHAR * src, const TCHAR * dst, const int verbose);
+int getFileStat(const TCHAR * path, tFileStat * stats, const int verbose);
+int getHardLinkId(const TCHAR * path, uint64_t * dev, uint64_t * ino);
+#ifndef UNICODE
+int getDirFileStats(const TCHAR * dir, const TCHAR * const * names, const size_t count, tFileStat * stats, const size_t stride, uint32_t * found, const uint32_t bit);
+#endif
+#ifndef UNICODE
+int absolutePath(const TCHAR * path, TCHAR * buf, const size_t len);
+int removeFile(const TCHAR * path, const int verbose);
+size_t raiseFileLimit(void);
+int emptyDirectory(tPruneDir * dir, const int verbose);
+void closeDirectory(tPruneDir * dir);
+int removeDirectory(tPruneDir * dir, const int verbose);
+int listenSocket(const TCHAR * path);
+int connectSocket(const TCHAR * path);
+int acceptSocket(const int fd, const int timeout);
+int isSocketPeerOwner(const int fd);
+int sendSocket(const int fd, const void * data, const size_t len);
+#endif
 
 
 #endif /* __LSYNC_H__ */
@@ -0,0 +1,971 @@
+/**
+ * @file manifest.c
+ * @author Daniel Starke
+ * @see manifest.h
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * A manifest consists of two files in the backup root:
+ * - The compacted manifest holds all entries sorted by key in prefix-compressed blocks of
+ *   MF_BLOCK_ENTRIES entries each, followed by a block offset index and a fixed size footer.
+ *   It is mapped into memory and binary searched by the first key of each block.
+ * - The log (MF_LOG_SUFFIX) holds entries appended since the last compaction. These take
+ *   precedence over the compacted entries and are merged into them once the log grows beyond
+ *   a quarter of the compacted entry count.
+ * Each entry maps a key to a file status and optional user data.
+ * All integers are stored in little endian byte order. Variable length fields use LEB128.
+ * Keys are stored as raw TCHAR strings without terminator.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "manifest.h"
+
+#ifdef PCF_IS_WIN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else /* PCF_IS_NO_WIN */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* PCF_IS_WIN */
+
+
+/** Magic of the compacted manifest footer. */
+#define MF_MAGIC "LSYNCMF1"
+
+
+/** Magic of the manifest log header. */
+#define MF_LOG_MAGIC "LSYNCML1"
+
+
+/** Size of the compacted manifest footer in bytes. */
+#define MF_FOOTER_SIZE 32
+
+
+/** Size of the manifest log header in bytes. */
+#define MF_LOG_HEADER_SIZE 16
+
+
+/** Maximum number of bytes of an encoded tFileStat and user data length. */
+#define MF_MAX_STAT_SIZE 80
+
+
+/** Maximum number of bytes of a LEB128 encoded 64-bit value. */
+#define MF_MAX_VARINT_SIZE 10
+
+
+/**
+ * Read-only memory mapped file.
+ */
+typedef struct {
+	const uint8_t * data; /**< mapped file content (NULL if missing or empty) */
+	size_t size;          /**< size of the mapped content in bytes */
+#ifdef PCF_IS_WIN
+	HANDLE file;          /**< file handle */
+	HANDLE mapping;       /**< file mapping handle */
+#endif /* PCF_IS_WIN */
+} tMfMap;
+
+
+/**
+ * Manifest state.
+ */
+struct tManifest {
+	TCHAR * path;          /**< path to the compacted manifest */
+	TCHAR * logPath;       /**< path to the manifest log */
+	TCHAR * tmpPath;       /**< path used to write a new compacted manifest */
+	int writable;          /**< updates are permitted? */
+	tMfMap base;           /**< mapped compacted manifest */
+	tMfMap log;            /**< mapped manifest log */
+	uint64_t entryCount;   /**< number of compacted entries */
+	uint64_t blockCount;   /**< number of compacted blocks */
+	uint64_t blockEntries; /**< number of entries per compacted block */
+	uint64_t indexOffset;  /**< byte offset of the block index */
+	const uint8_t ** logRecs; /**< log record payloads sorted by key (latest record per key only) */
+	size_t logCount;       /**< number of entries in logRecs */
+	FILE * logFile;        /**< log opened for appending (NULL until the first update) */
+	size_t appended;       /**< number of entries appended to the log by this instance */
+	int failed;            /**< an update could not be written */
+};
+
+
+/**
+ * Builder for a compacted manifest.
+ */
+typedef struct {
+	FILE * fp;             /**< output file */
+	uint64_t offset;       /**< current output offset */
+	uint64_t count;        /**< number of written entries */
+	uint8_t * prevKey;     /**< previously written key */
+	size_t prevLen;        /**< length of prevKey in bytes */
+	size_t prevCap;        /**< capacity of prevKey in bytes */
+	uint64_t * blocks;     /**< block offsets */
+	size_t blockCap;       /**< capacity of blocks */
+	int failed;            /**< a write or allocation failed */
+} tMfWriter;
+
+
+/**
+ * Encodes the given value as LEB128.
+ *
+ * @param[out] buf - output buffer (at least MF_MAX_VARINT_SIZE bytes)
+ * @param[in] value - value to encode
+ * @return number of bytes written
+ */
+static size_t mf_putVarint(uint8_t * buf, uint64_t value) {
+	size_t len = 0;
+	while (value >= 0x80) {
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+
+/**
+ * Decodes a LEB128 value.
+ *
+ * @param[in,out] ptr - current input position (advanced on success)
+ * @param[in] end - end of the input
+ * @param[out] value - decoded value
+ * @return 1 on success, 0 on truncated or invalid input
+ */
+static int mf_getVarint(const uint8_t ** ptr, const uint8_t * end, uint64_t * value) {
+	const uint8_t * p = *ptr;
+	uint64_t res = 0;
+	unsigned int shift;
+	for (shift = 0; p < end && shift < 64; shift += 7) {
+		const uint8_t b = *p++;
+		res |= ((uint64_t)(b & 0x7F)) << shift;
+		if ((b & 0x80) == 0) {
+			*ptr = p;
+			*value = res;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Stores a 64-bit value in little endian byte order.
+ *
+ * @param[out] buf - output buffer (8 bytes)
+ * @param[in] value - value to store
+ */
+static void mf_putU64(uint8_t * buf, const uint64_t value) {
+	int i;
+	for (i = 0; i < 8; i++) buf[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+/**
+ * Loads a little endian 64-bit value.
+ *
+ * @param[in] buf - input buffer (8 bytes)
+ * @return loaded value
+ */
+static uint64_t mf_getU64(const uint8_t * buf) {
+	uint64_t res = 0;
+	int i;
+	for (i = 7; i >= 0; i--) res = (res << 8) | buf[i];
+	return res;
+}
+
+
+/**
+ * Stores a 32-bit value in little endian byte order.
+ *
+ * @param[out] buf - output buffer (4 bytes)
+ * @param[in] value - value to store
+ */
+static void mf_putU32(uint8_t * buf, const uint32_t value) {
+	int i;
+	for (i = 0; i < 4; i++) buf[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+/**
+ * Loads a little endian 32-bit value.
+ *
+ * @param[in] buf - input buffer (4 bytes)
+ * @return loaded value
+ */
+static uint32_t mf_getU32(const uint8_t * buf) {
+	return ((uint32_t)buf[0]) | (((uint32_t)buf[1]) << 8) | (((uint32_t)buf[2]) << 16) | (((uint32_t)buf[3]) << 24);
+}
+
+
+/**
+ * Encodes the given file status.
+ *
+ * @param[out] buf - output buffer (at least MF_MAX_STAT_SIZE bytes)
+ * @param[in] stats - file status to encode
+ * @return number of bytes written
+ */
+static size_t mf_putStat(uint8_t * buf, const tFileStat * stats) {
+	size_t len = 0;
+	/* zig-zag encode the signed time values to keep pre-epoch times short */
+	len += mf_putVarint(buf + len, stats->size);
+	len += mf_putVarint(buf + len, (((uint64_t)stats->mtime) << 1) ^ (uint64_t)(stats->mtime >> 63));
+	len += mf_putVarint(buf + len, stats->mtimeNs);
+	len += mf_putVarint(buf + len, (((uint64_t)stats->ctime) << 1) ^ (uint64_t)(stats->ctime >> 63));
+	len += mf_putVarint(buf + len, stats->ctimeNs);
+	len += mf_putVarint(buf + len, stats->ino);
+	len += mf_putVarint(buf + len, stats->mode);
+	return len;
+}
+
+
+/**
+ * Decodes an entry value (file status and user data).
+ *
+ * @param[in,out] ptr - current input position (advanced on success)
+ * @param[in] end - end of the input
+ * @param[out] stats - decoded file status (may be NULL to skip)
+ * @param[out] data - receives the user data start (may be NULL)
+ * @param[out] dataLen - receives the user data length in bytes (may be NULL)
+ * @return 1 on success, 0 on truncated or invalid input
+ */
+static int mf_getValue(const uint8_t ** ptr, const uint8_t * end, tFileStat * stats, const void ** data, size_t * dataLen) {
+	uint64_t v[8];
+	int i;
+	for (i = 0; i < 8; i++) {
+		if (mf_getVarint(ptr, end, v + i) == 0) return 0;
+	}
+	if (v[7] > (uint64_t)(end - *ptr)) return 0;
+	if (data != NULL) *data = *ptr;
+	if (dataLen != NULL) *dataLen = (size_t)v[7];
+	*ptr += v[7];
+	if (stats != NULL) {
+		stats->size = v[0];
+		stats->mtime = (int64_t)((v[1] >> 1) ^ (~(v[1] & 1) + 1));
+		stats->mtimeNs = (uint32_t)v[2];
+		stats->ctime = (int64_t)((v[3] >> 1) ^ (~(v[3] & 1) + 1));
+		stats->ctimeNs = (uint32_t)v[4];
+		stats->ino = v[5];
+		stats->mode = (uint32_t)v[6];
+		stats->dev = 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Compares two keys byte-wise.
+ *
+ * @param[in] a - first key
+ * @param[in] aLen - length of a in bytes
+ * @param[in] b - second key
+ * @param[in] bLen - length of b in bytes
+ * @return <0 if a < b, 0 if equal and >0 if a > b
+ */
+static int mf_cmpKey(const uint8_t * a, const size_t aLen, const uint8_t * b, const size_t bLen) {
+	const int res = memcmp(a, b, PCF_MIN(aLen, bLen));
+	if (res != 0) return res;
+	return (aLen < bLen) ? -1 : ((aLen > bLen) ? 1 : 0);
+}
+
+
+/**
+ * Decodes the key of a log record payload.
+ *
+ * @param[in] rec - log record payload (length prefix already validated)
+ * @param[out] key - receives the key start
+ * @param[out] keyLen - receives the key length in bytes
+ * @return start of the encoded file status
+ */
+static const uint8_t * mf_logKey(const uint8_t * rec, const uint8_t ** key, size_t * keyLen) {
+	uint64_t len = 0;
+	const uint8_t * p = rec;
+	mf_getVarint(&p, p + MF_MAX_VARINT_SIZE, &len);
+	*key = p;
+	*keyLen = (size_t)len;
+	return p + len;
+}
+
+
+/**
+ * Compares two log records by key. Records with the same key are ordered by their position
+ * within the log to keep the latest one last.
+ *
+ * @param[in] a - pointer to the first record pointer
+ * @param[in] b - pointer to the second record pointer
+ * @return <0 if a < b, 0 if equal and >0 if a > b
+ */
+static int mf_cmpLogRec(const void * a, const void * b) {
+	const uint8_t * recA = *((const uint8_t * const *)a);
+	const uint8_t * recB = *((const uint8_t * const *)b);
+	const uint8_t * keyA, * keyB;
+	size_t lenA, lenB;
+	int res;
+	mf_logKey(recA, &keyA, &lenA);
+	mf_logKey(recB, &keyB, &lenB);
+	res = mf_cmpKey(keyA, lenA, keyB, lenB);
+	if (res != 0) return res;
+	return (recA < recB) ? -1 : ((recA > recB) ? 1 : 0);
+}
+
+
+/**
+ * Concatenates the given path, file name and suffix.
+ *
+ * @param[in] root - directory path
+ * @param[in] name - file name
+ * @param[in] suffix - file name suffix (may be NULL)
+ * @return allocated path or NULL on allocation failure
+ */
+static TCHAR * mf_joinPath(const TCHAR * root, const TCHAR * name, const TCHAR * suffix) {
+	const size_t rootLen = _tcslen(root);
+	const size_t nameLen = _tcslen(name);
+	const size_t suffixLen = (suffix != NULL) ? _tcslen(suffix) : 0;
+	TCHAR * res = (TCHAR *)malloc(sizeof(TCHAR) * (rootLen + nameLen + suffixLen + 2));
+	if (res == NULL) return NULL;
+	memcpy(res, root, sizeof(TCHAR) * rootLen);
+	res[rootLen] = PCF_PATH_SEPT[0];
+	memcpy(res + rootLen + 1, name, sizeof(TCHAR) * nameLen);
+	if (suffixLen > 0) memcpy(res + rootLen + 1 + nameLen, suffix, sizeof(TCHAR) * suffixLen);
+	res[rootLen + 1 + nameLen + suffixLen] = 0;
+	return res;
+}
+
+
+/**
+ * Maps the given file read-only into memory.
+ *
+ * @param[in] path - file to map
+ * @param[out] map - receives the mapping
+ * @return 1 on success, 0 if the file does not exist or is empty, -1 on error
+ */
+static int mf_map(const TCHAR * path, tMfMap * map) {
+	memset(map, 0, sizeof(*map));
+#ifdef PCF_IS_WIN
+	LARGE_INTEGER size;
+	map->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE) {
+		const DWORD err = GetLastError();
+		map->file = NULL;
+		return (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? 0 : -1;
+	}
+	if (GetFileSizeEx(map->file, &size) == 0 || ((uint64_t)size.QuadPart) > ((uint64_t)((size_t)-1))) goto onError;
+	if (size.QuadPart == 0) {
+		CloseHandle(map->file);
+		map->file = NULL;
+		return 0;
+	}
+	map->mapping = CreateFileMapping(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (map->mapping == NULL) goto onError;
+	map->data = (const uint8_t *)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (map->data == NULL) goto onError;
+	map->size = (size_t)size.QuadPart;
+	return 1;
+onError:
+	if (map->mapping != NULL) CloseHandle(map->mapping);
+	CloseHandle(map->file);
+	memset(map, 0, sizeof(*map));
+	return -1;
+#else /* PCF_IS_NO_WIN */
+	struct stat stats;
+	void * data;
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return (errno == ENOENT) ? 0 : -1;
+	if (fstat(fd, &stats) < 0 || ((uint64_t)stats.st_size) > ((uint64_t)((size_t)-1))) {
+		close(fd);
+		return -1;
+	}
+	if (stats.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	data = mmap(NULL, (size_t)stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); /* the mapping stays valid */
+	if (data == MAP_FAILED) return -1;
+	map->data = (const uint8_t *)data;
+	map->size = (size_t)stats.st_size;
+	return 1;
+#endif /* PCF_IS_WIN */
+}
+
+
+/**
+ * Removes a mapping created by mf_map().
+ *
+ * @param[in,out] map - mapping to remove
+ */
+static void mf_unmap(tMfMap * map) {
+#ifdef PCF_IS_WIN
+	if (map->data != NULL) UnmapViewOfFile((LPCVOID)map->data);
+	if (map->mapping != NULL) CloseHandle(map->mapping);
+	if (map->file != NULL) CloseHandle(map->file);
+#else /* PCF_IS_NO_WIN */
+	if (map->data != NULL) munmap((void *)map->data, map->size);
+#endif /* PCF_IS_WIN */
+	memset(map, 0, sizeof(*map));
+}
+
+
+/**
+ * Atomically replaces the destination file by the source file.
+ *
+ * @param[in] src - file to rename
+ * @param[in] dst - file to replace
+ * @return 1 on success, 0 on failure
+ */
+static int mf_replace(const TCHAR * src, const TCHAR * dst) {
+#ifdef PCF_IS_WIN
+	return (MoveFileEx(src, dst, MOVEFILE_REPLACE_EXISTING) != 0) ? 1 : 0;
+#else /* PCF_IS_NO_WIN */
+	return (rename(src, dst) == 0) ? 1 : 0;
+#endif /* PCF_IS_WIN */
+}
+
+
+/**
+ * Removes the given file.
+ *
+ * @param[in] path - file to remove
+ */
+static void mf_remove(const TCHAR * path) {
+#ifdef PCF_IS_WIN
+	DeleteFile(path);
+#else /* PCF_IS_NO_WIN */
+	unlink(path);
+#endif /* PCF_IS_WIN */
+}
+
+
+/**
+ * Validates the mapped compacted manifest and loads its footer.
+ *
+ * @param[in,out] mf - manifest handle
+ * @return 1 on success, 0 if the manifest is invalid
+ */
+static int mf_loadBase(tManifest * mf) {
+	const uint8_t * footer;
+	mf->entryCount = 0;
+	mf->blockCount = 0;
+	mf->blockEntries = MF_BLOCK_ENTRIES;
+	mf->indexOffset = 0;
+	if (mf->base.data == NULL) return 1;
+	if (mf->base.size < MF_FOOTER_SIZE) return 0;
+	footer = mf->base.data + mf->base.size - MF_FOOTER_SIZE;
+	if (memcmp(footer, MF_MAGIC, 8) != 0 || mf_getU32(footer + 8) != (uint32_t)sizeof(TCHAR)) return 0;
+	mf->blockEntries = mf_getU32(footer + 12);
+	mf->entryCount = mf_getU64(footer + 16);
+	mf->indexOffset = mf_getU64(footer + 24);
+	if (mf->blockEntries == 0) return 0;
+	mf->blockCount = (mf->entryCount + mf->blockEntries - 1) / mf->blockEntries;
+	if (mf->indexOffset > mf->base.size - MF_FOOTER_SIZE
+		|| ((mf->base.size - MF_FOOTER_SIZE - mf->indexOffset) / 8) != mf->blockCount
+		|| ((mf->base.size - MF_FOOTER_SIZE - mf->indexOffset) % 8) != 0) {
+		return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Parses the mapped log into the sorted list of latest records per key.
+ *
+ * @param[in,out] mf - manifest handle
+ * @return 1 on success, 0 if the log is damaged (valid records are still loaded), -1 on allocation failure
+ */
+static int mf_loadLog(tManifest * mf) {
+	const uint8_t * p;
+	const uint8_t * end;
+	size_t cap = 0;
+	size_t i, n;
+	int res = 1;
+	free(mf->logRecs);
+	mf->logRecs = NULL;
+	mf->logCount = 0;
+	if (mf->log.data == NULL) return 1;
+	if (mf->log.size < MF_LOG_HEADER_SIZE || memcmp(mf->log.data, MF_LOG_MAGIC, 8) != 0
+		|| mf_getU32(mf->log.data + 8) != (uint32_t)sizeof(TCHAR)) {
+		return 0;
+	}
+	p = mf->log.data + MF_LOG_HEADER_SIZE;
+	end = mf->log.data + mf->log.size;
+	while (p < end) {
+		const uint8_t * rec;
+		const uint8_t * recEnd;
+		uint64_t keyLen;
+		if ((size_t)(end - p) < 4) {
+			res = 0; /* truncated record */
+			break;
+		}
+		rec = p + 4;
+		if (mf_getU32(p) > (size_t)(end - rec)) {
+			res = 0; /* truncated record */
+			break;
+		}
+		recEnd = rec + mf_getU32(p);
+		p = rec;
+		if (mf_getVarint(&p, recEnd, &keyLen) == 0 || keyLen > (uint64_t)(recEnd - p) || (keyLen % sizeof(TCHAR)) != 0) {
+			res = 0;
+			break;
+		}
+		p += keyLen;
+		if (mf_getValue(&p, recEnd, NULL, NULL, NULL) == 0 || p != recEnd) {
+			res = 0;
+			break;
+		}
+		if (mf->logCount >= cap) {
+			const size_t newCap = (cap == 0) ? 1024 : (cap * 2);
+			const uint8_t ** newRecs = (const uint8_t **)realloc((void *)mf->logRecs, newCap * sizeof(*newRecs));
+			if (newRecs == NULL) return -1;
+			mf->logRecs = newRecs;
+			cap = newCap;
+		}
+		mf->logRecs[mf->logCount++] = rec;
+	}
+	if (mf->logCount > 1) {
+		qsort((void *)mf->logRecs, mf->logCount, sizeof(*(mf->logRecs)), mf_cmpLogRec);
+		/* keep only the latest record per key */
+		for (i = 1, n = 0; i < mf->logCount; i++) {
+			const uint8_t * keyA, * keyB;
+			size_t lenA, lenB;
+			mf_logKey(mf->logRecs[n], &keyA, &lenA);
+			mf_logKey(mf->logRecs[i], &keyB, &lenB);
+			if (mf_cmpKey(keyA, lenA, keyB, lenB) != 0) n++;
+			mf->logRecs[n] = mf->logRecs[i];
+		}
+		mf->logCount = n + 1;
+	}
+	return res;
+}
+
+
+/**
+ * Writes raw bytes to the compacted manifest being built.
+ *
+ * @param[in,out] w - manifest builder
+ * @param[in] data - bytes to write
+ * @param[in] len - number of bytes to write
+ */
+static void mf_write(tMfWriter * w, const void * data, const size_t len) {
+	if (w->failed != 0 || len == 0) return;
+	if (fwrite(data, 1, len, w->fp) != len) {
+		w->failed = 1;
+		return;
+	}
+	w->offset += len;
+}
+
+
+/**
+ * Adds an entry to the compacted manifest being built. Entries need to be added in key order.
+ *
+ * @param[in,out] w - manifest builder
+ * @param[in] key - entry key
+ * @param[in] keyLen - length of key in bytes
+ * @param[in] value - encoded value
+ * @param[in] valueLen - length of value in bytes
+ */
+static void mf_writeEntry(tMfWriter * w, const uint8_t * key, const size_t keyLen, const uint8_t * value, const size_t valueLen) {
+	uint8_t buf[2 * MF_MAX_VARINT_SIZE];
+	size_t shared = 0;
+	size_t len;
+	if (w->failed != 0) return;
+	if ((w->count % MF_BLOCK_ENTRIES) == 0) {
+		/* start a new block with an uncompressed key */
+		const size_t n = (size_t)(w->count / MF_BLOCK_ENTRIES);
+		if (n >= w->blockCap) {
+			const size_t newCap = (w->blockCap == 0) ? 1024 : (w->blockCap * 2);
+			uint64_t * newBlocks = (uint64_t *)realloc(w->blocks, newCap * sizeof(uint64_t));
+			if (newBlocks == NULL) {
+				w->failed = 1;
+				return;
+			}
+			w->blocks = newBlocks;
+			w->blockCap = newCap;
+		}
+		w->blocks[n] = w->offset;
+	} else {
+		const size_t maxShared = PCF_MIN(w->prevLen, keyLen);
+		while (shared < maxShared && w->prevKey[shared] == key[shared]) shared++;
+	}
+	len = mf_putVarint(buf, shared);
+	len += mf_putVarint(buf + len, keyLen - shared);
+	mf_write(w, buf, len);
+	mf_write(w, key + shared, keyLen - shared);
+	mf_write(w, value, valueLen);
+	if (keyLen > w->prevCap) {
+		uint8_t * newKey = (uint8_t *)realloc(w->prevKey, keyLen);
+		if (newKey == NULL) {
+			w->failed = 1;
+			return;
+		}
+		w->prevKey = newKey;
+		w->prevCap = keyLen;
+	}
+	memcpy(w->prevKey, key, keyLen);
+	w->prevLen = keyLen;
+	w->count++;
+}
+
+
+/**
+ * Merges the compacted entries with the log entries into a new compacted manifest and
+ * removes the log afterwards. The appending log file needs to be closed before.
+ *
+ * @param[in,out] mf - manifest handle
+ * @return 1 on success, 0 on failure
+ */
+static int mf_compact(tManifest * mf) {
+	tMfWriter w;
+	uint8_t footer[MF_FOOTER_SIZE];
+	uint8_t * key = NULL; /* current compacted key */
+	size_t keyLen = 0, keyCap = 0;
+	const uint8_t * p = NULL;
+	const uint8_t * blockEnd = NULL;
+	uint64_t entry = 0; /* number of compacted entries read */
+	size_t logIdx = 0;
+	int haveKey = 0;
+	size_t i;
+	int res = 0;
+	memset(&w, 0, sizeof(w));
+	w.fp = _tfopen(mf->tmpPath, _T("wb"));
+	if (w.fp == NULL) return 0;
+	for (;;) {
+		const uint8_t * stats = NULL;
+		const uint8_t * statsEnd = NULL;
+		/* decode the next compacted entry */
+		if (haveKey == 0 && entry < mf->entryCount) {
+			uint64_t shared, suffix;
+			if ((entry % mf->blockEntries) == 0) {
+				const uint64_t block = entry / mf->blockEntries;
+				p = mf->base.data + mf_getU64(mf->base.data + mf->indexOffset + (8 * block));
+				blockEnd = ((block + 1) < mf->blockCount) ? (mf->base.data + mf_getU64(mf->base.data + mf->indexOffset + (8 * (block + 1)))) : (mf->base.data + mf->indexOffset);
+				if (p > blockEnd || blockEnd > mf->base.data + mf->indexOffset) goto onError;
+			}
+			if (mf_getVarint(&p, blockEnd, &shared) == 0 || mf_getVarint(&p, blockEnd, &suffix) == 0
+				|| shared > keyLen || suffix > (uint64_t)(blockEnd - p)) {
+				goto onError;
+			}
+			if ((size_t)(shared + suffix) > keyCap) {
+				uint8_t * newKey = (uint8_t *)realloc(key, (size_t)(shared + suffix));
+				if (newKey == NULL) goto onError;
+				key = newKey;
+				keyCap = (size_t)(shared + suffix);
+			}
+			memcpy(key + shared, p, (size_t)suffix);
+			keyLen = (size_t)(shared + suffix);
+			p += suffix;
+			haveKey = 1;
+			entry++;
+		}
+		if (haveKey == 0 && logIdx >= mf->logCount) break;
+		/* emit the smaller key (log entries replace compacted ones) */
+		if (logIdx < mf->logCount) {
+			const uint8_t * logKey;
+			size_t logKeyLen;
+			const uint8_t * rec = mf->logRecs[logIdx];
+			const uint8_t * logStats = mf_logKey(rec, &logKey, &logKeyLen);
+			const int cmp = (haveKey != 0) ? mf_cmpKey(logKey, logKeyLen, key, keyLen) : -1;
+			if (cmp <= 0) {
+				const uint8_t * logStatsEnd = logStats;
+				mf_getValue(&logStatsEnd, rec + mf_getU32(rec - 4), NULL, NULL, NULL);
+				mf_writeEntry(&w, logKey, logKeyLen, logStats, (size_t)(logStatsEnd - logStats));
+				logIdx++;
+				if (cmp == 0) {
+					if (mf_getValue(&p, blockEnd, NULL, NULL, NULL) == 0) goto onError;
+					haveKey = 0;
+				}
+				continue;
+			}
+		}
+		stats = p;
+		if (mf_getValue(&p, blockEnd, NULL, NULL, NULL) == 0) goto onError;
+		statsEnd = p;
+		mf_writeEntry(&w, key, keyLen, stats, (size_t)(statsEnd - stats));
+		haveKey = 0;
+	}
+	/* block index and footer */
+	for (i = 0; w.failed == 0 && i < (size_t)((w.count + MF_BLOCK_ENTRIES - 1) / MF_BLOCK_ENTRIES); i++) {
+		uint8_t buf[8];
+		mf_putU64(buf, w.blocks[i]);
+		mf_write(&w, buf, 8);
+	}
+	memcpy(footer, MF_MAGIC, 8);
+	mf_putU32(footer + 8, (uint32_t)sizeof(TCHAR));
+	mf_putU32(footer + 12, MF_BLOCK_ENTRIES);
+	mf_putU64(footer + 16, w.count);
+	mf_putU64(footer + 24, w.offset - (8 * ((w.count + MF_BLOCK_ENTRIES - 1) / MF_BLOCK_ENTRIES)));
+	mf_write(&w, footer, MF_FOOTER_SIZE);
+	if (w.failed != 0) goto onError;
+	if (fclose(w.fp) != 0) {
+		w.fp = NULL;
+		goto onError;
+	}
+	w.fp = NULL;
+	/* swap in the new manifest (the old one cannot be replaced while mapped on Windows) */
+	mf_unmap(&(mf->base));
+	free((void *)mf->logRecs);
+	mf->logRecs = NULL;
+	mf->logCount = 0;
+	mf_unmap(&(mf->log));
+	if (mf_replace(mf->tmpPath, mf->path) == 0) goto onError;
+	mf_remove(mf->logPath);
+	mf->appended = 0;
+	res = 1;
+	if (mf_map(mf->path, &(mf->base)) < 0 || mf_loadBase(mf) == 0) {
+		mf_unmap(&(mf->base));
+		mf_loadBase(mf);
+		res = 0;
+	}
+onError:
+	if (w.fp != NULL) fclose(w.fp);
+	if (res == 0) mf_remove(mf->tmpPath);
+	free(w.prevKey);
+	free(w.blocks);
+	free(key);
+	return res;
+}
+
+
+/**
+ * Opens the manifest of the given backup root. A missing manifest is handled like an empty one.
+ *
+ * @param[in] root - backup root directory
+ * @param[in] name - file name of the compacted manifest
+ * @param[in] writable - set to allow updates via mf_append()
+ * @return manifest handle or NULL on error
+ */
+tManifest * mf_open(const TCHAR * root, const TCHAR * name, const int writable) {
+	tManifest * mf = (tManifest *)calloc(1, sizeof(tManifest));
+	int res;
+	if (mf == NULL) return NULL;
+	mf->writable = writable;
+	mf->path = mf_joinPath(root, name, NULL);
+	mf->logPath = mf_joinPath(root, name, MF_LOG_SUFFIX);
+	mf->tmpPath = mf_joinPath(root, name, MF_TMP_SUFFIX);
+	if (mf->path == NULL || mf->logPath == NULL || mf->tmpPath == NULL) goto onError;
+	if (mf_map(mf->path, &(mf->base)) < 0 || mf_map(mf->logPath, &(mf->log)) < 0) goto onError;
+	if (mf_loadBase(mf) == 0) {
+		if (writable == 0) goto onError;
+		/* invalid manifest -> rebuild it from the log */
+		mf_unmap(&(mf->base));
+		mf_loadBase(mf);
+		res = mf_loadLog(mf);
+		if (res < 0 || mf_compact(mf) == 0) goto onError;
+		return mf;
+	}
+	res = mf_loadLog(mf);
+	if (res < 0) goto onError;
+	if (res == 0 && writable != 0) {
+		/* damaged log (e.g. interrupted write) -> compact the valid part before appending */
+		if (mf_compact(mf) == 0) goto onError;
+	}
+	return mf;
+onError:
+	mf_unmap(&(mf->base));
+	mf_unmap(&(mf->log));
+	free((void *)mf->logRecs);
+	free(mf->path);
+	free(mf->logPath);
+	free(mf->tmpPath);
+	free(mf);
+	return NULL;
+}
+
+
+/**
+ * Looks up the file status recorded for the given key. This function may be called
+ * concurrently but not concurrently to mf_close().
+ *
+ * @param[in] mf - manifest handle
+ * @param[in] key - path relative to the backup root
+ * @param[out] stats - receives the recorded file status
+ * @param[out] data - receives the recorded user data which stays valid until mf_close() (may be NULL)
+ * @param[out] dataLen - receives the recorded user data length in bytes (may be NULL)
+ * @return 1 if found, 0 if not recorded
+ */
+int mf_find(const tManifest * mf, const TCHAR * key, tFileStat * stats, const void ** data, size_t * dataLen) {
+	const uint8_t * k = (const uint8_t *)key;
+	const size_t kLen = sizeof(TCHAR) * _tcslen(key);
+	uint64_t lo, hi;
+	const uint8_t * p;
+	const uint8_t * blockEnd;
+	size_t m; /* common prefix length of the previous entry and the key */
+	if (mf == NULL) return 0;
+	/* log entries take precedence */
+	if (mf->logCount > 0) {
+		size_t l = 0, h = mf->logCount;
+		while (l < h) {
+			const size_t mid = l + ((h - l) / 2);
+			const uint8_t * recKey;
+			size_t recKeyLen;
+			const uint8_t * recStats = mf_logKey(mf->logRecs[mid], &recKey, &recKeyLen);
+			const int cmp = mf_cmpKey(recKey, recKeyLen, k, kLen);
+			if (cmp == 0) {
+				return mf_getValue(&recStats, mf->logRecs[mid] + mf_getU32(mf->logRecs[mid] - 4), stats, data, dataLen);
+			} else if (cmp < 0) {
+				l = mid + 1;
+			} else {
+				h = mid;
+			}
+		}
+	}
+	if (mf->blockCount == 0) return 0;
+	/* find the last block whose first key is not greater than the key */
+	lo = 0;
+	hi = mf->blockCount;
+	while ((hi - lo) > 1) {
+		const uint64_t mid = lo + ((hi - lo) / 2);
+		uint64_t shared, len;
+		p = mf->base.data + mf_getU64(mf->base.data + mf->indexOffset + (8 * mid));
+		blockEnd = mf->base.data + mf->indexOffset;
+		if (p >= blockEnd || mf_getVarint(&p, blockEnd, &shared) == 0 || mf_getVarint(&p, blockEnd, &len) == 0
+			|| shared != 0 || len > (uint64_t)(blockEnd - p)) {
+			return 0; /* damaged */
+		}
+		if (mf_cmpKey(p, (size_t)len, k, kLen) <= 0) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	p = mf->base.data + mf_getU64(mf->base.data + mf->indexOffset + (8 * lo));
+	blockEnd = ((lo + 1) < mf->blockCount) ? (mf->base.data + mf_getU64(mf->base.data + mf->indexOffset + (8 * (lo + 1)))) : (mf->base.data + mf->indexOffset);
+	if (p > blockEnd || blockEnd > mf->base.data + mf->indexOffset) return 0;
+	/* linear scan without key reconstruction: entries are sorted, hence the previous entry
+	 * is always smaller than the key and only the shared prefix length needs to be tracked */
+	m = 0;
+	while (p < blockEnd) {
+		uint64_t shared, suffix;
+		size_t j = 0;
+		if (mf_getVarint(&p, blockEnd, &shared) == 0 || mf_getVarint(&p, blockEnd, &suffix) == 0
+			|| suffix > (uint64_t)(blockEnd - p)) {
+			return 0; /* damaged */
+		}
+		if (shared < m) return 0; /* entry differs at a position where it is greater than the key */
+		if (shared == m) {
+			while (j < suffix && (m + j) < kLen && p[j] == k[m + j]) j++;
+			if (j == suffix && (m + j) == kLen) {
+				p += suffix;
+				return mf_getValue(&p, blockEnd, stats, data, dataLen);
+			}
+			if (j < suffix && ((m + j) == kLen || p[j] > k[m + j])) return 0; /* passed the key */
+			m += j;
+		} /* else: entry equals the previous one up to m and is still smaller */
+		p += suffix;
+		if (mf_getValue(&p, blockEnd, NULL, NULL, NULL) == 0) return 0;
+	}
+	return 0;
+}
+
+
+/**
+ * Records the file status and user data for the given key in the log. This function is not
+ * thread-safe.
+ *
+ * @param[in,out] mf - manifest handle
+ * @param[in] key - path relative to the backup root
+ * @param[in] stats - file status to record
+ * @param[in] data - user data to record (may be NULL if dataLen is 0)
+ * @param[in] dataLen - user data length in bytes
+ * @return 1 on success, 0 on failure
+ */
+int mf_append(tManifest * mf, const TCHAR * key, const tFileStat * stats, const void * data, const size_t dataLen) {
+	uint8_t head[4 + MF_MAX_VARINT_SIZE];
+	uint8_t buf[MF_MAX_STAT_SIZE];
+	const size_t kLen = sizeof(TCHAR) * _tcslen(key);
+	size_t headLen, statsLen;
+	if (mf == NULL || mf->writable == 0 || mf->failed != 0) return 0;
+	if (mf->logFile == NULL) {
+		mf->logFile = _tfopen(mf->logPath, (mf->log.data != NULL) ? _T("ab") : _T("wb"));
+		if (mf->logFile == NULL) {
+			mf->failed = 1;
+			return 0;
+		}
+		if (mf->log.data == NULL) {
+			uint8_t header[MF_LOG_HEADER_SIZE];
+			memset(header, 0, sizeof(header));
+			memcpy(header, MF_LOG_MAGIC, 8);
+			mf_putU32(header + 8, (uint32_t)sizeof(TCHAR));
+			if (fwrite(header, 1, sizeof(header), mf->logFile) != sizeof(header)) mf->failed = 1;
+		}
+	}
+	headLen = 4 + mf_putVarint(head + 4, kLen);
+	if (((uint64_t)kLen + dataLen) > (uint64_t)(UINT32_MAX - MF_MAX_VARINT_SIZE - MF_MAX_STAT_SIZE)) return 0;
+	statsLen = mf_putStat(buf, stats);
+	statsLen += mf_putVarint(buf + statsLen, dataLen);
+	mf_putU32(head, (uint32_t)(headLen - 4 + kLen + statsLen + dataLen));
+	if (fwrite(head, 1, headLen, mf->logFile) != headLen
+		|| fwrite(key, 1, kLen, mf->logFile) != kLen
+		|| fwrite(buf, 1, statsLen, mf->logFile) != statsLen
+		|| (dataLen > 0 && fwrite(data, 1, dataLen, mf->logFile) != dataLen)) {
+		mf->failed = 1;
+		return 0;
+	}
+	mf->appended++;
+	return 1;
+}
+
+
+/**
+ * Marks the manifest as outdated. It is removed by mf_close() which then reports a failure.
+ * Further updates are rejected.
+ *
+ * @param[in,out] mf - manifest handle
+ */
+void mf_invalidate(tManifest * mf) {
+	if (mf == NULL || mf->writable == 0) return;
+	mf->failed = 1;
+}
+
+
+/**
+ * Closes the manifest. The log is merged into the compacted manifest if it holds more than
+ * a quarter of the compacted entry count. The manifest is removed if updates could not be
+ * written.
+ *
+ * @param[in,out] mf - manifest handle (freed)
+ * @return 1 on success, 0 if updates could not be written
+ */
+int mf_close(tManifest * mf) {
+	int res = 1;
+	if (mf == NULL) return 1;
+	if (mf->logFile != NULL) {
+		if (fclose(mf->logFile) != 0) mf->failed = 1;
+		mf->logFile = NULL;
+	}
+	if (mf->failed != 0) res = 0;
+	if (res != 0 && mf->writable != 0 && ((uint64_t)(mf->logCount + mf->appended) * 4) > mf->entryCount) {
+		/* reload the log including the records appended by this instance and compact */
+		mf_unmap(&(mf->log));
+		if (mf_map(mf->logPath, &(mf->log)) < 0 || mf_loadLog(mf) < 0 || mf_compact(mf) == 0) res = 0;
+	}
+	mf_unmap(&(mf->base));
+	mf_unmap(&(mf->log));
+	if (res == 0 && mf->writable != 0) {
+		/* a missing update could leave outdated entries -> drop the manifest to rebuild it */
+		mf_remove(mf->path);
+		mf_remove(mf->logPath);
+	}
+	free((void *)mf->logRecs);
+	free(mf->path);
+	free(mf->logPath);
+	free(mf->tmpPath);
+	free(mf);
+	return res;
+}
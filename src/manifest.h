@@ -0,0 +1,80 @@
+/**
+ * @file manifest.h
+ * @author Daniel Starke
+ * @see manifest.c
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "target.h"
+#include "tchar.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** File name suffix of the manifest update log. */
+#define MF_LOG_SUFFIX _T(".log")
+
+
+/** File name suffix used while writing a new compacted manifest. */
+#define MF_TMP_SUFFIX _T(".tmp")
+
+
+/** Number of entries per prefix-compressed block. */
+#define MF_BLOCK_ENTRIES 64
+
+
+/**
+ * File status as recorded in the manifest.
+ */
+typedef struct {
+	uint64_t size;    /**< file size in bytes */
+	int64_t mtime;    /**< modification time in seconds since the Unix epoch */
+	uint32_t mtimeNs; /**< nanosecond part of the modification time */
+	int64_t ctime;    /**< status change time in seconds since the Unix epoch */
+	uint32_t ctimeNs; /**< nanosecond part of the status change time */
+	uint64_t ino;     /**< inode or file index (0 if unknown) */
+	uint32_t mode;    /**< file type and mode bits (file attributes on Windows) */
+	uint64_t dev;     /**< device or volume serial number (0 if unknown, not recorded) */
+} tFileStat;
+
+
+/**
+ * Opaque manifest handle.
+ */
+typedef struct tManifest tManifest;
+
+
+tManifest * mf_open(const TCHAR * root, const TCHAR * name, const int writable);
+int mf_find(const tManifest * mf, const TCHAR * key, tFileStat * stats, const void ** data, size_t * dataLen);
+int mf_append(tManifest * mf, const TCHAR * key, const tFileStat * stats, const void * data, const size_t dataLen);
+void mf_invalidate(tManifest * mf);
+int mf_close(tManifest * mf);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* __MANIFEST_H__ */
@@ -2,7 +2,7 @@
  * @file tchar.h
  * @author Daniel Starke
  * @date 2014-05-04
- * @version 2026-06-28
+ * @version 2026-10-18
  * 
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -50,7 +50,9 @@ typedef wchar_t TCHAR;
 #define _tcsrchr wcsrchr
 #define _tcspbrk wcspbrk
 #define _tcschr wcschr
+#define _tcsspn wcsspn
 #define _ttoi _wtoi
+#define _tcstoul wcstoul
 #define _fgetts fgetws
 #define _fputts _fputws
 #define _putts _putws
@@ -58,6 +60,7 @@ typedef wchar_t TCHAR;
 #define _ftprintf fwprintf
 #define _sntprintf snwprintf
 #define _tfopen _wfopen
+#define _tremove _wremove
 #define _tstat wstat
 #define _tcserror _wcserror
 #define PCF_PATH_SEPT PCF_PATH_SEPU
@@ -80,7 +83,9 @@ typedef char TCHAR;
 #define _tcsrchr strrchr
 #define _tcspbrk strpbrk
 #define _tcschr strchr
+#define _tcsspn strspn
 #define _ttoi atoi
+#define _tcstoul strtoul
 #define _fgetts fgets
 #define _fputts fputs
 #define _putts puts
@@ -88,6 +93,7 @@ typedef char TCHAR;
 #define _ftprintf fprintf
 #define _sntprintf snprintf
 #define _tfopen fopen
+#define _tremove remove
 #define _tstat stat
 #define _tcserror strerror
 #define PCF_PATH_SEPT PCF_PATH_SEP
@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see tdirs.h
  * @date 2012-12-15
- * @version 2026-06-28
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -33,6 +33,10 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+/* POSIX 2008, not declared for _POSIX_C_SOURCE=200112L */
+DIR * fdopendir(int fd);
 #endif /* PCF_IS_WIN */
 
 
@@ -63,6 +67,7 @@ typedef struct tTdsCtx {
 	int maxLevel;                /**< maximal level to traverse to (`-1` for no limit) */
 	int options;                 /**< combination of tTdsOption elements */
 	TraverseDirVisitorS visitor; /**< user defined callback function */
+	TraverseDirListS lister;     /**< user defined directory listing function (NULL to read directly) */
 	void * param;                /**< user defined callback parameter */
 } tTdsCtx;
 
@@ -235,12 +240,14 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 					/* directory */
 					const int isLink = (item.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
 					const int following = (ctx->options & TDSO_FOLLOW_LINKS) != 0;
+					int visited = 1;
 					if ((ctx->options & TDSO_DIRECTORY) != 0) {
-						if ((*ctx->visitor)(newPath, itemName, itemExt, TDSF_DIR | (isLink ? TDSF_LINK : 0), curLevel, ctx->param) == 0) {
-							result = 0;
-						}
+						visited = (*ctx->visitor)(newPath, itemName, itemExt, TDSF_DIR | (isLink ? TDSF_LINK : 0), curLevel, ctx->param);
+						if (visited == 0) result = 0;
 					}
-					if (isLink && ( ! following )) {
+					if (visited == TDS_SKIP) {
+						/* visitor skipped this directory */
+					} else if (isLink && ( ! following )) {
 						/* reparse-point directory and not following links -> skip */
 					} else if ( ! following ) {
 						/* regular directory */
@@ -293,17 +300,34 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 	size_t maxPath = 256;
 	int needPathSize;
 	int result = 1, subResult = 1;
+	char * names = NULL; /* entry names provided by the lister */
+	size_t namesSize = 0;
+	size_t namesPos = 0;
+	const char * itemName;
 	if (ctx->maxLevel >= 0 && curLevel > ((const unsigned int)ctx->maxLevel)) return 1;
-	if ((dp = opendir(path)) == NULL) result = -1;
+	if (ctx->lister != NULL) {
+		if ((*ctx->lister)(path, &names, &namesSize, ctx->param) == 0 || (namesSize > 0 && names[namesSize - 1] != 0)) {
+			result = -1;
+		}
+	} else if ((dp = opendir(path)) == NULL) {
+		result = -1;
+	}
 	while (result == 1) {
-		errno = 0;
-		item = readdir(dp);
-		if (item == NULL) {
-			/* real error or end of list? */
-			if (errno != 0) result = -1;
-			break;
+		if (ctx->lister != NULL) {
+			if (namesPos >= namesSize) break; /* end of list */
+			itemName = names + namesPos;
+			namesPos += strlen(itemName) + 1;
+		} else {
+			errno = 0;
+			item = readdir(dp);
+			if (item == NULL) {
+				/* real error or end of list? */
+				if (errno != 0) result = -1;
+				break;
+			}
+			itemName = item->d_name;
 		}
-		if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+		if (strcmp(itemName, ".") == 0 || strcmp(itemName, "..") == 0) continue;
 		do {
 			if (newPath == NULL) {
 				if ((newPath = (char *)malloc(sizeof(char) * maxPath)) == NULL) {
@@ -312,9 +336,9 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 				}
 			}
 			if (path[pathLength - 1] == '\\' || path[pathLength - 1] == '/') {
-				needPathSize = snprintf(newPath, maxPath, "%s%s", path, item->d_name);
+				needPathSize = snprintf(newPath, maxPath, "%s%s", path, itemName);
 			} else {
-				needPathSize = snprintf(newPath, maxPath, "%s"PCF_PATH_SEP"%s", path, item->d_name);
+				needPathSize = snprintf(newPath, maxPath, "%s"PCF_PATH_SEP"%s", path, itemName);
 			}
 			if (needPathSize < 0 || ((size_t)needPathSize) >= maxPath) {
 				/* error or path did not fit -> grow buffer and retry */
@@ -332,48 +356,62 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 			}
 		} while (newPath == NULL);
 		if (result == 1) {
-			const char * itemName = newPath + strlen(newPath) - strlen(item->d_name);
-			const char * itemExt = strrchr(itemName, '.');
+			const size_t itemLength = strlen(itemName);
+			const char * itemExt;
 			int isLink = 0;
-			int isDir;
+			int isDir = -1;
 			const int following = (ctx->options & TDSO_FOLLOW_LINKS) != 0;
 			struct stat idStat;
+			itemName = newPath + strlen(newPath) - itemLength;
+			itemExt = strrchr(itemName, '.');
 			if (itemExt == NULL) {
-				itemExt = itemName + strlen(item->d_name);
+				itemExt = itemName + itemLength;
 			}
-			if (lstat(newPath, &itemStat) != 0) {
-				if (tds_reportError(ctx, newPath, itemName, itemExt, TDSF_FILE, curLevel) == 0) {
-					result = 0;
-				}
-				continue;
+#if defined(_DIRENT_HAVE_D_TYPE) && defined(DT_UNKNOWN)
+			if ((ctx->options & TDSO_NO_STAT) != 0 && item != NULL && ( ! following ) && item->d_type != DT_UNKNOWN) {
+				/* the entry type suffices as links are not followed */
+				isLink = (item->d_type == DT_LNK) ? 1 : 0;
+				isDir = (item->d_type == DT_DIR) ? 1 : 0;
+				memset(&idStat, 0, sizeof(idStat)); /* only needed for followed links */
 			}
-			idStat = itemStat;
-#ifdef S_ISLNK
-			if (S_ISLNK(itemStat.st_mode)) isLink = 1;
 #endif
-			if (isLink) {
-				/* dereference the link to classify it (and identify its target) */
-				struct stat targetStat;
-				if (stat(newPath, &targetStat) == 0) {
-					idStat = targetStat;
-				} else if (following) {
-					/* dangling or unreadable link target -> report and skip */
-					if (tds_reportError(ctx, newPath, itemName, itemExt, TDSF_DIR, curLevel) == 0) {
+			if (isDir < 0) {
+				if (lstat(newPath, &itemStat) != 0) {
+					if (tds_reportError(ctx, newPath, itemName, itemExt, TDSF_FILE, curLevel) == 0) {
 						result = 0;
 					}
 					continue;
 				}
-				/* not following + unresolved target -> keep lstat (treated as item) */
+				idStat = itemStat;
+#ifdef S_ISLNK
+				if (S_ISLNK(itemStat.st_mode)) isLink = 1;
+#endif
+				if (isLink) {
+					/* dereference the link to classify it (and identify its target) */
+					struct stat targetStat;
+					if (stat(newPath, &targetStat) == 0) {
+						idStat = targetStat;
+					} else if (following) {
+						/* dangling or unreadable link target -> report and skip */
+						if (tds_reportError(ctx, newPath, itemName, itemExt, TDSF_DIR, curLevel) == 0) {
+							result = 0;
+						}
+						continue;
+					}
+					/* not following + unresolved target -> keep lstat (treated as item) */
+				}
+				isDir = S_ISDIR(idStat.st_mode) ? 1 : 0;
 			}
-			isDir = S_ISDIR(idStat.st_mode) ? 1 : 0;
 			if (isDir) {
 				/* directory (including a symlink to a directory) */
+				int visited = 1;
 				if ((ctx->options & TDSO_DIRECTORY) != 0) {
-					if ((*ctx->visitor)(newPath, itemName, itemExt, TDSF_DIR | (isLink ? TDSF_LINK : 0), curLevel, ctx->param) == 0) {
-						result = 0;
-					}
+					visited = (*ctx->visitor)(newPath, itemName, itemExt, TDSF_DIR | (isLink ? TDSF_LINK : 0), curLevel, ctx->param);
+					if (visited == 0) result = 0;
 				}
-				if (isLink && ( ! following )) {
+				if (visited == TDS_SKIP) {
+					/* visitor skipped this directory */
+				} else if (isLink && ( ! following )) {
 					/* directory symlink and not following links -> reported, not descended */
 				} else if ( following ) {
 					/* cycle detection is active while following links */
@@ -403,6 +441,7 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 		}
 	}
 	if (dp != NULL) closedir(dp);
+	if (names != NULL) free(names);
 	if (newPath != NULL) free(newPath);
 	if (result == 0) return 0;
 	if (subResult != 1) return subResult;
@@ -411,6 +450,153 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
 }
 
 
+/**
+ * Appends a directory entry name to the given name list.
+ *
+ * @param[in,out] names - name list buffer
+ * @param[in,out] size - used size of names in bytes
+ * @param[in,out] cap - capacity of names in bytes
+ * @param[in] name - entry name to append
+ * @return 1 on success, 0 on allocation failure
+ */
+static int tds_addName(char ** names, size_t * size, size_t * cap, const char * name) {
+	const size_t len = strlen(name) + 1;
+	if ((*size + len) > *cap) {
+		size_t newCap = (*cap == 0) ? 4096 : (*cap * 2);
+		char * newNames;
+		while ((*size + len) > newCap) newCap *= 2;
+		newNames = (char *)realloc(*names, newCap);
+		if (newNames == NULL) return 0;
+		*names = newNames;
+		*cap = newCap;
+	}
+	memcpy(*names + *size, name, len);
+	*size += len;
+	return 1;
+}
+
+
+/**
+ * Reads the entry names of the given directory. This is the default
+ * directory listing used by tds_traverse().
+ *
+ * @param[in] path - directory path
+ * @param[out] names - receives an allocated buffer of NUL terminated entry names
+ * (without "." and "..") which needs to be freed by the caller
+ * @param[out] size - receives the size of names in bytes
+ * @return 1 on success, 0 on error
+ */
+int tds_listDir(const char * path, char ** names, size_t * size) {
+	size_t cap = 0;
+	int result = 1;
+	*names = NULL;
+	*size = 0;
+	if (path == NULL || *path == 0) return 0;
+#ifdef PCF_IS_WIN
+	{
+		WIN32_FIND_DATAA item;
+		HANDLE dp;
+		const size_t myPathLength = strlen(path) + strlen(PCF_PATH_SEP) + 2;
+		char * myPath = (char *)malloc(sizeof(char) * myPathLength);
+		if (myPath == NULL) return 0;
+		snprintf(myPath, myPathLength, "%s" PCF_PATH_SEP "*", path);
+		dp = FindFirstFileA(myPath, &item);
+		free(myPath);
+		if (dp == INVALID_HANDLE_VALUE) return 0;
+		do {
+			if (strcmp(item.cFileName, ".") == 0 || strcmp(item.cFileName, "..") == 0) continue;
+			if (tds_addName(names, size, &cap, item.cFileName) == 0) {
+				result = 0;
+				break;
+			}
+		} while (FindNextFileA(dp, &item) != 0);
+		if (result == 1 && GetLastError() != ERROR_NO_MORE_FILES) result = 0;
+		FindClose(dp);
+	}
+#else /* PCF_IS_NO_WIN */
+	{
+		struct dirent * item;
+		DIR * dp = opendir(path);
+		if (dp == NULL) return 0;
+		for (;;) {
+			errno = 0;
+			item = readdir(dp);
+			if (item == NULL) {
+				/* real error or end of list? */
+				if (errno != 0) result = 0;
+				break;
+			}
+			if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+			if (tds_addName(names, size, &cap, item->d_name) == 0) {
+				result = 0;
+				break;
+			}
+		}
+		closedir(dp);
+	}
+#endif /* PCF_IS_WIN */
+	if (result == 0) {
+		free(*names);
+		*names = NULL;
+		*size = 0;
+	}
+	return result;
+}
+
+
+#ifndef PCF_IS_WIN
+/**
+ * Reads the entry names of the directory opened as the given file descriptor.
+ * Unlike tds_listDir(), no path is resolved again. The passed descriptor is
+ * kept open and remains owned by the caller.
+ *
+ * @param[in] fd - file descriptor of the opened directory
+ * @param[out] names - receives an allocated buffer of NUL terminated entry names
+ * (without "." and "..") which needs to be freed by the caller
+ * @param[out] size - receives the size of names in bytes
+ * @return 1 on success, 0 on error
+ */
+int tds_listDirFd(const int fd, char ** names, size_t * size) {
+	size_t cap = 0;
+	int result = 1;
+	struct dirent * item;
+	DIR * dp;
+	int dirFd;
+	*names = NULL;
+	*size = 0;
+	/* closedir() closes the descriptor passed to fdopendir() */
+	dirFd = dup(fd);
+	if (dirFd < 0) return 0;
+	dp = fdopendir(dirFd);
+	if (dp == NULL) {
+		close(dirFd);
+		return 0;
+	}
+	for (;;) {
+		errno = 0;
+		item = readdir(dp);
+		if (item == NULL) {
+			/* real error or end of list? */
+			if (errno != 0) result = 0;
+			break;
+		}
+		if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+		if (tds_addName(names, size, &cap, item->d_name) == 0) {
+			result = 0;
+			break;
+		}
+	}
+	closedir(dp);
+	if (result == 0) {
+		free(*names);
+		*names = NULL;
+		*size = 0;
+	}
+	return result;
+}
+#endif /* PCF_IS_NO_WIN */
+
+
 /**
  * The function traverses the given path by the specified options
  * and notifies the passed visitor on each processed item.
@@ -423,10 +609,31 @@ static int tds_traverseR(const char * path, const unsigned int curLevel,
  * @return 1 on success, 0 on user abort, -1 on error
  */
 int tds_traverse(const char * path, const int maxLevel, const int options, TraverseDirVisitorS visitor, void * param) {
+	return tds_traverseList(path, maxLevel, options, visitor, NULL, param);
+}
+
+
+/**
+ * The function traverses the given path by the specified options
+ * and notifies the passed visitor on each processed item. The directory
+ * entries are retrieved via the given lister. The lister is not used on
+ * Windows as the directory listing there already provides the item types.
+ *
+ * @param[in] path - base path to process
+ * @param[in] maxLevel - maximal level to traverse to (-1 for no limit)
+ * @param[in] options - combination of tTdsOption elements by binary OR
+ * @param[in] visitor - user defined callback function
+ * @param[in] lister - user defined directory listing function (NULL to read directly)
+ * @param[in,out] param - user defined parameter (passed to callback functions)
+ * @return 1 on success, 0 on user abort, -1 on error
+ */
+int tds_traverseList(const char * path, const int maxLevel, const int options, TraverseDirVisitorS visitor,
+	TraverseDirListS lister, void * param) {
 	tTdsCtx ctx;
 	ctx.maxLevel = maxLevel;
 	ctx.options = options & TDSO_ALL;
 	ctx.visitor = visitor;
+	ctx.lister = lister;
 	ctx.param = param;
 	if (ctx.options == 0) return -1;
 	if (path == NULL || *path == 0) return -1;
@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see tdirs.c
  * @date 2012-12-15
- * @version 2026-06-28
+ * @version 2026-10-18
  * 
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -40,6 +40,12 @@ typedef enum tTdsFlag {
 } tTdsFlag;
 
 
+/**
+ * Visitor return value to skip the entries of the reported directory.
+ */
+#define TDS_SKIP 2
+
+
 /**
  * Defines the callback function for directory traversing.
  * It is recommended to make the callback function inline
@@ -76,11 +82,27 @@ typedef enum tTdsFlag {
  * @param[in,out] param - user defined parameter
  * @return 0 to abort
  * @return 1 to continue
+ * @return TDS_SKIP to continue without descending into the reported directory
  */
 typedef int (* TraverseDirVisitorS)(const char * path, const char * item, const char * ext,
 	const int flags, const unsigned int level, void * param);
 
 
+/**
+ * Defines the callback function to list the entries of a directory.
+ * This allows to provide directory listings from a cache. tds_listDir()
+ * can be used to read the directory.
+ *
+ * @param[in] path - directory path
+ * @param[out] names - receives an allocated buffer of NUL terminated entry names
+ * (without "." and "..") which is freed by the caller
+ * @param[out] size - receives the size of names in bytes
+ * @param[in,out] param - user defined parameter
+ * @return 1 on success, 0 on error
+ */
+typedef int (* TraverseDirListS)(const char * path, char ** names, size_t * size, void * param);
+
+
 /**
  * These options are used to control the traversing process of
  * tds_traverse().
@@ -90,11 +112,20 @@ typedef enum tTdsOption {
 	TDSO_ITEM = TDSO_DIRECTORY << 1,
 	TDSO_FOLLOW_LINKS = TDSO_ITEM << 1,
 	TDSO_ERRORS = TDSO_FOLLOW_LINKS << 1,
-	TDSO_ALL = TDSO_DIRECTORY | TDSO_ITEM | TDSO_FOLLOW_LINKS | TDSO_ERRORS
+	/** classify entries by the type in the directory entry if available instead of querying
+	 * their status (ignored with TDSO_FOLLOW_LINKS or a lister; symlinks are reported as items) */
+	TDSO_NO_STAT = TDSO_ERRORS << 1,
+	TDSO_ALL = TDSO_DIRECTORY | TDSO_ITEM | TDSO_FOLLOW_LINKS | TDSO_ERRORS | TDSO_NO_STAT
 } tTdsOption;
 
 
+int tds_listDir(const char * path, char ** names, size_t * size);
+#ifndef PCF_IS_WIN
+int tds_listDirFd(const int fd, char ** names, size_t * size);
+#endif /* PCF_IS_NO_WIN */
 int tds_traverse(const char * path, const int maxLevel, const int options, TraverseDirVisitorS visitor, void * param);
+int tds_traverseList(const char * path, const int maxLevel, const int options, TraverseDirVisitorS visitor,
+	TraverseDirListS lister, void * param);
 
 
 #ifdef __cplusplus
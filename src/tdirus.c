@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see tdirus.h
  * @date 2012-12-16
- * @version 2026-06-28
+ * @version 2026-10-18
  *
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -215,12 +215,14 @@ static int tdus_traverseR(const wchar_t * path, const unsigned int curLevel,
 					/* directory */
 					const int isLink = (item.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
 					const int following = (ctx->options & TDUSO_FOLLOW_LINKS) != 0;
+					int visited = 1;
 					if ((ctx->options & TDUSO_DIRECTORY) != 0) {
-						if ((*ctx->visitor)(newPath, itemName, itemExt, TDSUF_DIR | (isLink ? TDSUF_LINK : 0), curLevel, ctx->param) == 0) {
-							result = 0;
-						}
+						visited = (*ctx->visitor)(newPath, itemName, itemExt, TDSUF_DIR | (isLink ? TDSUF_LINK : 0), curLevel, ctx->param);
+						if (visited == 0) result = 0;
 					}
-					if (isLink && ( ! following )) {
+					if (visited == TDUS_SKIP) {
+						/* visitor skipped this directory */
+					} else if (isLink && ( ! following )) {
 						/* reparse-point directory and not following links -> skip */
 					} else if ( ! following ) {
 						/* regular directory */
@@ -3,7 +3,7 @@
  * @author Daniel Starke
  * @see tdirus.c
  * @date 2012-12-16
- * @version 2026-06-28
+ * @version 2026-10-18
  * 
  * DISCLAIMER
  * This file has no copyright assigned and is placed in the Public Domain.
@@ -41,6 +41,12 @@ typedef enum tTdusFlag {
 } tTdusFlag;
 
 
+/**
+ * Visitor return value to skip the entries of the reported directory.
+ */
+#define TDUS_SKIP 2
+
+
 /**
  * Defines the callback function for directory traversing.
  * It is recommended to make the callback function inline
@@ -77,6 +83,7 @@ typedef enum tTdusFlag {
  * @param[in,out] param - user defined parameter
  * @return 0 to abort
  * @return 1 to continue
+ * @return TDUS_SKIP to continue without descending into the reported directory
  */
 typedef int (* TraverseDirVisitorUS)(const wchar_t * path, const wchar_t * item, const wchar_t * ext,
 	const int flags, const unsigned int level, void * param);
@@ -91,7 +98,9 @@ typedef enum tTdusOption {
 	TDUSO_ITEM = TDUSO_DIRECTORY << 1,
 	TDUSO_FOLLOW_LINKS = TDUSO_ITEM << 1,
 	TDUSO_ERRORS = TDUSO_FOLLOW_LINKS << 1,
-	TDUSO_ALL = TDUSO_DIRECTORY | TDUSO_ITEM | TDUSO_FOLLOW_LINKS | TDUSO_ERRORS
+	/** no effect as the directory listing provides the entry types already */
+	TDUSO_NO_STAT = TDUSO_ERRORS << 1,
+	TDUSO_ALL = TDUSO_DIRECTORY | TDUSO_ITEM | TDUSO_FOLLOW_LINKS | TDUSO_ERRORS | TDUSO_NO_STAT
 } tTdusOption;
 
 
@@ -0,0 +1,707 @@
+/**
+ * @file watch.c
+ * @author Daniel Starke
+ * @see watch.h
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Changes are received via fanotify if the kernel supports reporting the directory and name
+ * of a change (Linux 5.9) and the process may resolve file handles (CAP_SYS_ADMIN and
+ * CAP_DAC_READ_SEARCH). A single filesystem mark covers all directories of a root in that
+ * case. Otherwise, every directory is watched via inotify.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* open_by_handle_at(), O_PATH */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "watch.h"
+
+#ifdef PCF_IS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
+#include "tdirs.h"
+
+
+/** Size of the event read buffer in bytes. */
+#define WT_BUFFER_SIZE 65536
+
+
+/** inotify events of interest for directories. */
+#define WT_DIR_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO \
+	| IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+
+/** inotify events of interest for a single file root. */
+#define WT_FILE_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_DONT_FOLLOW)
+
+
+#if defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM)
+#define WT_HAS_FANOTIFY 1
+/** fanotify events of interest. */
+#define WT_FAN_MASK (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_MODIFY | FAN_CLOSE_WRITE \
+	| FAN_ATTRIB | FAN_ONDIR)
+#endif
+
+
+/**
+ * Watched root.
+ */
+typedef struct {
+	char * path;  /**< root path as given */
+	char * real;  /**< resolved root path (fanotify only) */
+	size_t id;    /**< user defined identifier */
+	int isDir;    /**< root is a directory? */
+	int mountFd;  /**< file descriptor to resolve file handles (fanotify only) */
+	int fsid[2];  /**< filesystem identifier (fanotify only) */
+} tWtRoot;
+
+
+/**
+ * inotify watch descriptor state.
+ */
+typedef struct {
+	char * path;  /**< watched path (NULL if unused) */
+	size_t id;    /**< identifier of the root */
+	int isDir;    /**< watched path is a directory? */
+} tWtNode;
+
+
+/**
+ * Watcher state.
+ */
+struct tWatch {
+	int fd;                 /**< fanotify or inotify file descriptor */
+	int fanotify;           /**< fd is a fanotify descriptor? */
+	tWtRoot * roots;        /**< watched roots */
+	size_t rootCount;       /**< number of roots */
+	tWtNode * nodes;        /**< inotify watches indexed by watch descriptor */
+	size_t nodeCount;       /**< number of entries in nodes */
+	size_t addId;           /**< root identifier while adding a directory tree */
+	int addFailed;          /**< a watch could not be added while adding a directory tree */
+	tWatchVisitor visitor;  /**< visitor while reading events */
+	void * param;           /**< visitor parameter while reading events */
+	char * path;            /**< path buffer for reported paths */
+	size_t pathCap;         /**< capacity of path in bytes */
+	char * full;            /**< path buffer for resolved paths */
+	size_t fullCap;         /**< capacity of full in bytes */
+	uint64_t buf[WT_BUFFER_SIZE / sizeof(uint64_t)]; /**< event read buffer (aligned) */
+};
+
+
+/**
+ * Duplicates the given string.
+ *
+ * @param[in] str - string to duplicate
+ * @return allocated copy or NULL on allocation failure
+ */
+static char * wt_dup(const char * str) {
+	const size_t len = strlen(str) + 1;
+	char * res = (char *)malloc(len);
+	if (res != NULL) memcpy(res, str, len);
+	return res;
+}
+
+
+/**
+ * Joins the given path and name into the given growable buffer. No separator is added if
+ * the path already ends with one or name starts with one.
+ *
+ * @param[in,out] buf - buffer
+ * @param[in,out] cap - buffer capacity in bytes
+ * @param[in] path - base path
+ * @param[in] name - appended name (may be NULL or empty to copy path only)
+ * @return joined path or NULL on allocation failure
+ */
+static char * wt_join(char ** buf, size_t * cap, const char * path, const char * name) {
+	const size_t pathLen = strlen(path);
+	const size_t nameLen = (name != NULL) ? strlen(name) : 0;
+	const int sep = (nameLen > 0 && pathLen > 0 && path[pathLen - 1] != '/' && name[0] != '/') ? 1 : 0;
+	const size_t len = pathLen + (size_t)sep + nameLen + 1;
+	if (len > *cap) {
+		char * newBuf = (char *)realloc(*buf, len);
+		if (newBuf == NULL) return NULL;
+		*buf = newBuf;
+		*cap = len;
+	}
+	memcpy(*buf, path, pathLen);
+	if (sep != 0) (*buf)[pathLen] = '/';
+	if (nameLen > 0) memcpy(*buf + pathLen + (size_t)sep, name, nameLen);
+	(*buf)[len - 1] = 0;
+	return *buf;
+}
+
+
+/**
+ * Adds an inotify watch for the given path.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] path - path to watch
+ * @param[in] id - identifier of the root
+ * @param[in] isDir - path is a directory?
+ * @return 1 on success, 0 on error
+ */
+static int wt_addWatch(tWatch * w, const char * path, const size_t id, const int isDir) {
+	char * copy;
+	const int wd = inotify_add_watch(w->fd, path, (uint32_t)((isDir != 0) ? WT_DIR_MASK : WT_FILE_MASK));
+	if (wd < 0) return 0;
+	if ((size_t)wd >= w->nodeCount) {
+		size_t count = (w->nodeCount > 0) ? w->nodeCount : 64;
+		tWtNode * nodes;
+		while (count <= (size_t)wd) count *= 2;
+		nodes = (tWtNode *)realloc(w->nodes, sizeof(tWtNode) * count);
+		if (nodes == NULL) return 0;
+		memset(nodes + w->nodeCount, 0, sizeof(tWtNode) * (count - w->nodeCount));
+		w->nodes = nodes;
+		w->nodeCount = count;
+	}
+	/* the same descriptor is returned for an inode watched before (e.g. after a move) */
+	copy = wt_dup(path);
+	if (copy == NULL) return 0;
+	free(w->nodes[wd].path);
+	w->nodes[wd].path = copy;
+	w->nodes[wd].id = id;
+	w->nodes[wd].isDir = isDir;
+	return 1;
+}
+
+
+/**
+ * Directory traversal visitor to add inotify watches for all sub directories.
+ *
+ * @param[in] path - full path
+ * @param[in] item - item name
+ * @param[in] ext - file extension
+ * @param[in] flags - item flags
+ * @param[in] level - path depth
+ * @param[in,out] param - watcher
+ * @return 1 to continue
+ */
+static int wt_addVisitor(const char * path, const char * item, const char * ext, const int flags,
+	const unsigned int level, void * param) {
+	tWatch * w = (tWatch *)param;
+	PCF_UNUSED(item)
+	PCF_UNUSED(ext)
+	PCF_UNUSED(level)
+	if (flags == TDSF_DIR && wt_addWatch(w, path, w->addId, 1) == 0) w->addFailed = 1;
+	return 1;
+}
+
+
+/**
+ * Adds inotify watches for the given directory and all its sub directories.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] path - directory path
+ * @param[in] id - identifier of the root
+ * @return 1 on success, 0 if not all directories could be watched
+ */
+static int wt_addTree(tWatch * w, const char * path, const size_t id) {
+	/* watch first to not miss changes during the traversal */
+	if (wt_addWatch(w, path, id, 1) == 0) return 0;
+	w->addId = id;
+	w->addFailed = 0;
+	tds_traverse(path, -1, TDSO_DIRECTORY, wt_addVisitor, w);
+	return (w->addFailed == 0) ? 1 : 0;
+}
+
+
+/**
+ * Removes the inotify watches of the given directory and all its sub directories.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] path - directory path
+ */
+static void wt_removeTree(tWatch * w, const char * path) {
+	const size_t len = strlen(path);
+	size_t i;
+	for (i = 0; i < w->nodeCount; i++) {
+		const char * node = w->nodes[i].path;
+		if (node == NULL || strncmp(node, path, len) != 0 || (node[len] != 0 && node[len] != '/')) continue;
+		inotify_rm_watch(w->fd, (int)i);
+		free(w->nodes[i].path);
+		w->nodes[i].path = NULL;
+	}
+}
+
+
+/**
+ * Handles a single inotify event.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] ev - event
+ */
+static void wt_inotifyEvent(tWatch * w, const struct inotify_event * ev) {
+	const char * dir;
+	const char * child;
+	size_t id;
+	int isDir;
+	if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+		w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	if (ev->wd < 0 || (size_t)ev->wd >= w->nodeCount || w->nodes[ev->wd].path == NULL) return;
+	dir = w->nodes[ev->wd].path;
+	id = w->nodes[ev->wd].id;
+	if ((ev->mask & IN_IGNORED) != 0) {
+		free(w->nodes[ev->wd].path);
+		w->nodes[ev->wd].path = NULL;
+		return;
+	}
+	if (w->nodes[ev->wd].isDir == 0) {
+		/* single file root */
+		if ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+			/* follow a replaced file by its path */
+			char * path = wt_dup(dir);
+			if (path == NULL) {
+				w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+				return;
+			}
+			inotify_rm_watch(w->fd, ev->wd);
+			free(w->nodes[ev->wd].path);
+			w->nodes[ev->wd].path = NULL;
+			wt_addWatch(w, path, id, 0);
+			w->visitor(path, WTK_FILE, id, w->param);
+			free(path);
+		} else {
+			w->visitor(dir, WTK_FILE, id, w->param);
+		}
+		return;
+	}
+	/* changes of the directory itself are reported by its parent */
+	if (ev->len == 0 || ev->name[0] == 0) return;
+	child = wt_join(&(w->path), &(w->pathCap), dir, ev->name);
+	if (child == NULL) {
+		w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	isDir = ((ev->mask & IN_ISDIR) != 0) ? 1 : 0;
+	if ((ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) != 0) {
+		w->visitor(dir, WTK_DIR, id, w->param);
+		if (isDir != 0 && (ev->mask & IN_MOVED_FROM) != 0) {
+			/* moved within the tree -> re-added by IN_MOVED_TO with its new path */
+			wt_removeTree(w, child);
+		}
+		if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+			if (isDir != 0) {
+				/* the directory may already hold entries -> back up the whole tree */
+				if (wt_addTree(w, child, id) == 0) w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+				w->visitor(child, WTK_TREE, id, w->param);
+			} else {
+				w->visitor(child, WTK_FILE, id, w->param);
+			}
+		}
+	} else if ((ev->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)) != 0) {
+		w->visitor(child, (isDir != 0) ? WTK_DIR : WTK_FILE, id, w->param);
+	}
+}
+
+
+#ifdef WT_HAS_FANOTIFY
+/**
+ * Resolves the given path. The last path element is kept as is for non-directories to
+ * match changes of a symbolic link itself.
+ *
+ * @param[in] path - path to resolve
+ * @param[in] isDir - path is a directory?
+ * @return allocated resolved path or NULL on error
+ */
+static char * wt_realPath(const char * path, const int isDir) {
+	char * res = NULL;
+	char * parent;
+	const char * name;
+	char * real;
+	size_t len;
+	if (isDir != 0) return realpath(path, NULL);
+	name = strrchr(path, '/');
+	if (name == NULL) {
+		parent = wt_dup(".");
+		name = path;
+	} else {
+		parent = wt_dup(path);
+		if (parent != NULL) parent[(name == path) ? 1 : (size_t)(name - path)] = 0;
+		name++;
+	}
+	if (parent == NULL) return NULL;
+	real = realpath(parent, NULL);
+	free(parent);
+	if (real == NULL) return NULL;
+	len = 0;
+	wt_join(&res, &len, real, name);
+	free(real);
+	return res;
+}
+
+
+/**
+ * Prepares the given root for fanotify. The file handle resolution is tested here as it
+ * requires additional privileges.
+ *
+ * @param[in,out] w - watcher
+ * @param[in,out] root - root to add
+ * @return 1 on success, 0 on error
+ */
+static int wt_markRoot(tWatch * w, tWtRoot * root) {
+	union {
+		struct file_handle fh;
+		char data[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+	} handle;
+	struct statfs sfs;
+	int mountId, fd;
+	if (statfs(root->path, &sfs) != 0) return 0;
+	memcpy(root->fsid, &(sfs.f_fsid), sizeof(root->fsid));
+	if (root->real == NULL) root->real = wt_realPath(root->path, root->isDir);
+	if (root->real == NULL) return 0;
+	if (root->mountFd < 0) root->mountFd = open(root->path, O_PATH | O_CLOEXEC);
+	if (root->mountFd < 0) return 0;
+	handle.fh.handle_bytes = MAX_HANDLE_SZ;
+	if (name_to_handle_at(AT_FDCWD, root->path, &(handle.fh), &mountId, 0) != 0) return 0;
+	fd = open_by_handle_at(root->mountFd, &(handle.fh), O_PATH | O_CLOEXEC);
+	if (fd < 0) return 0;
+	close(fd);
+	return (fanotify_mark(w->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, WT_FAN_MASK, AT_FDCWD, root->path) == 0) ? 1 : 0;
+}
+
+
+/**
+ * Reports a change of the given resolved path for each root containing it.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] dir - resolved directory path
+ * @param[in] name - entry name within dir (NULL for dir itself)
+ * @param[in] kind - kind of change
+ */
+static void wt_reportReal(tWatch * w, const char * dir, const char * name, const tWatchKind kind) {
+	const char * full = wt_join(&(w->full), &(w->fullCap), dir, name);
+	size_t i;
+	if (full == NULL) {
+		w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	for (i = 0; i < w->rootCount; i++) {
+		const tWtRoot * root = w->roots + i;
+		const size_t len = strlen(root->real);
+		const char * rest = full + len;
+		const char * path;
+		if (strncmp(full, root->real, len) != 0) continue;
+		if (root->isDir == 0) {
+			if (*rest != 0 || kind != WTK_FILE) continue;
+		} else if (*rest != 0 && *rest != '/' && root->real[len - 1] != '/') {
+			continue;
+		}
+		path = wt_join(&(w->path), &(w->pathCap), root->path, rest);
+		if (path == NULL) {
+			w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+			return;
+		}
+		w->visitor(path, kind, root->id, w->param);
+	}
+}
+
+
+/**
+ * Handles a single fanotify event.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] meta - event
+ */
+static void wt_fanotifyEvent(tWatch * w, const struct fanotify_event_metadata * meta) {
+	const char * end = (const char *)meta + meta->event_len;
+	const struct fanotify_event_info_fid * info = (const struct fanotify_event_info_fid *)((const char *)meta + meta->metadata_len);
+	struct file_handle * fh;
+	const char * name = NULL;
+	char proc[64];
+	char dir[PATH_MAX + 1];
+	ssize_t len;
+	size_t i;
+	int mountFd = -1, fd, isDir;
+	if (meta->fd >= 0) close(meta->fd);
+	if ((meta->mask & FAN_Q_OVERFLOW) != 0) {
+		w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	if ((const char *)(info + 1) > end) return;
+	fh = (struct file_handle *)(info->handle);
+	if (info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+		name = (const char *)(fh->f_handle + fh->handle_bytes);
+		if (strcmp(name, ".") == 0) name = NULL;
+	} else if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID) {
+		return;
+	}
+	for (i = 0; i < w->rootCount; i++) {
+		if (memcmp(w->roots[i].fsid, &(info->fsid), sizeof(w->roots[i].fsid)) == 0) {
+			mountFd = w->roots[i].mountFd;
+			break;
+		}
+	}
+	if (mountFd < 0) return; /* not below any root */
+	fd = open_by_handle_at(mountFd, fh, O_PATH | O_CLOEXEC);
+	if (fd < 0) {
+		/* a removed directory needs no backup */
+		if (errno != ESTALE && errno != ENOENT) w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	len = readlink(proc, dir, sizeof(dir) - 1);
+	close(fd);
+	if (len < 0 || (size_t)len >= (sizeof(dir) - 1)) {
+		w->visitor(NULL, WTK_OVERFLOW, 0, w->param);
+		return;
+	}
+	dir[len] = 0;
+	isDir = ((meta->mask & FAN_ONDIR) != 0) ? 1 : 0;
+	if (name == NULL) {
+		/* change of a directory itself */
+		if ((meta->mask & (FAN_ATTRIB | FAN_MODIFY)) != 0) wt_reportReal(w, dir, NULL, WTK_DIR);
+		return;
+	}
+	if ((meta->mask & (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)) != 0) {
+		wt_reportReal(w, dir, NULL, WTK_DIR);
+		if ((meta->mask & (FAN_CREATE | FAN_MOVED_TO)) != 0) {
+			wt_reportReal(w, dir, name, (isDir != 0) ? WTK_TREE : WTK_FILE);
+		}
+	}
+	if ((meta->mask & (FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ATTRIB)) != 0) {
+		wt_reportReal(w, dir, name, (isDir != 0) ? WTK_DIR : WTK_FILE);
+	}
+}
+#endif /* WT_HAS_FANOTIFY */
+
+
+/**
+ * Adds the given root via inotify.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] root - root to add
+ * @return 1 on success, 0 on error
+ */
+static int wt_addInotify(tWatch * w, const tWtRoot * root) {
+	if (root->isDir != 0) return wt_addTree(w, root->path, root->id);
+	return wt_addWatch(w, root->path, root->id, 0);
+}
+
+
+/**
+ * Switches from fanotify to inotify and adds all roots again.
+ *
+ * @param[in,out] w - watcher
+ * @return 1 on success, 0 on error
+ */
+static int wt_fallback(tWatch * w) {
+	size_t i;
+	close(w->fd);
+	w->fanotify = 0;
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0) return 0;
+	for (i = 0; i < w->rootCount; i++) {
+		if (wt_addInotify(w, w->roots + i) == 0) return 0;
+	}
+	return 1;
+}
+#endif /* PCF_IS_LINUX */
+
+
+/**
+ * Creates a new watcher.
+ *
+ * @return watcher handle or NULL on error or if not supported on this platform
+ */
+tWatch * wt_create(void) {
+#ifdef PCF_IS_LINUX
+	tWatch * w = (tWatch *)malloc(sizeof(tWatch));
+	if (w == NULL) return NULL;
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+#ifdef WT_HAS_FANOTIFY
+	w->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE);
+	if (w->fd >= 0) w->fanotify = 1;
+#endif
+	if (w->fd < 0) w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0) {
+		free(w);
+		return NULL;
+	}
+	return w;
+#else /* not PCF_IS_LINUX */
+	return NULL;
+#endif /* PCF_IS_LINUX */
+}
+
+
+/**
+ * Watches the given file or directory tree. Adding the same root again re-adds the watches
+ * for all its directories, e.g. after events got lost.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] root - path to watch
+ * @param[in] id - user defined identifier reported for changes below root
+ * @return 1 on success, 0 if not all directories could be watched
+ */
+int wt_add(tWatch * w, const char * root, const size_t id) {
+#ifdef PCF_IS_LINUX
+	struct stat st;
+	tWtRoot * entry = NULL;
+	size_t i;
+	if (w == NULL || root == NULL) return 0;
+	if (lstat(root, &st) != 0) return 0;
+	for (i = 0; i < w->rootCount; i++) {
+		if (w->roots[i].id == id && strcmp(w->roots[i].path, root) == 0) {
+			entry = w->roots + i;
+			if (w->fanotify != 0) return 1; /* a filesystem mark covers all directories */
+			break;
+		}
+	}
+	if (entry == NULL) {
+		tWtRoot * roots = (tWtRoot *)realloc(w->roots, sizeof(tWtRoot) * (w->rootCount + 1));
+		if (roots == NULL) return 0;
+		w->roots = roots;
+		entry = w->roots + w->rootCount;
+		memset(entry, 0, sizeof(*entry));
+		entry->path = wt_dup(root);
+		if (entry->path == NULL) return 0;
+		entry->id = id;
+		entry->mountFd = -1;
+		w->rootCount++;
+	}
+	entry->isDir = S_ISDIR(st.st_mode) ? 1 : 0;
+#ifdef WT_HAS_FANOTIFY
+	if (w->fanotify != 0) {
+		if (wt_markRoot(w, entry) != 0) return 1;
+		/* missing privileges or kernel support */
+		return wt_fallback(w);
+	}
+#endif
+	return wt_addInotify(w, entry);
+#else /* not PCF_IS_LINUX */
+	PCF_UNUSED(w)
+	PCF_UNUSED(root)
+	PCF_UNUSED(id)
+	return 0;
+#endif /* PCF_IS_LINUX */
+}
+
+
+/**
+ * Waits for changes and reports them to the given visitor. A single change may be reported
+ * multiple times.
+ *
+ * @param[in,out] w - watcher
+ * @param[in] timeout - maximum time to wait in milliseconds (-1 to wait infinitely)
+ * @param[in] visitor - callback for each change
+ * @param[in,out] param - user defined parameter passed to visitor
+ * @return 1 if changes were reported, 0 on timeout or interruption, -1 on error
+ */
+int wt_read(tWatch * w, const int timeout, tWatchVisitor visitor, void * param) {
+#ifdef PCF_IS_LINUX
+	struct pollfd pfd;
+	int res;
+	if (w == NULL || visitor == NULL) return -1;
+	pfd.fd = w->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	res = poll(&pfd, 1, timeout);
+	if (res < 0) return (errno == EINTR) ? 0 : -1;
+	if (res == 0) return 0;
+	w->visitor = visitor;
+	w->param = param;
+	for (;;) {
+		const char * ptr = (const char *)(w->buf);
+		const ssize_t len = read(w->fd, w->buf, sizeof(w->buf));
+		const char * end = ptr + len;
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			return -1;
+		} else if (len == 0) {
+			break;
+		}
+#ifdef WT_HAS_FANOTIFY
+		if (w->fanotify != 0) {
+			const struct fanotify_event_metadata * meta = (const struct fanotify_event_metadata *)ptr;
+			ssize_t left = len;
+			for (; FAN_EVENT_OK(meta, left); meta = FAN_EVENT_NEXT(meta, left)) {
+				if (meta->vers != FANOTIFY_METADATA_VERSION) return -1;
+				wt_fanotifyEvent(w, meta);
+			}
+			continue;
+		}
+#endif
+		while (ptr < end) {
+			const struct inotify_event * ev = (const struct inotify_event *)ptr;
+			wt_inotifyEvent(w, ev);
+			ptr += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return 1;
+#else /* not PCF_IS_LINUX */
+	PCF_UNUSED(w)
+	PCF_UNUSED(timeout)
+	PCF_UNUSED(visitor)
+	PCF_UNUSED(param)
+	return -1;
+#endif /* PCF_IS_LINUX */
+}
+
+
+/**
+ * Returns the name of the used notification interface.
+ *
+ * @param[in] w - watcher
+ * @return "fanotify" or "inotify"
+ */
+const char * wt_backend(const tWatch * w) {
+#ifdef PCF_IS_LINUX
+	return (w != NULL && w->fanotify != 0) ? "fanotify" : "inotify";
+#else /* not PCF_IS_LINUX */
+	PCF_UNUSED(w)
+	return "none";
+#endif /* PCF_IS_LINUX */
+}
+
+
+/**
+ * Stops watching and frees the given watcher.
+ *
+ * @param[in,out] w - watcher (may be NULL)
+ */
+void wt_destroy(tWatch * w) {
+#ifdef PCF_IS_LINUX
+	size_t i;
+	if (w == NULL) return;
+	if (w->fd >= 0) close(w->fd);
+	for (i = 0; i < w->rootCount; i++) {
+		free(w->roots[i].path);
+		free(w->roots[i].real);
+		if (w->roots[i].mountFd >= 0) close(w->roots[i].mountFd);
+	}
+	for (i = 0; i < w->nodeCount; i++) free(w->nodes[i].path);
+	free(w->roots);
+	free(w->nodes);
+	free(w->path);
+	free(w->full);
+	free(w);
+#else /* not PCF_IS_LINUX */
+	PCF_UNUSED(w)
+#endif /* PCF_IS_LINUX */
+}
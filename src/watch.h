@@ -0,0 +1,73 @@
+/**
+ * @file watch.h
+ * @author Daniel Starke
+ * @see watch.c
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <stddef.h>
+#include "target.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Kind of change reported by wt_read().
+ */
+typedef enum tWatchKind {
+	WTK_FILE = 1,  /**< content or attributes of a non-directory item changed */
+	WTK_DIR = 2,   /**< entries or attributes of a directory changed */
+	WTK_TREE = 3,  /**< a directory tree appeared (created or moved in) */
+	WTK_OVERFLOW = 4 /**< events were lost (path is NULL) -> everything needs to be rescanned */
+} tWatchKind;
+
+
+/**
+ * Defines the callback function for reported changes.
+ *
+ * @param[in] path - changed path below the watched root (in the form given to wt_add())
+ * @param[in] kind - kind of change
+ * @param[in] id - identifier of the watched root given to wt_add()
+ * @param[in,out] param - user defined parameter
+ */
+typedef void (* tWatchVisitor)(const char * path, const tWatchKind kind, const size_t id, void * param);
+
+
+/**
+ * Opaque watcher handle.
+ */
+typedef struct tWatch tWatch;
+
+
+tWatch * wt_create(void);
+int wt_add(tWatch * w, const char * root, const size_t id);
+int wt_read(tWatch * w, const int timeout, tWatchVisitor visitor, void * param);
+const char * wt_backend(const tWatch * w);
+void wt_destroy(tWatch * w);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* __WATCH_H__ */
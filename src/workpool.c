@@ -0,0 +1,570 @@
+/**
+ * @file workpool.c
+ * @author Daniel Starke
+ * @see workpool.h
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "workpool.h"
+
+#ifdef PCF_IS_WIN
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else /* PCF_IS_NO_WIN */
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#endif /* PCF_IS_WIN */
+
+
+/** Minimal measurement interval for auto-tuning in microseconds. */
+#define WP_TUNE_INTERVAL 250000
+
+
+/** Measurement interval after which a tuning step is done even with few completions. */
+#define WP_TUNE_MAX_INTERVAL 2000000
+
+
+#ifdef PCF_IS_WIN
+/** Layout compatible to CONDITION_VARIABLE (not declared by older SDKs). */
+typedef struct {
+	void * ptr;
+} tWpCond;
+
+
+typedef VOID (WINAPI * tWpInitCond)(tWpCond *);
+typedef BOOL (WINAPI * tWpSleepCond)(tWpCond *, CRITICAL_SECTION *, DWORD);
+typedef VOID (WINAPI * tWpWakeCond)(tWpCond *);
+
+
+/* condition variables need Windows Vista or newer -> resolved dynamically to still load on Windows XP */
+static tWpInitCond wp_initCond = NULL;
+static tWpSleepCond wp_sleepCond = NULL;
+static tWpWakeCond wp_wakeAllCond = NULL;
+#endif /* PCF_IS_WIN */
+
+
+/**
+ * Work pool state.
+ */
+struct tWorkPool {
+	struct tWorkPool * base; /**< pool which executes the work items (itself if not shared) */
+	tWorkPoolRun run;    /**< work item execution callback */
+	tWorkPoolDone done;  /**< work item completion callback */
+	void * param;        /**< user defined callback parameter */
+	int threaded;        /**< work items are executed by worker threads? */
+	int autoTune;        /**< adjust worker count and queue depth from measurements? */
+	int fixedDepth;      /**< queue depth was set explicitly? */
+	int stop;            /**< worker threads shall terminate? */
+	size_t limit;        /**< number of worker threads allowed to execute work items */
+	size_t depth;        /**< maximum number of queued work items */
+	size_t spawned;      /**< number of started worker threads */
+	size_t running;      /**< number of work items currently executed */
+	size_t queued;       /**< number of work items waiting for a worker */
+	size_t outstanding;  /**< number of submitted work items not reaped yet (per handle) */
+	tWorkItem * head;    /**< first queued work item */
+	tWorkItem * tail;    /**< last queued work item */
+	tWorkItem * finished; /**< executed work items waiting to be reaped (per handle) */
+	/* auto-tuning state */
+	uint64_t tuneStart;  /**< start of the current measurement interval */
+	size_t tuneOps;      /**< work items completed in the current measurement interval */
+	uint64_t tuneBusy;   /**< summed execution time in the current measurement interval */
+	double lastScore;    /**< throughput of the previous interval in work items per second */
+	double lastLatency;  /**< mean work item latency of the previous interval in microseconds */
+	double bestScore;    /**< highest throughput measured */
+	size_t bestLimit;    /**< worker count of the highest throughput measured */
+	size_t bestDepth;    /**< queue depth of the highest throughput measured */
+	int direction;       /**< current hill-climbing direction (+1 or -1) */
+	/* pacing state */
+	uint64_t paceInterval; /**< microseconds between paced operations (0 if unlimited) */
+	uint64_t paceNext;   /**< earliest start time of the next paced operation */
+#ifdef PCF_IS_WIN
+	CRITICAL_SECTION mutex; /**< guards all fields above */
+	tWpCond work;        /**< signaled if work items were queued */
+	tWpCond change;      /**< signaled if work items were dequeued or completed */
+	HANDLE threads[WP_MAX_WORKERS]; /**< worker thread handles */
+#else /* PCF_IS_NO_WIN */
+	pthread_mutex_t mutex; /**< guards all fields above */
+	pthread_cond_t work;   /**< signaled if work items were queued */
+	pthread_cond_t change; /**< signaled if work items were dequeued or completed */
+	pthread_t threads[WP_MAX_WORKERS]; /**< worker thread handles */
+#endif /* PCF_IS_WIN */
+};
+
+
+/**
+ * Returns a monotonic time stamp.
+ *
+ * @return time in microseconds
+ */
+static uint64_t wp_now(void) {
+#ifdef PCF_IS_WIN
+	LARGE_INTEGER freq, count;
+	if (QueryPerformanceFrequency(&freq) == 0 || QueryPerformanceCounter(&count) == 0) {
+		return ((uint64_t)GetTickCount()) * 1000;
+	}
+	return (uint64_t)((((double)count.QuadPart) * 1000000.0) / ((double)freq.QuadPart));
+#else /* PCF_IS_NO_WIN */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec) * 1000000) + (((uint64_t)ts.tv_nsec) / 1000);
+#endif /* PCF_IS_WIN */
+}
+
+
+/**
+ * Suspends the calling thread.
+ *
+ * @param[in] duration - time to sleep in microseconds
+ */
+static void wp_sleep(const uint64_t duration) {
+#ifdef PCF_IS_WIN
+	Sleep((DWORD)((duration + 999) / 1000));
+#else /* PCF_IS_NO_WIN */
+	struct timespec ts;
+	ts.tv_sec = (time_t)(duration / 1000000);
+	ts.tv_nsec = (long)((duration % 1000000) * 1000);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif /* PCF_IS_WIN */
+}
+
+
+#ifdef PCF_IS_WIN
+static void wp_lock(tWorkPool * pool) { EnterCriticalSection(&(pool->mutex)); }
+static void wp_unlock(tWorkPool * pool) { LeaveCriticalSection(&(pool->mutex)); }
+static void wp_wait(tWorkPool * pool, tWpCond * cond) { wp_sleepCond(cond, &(pool->mutex), INFINITE); }
+static void wp_wakeAll(tWpCond * cond) { wp_wakeAllCond(cond); }
+#else /* PCF_IS_NO_WIN */
+static void wp_lock(tWorkPool * pool) { pthread_mutex_lock(&(pool->mutex)); }
+static void wp_unlock(tWorkPool * pool) { pthread_mutex_unlock(&(pool->mutex)); }
+static void wp_wait(tWorkPool * pool, pthread_cond_t * cond) { pthread_cond_wait(cond, &(pool->mutex)); }
+static void wp_wakeAll(pthread_cond_t * cond) { pthread_cond_broadcast(cond); }
+#endif /* PCF_IS_WIN */
+
+
+/**
+ * Worker thread main loop. Executes queued work items until the pool is stopped. The
+ * callbacks and completion list of the handle each item was submitted to are used.
+ *
+ * @param[in,out] pool - work pool handle
+ */
+static void wp_worker(tWorkPool * pool) {
+	tWorkItem * item;
+	uint64_t finished;
+	wp_lock(pool);
+	for (;;) {
+		/* workers beyond the current limit stay idle */
+		while (pool->stop == 0 && (pool->head == NULL || pool->running >= pool->limit)) {
+			wp_wait(pool, &(pool->work));
+		}
+		if (pool->stop != 0) break;
+		item = pool->head;
+		pool->head = item->next;
+		if (pool->head == NULL) pool->tail = NULL;
+		pool->queued--;
+		pool->running++;
+		wp_wakeAll(&(pool->change)); /* queue slot became free */
+		wp_unlock(pool);
+		item->started = wp_now();
+		(*(item->owner->run))(item, item->owner->param);
+		finished = wp_now();
+		wp_lock(pool);
+		pool->running--;
+		pool->tuneOps++;
+		pool->tuneBusy += finished - item->started;
+		item->next = item->owner->finished;
+		item->owner->finished = item;
+		wp_wakeAll(&(pool->change));
+	}
+	wp_unlock(pool);
+}
+
+
+#ifdef PCF_IS_WIN
+static DWORD WINAPI wp_threadMain(LPVOID param) {
+	wp_worker((tWorkPool *)param);
+	return 0;
+}
+#else /* PCF_IS_NO_WIN */
+static void * wp_threadMain(void * param) {
+	wp_worker((tWorkPool *)param);
+	return NULL;
+}
+#endif /* PCF_IS_WIN */
+
+
+/**
+ * Starts worker threads until the current limit is reached. The pool needs to be locked.
+ *
+ * @param[in,out] pool - work pool handle
+ */
+static void wp_spawn(tWorkPool * pool) {
+	while (pool->spawned < pool->limit) {
+#ifdef PCF_IS_WIN
+		pool->threads[pool->spawned] = CreateThread(NULL, 0, wp_threadMain, pool, 0, NULL);
+		if (pool->threads[pool->spawned] == NULL) break;
+#else /* PCF_IS_NO_WIN */
+		if (pthread_create(pool->threads + pool->spawned, NULL, wp_threadMain, pool) != 0) break;
+#endif /* PCF_IS_WIN */
+		pool->spawned++;
+	}
+	/* continue with fewer workers if the system refuses to start more threads */
+	if (pool->spawned > 0 && pool->limit > pool->spawned) pool->limit = pool->spawned;
+}
+
+
+/**
+ * Adjusts the worker count and queue depth by hill-climbing on the measured throughput. The
+ * direction is reversed if throughput dropped, and the worker count is reduced if latency
+ * rose without throughput gain (i.e. operations only wait longer on the storage).
+ *
+ * @param[in,out] pool - work pool handle
+ */
+static void wp_tune(tWorkPool * pool) {
+	uint64_t now, elapsed, busy;
+	size_t ops, step, newLimit;
+	double score, latency;
+	wp_lock(pool); /* handles sharing the pool may tune concurrently */
+	now = wp_now();
+	elapsed = now - pool->tuneStart;
+	if (elapsed < WP_TUNE_INTERVAL) {
+		wp_unlock(pool);
+		return;
+	}
+	ops = pool->tuneOps;
+	busy = pool->tuneBusy;
+	/* too few samples to judge the current setting -> keep measuring */
+	if (ops < pool->limit && elapsed < WP_TUNE_MAX_INTERVAL) {
+		wp_unlock(pool);
+		return;
+	}
+	pool->tuneOps = 0;
+	pool->tuneBusy = 0;
+	pool->tuneStart = now;
+	if (ops == 0) {
+		wp_unlock(pool);
+		return;
+	}
+	score = (((double)ops) * 1000000.0) / ((double)elapsed);
+	latency = ((double)busy) / ((double)ops);
+	if (score > pool->bestScore) {
+		pool->bestScore = score;
+		pool->bestLimit = pool->limit;
+		pool->bestDepth = pool->depth;
+	}
+	if (pool->lastScore > 0.0) {
+		if (score < (pool->lastScore * 0.95)) {
+			/* got worse -> turn around */
+			pool->direction = -(pool->direction);
+		} else if (score < (pool->lastScore * 1.05) && latency > (pool->lastLatency * 1.5)) {
+			/* no gain but operations wait longer -> back off */
+			pool->direction = -1;
+		}
+	}
+	pool->lastScore = score;
+	pool->lastLatency = latency;
+	if (pool->direction > 0) {
+		step = PCF_MAX(pool->limit / 2, 1);
+		newLimit = PCF_MIN(pool->limit + step, WP_MAX_AUTO_WORKERS);
+	} else {
+		step = PCF_MAX(pool->limit / 4, 1);
+		newLimit = (pool->limit > step) ? (pool->limit - step) : 1;
+	}
+	if (newLimit == pool->limit) pool->direction = -(pool->direction); /* hit a bound */
+	pool->limit = newLimit;
+	/* keep enough work items queued for every worker */
+	if (pool->fixedDepth == 0) pool->depth = 2 * newLimit;
+	wp_spawn(pool);
+	wp_wakeAll(&(pool->work));
+	wp_unlock(pool);
+}
+
+
+/**
+ * Creates a new work pool. A single worker without auto-tuning executes work items
+ * synchronously within wp_submit() without starting any thread.
+ *
+ * @param[in] workers - (initial) number of worker threads
+ * @param[in] depth - maximum number of queued work items (0 for twice the worker count)
+ * @param[in] autoTune - adjust worker count and queue depth from measured throughput and latency?
+ * @param[in] run - work item execution callback
+ * @param[in] done - work item completion callback
+ * @param[in,out] param - user defined parameter passed to the callbacks
+ * @return work pool handle or NULL on error
+ */
+tWorkPool * wp_create(const size_t workers, const size_t depth, const int autoTune, tWorkPoolRun run, tWorkPoolDone done, void * param) {
+	if (run == NULL || done == NULL) return NULL;
+	tWorkPool * pool = (tWorkPool *)malloc(sizeof(tWorkPool));
+	if (pool == NULL) return NULL;
+	memset(pool, 0, sizeof(*pool));
+	pool->base = pool;
+	pool->run = run;
+	pool->done = done;
+	pool->param = param;
+	pool->autoTune = autoTune;
+	pool->fixedDepth = (depth != 0) ? 1 : 0;
+	pool->limit = PCF_MIN(PCF_MAX(workers, 1), WP_MAX_WORKERS);
+	pool->depth = (depth != 0) ? depth : (2 * pool->limit);
+	pool->direction = 1;
+	pool->bestLimit = pool->limit;
+	pool->bestDepth = pool->depth;
+	if (pool->limit == 1 && autoTune == 0) return pool; /* synchronous execution */
+#ifdef PCF_IS_WIN
+	if (wp_initCond == NULL) {
+		const HMODULE kernel = GetModuleHandle(TEXT("kernel32.dll"));
+		union {
+			FARPROC proc;
+			tWpInitCond init;
+			tWpSleepCond sleep;
+			tWpWakeCond wake;
+		} conv;
+		conv.proc = GetProcAddress(kernel, "SleepConditionVariableCS");
+		wp_sleepCond = conv.sleep;
+		conv.proc = GetProcAddress(kernel, "WakeAllConditionVariable");
+		wp_wakeAllCond = conv.wake;
+		conv.proc = GetProcAddress(kernel, "InitializeConditionVariable");
+		if (wp_sleepCond != NULL && wp_wakeAllCond != NULL) wp_initCond = conv.init;
+	}
+	/* no condition variables (before Windows Vista) -> synchronous execution */
+	if (wp_initCond == NULL) return pool;
+	InitializeCriticalSection(&(pool->mutex));
+	wp_initCond(&(pool->work));
+	wp_initCond(&(pool->change));
+#else /* PCF_IS_NO_WIN */
+	if (pthread_mutex_init(&(pool->mutex), NULL) != 0) return pool;
+	if (pthread_cond_init(&(pool->work), NULL) != 0) {
+		pthread_mutex_destroy(&(pool->mutex));
+		return pool;
+	}
+	if (pthread_cond_init(&(pool->change), NULL) != 0) {
+		pthread_cond_destroy(&(pool->work));
+		pthread_mutex_destroy(&(pool->mutex));
+		return pool;
+	}
+#endif /* PCF_IS_WIN */
+	pool->threaded = 1;
+	pool->tuneStart = wp_now();
+	return pool;
+}
+
+
+/**
+ * Creates a new handle to the worker threads and queue of the given pool. Work items
+ * submitted via this handle use its own callbacks and are only reaped by it. This allows
+ * independent submitters in different threads to share the same workers and auto-tuning.
+ * The handle needs to be destroyed before its base pool.
+ *
+ * @param[in,out] base - pool which executes the work items
+ * @param[in] run - work item execution callback
+ * @param[in] done - work item completion callback
+ * @param[in,out] param - user defined parameter passed to the callbacks
+ * @return work pool handle or NULL on error
+ */
+tWorkPool * wp_share(tWorkPool * base, tWorkPoolRun run, tWorkPoolDone done, void * param) {
+	if (base == NULL || run == NULL || done == NULL) return NULL;
+	tWorkPool * pool = (tWorkPool *)malloc(sizeof(tWorkPool));
+	if (pool == NULL) return NULL;
+	memset(pool, 0, sizeof(*pool));
+	pool->base = base->base;
+	pool->run = run;
+	pool->done = done;
+	pool->param = param;
+	pool->threaded = pool->base->threaded;
+	pool->autoTune = pool->base->autoTune;
+	return pool;
+}
+
+
+/**
+ * Submits a work item for execution. The function blocks while the queue is full.
+ * Completed work items are reaped in the calling thread.
+ *
+ * @param[in,out] pool - work pool handle
+ * @param[in,out] item - work item to execute
+ * @return 1 on success, 0 on error
+ */
+int wp_submit(tWorkPool * pool, tWorkItem * item) {
+	if (pool == NULL || item == NULL) return 0;
+	tWorkPool * base = pool->base;
+	item->owner = pool;
+	if (pool->threaded == 0) {
+		(*(pool->run))(item, pool->param);
+		(*(pool->done))(item, pool->param);
+		return 1;
+	}
+	wp_lock(base);
+	if (base->spawned < base->limit) wp_spawn(base);
+	if (base->spawned == 0) {
+		/* no worker thread could be started -> execute synchronously */
+		wp_unlock(base);
+		(*(pool->run))(item, pool->param);
+		(*(pool->done))(item, pool->param);
+		return 1;
+	}
+	while (base->queued >= base->depth) wp_wait(base, &(base->change));
+	item->next = NULL;
+	if (base->tail == NULL) {
+		base->head = item;
+	} else {
+		base->tail->next = item;
+	}
+	base->tail = item;
+	base->queued++;
+	pool->outstanding++;
+	wp_wakeAll(&(base->work));
+	wp_unlock(base);
+	wp_reap(pool, 0);
+	return 1;
+}
+
+
+/**
+ * Passes all executed work items to the completion callback in the calling thread.
+ *
+ * @param[in,out] pool - work pool handle
+ * @param[in] wait - block until at least one work item completed if some are outstanding?
+ * @return number of reaped work items
+ */
+size_t wp_reap(tWorkPool * pool, const int wait) {
+	tWorkItem * item;
+	tWorkItem * next;
+	size_t count = 0;
+	if (pool == NULL || pool->threaded == 0) return 0;
+	wp_lock(pool->base);
+	if (wait != 0) {
+		while (pool->finished == NULL && pool->outstanding > 0) wp_wait(pool->base, &(pool->base->change));
+	}
+	item = pool->finished;
+	pool->finished = NULL;
+	wp_unlock(pool->base);
+	for (; item != NULL; item = next) {
+		next = item->next;
+		pool->outstanding--;
+		(*(pool->done))(item, pool->param);
+		count++;
+	}
+	if (pool->autoTune != 0) wp_tune(pool->base);
+	return count;
+}
+
+
+/**
+ * Waits until all submitted work items were executed and reaped.
+ *
+ * @param[in,out] pool - work pool handle
+ */
+void wp_drain(tWorkPool * pool) {
+	if (pool == NULL || pool->threaded == 0) return;
+	while (pool->outstanding > 0) wp_reap(pool, 1);
+}
+
+
+/**
+ * Returns the current worker count and queue depth. The values with the highest measured
+ * throughput are returned if auto-tuning is enabled.
+ *
+ * @param[in] pool - work pool handle
+ * @param[out] workers - receives the worker count (may be NULL)
+ * @param[out] depth - receives the queue depth (may be NULL)
+ */
+void wp_settings(const tWorkPool * pool, size_t * workers, size_t * depth) {
+	if (pool == NULL) return;
+	pool = pool->base;
+	const int best = (pool->autoTune != 0 && pool->bestScore > 0.0) ? 1 : 0;
+	if (workers != NULL) *workers = (best != 0) ? pool->bestLimit : pool->limit;
+	if (depth != NULL) *depth = (best != 0) ? pool->bestDepth : pool->depth;
+}
+
+
+/**
+ * Limits the rate of the operations paced via wp_pace() by all workers of the given pool.
+ * Needs to be called before work items are submitted.
+ *
+ * @param[in,out] pool - work pool handle
+ * @param[in] rate - maximum number of operations per second (0 for unlimited)
+ */
+void wp_limit(tWorkPool * pool, const size_t rate) {
+	if (pool == NULL) return;
+	pool = pool->base;
+	pool->paceInterval = (rate > 0) ? PCF_MAX(1000000 / (uint64_t)rate, 1) : 0;
+	pool->paceNext = 0;
+}
+
+
+/**
+ * Waits until the next operation of the given work item is within the rate set by
+ * wp_limit(). Operations are spread evenly over time instead of bursting to catch up
+ * after idle periods. Called from the work item execution callback.
+ *
+ * @param[in,out] item - executing work item
+ */
+void wp_pace(tWorkItem * item) {
+	tWorkPool * pool;
+	uint64_t now, start;
+	if (item == NULL || item->owner == NULL) return;
+	pool = item->owner->base;
+	if (pool->paceInterval == 0) return;
+	if (pool->threaded != 0) wp_lock(pool);
+	now = wp_now();
+	start = PCF_MAX(now, pool->paceNext);
+	pool->paceNext = start + pool->paceInterval;
+	if (pool->threaded != 0) wp_unlock(pool);
+	if (start > now) wp_sleep(start - now);
+}
+
+
+/**
+ * Waits for all outstanding work items, stops the worker threads and frees the pool.
+ * Only the handle is freed for handles created by wp_share().
+ *
+ * @param[in,out] pool - work pool handle
+ */
+void wp_destroy(tWorkPool * pool) {
+	size_t i;
+	if (pool == NULL) return;
+	if (pool->base != pool) {
+		wp_drain(pool);
+		free(pool);
+		return;
+	}
+	if (pool->threaded != 0) {
+		wp_drain(pool);
+		wp_lock(pool);
+		pool->stop = 1;
+		wp_wakeAll(&(pool->work));
+		wp_unlock(pool);
+		for (i = 0; i < pool->spawned; i++) {
+#ifdef PCF_IS_WIN
+			WaitForSingleObject(pool->threads[i], INFINITE);
+			CloseHandle(pool->threads[i]);
+#else /* PCF_IS_NO_WIN */
+			pthread_join(pool->threads[i], NULL);
+#endif /* PCF_IS_WIN */
+		}
+#ifdef PCF_IS_WIN
+		DeleteCriticalSection(&(pool->mutex));
+#else /* PCF_IS_NO_WIN */
+		pthread_cond_destroy(&(pool->change));
+		pthread_cond_destroy(&(pool->work));
+		pthread_mutex_destroy(&(pool->mutex));
+#endif /* PCF_IS_WIN */
+	}
+	free(pool);
+}
@@ -0,0 +1,93 @@
+/**
+ * @file workpool.h
+ * @author Daniel Starke
+ * @see workpool.c
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "target.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Maximum number of worker threads. */
+#define WP_MAX_WORKERS 256
+
+
+/** Upper worker limit used while auto-tuning. */
+#define WP_MAX_AUTO_WORKERS 64
+
+
+/**
+ * Work item header. Embed this as first member of the job structure.
+ */
+typedef struct tWorkItem {
+	struct tWorkItem * next; /**< next item in the queue or completion list (internal) */
+	struct tWorkPool * owner; /**< pool handle the item was submitted to (internal) */
+	uint64_t started;        /**< execution start time in microseconds (internal) */
+} tWorkItem;
+
+
+/**
+ * Defines the callback function to execute a work item. It is called from a worker thread.
+ *
+ * @param[in,out] item - work item to execute
+ * @param[in,out] param - user defined parameter
+ */
+typedef void (* tWorkPoolRun)(tWorkItem * item, void * param);
+
+
+/**
+ * Defines the callback function to complete a work item. It is called from the thread
+ * which submits or reaps the work items.
+ *
+ * @param[in,out] item - executed work item (may be freed by the callback)
+ * @param[in,out] param - user defined parameter
+ */
+typedef void (* tWorkPoolDone)(tWorkItem * item, void * param);
+
+
+/**
+ * Opaque work pool handle.
+ */
+typedef struct tWorkPool tWorkPool;
+
+
+tWorkPool * wp_create(const size_t workers, const size_t depth, const int autoTune, tWorkPoolRun run, tWorkPoolDone done, void * param);
+tWorkPool * wp_share(tWorkPool * base, tWorkPoolRun run, tWorkPoolDone done, void * param);
+int wp_submit(tWorkPool * pool, tWorkItem * item);
+size_t wp_reap(tWorkPool * pool, const int wait);
+void wp_drain(tWorkPool * pool);
+void wp_settings(const tWorkPool * pool, size_t * workers, size_t * depth);
+void wp_limit(tWorkPool * pool, const size_t rate);
+void wp_pace(tWorkItem * item);
+void wp_destroy(tWorkPool * pool);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* __WORKPOOL_H__ */
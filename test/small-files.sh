@@ -0,0 +1,65 @@
+#!/bin/sh
+# Checks the file system calls lsync needs per copied small file (Linux only).
+# The difference between copying 2N and N files gives the cost per file without
+# the fixed startup cost.
+#
+# usage: small-files.sh <lsync> <syscount.so>
+set -e
+
+LSYNC=$(realpath "$1")
+SHIM=$(realpath "$2")
+COUNT=100
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# creates <count> files of 1 KiB in the given directory
+makeFiles() {
+	mkdir -p "$1"
+	i=0
+	while [ $i -lt $2 ]; do
+		head -c 1024 /dev/zero > "$1/file$i"
+		chmod 0640 "$1/file$i"
+		i=$((i + 1))
+	done
+}
+
+# copies the given source directory and prints "<name> <count>" lines
+countCalls() {
+	rm -f "$WORK/counts"
+	SYSCOUNT_OUT="$WORK/counts" LD_PRELOAD="$SHIM" "$LSYNC" -a "$1" "$WORK/dst-$2" > /dev/null
+	cat "$WORK/counts"
+}
+
+makeFiles "$WORK/one" $COUNT
+makeFiles "$WORK/two" $((COUNT * 2))
+countCalls "$WORK/one" one > "$WORK/counts-one"
+countCalls "$WORK/two" two > "$WORK/counts-two"
+
+failed=0
+# expect <name> <calls per file>
+expect() {
+	one=$(awk -v n="$1" '$1 == n { print $2 }' "$WORK/counts-one")
+	two=$(awk -v n="$1" '$1 == n { print $2 }' "$WORK/counts-two")
+	perFile=$(( (two - one) / COUNT ))
+	if [ $((two - one)) -ne $(($2 * COUNT)) ]; then
+		echo "FAIL: $1() per file: $perFile (expected $2)"
+		failed=1
+	else
+		echo "ok: $1() per file: $perFile"
+	fi
+}
+
+expect read 1
+expect write 1
+expect chmod 0
+expect fchmod 0
+expect umask 0
+expect rename 0
+
+# the copies need to be complete and keep the permissions
+for f in "$WORK/two"/*; do
+	cmp -s "$f" "$WORK/dst-two/two/${f##*/}" || { echo "FAIL: ${f##*/} differs"; failed=1; }
+	[ "$(stat -c %a "$WORK/dst-two/two/${f##*/}")" = 640 ] || { echo "FAIL: ${f##*/} has wrong permissions"; failed=1; }
+done
+
+exit $failed
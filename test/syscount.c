@@ -0,0 +1,161 @@
+/**
+ * @file syscount.c
+ * @author Daniel Starke
+ * @date 2026-10-18
+ * @version 2026-10-18
+ *
+ * DISCLAIMER
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * All contributions are also assumed to be in the Public Domain.
+ * Other contributions are not permitted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * LD_PRELOAD library which counts the file system calls of a process (Linux only). The
+ * counts are appended as "<name> <count>" lines to the file given by the environment
+ * variable SYSCOUNT_OUT on exit.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+/** Counted functions. */
+typedef enum {
+	SC_OPEN,
+	SC_READ,
+	SC_WRITE,
+	SC_CLOSE,
+	SC_LSTAT,
+	SC_STAT,
+	SC_FSTAT,
+	SC_CHMOD,
+	SC_FCHMOD,
+	SC_UMASK,
+	SC_RENAME,
+	SC_LINKAT,
+	SC_COUNT
+} tSysCall;
+
+
+static const char * const names[SC_COUNT] = {
+	"open", "read", "write", "close", "lstat", "stat", "fstat", "chmod", "fchmod", "umask", "rename", "linkat"
+};
+
+
+static int counts[SC_COUNT];
+
+
+/**
+ * Counts a call and resolves the original function.
+ *
+ * @param[in] call - counted function
+ * @param[in] name - symbol name of the original function
+ * @return original function
+ */
+static void * countCall(const tSysCall call, const char * name) {
+	__sync_fetch_and_add(counts + call, 1);
+	return dlsym(RTLD_NEXT, name);
+}
+
+
+int open64(const char * path, int flags, ...) {
+	int (* fn)(const char *, int, ...) = (int (*)(const char *, int, ...))countCall(SC_OPEN, "open64");
+	va_list ap;
+	mode_t mode;
+	va_start(ap, flags);
+	mode = (mode_t)va_arg(ap, int);
+	va_end(ap);
+	return fn(path, flags, mode);
+}
+
+
+ssize_t read(int fd, void * buf, size_t len) {
+	ssize_t (* fn)(int, void *, size_t) = (ssize_t (*)(int, void *, size_t))countCall(SC_READ, "read");
+	return fn(fd, buf, len);
+}
+
+
+ssize_t write(int fd, const void * buf, size_t len) {
+	ssize_t (* fn)(int, const void *, size_t) = (ssize_t (*)(int, const void *, size_t))countCall(SC_WRITE, "write");
+	return fn(fd, buf, len);
+}
+
+
+int close(int fd) {
+	int (* fn)(int) = (int (*)(int))countCall(SC_CLOSE, "close");
+	return fn(fd);
+}
+
+
+int lstat64(const char * path, struct stat64 * st) {
+	int (* fn)(const char *, struct stat64 *) = (int (*)(const char *, struct stat64 *))countCall(SC_LSTAT, "lstat64");
+	return fn(path, st);
+}
+
+
+int stat64(const char * path, struct stat64 * st) {
+	int (* fn)(const char *, struct stat64 *) = (int (*)(const char *, struct stat64 *))countCall(SC_STAT, "stat64");
+	return fn(path, st);
+}
+
+
+int fstat64(int fd, struct stat64 * st) {
+	int (* fn)(int, struct stat64 *) = (int (*)(int, struct stat64 *))countCall(SC_FSTAT, "fstat64");
+	return fn(fd, st);
+}
+
+
+int chmod(const char * path, mode_t mode) {
+	int (* fn)(const char *, mode_t) = (int (*)(const char *, mode_t))countCall(SC_CHMOD, "chmod");
+	return fn(path, mode);
+}
+
+
+int fchmod(int fd, mode_t mode) {
+	int (* fn)(int, mode_t) = (int (*)(int, mode_t))countCall(SC_FCHMOD, "fchmod");
+	return fn(fd, mode);
+}
+
+
+mode_t umask(mode_t mask) {
+	mode_t (* fn)(mode_t) = (mode_t (*)(mode_t))countCall(SC_UMASK, "umask");
+	return fn(mask);
+}
+
+
+int rename(const char * src, const char * dst) {
+	int (* fn)(const char *, const char *) = (int (*)(const char *, const char *))countCall(SC_RENAME, "rename");
+	return fn(src, dst);
+}
+
+
+int linkat(int srcFd, const char * src, int dstFd, const char * dst, int flags) {
+	int (* fn)(int, const char *, int, const char *, int) = (int (*)(int, const char *, int, const char *, int))countCall(SC_LINKAT, "linkat");
+	return fn(srcFd, src, dstFd, dst, flags);
+}
+
+
+/**
+ * Writes the counts to the file given by SYSCOUNT_OUT.
+ */
+__attribute__((destructor)) static void writeCounts(void) {
+	const char * path = getenv("SYSCOUNT_OUT");
+	FILE * fp;
+	int i;
+	if (path == NULL) return;
+	fp = fopen(path, "a");
+	if (fp == NULL) return;
+	for (i = 0; i < SC_COUNT; i++) fprintf(fp, "%s %i\n", names[i], counts[i]);
+	fclose(fp);
+}